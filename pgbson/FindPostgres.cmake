@@ -18,7 +18,7 @@ if(NOT Postgres_INCLUDEDIR OR NOT Postgres_LIBDIR OR NOT Postgres_SHAREDIR)
     endif()
 
     execute_process(
-        COMMAND pg_config --libdir
+        COMMAND pg_config --pkglibdir
         OUTPUT_VARIABLE OUT_Postgres_LIBDIR OUTPUT_STRIP_TRAILING_WHITESPACE
     )
 
@@ -62,11 +62,23 @@ namespace mongo {
     template <typename Allocator>
     class StringBuilderImpl;
 
+    /** Allocation functions for a BufBuilder which keeps its buffer in memory managed by the
+        embedding application (pgbson: PostgreSQL memory contexts). reallocate gets NULL for the
+        first allocation of a builder created with zero size. */
+    struct BufAllocatorFunctions {
+        void* (*allocate)(size_t sz);
+        void* (*reallocate)(void *p, size_t sz);
+        void (*release)(void *p);
+    };
+
     class TrivialAllocator { 
     public:
-        void* Malloc(size_t sz) { return malloc(sz); }
-        void* Realloc(void *p, size_t sz) { return realloc(p, sz); }
-        void Free(void *p) { free(p); }
+        TrivialAllocator() : functions(0) {}
+        void* Malloc(size_t sz) { return functions ? functions->allocate(sz) : malloc(sz); }
+        void* Realloc(void *p, size_t sz) { return functions ? functions->reallocate(p, sz) : realloc(p, sz); }
+        void Free(void *p) { if ( functions ) functions->release(p); else free(p); }
+
+        const BufAllocatorFunctions* functions; // malloc/realloc/free if null
     };
 
     class StackAllocator {
@@ -113,6 +125,19 @@ namespace mongo {
             }
             l = 0;
         }
+        /** buffer allocated with given functions, see BufAllocatorFunctions */
+        _BufBuilder(int initsize, const BufAllocatorFunctions* functions) : size(initsize) {
+            al.functions = functions;
+            if ( size > 0 ) {
+                data = (char *) al.Malloc(size);
+                if( data == 0 )
+                    msgasserted(10000, "out of memory BufBuilder");
+            }
+            else {
+                data = 0;
+            }
+            l = 0;
+        }
         ~_BufBuilder() { kill(); }
 
         void kill() {
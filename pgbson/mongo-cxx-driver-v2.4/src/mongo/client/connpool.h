@@ -301,7 +301,7 @@ namespace mongo {
             return _conn;
         }
 
-        bool ok() const { return _conn > 0; }
+        bool ok() const { return _conn != 0; }
 
         string getHost() const { return _host; }
 
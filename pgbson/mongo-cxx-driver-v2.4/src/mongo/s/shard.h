@@ -283,7 +283,7 @@ namespace mongo {
             _finishedInit = true;
         }
         
-        bool ok() const { return _conn > 0; }
+        bool ok() const { return _conn != 0; }
 
         /**
            this just passes through excpet it checks for stale configs
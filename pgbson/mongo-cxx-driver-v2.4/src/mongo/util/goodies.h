@@ -18,7 +18,12 @@
 
 #pragma once
 
+#include <boost/version.hpp>
+#if BOOST_VERSION >= 105500
+#include <boost/predef/other/endian.h>
+#else
 #include <boost/detail/endian.hpp>
+#endif
 #include <boost/thread/condition_variable.hpp>
 
 #include "mongo/bson/util/misc.h"
@@ -101,11 +106,11 @@ namespace mongo {
             ((x & 0xff000000) >> 24);
     }
 
-#if defined(BOOST_LITTLE_ENDIAN)
+#if defined(BOOST_LITTLE_ENDIAN) || BOOST_ENDIAN_LITTLE_BYTE
     inline unsigned long fixEndian(unsigned long x) {
         return x;
     }
-#elif defined(BOOST_BIG_ENDIAN)
+#elif defined(BOOST_BIG_ENDIAN) || BOOST_ENDIAN_BIG_BYTE
     inline unsigned long fixEndian(unsigned long x) {
         return swapEndian(x);
     }
@@ -0,0 +1,711 @@
+-- Updates pgbson 1.0 to 1.1. The result is the same as of CREATE EXTENSION pgbson VERSION '1.1',
+-- except for attributes older servers can't alter, which are set in catalogs directly.
+
+------------------------------------
+-- type definition and i/o functions
+------------------------------------
+
+-- true if bytea holds a document that binary input accepts
+CREATE FUNCTION bson_is_valid(bytea) RETURNS bool
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+-- validates and reinterprets BSON bytes, e.g. produced by a MongoDB driver
+CREATE FUNCTION bson_from_bytea(bytea) RETURNS bson
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+-- collects per-path statistics in addition to the standard ones, see bson_path_stats
+CREATE FUNCTION bson_typanalyze(internal) RETURNS bool
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+-- ALTER TYPE can set the analyze function since PostgreSQL 13
+DO $$
+BEGIN
+    IF current_setting('server_version_num')::int >= 130000 THEN
+        ALTER TYPE bson SET (ANALYZE = bson_typanalyze);
+    ELSE
+        UPDATE pg_catalog.pg_type SET typanalyze = 'bson_typanalyze(internal)'::regprocedure
+        WHERE oid = 'bson'::regtype;
+    END IF;
+END
+$$;
+
+-- bson is stored as the document bytes, so only bytea::bson needs a function (to validate them)
+CREATE CAST (bytea AS bson) WITH FUNCTION bson_from_bytea(bytea);
+CREATE CAST (bson AS bytea) WITHOUT FUNCTION;
+
+------------
+-- operators
+------------
+
+-- comparison functions were SQL wrappers of bson_compare
+CREATE OR REPLACE FUNCTION bson_equal(bson, bson) RETURNS BOOL
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE OR REPLACE FUNCTION bson_not_equal(bson, bson) RETURNS BOOL
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE OR REPLACE FUNCTION bson_lt(bson, bson) RETURNS BOOL
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE OR REPLACE FUNCTION bson_lte(bson, bson) RETURNS BOOL
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE OR REPLACE FUNCTION bson_gt(bson, bson) RETURNS BOOL
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE OR REPLACE FUNCTION bson_gte(bson, bson) RETURNS BOOL
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE OR REPLACE FUNCTION bson_binary_not_equal(bson, bson) RETURNS BOOL
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+-- b-tree sort support, with abbreviated keys
+CREATE FUNCTION bson_sortsupport(internal) RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+-- commutators, selectivity estimators, hash and merge joins.
+-- ALTER OPERATOR can set all of them since PostgreSQL 17 (and sets the commutator of both operators).
+DO $$
+BEGIN
+    IF current_setting('server_version_num')::int >= 170000 THEN
+        ALTER OPERATOR = (bson, bson) SET (COMMUTATOR = =, RESTRICT = eqsel, JOIN = eqjoinsel, HASHES, MERGES);
+        ALTER OPERATOR <> (bson, bson) SET (COMMUTATOR = <>, RESTRICT = neqsel, JOIN = neqjoinsel);
+        ALTER OPERATOR < (bson, bson) SET (COMMUTATOR = >, RESTRICT = scalarltsel, JOIN = scalarltjoinsel);
+        ALTER OPERATOR <= (bson, bson) SET (COMMUTATOR = >=, RESTRICT = scalarltsel, JOIN = scalarltjoinsel);
+        ALTER OPERATOR > (bson, bson) SET (RESTRICT = scalargtsel, JOIN = scalargtjoinsel);
+        ALTER OPERATOR >= (bson, bson) SET (RESTRICT = scalargtsel, JOIN = scalargtjoinsel);
+        ALTER OPERATOR == (bson, bson) SET (COMMUTATOR = ==, RESTRICT = eqsel, JOIN = eqjoinsel, HASHES);
+        ALTER OPERATOR <<>> (bson, bson) SET (COMMUTATOR = <<>>, RESTRICT = neqsel, JOIN = neqjoinsel);
+    ELSE
+        UPDATE pg_catalog.pg_operator o SET
+            oprcom = c.com::regoperator,
+            oprrest = c.restrict_sel::regproc,
+            oprjoin = c.join_sel::regproc,
+            oprcanhash = c.hashes,
+            oprcanmerge = c.merges
+        FROM (VALUES
+            ('=(bson,bson)', '=(bson,bson)', 'eqsel', 'eqjoinsel', true, true),
+            ('<>(bson,bson)', '<>(bson,bson)', 'neqsel', 'neqjoinsel', false, false),
+            ('<(bson,bson)', '>(bson,bson)', 'scalarltsel', 'scalarltjoinsel', false, false),
+            ('<=(bson,bson)', '>=(bson,bson)', 'scalarltsel', 'scalarltjoinsel', false, false),
+            ('>(bson,bson)', '<(bson,bson)', 'scalargtsel', 'scalargtjoinsel', false, false),
+            ('>=(bson,bson)', '<=(bson,bson)', 'scalargtsel', 'scalargtjoinsel', false, false),
+            ('==(bson,bson)', '==(bson,bson)', 'eqsel', 'eqjoinsel', true, false),
+            ('<<>>(bson,bson)', '<<>>(bson,bson)', 'neqsel', 'neqjoinsel', false, false)
+        ) AS c(op, com, restrict_sel, join_sel, hashes, merges)
+        WHERE o.oid = c.op::regoperator;
+    END IF;
+END
+$$;
+
+---------------------
+-- hash index support
+---------------------
+
+-- bson_hash and bson_hash_ops (binary hash, for ==) are kept, existing hash indexes stay valid.
+-- The default operator class is now the one for =; there is no ALTER for that.
+UPDATE pg_catalog.pg_opclass SET opcdefault = false
+WHERE opcname = 'bson_hash_ops' AND opcintype = 'bson'::regtype
+    AND opcmethod = (SELECT oid FROM pg_catalog.pg_am WHERE amname = 'hash');
+
+-- hash consistent with logical equality (=): numbers are hashed by value, regardless of type
+CREATE FUNCTION bson_logical_hash(bson) RETURNS INT4
+AS 'MODULE_PATHNAME', 'bson_hash_logical'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bson_logical_hash_extended(bson, int8) RETURNS int8
+AS 'MODULE_PATHNAME', 'bson_hash_logical_extended'
+LANGUAGE C STRICT IMMUTABLE;
+
+-- MurmurHash3 of binary representation, for binary equality (==); faster than bson_hash
+CREATE FUNCTION bson_binary_hash(bson) RETURNS INT4
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bson_binary_hash_extended(bson, int8) RETURNS int8
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE OPERATOR CLASS bson_logical_hash_ops
+    DEFAULT FOR TYPE bson USING hash AS
+        OPERATOR 1 = (bson, bson) ,
+        FUNCTION 1 bson_logical_hash(bson);
+
+CREATE OPERATOR CLASS bson_binary_hash_ops
+    FOR TYPE bson USING hash AS
+        OPERATOR 1 == (bson, bson) ,
+        FUNCTION 1 bson_binary_hash(bson);
+
+-- extended (seeded, 64-bit) hash functions, used for hash partitioning, exist since PostgreSQL 11
+DO $$
+BEGIN
+    IF current_setting('server_version_num')::int >= 110000 THEN
+        ALTER OPERATOR FAMILY bson_logical_hash_ops USING hash ADD FUNCTION 2 bson_logical_hash_extended(bson, int8);
+        ALTER OPERATOR FAMILY bson_binary_hash_ops USING hash ADD FUNCTION 2 bson_binary_hash_extended(bson, int8);
+    END IF;
+END
+$$;
+
+-----------------------
+-- b-tree index support
+-----------------------
+
+ALTER OPERATOR FAMILY bson_btree_ops USING btree ADD
+    FUNCTION 2 (bson, bson) bson_sortsupport(internal);
+
+------------------------------
+-- deep object inspection functions
+------------------------------
+
+-- return (dotted) array field as an array of int4, int8, float8, text, bool or timestamptz.
+-- Elements are converted as by the scalar getters, bool from booleans and timestamptz from dates;
+-- null elements are nulls, a field which is not an array gives a single-element array.
+-- returns null if no such field
+-- fails if conversion is impossible
+CREATE FUNCTION bson_get_int_array(bson, text) RETURNS int4[]
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bson_get_bigint_array(bson, text) RETURNS int8[]
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bson_get_double_array(bson, text) RETURNS float8[]
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bson_get_text_array(bson, text) RETURNS text[]
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bson_get_bool_array(bson, text) RETURNS bool[]
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bson_get_timestamptz_array(bson, text) RETURNS timestamptz[]
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+-- returns values of several (dotted) fields, found in a single pass over the object.
+-- i-th path is converted to the type of i-th column of the column definition list:
+-- text, int4, int8, float8 and bson are converted like the bson_get_* functions, other types via text representation
+-- missing fields are returned as nulls
+-- example: SELECT * FROM bson_get_many(data, ARRAY['name', 'address.city']) AS (name text, city text)
+CREATE FUNCTION bson_get_many(bson, text[]) RETURNS record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+-- returns values of several (dotted) fields converted to text, found in a single pass over the object.
+-- missing fields are returned as nulls
+CREATE FUNCTION bson_get_many_text(bson, text[]) RETURNS text[]
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+------------------
+-- Array utilities
+------------------
+
+-- Unwinds nested arrays (full paths, each within the previous one) into rows of
+-- ordinality of each array followed by the fields (full paths), typed by the column definition list:
+-- SELECT * FROM bson_unwind(data, '{orders,orders.items}', '{customer,orders.id,orders.items.sku}')
+--     AS u(order_no int, item_no int, customer text, order_id int, sku text)
+CREATE FUNCTION bson_unwind(bson, text[], text[] DEFAULT '{}') RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT STABLE;
+
+-----------------
+-- path existence
+-----------------
+
+-- true if the object contains (dotted) field
+CREATE FUNCTION bson_exists(bson, text) RETURNS bool
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+-- true if the object contains any of the (dotted) fields
+CREATE FUNCTION bson_exists_any(bson, text[]) RETURNS bool
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+-- true if the object contains all the (dotted) fields
+CREATE FUNCTION bson_exists_all(bson, text[]) RETURNS bool
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+-- selectivity estimators of ?, ?| and ?&, use per-path statistics
+CREATE FUNCTION bson_exists_sel(internal, oid, internal, int4) RETURNS float8
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT STABLE;
+
+CREATE FUNCTION bson_exists_any_sel(internal, oid, internal, int4) RETURNS float8
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT STABLE;
+
+CREATE FUNCTION bson_exists_all_sel(internal, oid, internal, int4) RETURNS float8
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT STABLE;
+
+CREATE OPERATOR ? (
+    LEFTARG = bson,
+    RIGHTARG = text,
+    PROCEDURE = bson_exists,
+    RESTRICT = bson_exists_sel,
+    JOIN = contjoinsel
+);
+
+CREATE OPERATOR ?| (
+    LEFTARG = bson,
+    RIGHTARG = text[],
+    PROCEDURE = bson_exists_any,
+    RESTRICT = bson_exists_any_sel,
+    JOIN = contjoinsel
+);
+
+CREATE OPERATOR ?& (
+    LEFTARG = bson,
+    RIGHTARG = text[],
+    PROCEDURE = bson_exists_all,
+    RESTRICT = bson_exists_all_sel,
+    JOIN = contjoinsel
+);
+
+-- per-path statistics of a bson column, collected by ANALYZE. One document per path:
+-- { path, frac, null_frac, types, nd, mcv, mcf, hist }, see README
+CREATE FUNCTION bson_path_stats(regclass, text) RETURNS SETOF bson
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT STABLE;
+
+--------------
+-- containment
+--------------
+
+-- true if the first object contains the second one: all its fields, with containing values.
+-- Objects contain their fields, arrays contain their elements in any order,
+-- scalars and objects are also searched in arrays (like MongoDB multi-key indexes)
+CREATE FUNCTION bson_contains(bson, bson) RETURNS bool
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bson_contained(bson, bson) RETURNS bool
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+-- selectivity estimator of @>, uses per-path statistics
+CREATE FUNCTION bson_contains_sel(internal, oid, internal, int4) RETURNS float8
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT STABLE;
+
+CREATE OPERATOR @> (
+    LEFTARG = bson,
+    RIGHTARG = bson,
+    PROCEDURE = bson_contains,
+    COMMUTATOR = <@,
+    RESTRICT = bson_contains_sel,
+    JOIN = contjoinsel
+);
+
+CREATE OPERATOR <@ (
+    LEFTARG = bson,
+    RIGHTARG = bson,
+    PROCEDURE = bson_contained,
+    COMMUTATOR = @>,
+    RESTRICT = contsel,
+    JOIN = contjoinsel
+);
+
+-----------------
+-- MongoDB queries
+-----------------
+
+-- true if the object matches MongoDB query, like {"age": {"$gte": 18}, "tags": {"$in": ["a", "b"]}}
+-- supported: equality, $eq, $ne, $gt, $gte, $lt, $lte, $in, $nin, $exists, $type, $size, $all,
+-- $elemMatch, $mod, $regex, $options, $not, $and, $or, $nor
+-- constant queries are compiled once per statement
+CREATE FUNCTION bson_match(bson, bson) RETURNS bool
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+-- selectivity estimator of @@, uses per-path statistics
+CREATE FUNCTION bson_match_sel(internal, oid, internal, int4) RETURNS float8
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT STABLE;
+
+CREATE OPERATOR @@ (
+    LEFTARG = bson,
+    RIGHTARG = bson,
+    PROCEDURE = bson_match,
+    RESTRICT = bson_match_sel,
+    JOIN = contjoinsel
+);
+
+---------------------
+-- GIN index support
+---------------------
+
+-- Entries are hashes of paths and of path=value pairs, array elements are indexed under the path of the array.
+-- bson_gin_ops (default) supports @>, ?, ?| and ?&.
+-- bson_gin_path_ops indexes paths only: smaller index, good for ?, ?| and ?&; @> is a looser filter.
+
+CREATE FUNCTION bson_gin_extract_value(bson, internal, internal) RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bson_gin_extract_query(bson, internal, int2, internal, internal, internal, internal) RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bson_gin_path_extract_value(bson, internal, internal) RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bson_gin_path_extract_query(bson, internal, int2, internal, internal, internal, internal) RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bson_gin_consistent(internal, int2, bson, int4, internal, internal, internal, internal) RETURNS bool
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE OPERATOR CLASS bson_gin_ops
+    DEFAULT FOR TYPE bson USING gin AS
+        OPERATOR 7 @> (bson, bson),
+        OPERATOR 9 ? (bson, text),
+        OPERATOR 10 ?| (bson, text[]),
+        OPERATOR 11 ?& (bson, text[]),
+        FUNCTION 1 btint4cmp(int4, int4),
+        FUNCTION 2 bson_gin_extract_value(bson, internal, internal),
+        FUNCTION 3 bson_gin_extract_query(bson, internal, int2, internal, internal, internal, internal),
+        FUNCTION 4 bson_gin_consistent(internal, int2, bson, int4, internal, internal, internal, internal),
+        STORAGE int4;
+
+CREATE OPERATOR CLASS bson_gin_path_ops
+    FOR TYPE bson USING gin AS
+        OPERATOR 7 @> (bson, bson),
+        OPERATOR 9 ? (bson, text),
+        OPERATOR 10 ?| (bson, text[]),
+        OPERATOR 11 ?& (bson, text[]),
+        FUNCTION 1 btint4cmp(int4, int4),
+        FUNCTION 2 bson_gin_path_extract_value(bson, internal, internal),
+        FUNCTION 3 bson_gin_path_extract_query(bson, internal, int2, internal, internal, internal, internal),
+        FUNCTION 4 bson_gin_consistent(internal, int2, bson, int4, internal, internal, internal, internal),
+        STORAGE int4;
+
+--------------------------
+-- conversion to/from bson
+--------------------------
+
+-- returns the object with the named top-level fields moved to the front, in the order of names,
+-- so that their lookups in a large document stored uncompressed read only its beginning
+CREATE FUNCTION bson_move_fields(bson, text[]) RETURNS bson
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+-----------------------------------------------------
+-- bsonx - bson with field directory for fast lookups
+-----------------------------------------------------
+
+-- Stores a sorted field directory for each object with many fields, written on input.
+-- Field lookup is a binary search instead of a linear scan.
+-- Text and binary output are the same as for bson.
+
+CREATE TYPE bsonx;
+
+CREATE FUNCTION bsonx_in(cstring) RETURNS bsonx
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bsonx_out(bsonx) RETURNS cstring
+AS 'MODULE_PATHNAME', 'bson_out'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bsonx_send(bsonx) RETURNS bytea
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bsonx_recv(internal) RETURNS bsonx
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE TYPE bsonx (
+    input = bsonx_in,
+    output = bsonx_out,
+    send = bsonx_send,
+    receive = bsonx_recv,
+    alignment = int4,
+    storage = main
+);
+
+CREATE FUNCTION bson_to_bsonx(bson) RETURNS bsonx
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bsonx_to_bson(bsonx) RETURNS bson
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE CAST (bson AS bsonx) WITH FUNCTION bson_to_bsonx(bson) AS ASSIGNMENT;
+CREATE CAST (bsonx AS bson) WITH FUNCTION bsonx_to_bson(bsonx) AS ASSIGNMENT;
+
+-- same as bson_get_* for bson; named apart so that calls with an untyped literal stay unambiguous
+CREATE FUNCTION bsonx_get_text(bsonx, text) RETURNS text
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bsonx_get_bson(bsonx, text) RETURNS bson
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bsonx_get_int(bsonx, text) RETURNS int4
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bsonx_get_double(bsonx, text) RETURNS float8
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bsonx_get_bigint(bsonx, text) RETURNS int8
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+-- converts row to bsonx
+CREATE FUNCTION row_to_bsonx(record) RETURNS bsonx
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+-- converts bson to a row of the type of the first argument, inverse of row_to_bson
+-- missing fields are NULL, or taken from the first argument if it's not null
+CREATE FUNCTION bson_populate_record(anyelement, bson) RETURNS anyelement
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE;
+
+-- as above, for each document of the array
+CREATE FUNCTION bson_populate_recordset(anyelement, bson[]) RETURNS SETOF anyelement
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE;
+
+---------------------------------------------------
+-- bsonkey - order-preserving compact index keys
+---------------------------------------------------
+
+-- Fields of a document named by a MongoDB key pattern, encoded so that keys compare bytewise
+-- in MongoDB index order; see pgbson_key.hpp for the encoding.
+-- Text and binary representation are those of bytea.
+
+CREATE TYPE bsonkey;
+
+CREATE FUNCTION bsonkey_in(cstring) RETURNS bsonkey
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bsonkey_out(bsonkey) RETURNS cstring
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bsonkey_send(bsonkey) RETURNS bytea
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bsonkey_recv(internal) RETURNS bsonkey
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE TYPE bsonkey (
+    input = bsonkey_in,
+    output = bsonkey_out,
+    send = bsonkey_send,
+    receive = bsonkey_recv,
+    alignment = int4,
+    storage = main
+);
+
+CREATE CAST (bsonkey AS bytea) WITHOUT FUNCTION;
+
+-- key of the document for the pattern, e.g. bson_index_key(doc, '{"a": 1, "b.c": -1}')
+-- missing fields are keyed as null, arrays as whole values
+CREATE FUNCTION bson_index_key(bson, bson) RETURNS bsonkey
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bsonkey_compare(bsonkey, bsonkey) RETURNS INT4
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bsonkey_equal(bsonkey, bsonkey) RETURNS BOOL
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bsonkey_not_equal(bsonkey, bsonkey) RETURNS BOOL
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bsonkey_lt(bsonkey, bsonkey) RETURNS BOOL
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bsonkey_lte(bsonkey, bsonkey) RETURNS BOOL
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bsonkey_gt(bsonkey, bsonkey) RETURNS BOOL
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION bsonkey_gte(bsonkey, bsonkey) RETURNS BOOL
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+-- b-tree sort support, with abbreviated keys
+CREATE FUNCTION bsonkey_sortsupport(internal) RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE;
+
+CREATE OPERATOR = (
+    LEFTARG = bsonkey,
+    RIGHTARG = bsonkey,
+    COMMUTATOR = =,
+    PROCEDURE = bsonkey_equal,
+    RESTRICT = eqsel,
+    JOIN = eqjoinsel,
+    NEGATOR = <>,
+    MERGES
+);
+
+CREATE OPERATOR <> (
+    LEFTARG = bsonkey,
+    RIGHTARG = bsonkey,
+    COMMUTATOR = <>,
+    PROCEDURE = bsonkey_not_equal,
+    RESTRICT = neqsel,
+    JOIN = neqjoinsel,
+    NEGATOR = =
+);
+
+CREATE OPERATOR < (
+    LEFTARG = bsonkey,
+    RIGHTARG = bsonkey,
+    COMMUTATOR = >,
+    PROCEDURE = bsonkey_lt,
+    RESTRICT = scalarltsel,
+    JOIN = scalarltjoinsel,
+    NEGATOR = >=
+);
+
+CREATE OPERATOR <= (
+    LEFTARG = bsonkey,
+    RIGHTARG = bsonkey,
+    COMMUTATOR = >=,
+    PROCEDURE = bsonkey_lte,
+    RESTRICT = scalarltsel,
+    JOIN = scalarltjoinsel,
+    NEGATOR = >
+);
+
+CREATE OPERATOR > (
+    LEFTARG = bsonkey,
+    RIGHTARG = bsonkey,
+    COMMUTATOR = <,
+    PROCEDURE = bsonkey_gt,
+    RESTRICT = scalargtsel,
+    JOIN = scalargtjoinsel,
+    NEGATOR = <=
+);
+
+CREATE OPERATOR >= (
+    LEFTARG = bsonkey,
+    RIGHTARG = bsonkey,
+    COMMUTATOR = <=,
+    PROCEDURE = bsonkey_gte,
+    RESTRICT = scalargtsel,
+    JOIN = scalargtjoinsel,
+    NEGATOR = <
+);
+
+CREATE OPERATOR CLASS bsonkey_ops
+    DEFAULT FOR TYPE bsonkey USING btree AS
+        OPERATOR 1 < (bsonkey, bsonkey),
+        OPERATOR 2 <= (bsonkey, bsonkey),
+        OPERATOR 3 = (bsonkey, bsonkey),
+        OPERATOR 4 >= (bsonkey, bsonkey),
+        OPERATOR 5 > (bsonkey, bsonkey),
+        FUNCTION 1 bsonkey_compare(bsonkey, bsonkey),
+        FUNCTION 2 bsonkey_sortsupport(internal);
+
+-------------------------------
+-- jsonb casts (PostgreSQL 9.4)
+-------------------------------
+
+-- direct conversion, without text representation; see pgbson_jsonb.hpp for the type mapping
+DO $$
+BEGIN
+    IF current_setting('server_version_num')::int >= 90400 THEN
+        CREATE FUNCTION jsonb_to_bson(jsonb) RETURNS bson
+        AS 'MODULE_PATHNAME'
+        LANGUAGE C STRICT IMMUTABLE;
+
+        CREATE FUNCTION bson_to_jsonb(bson) RETURNS jsonb
+        AS 'MODULE_PATHNAME'
+        LANGUAGE C STRICT IMMUTABLE;
+
+        CREATE CAST (jsonb AS bson) WITH FUNCTION jsonb_to_bson(jsonb) AS ASSIGNMENT;
+        CREATE CAST (bson AS jsonb) WITH FUNCTION bson_to_jsonb(bson) AS ASSIGNMENT;
+    END IF;
+END
+$$;
+
+----------------------------
+-- planner support functions
+----------------------------
+
+-- Cost estimates of field lookups (growing with path depth and average document width),
+-- selectivity of bson_exists and number of rows of bson_unwind_array.
+-- bson_exists(column, path) is turned into column ? path, so it can use an index supporting ?.
+-- Support functions can be attached since PostgreSQL 12.
+
+CREATE FUNCTION bson_getter_support(internal) RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION bson_exists_support(internal) RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION bson_unwind_support(internal) RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+DO $$
+BEGIN
+    IF current_setting('server_version_num')::int >= 120000 THEN
+        ALTER FUNCTION bson_get_text(bson, text) SUPPORT bson_getter_support;
+        ALTER FUNCTION bson_get_bson(bson, text) SUPPORT bson_getter_support;
+        ALTER FUNCTION bson_get_int(bson, text) SUPPORT bson_getter_support;
+        ALTER FUNCTION bson_get_double(bson, text) SUPPORT bson_getter_support;
+        ALTER FUNCTION bson_get_bigint(bson, text) SUPPORT bson_getter_support;
+        ALTER FUNCTION bsonx_get_text(bsonx, text) SUPPORT bson_getter_support;
+        ALTER FUNCTION bsonx_get_bson(bsonx, text) SUPPORT bson_getter_support;
+        ALTER FUNCTION bsonx_get_int(bsonx, text) SUPPORT bson_getter_support;
+        ALTER FUNCTION bsonx_get_double(bsonx, text) SUPPORT bson_getter_support;
+        ALTER FUNCTION bsonx_get_bigint(bsonx, text) SUPPORT bson_getter_support;
+        ALTER FUNCTION bson_get_int_array(bson, text) SUPPORT bson_getter_support;
+        ALTER FUNCTION bson_get_bigint_array(bson, text) SUPPORT bson_getter_support;
+        ALTER FUNCTION bson_get_double_array(bson, text) SUPPORT bson_getter_support;
+        ALTER FUNCTION bson_get_text_array(bson, text) SUPPORT bson_getter_support;
+        ALTER FUNCTION bson_get_bool_array(bson, text) SUPPORT bson_getter_support;
+        ALTER FUNCTION bson_get_timestamptz_array(bson, text) SUPPORT bson_getter_support;
+        ALTER FUNCTION bson_array_size(bson, text) SUPPORT bson_getter_support;
+        ALTER FUNCTION bson_exists(bson, text) SUPPORT bson_exists_support;
+        ALTER FUNCTION bson_unwind_array(bson, text) SUPPORT bson_unwind_support;
+    END IF;
+END
+$$;
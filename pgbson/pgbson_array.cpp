@@ -0,0 +1,285 @@
+// Copyright (c) 2012-2013 Maciej Gajewski <maciej.gajewski0@gmail.com>
+// 
+// Permission to use, copy, modify, and distribute this software and its documentation for any purpose, without fee, and without a written agreement is hereby granted,
+// provided that the above copyright notice and this paragraph and the following two paragraphs appear in all copies.
+// 
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, 
+// ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+// THE AUTHOR SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+// THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE AUTHOR HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+
+#include "pgbson_array.hpp"
+
+#include <cstring>
+#include <string>
+
+namespace {
+
+// element readers of fixed-size types: read() returns false if the BSON type can't be converted
+
+struct int4_element
+{
+    typedef int32 value_type;
+    static const char* name() { return "int4"; }
+
+    static bool read(char type, const char* value, int32* result)
+    {
+        if (type != mongo::NumberInt)
+            return false;
+        std::memcpy(result, value, sizeof(int32));
+        return true;
+    }
+};
+
+struct int8_element
+{
+    typedef int64 value_type;
+    static const char* name() { return "int8"; }
+
+    static bool read(char type, const char* value, int64* result)
+    {
+        if (type == mongo::NumberLong)
+        {
+            std::memcpy(result, value, sizeof(int64));
+            return true;
+        }
+        if (type == mongo::NumberInt)
+        {
+            int32 i;
+            std::memcpy(&i, value, sizeof(int32));
+            *result = i;
+            return true;
+        }
+        return false;
+    }
+};
+
+struct float8_element
+{
+    typedef double value_type;
+    static const char* name() { return "float8"; }
+
+    static bool read(char type, const char* value, double* result)
+    {
+        if (type == mongo::NumberDouble)
+        {
+            std::memcpy(result, value, sizeof(double));
+            return true;
+        }
+        if (type == mongo::NumberInt)
+        {
+            int32 i;
+            std::memcpy(&i, value, sizeof(int32));
+            *result = i;
+            return true;
+        }
+        return false;
+    }
+};
+
+struct bool_element
+{
+    typedef bool value_type;
+    static const char* name() { return "bool"; }
+
+    static bool read(char type, const char* value, bool* result)
+    {
+        if (type != mongo::Bool)
+            return false;
+        *result = *value != 0;
+        return true;
+    }
+};
+
+struct timestamptz_element
+{
+    typedef TimestampTz value_type;
+    static const char* name() { return "timestamptz"; }
+
+    static bool read(char type, const char* value, TimestampTz* result)
+    {
+        if (type != mongo::Date)
+            return false;
+        long long ms;
+        std::memcpy(&ms, value, sizeof(ms));
+        *result = bson_date_to_timestamp(ms);
+        return true;
+    }
+};
+
+// size of the value of the types accepted by the readers above
+int value_size(char type)
+{
+    switch (type)
+    {
+        case mongo::Bool:
+            return 1;
+        case mongo::NumberInt:
+            return 4;
+        case mongo::NumberLong:
+        case mongo::NumberDouble:
+        case mongo::Date:
+            return 8;
+        default: // null, undefined
+            return 0;
+    }
+}
+
+// upper bound of the number of elements: each takes at least 2 bytes (type and the terminator of the name,
+// a null with an empty name; binary input doesn't require array keys to be indexes)
+int max_elements(const mongo::BSONElement& e)
+{
+    if (e.type() != mongo::Array)
+        return 1;
+    return (e.embeddedObject().objsize() - 5) / 2;
+}
+
+void conversion_error(const mongo::BSONElement& e, const char* field_name, int index, const char* target)
+{
+    ereport(
+        ERROR,
+            (
+            errcode(ERRCODE_INTERNAL_ERROR),
+            errmsg("Element %d of field %s is of type %s and can not be converted to %s",
+                index + 1, field_name, bson_type_name(e), target)
+            )
+        );
+}
+
+template<typename Element>
+ArrayType* fixed_size_array(const mongo::BSONElement& e, Oid element_type, const char* field_name)
+{
+    typedef typename Element::value_type value_type;
+
+    const char* p;
+    bool single;
+    if (e.type() == mongo::Array)
+    {
+        p = e.embeddedObject().objdata() + 4;
+        single = false;
+    }
+    else
+    {
+        p = e.rawdata();
+        single = true;
+    }
+
+    int bound = max_elements(e);
+    value_type* values = reinterpret_cast<value_type*>(palloc(sizeof(value_type) * (bound + 1)));
+    bool* nulls = reinterpret_cast<bool*>(palloc(sizeof(bool) * (bound + 1)));
+    int n = 0;
+    int n_values = 0;
+    bool has_nulls = false;
+
+    while (*p != mongo::EOO)
+    {
+        char type = *p;
+        const char* value = p + 1 + std::strlen(p + 1) + 1;
+        if (type == mongo::jstNULL || type == mongo::Undefined)
+        {
+            nulls[n] = true;
+            has_nulls = true;
+        }
+        else if (Element::read(type, value, &values[n_values]))
+        {
+            nulls[n] = false;
+            n_values++;
+        }
+        else
+        {
+            conversion_error(mongo::BSONElement(p), field_name, n, Element::name());
+        }
+        n++;
+
+        if (single)
+            break;
+        p = value + value_size(type);
+    }
+
+    if (n == 0)
+        return construct_empty_array(element_type);
+
+    // fixed-size values are stored unpadded, null elements take no space
+    std::size_t data_size = sizeof(value_type) * n_values;
+    std::size_t overhead = has_nulls ? ARR_OVERHEAD_WITHNULLS(1, n) : ARR_OVERHEAD_NONULLS(1);
+    ArrayType* result = reinterpret_cast<ArrayType*>(palloc0(overhead + data_size));
+    SET_VARSIZE(result, overhead + data_size);
+    result->ndim = 1;
+    result->dataoffset = has_nulls ? overhead : 0;
+    result->elemtype = element_type;
+    ARR_DIMS(result)[0] = n;
+    ARR_LBOUND(result)[0] = 1;
+
+    if (has_nulls)
+    {
+        bits8* bitmap = ARR_NULLBITMAP(result);
+        for (int i = 0; i < n; i++)
+        {
+            if (!nulls[i])
+                bitmap[i / 8] |= 1 << (i % 8);
+        }
+    }
+    std::memcpy(ARR_DATA_PTR(result), values, data_size);
+
+    pfree(values);
+    pfree(nulls);
+    return result;
+}
+
+void text_value(const mongo::BSONElement& element, const char* field_name, Datum* value, bool* null)
+{
+    *null = element.isNull() || element.type() == mongo::Undefined;
+    *value = *null ? (Datum) 0 : convert_field<std::string>(NULL, element, field_name);
+}
+
+ArrayType* text_array(const mongo::BSONElement& e, const char* field_name)
+{
+    int bound = max_elements(e);
+    Datum* values = reinterpret_cast<Datum*>(palloc(sizeof(Datum) * (bound + 1)));
+    bool* nulls = reinterpret_cast<bool*>(palloc(sizeof(bool) * (bound + 1)));
+    int n = 0;
+
+    if (e.type() == mongo::Array)
+    {
+        mongo::BSONObjIterator it(e.embeddedObject());
+        while (it.more())
+        {
+            text_value(it.next(), field_name, &values[n], &nulls[n]);
+            n++;
+        }
+    }
+    else
+    {
+        text_value(e, field_name, &values[n], &nulls[n]);
+        n++;
+    }
+
+    int dims[1] = { n };
+    int lbs[1] = { 1 };
+    return construct_md_array(values, nulls, 1, dims, lbs, TEXTOID, -1, false, 'i');
+}
+
+}
+
+ArrayType* bson_to_array(const mongo::BSONElement& e, Oid element_type, const char* field_name)
+{
+    switch (element_type)
+    {
+        case INT4OID:
+            return fixed_size_array<int4_element>(e, element_type, field_name);
+        case INT8OID:
+            return fixed_size_array<int8_element>(e, element_type, field_name);
+        case FLOAT8OID:
+            return fixed_size_array<float8_element>(e, element_type, field_name);
+        case BOOLOID:
+            return fixed_size_array<bool_element>(e, element_type, field_name);
+        case TIMESTAMPTZOID:
+            return fixed_size_array<timestamptz_element>(e, element_type, field_name);
+        case TEXTOID:
+            return text_array(e, field_name);
+        default:
+            ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR), errmsg("unsupported array element type %u", element_type)));
+            return NULL; // not reached
+    }
+}
@@ -0,0 +1,29 @@
+// Copyright (c) 2012-2013 Maciej Gajewski <maciej.gajewski0@gmail.com>
+// 
+// Permission to use, copy, modify, and distribute this software and its documentation for any purpose, without fee, and without a written agreement is hereby granted,
+// provided that the above copyright notice and this paragraph and the following two paragraphs appear in all copies.
+// 
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, 
+// ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+// THE AUTHOR SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+// THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE AUTHOR HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+
+#ifndef PGBSON_ARRAY_HPP
+#define PGBSON_ARRAY_HPP
+
+#include "pgbson_internal.hpp"
+
+// Conversion of BSON arrays to PostgreSQL arrays, used by the bson_get_*_array functions.
+//
+// Elements are converted as by the scalar getters: int4 from int32, int8 from int32 and int64,
+// float8 from double and int32, text as by bson_get_text; bool from booleans and timestamptz from Date.
+// null and undefined elements become NULL, a field which is not an array gives a single-element array.
+//
+// Arrays of fixed-size types are read in one pass over the raw elements into a buffer sized
+// by the byte length of the BSON array, and the result is assembled with a single copy of it.
+
+// element_type is one of INT4OID, INT8OID, FLOAT8OID, BOOLOID, TIMESTAMPTZOID and TEXTOID
+ArrayType* bson_to_array(const mongo::BSONElement& e, Oid element_type, const char* field_name);
+
+#endif
@@ -0,0 +1,255 @@
+// Copyright (c) 2012-2013 Maciej Gajewski <maciej.gajewski0@gmail.com>
+// 
+// Permission to use, copy, modify, and distribute this software and its documentation for any purpose, without fee, and without a written agreement is hereby granted,
+// provided that the above copyright notice and this paragraph and the following two paragraphs appear in all copies.
+// 
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, 
+// ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+// THE AUTHOR SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+// THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE AUTHOR HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+
+#include "pgbson_directory.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+struct directory_level
+{
+    uint32 object_offset;
+    uint32 first_entry;
+    uint32 n_entries;
+};
+
+// unaligned read, varlena data may be not aligned
+inline uint32 read_uint32(const char* p)
+{
+    uint32 v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// orders element offsets by field name, keeping document order for equal names
+struct field_name_less
+{
+    const char* document;
+    field_name_less(const char* d) : document(d) { }
+
+    bool operator()(uint32 l, uint32 r) const
+    {
+        return std::strcmp(document + l + 1, document + r + 1) < 0;
+    }
+};
+
+void collect_levels(const char* document, const mongo::BSONObj& object, bool is_array,
+    std::vector<directory_level>& levels, std::vector<uint32>& entries)
+{
+    std::vector<uint32> fields;
+    mongo::BSONObjIterator it(object);
+    while (it.more())
+    {
+        mongo::BSONElement e = it.next();
+        fields.push_back(e.rawdata() - document);
+    }
+
+    if (!is_array && fields.size() >= std::size_t(directory_min_fields))
+    {
+        directory_level level;
+        level.object_offset = object.objdata() - document;
+        level.first_entry = entries.size();
+        level.n_entries = fields.size();
+        levels.push_back(level);
+
+        std::stable_sort(fields.begin(), fields.end(), field_name_less(document));
+        entries.insert(entries.end(), fields.begin(), fields.end());
+    }
+
+    // objects are visited in document order, so levels end up sorted by offset
+    mongo::BSONObjIterator sub(object);
+    while (sub.more())
+    {
+        mongo::BSONElement e = sub.next();
+        if (e.type() == mongo::Object || e.type() == mongo::Array)
+        {
+            collect_levels(document, e.embeddedObject(), e.type() == mongo::Array, levels, entries);
+        }
+    }
+}
+
+// compares null-terminated field name with name of given length, like strcmp
+inline int compare_name(const char* field_name, const char* name, int length)
+{
+    int c = std::strncmp(field_name, name, length);
+    if (c != 0)
+        return c;
+    return field_name[length] == 0 ? 0 : 1;
+}
+
+class directory
+{
+public:
+
+    directory(const char* data, std::size_t size)
+        : _document(data), _n_levels(0), _levels(NULL), _entries(NULL)
+    {
+        std::size_t objsize = read_uint32(data);
+        if (size >= objsize + sizeof(uint32))
+        {
+            const char* p = data + objsize;
+            _n_levels = read_uint32(p);
+            _levels = p + sizeof(uint32);
+            _entries = _levels + _n_levels * 3 * sizeof(uint32);
+        }
+    }
+
+    // returns false if the object has no directory
+    bool find_level(const char* object, directory_level* level) const
+    {
+        uint32 offset = object - _document;
+        uint32 lo = 0;
+        uint32 hi = _n_levels;
+        while (lo < hi)
+        {
+            uint32 mid = lo + (hi - lo) / 2;
+            uint32 mid_offset = read_uint32(_levels + mid * 3 * sizeof(uint32));
+            if (mid_offset < offset)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        if (lo < _n_levels && read_uint32(_levels + lo * 3 * sizeof(uint32)) == offset)
+        {
+            const char* l = _levels + lo * 3 * sizeof(uint32);
+            level->object_offset = offset;
+            level->first_entry = read_uint32(l + sizeof(uint32));
+            level->n_entries = read_uint32(l + 2 * sizeof(uint32));
+            return true;
+        }
+        return false;
+    }
+
+    // first field with given name
+    mongo::BSONElement find_field(const directory_level& level, const char* name, int length) const
+    {
+        uint32 lo = 0;
+        uint32 hi = level.n_entries;
+        while (lo < hi)
+        {
+            uint32 mid = lo + (hi - lo) / 2;
+            if (compare_name(field_name(level, mid), name, length) < 0)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        if (lo < level.n_entries && compare_name(field_name(level, lo), name, length) == 0)
+            return mongo::BSONElement(_document + entry(level, lo));
+
+        return mongo::BSONElement();
+    }
+
+private:
+
+    uint32 entry(const directory_level& level, uint32 i) const
+    {
+        return read_uint32(_entries + (level.first_entry + i) * sizeof(uint32));
+    }
+
+    const char* field_name(const directory_level& level, uint32 i) const
+    {
+        return _document + entry(level, i) + 1;
+    }
+
+    const char* _document;
+    uint32 _n_levels;
+    const char* _levels;
+    const char* _entries;
+};
+
+}
+
+bytea* build_bsonx(const mongo::BSONObj& object)
+{
+    std::vector<directory_level> levels;
+    std::vector<uint32> entries;
+    collect_levels(object.objdata(), object, false, levels, entries);
+
+    uint32 n_levels = levels.size();
+    std::size_t size = VARHDRSZ + object.objsize()
+        + sizeof(uint32)
+        + n_levels * 3 * sizeof(uint32)
+        + entries.size() * sizeof(uint32);
+
+    bytea* result = (bytea *) palloc(size);
+    SET_VARSIZE(result, size);
+
+    char* p = VARDATA(result);
+    std::memcpy(p, object.objdata(), object.objsize());
+    p += object.objsize();
+
+    std::memcpy(p, &n_levels, sizeof(uint32));
+    p += sizeof(uint32);
+    for (uint32 i = 0; i < n_levels; i++)
+    {
+        std::memcpy(p, &levels[i].object_offset, sizeof(uint32));
+        std::memcpy(p + sizeof(uint32), &levels[i].first_entry, sizeof(uint32));
+        std::memcpy(p + 2 * sizeof(uint32), &levels[i].n_entries, sizeof(uint32));
+        p += 3 * sizeof(uint32);
+    }
+    if (!entries.empty())
+        std::memcpy(p, &entries[0], entries.size() * sizeof(uint32));
+
+    return result;
+}
+
+Datum return_bsonx(const mongo::BSONObj& b)
+{
+    PG_RETURN_BYTEA_P(build_bsonx(b));
+}
+
+mongo::BSONElement get_field_indexed(const char* data, std::size_t size, const compiled_path* path)
+{
+    directory dir(data, size);
+    mongo::BSONObj current(data);
+
+    for (int segment = 0; segment < path->n_segments; segment++)
+    {
+        mongo::BSONElement segment_field;
+        directory_level level;
+
+        if (dir.find_level(current.objdata(), &level))
+        {
+            const compiled_path_segment& s = path->segments[segment];
+            const char* rest = path->path + s.offset;
+
+            // the rest of the path as a literal name takes precedence
+            mongo::BSONElement e = dir.find_field(level, rest, path->length - s.offset);
+            if (!e.eoo())
+                return e;
+
+            if (segment < path->n_segments - 1)
+                segment_field = dir.find_field(level, rest, s.length);
+        }
+        else
+        {
+            mongo::BSONElement e = get_field_level(current, path, segment, &segment_field);
+            if (!e.eoo())
+                return e;
+        }
+
+        if (segment_field.eoo())
+            return mongo::BSONElement();
+
+        mongo::BSONType t = segment_field.type();
+        if (t != mongo::Object && t != mongo::Array)
+            return mongo::BSONElement();
+
+        current = segment_field.embeddedObject();
+    }
+
+    return mongo::BSONElement();
+}
@@ -0,0 +1,58 @@
+// Copyright (c) 2012-2013 Maciej Gajewski <maciej.gajewski0@gmail.com>
+// 
+// Permission to use, copy, modify, and distribute this software and its documentation for any purpose, without fee, and without a written agreement is hereby granted,
+// provided that the above copyright notice and this paragraph and the following two paragraphs appear in all copies.
+// 
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, 
+// ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+// THE AUTHOR SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+// THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE AUTHOR HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+
+#ifndef PGBSON_DIRECTORY_HPP
+#define PGBSON_DIRECTORY_HPP
+
+#include "pgbson_internal.hpp"
+
+// Field directory, used by the bsonx type.
+//
+// bsonx value is a plain BSON document followed by a directory:
+//
+//  uint32 n_levels
+//  n_levels x { uint32 object_offset, uint32 first_entry, uint32 n_entries } - sorted by object_offset
+//  uint32 entries[] - element offsets, for each level sorted by field name (and offset for equal names)
+//
+// All offsets are relative to the beginning of the document. Only objects with at least
+// directory_min_fields fields get a directory, smaller objects (and arrays) are scanned.
+// Since the document comes first, BSONObj(VARDATA_ANY(x)) works on bsonx values as well.
+
+const int directory_min_fields = 8;
+
+// builds palloc-ed bsonx varlena
+bytea* build_bsonx(const mongo::BSONObj& object);
+
+Datum return_bsonx(const mongo::BSONObj& b);
+
+// same as get_field, but uses the directory
+// data and size are the payload of bsonx varlena
+mongo::BSONElement get_field_indexed(const char* data, std::size_t size, const compiled_path* path);
+
+template<typename FieldType>
+static
+Datum bsonx_get(PG_FUNCTION_ARGS)
+{
+    bytea* arg = GETARG_BSON(0);
+    const compiled_path* path = get_cached_path(fcinfo, 1);
+
+    mongo::BSONElement e = get_field_indexed(VARDATA_ANY(arg), VARSIZE_ANY_EXHDR(arg), path);
+    if (e.eoo())
+    {
+        PG_RETURN_NULL();
+    }
+    else
+    {
+        return convert_field<FieldType>(fcinfo, e, path->path);
+    }
+}
+
+#endif
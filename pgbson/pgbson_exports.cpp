@@ -10,7 +10,22 @@
 // THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE AUTHOR HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
 
 #include "pgbson_internal.hpp"
+#include "pgbson_directory.hpp"
+#include "pgbson_hash.hpp"
+#include "pgbson_stats.hpp"
+#include "pgbson_planner.hpp"
+#include "pgbson_gin.hpp"
+#include "pgbson_match.hpp"
+#include "pgbson_json.hpp"
+#include "pgbson_jsonb.hpp"
+#include "pgbson_populate.hpp"
+#include "pgbson_array.hpp"
+#include "pgbson_validate.hpp"
+#include "pgbson_scan.hpp"
+#include "pgbson_key.hpp"
 
+#include <algorithm>
+#include <vector>
 #include <string>
 #include <cstring>
 
@@ -24,7 +39,7 @@ PG_MODULE_MAGIC;
 PG_FUNCTION_INFO_V1(pgbson_version);
 Datum pgbson_version(PG_FUNCTION_ARGS)
 {
-    return return_string("1.0");
+    return return_string("1.1");
 }
 
 // bson output - to json
@@ -33,10 +48,34 @@ Datum
 bson_out(PG_FUNCTION_ARGS)
 {
     bytea* arg = GETARG_BSON(0);
-    mongo::BSONObj object(VARDATA_ANY(arg));
+    StringInfoData json;
+    initStringInfo(&json);
+    try
+    {
+        enlargeStringInfo(&json, VARSIZE_ANY_EXHDR(arg) * 2);
+        bson_to_json(&json, VARDATA_ANY(arg)); // same as jsonString(), strict, not-pretty
+    }
+    catch(const std::exception& e)
+    {
+        ereport(
+            ERROR,
+            (errcode(ERRCODE_DATA_CORRUPTED), errmsg("can not convert BSON to JSON: %s", e.what()))
+        );
+    }
+    PG_RETURN_CSTRING(const_cast<char*>(utf8_to_server(json.data, &json.len)));
+}
 
-    std::string json = object.jsonString(); // strict, not-pretty
-    return return_cstring(json);
+// checks a built bson or bsonx value, for input paths that don't guarantee valid UTF-8 and nesting depth.
+// Called outside of try blocks, so that no destructors are skipped by ereport
+static void check_built_bson(Datum value, int sqlerrcode)
+{
+    bytea* result = reinterpret_cast<bytea*>(DatumGetPointer(value));
+    int32 size;
+    const char* error = validate_bson(VARDATA(result), VARSIZE(result) - VARHDRSZ, &size);
+    if (error != NULL)
+    {
+        ereport(ERROR, (errcode(sqlerrcode), errmsg("invalid BSON: %s", error)));
+    }
 }
 
 // bson input - from json
@@ -45,11 +84,22 @@ Datum
 bson_in(PG_FUNCTION_ARGS)
 {
     char* arg = PG_GETARG_CSTRING(0);
+    int length = std::strlen(arg);
+    const char* json = server_to_utf8(arg, &length); // BSON strings are UTF-8
+    Datum result;
     try
     {
-        mongo::BSONObj object = mongo::fromjson(arg, NULL);
+        // the fast parser checks UTF-8 and depth itself
+        bytea* parsed = json_to_bson(json, length);
+        if (parsed != NULL)
+        {
+            PG_RETURN_BYTEA_P(parsed);
+        }
+
+        // syntax not handled by the fast parser, or invalid input
+        mongo::BSONObj object = mongo::fromjson(json, NULL);
         // copy to palloc-ed buffer
-        return return_bson(object);
+        result = return_bson(object);
     }
     catch(...)
     {
@@ -58,28 +108,40 @@ bson_in(PG_FUNCTION_ARGS)
             (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION), errmsg("invalid input syntax for BSON"))
         );
     }
+    check_built_bson(result, ERRCODE_INVALID_TEXT_REPRESENTATION);
+    return result;
 }
 
 // binary i/o
-PG_FUNCTION_INFO_V1(bson_recv);
-Datum
-bson_recv(PG_FUNCTION_ARGS)
+
+// validates the document at the cursor, returns its size
+static int32 receive_bson(StringInfo buf)
 {
-    StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
-    try
-    {
-        mongo::BSONObj object(buf->data);
-        buf->cursor += object.objsize();
-        // copy to palloc-ed buffer
-        return return_bson(object);
-    }
-    catch(...)
+    int32 size;
+    const char* error = validate_bson(buf->data + buf->cursor, buf->len - buf->cursor, &size);
+    if (error != NULL)
     {
         ereport(
             ERROR,
-            (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION), errmsg("invalid binary input for BSON"))
+            (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION), errmsg("invalid binary input for BSON: %s", error))
         );
     }
+    return size;
+}
+
+PG_FUNCTION_INFO_V1(bson_recv);
+Datum
+bson_recv(PG_FUNCTION_ARGS)
+{
+    StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
+    int32 size = receive_bson(buf);
+
+    // the validated bytes are copied to the varlena as they are
+    bytea* result = reinterpret_cast<bytea*>(palloc(size + VARHDRSZ));
+    SET_VARSIZE(result, size + VARHDRSZ);
+    std::memcpy(VARDATA(result), buf->data + buf->cursor, size);
+    buf->cursor += size;
+    PG_RETURN_POINTER(result);
 }
 
 PG_FUNCTION_INFO_V1(bson_send);
@@ -90,6 +152,32 @@ bson_send(PG_FUNCTION_ARGS)
     PG_RETURN_BYTEA_P(arg);
 }
 
+// checks bytes before they are cast to bson
+PG_FUNCTION_INFO_V1(bson_is_valid);
+Datum
+bson_is_valid(PG_FUNCTION_ARGS)
+{
+    bytea* arg = PG_GETARG_BYTEA_PP(0);
+    PG_RETURN_BOOL(validate_bson_document(VARDATA_ANY(arg), VARSIZE_ANY_EXHDR(arg)) == NULL);
+}
+
+// bytea to bson: the varlena layout is the same, so the validated value is returned as it is
+PG_FUNCTION_INFO_V1(bson_from_bytea);
+Datum
+bson_from_bytea(PG_FUNCTION_ARGS)
+{
+    bytea* arg = PG_GETARG_BYTEA_PP(0);
+    const char* error = validate_bson_document(VARDATA_ANY(arg), VARSIZE_ANY_EXHDR(arg));
+    if (error != NULL)
+    {
+        ereport(
+            ERROR,
+            (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION), errmsg("invalid BSON: %s", error))
+        );
+    }
+    PG_RETURN_BYTEA_P(arg);
+}
+
 PG_FUNCTION_INFO_V1(bson_get_text);
 Datum
 bson_get_text(PG_FUNCTION_ARGS)
@@ -118,193 +206,1723 @@ bson_get_bigint(PG_FUNCTION_ARGS)
     return bson_get<int64>(fcinfo);
 }
 
-PG_FUNCTION_INFO_V1(bson_get_bson);
-Datum
-bson_get_bson(PG_FUNCTION_ARGS)
+// array field as PostgreSQL array
+static Datum bson_get_array(PG_FUNCTION_ARGS, Oid element_type)
 {
-    bytea* arg = GETARG_BSON(0);
-    mongo::BSONObj object(VARDATA_ANY(arg));
+    const compiled_path* path = get_cached_path(fcinfo, 1);
 
-    text* arg2 = PG_GETARG_TEXT_P(1);
-    std::string field_name(VARDATA(arg2),  VARSIZE(arg2)-VARHDRSZ);
-
-    mongo::BSONElement el = object.getFieldDotted(field_name);
-    if (el.eoo())
+    mongo::BSONElement e = get_field_detoast(PG_GETARG_DATUM(0), path);
+    if (e.eoo())
     {
         PG_RETURN_NULL();
     }
-    else if (el.type() == mongo::Object)
-    {
-        return return_bson(el.embeddedObject());
-    }
     else
     {
-        // build object with sinle, anonymous field
-        mongo::BSONObjBuilder builder;
-        builder.appendAs(el, "");
-        return return_bson(builder.obj());
+        PG_RETURN_ARRAYTYPE_P(bson_to_array(e, element_type, path->path));
     }
 }
 
-// Converts composite type to BSON
-//
-// Code of this function is based on row_to_json
-PG_FUNCTION_INFO_V1(row_to_bson);
+PG_FUNCTION_INFO_V1(bson_get_int_array);
 Datum
-row_to_bson(PG_FUNCTION_ARGS)
+bson_get_int_array(PG_FUNCTION_ARGS)
 {
-    PGBSON_LOG << "row_to_bson" << PGBSON_ENDL;
-    Datum record = PG_GETARG_DATUM(0);
-    mongo::BSONObjBuilder builder;
-
-    composite_to_bson(builder, record);
-
-    return return_bson(builder.obj());
+    return bson_get_array(fcinfo, INT4OID);
 }
 
-// logical comparison
-PG_FUNCTION_INFO_V1(bson_compare);
+PG_FUNCTION_INFO_V1(bson_get_bigint_array);
 Datum
-bson_compare(PG_FUNCTION_ARGS)
+bson_get_bigint_array(PG_FUNCTION_ARGS)
 {
-    bytea* arg0 = GETARG_BSON(0);
-    bytea* arg1 = GETARG_BSON(1);
-    mongo::BSONObj object0(VARDATA_ANY(arg0));
-    mongo::BSONObj object1(VARDATA_ANY(arg1));
-
-    PG_RETURN_INT32(object0.woCompare(object1));
+    return bson_get_array(fcinfo, INT8OID);
 }
 
-// binary equality
-PG_FUNCTION_INFO_V1(bson_binary_equal);
+PG_FUNCTION_INFO_V1(bson_get_double_array);
 Datum
-bson_binary_equal(PG_FUNCTION_ARGS)
+bson_get_double_array(PG_FUNCTION_ARGS)
 {
-    bytea* arg0 = GETARG_BSON(0);
-    bytea* arg1 = GETARG_BSON(1);
-    mongo::BSONObj object0(VARDATA_ANY(arg0));
-    mongo::BSONObj object1(VARDATA_ANY(arg1));
-
-    PG_RETURN_BOOL(object0.binaryEqual(object1));
+    return bson_get_array(fcinfo, FLOAT8OID);
 }
 
-// hash
-PG_FUNCTION_INFO_V1(bson_hash);
+PG_FUNCTION_INFO_V1(bson_get_text_array);
 Datum
-bson_hash(PG_FUNCTION_ARGS)
+bson_get_text_array(PG_FUNCTION_ARGS)
 {
-    bytea* arg0 = GETARG_BSON(0);
-    mongo::BSONObj object0(VARDATA_ANY(arg0));
-
-    PG_RETURN_INT32(object0.hash());
+    return bson_get_array(fcinfo, TEXTOID);
 }
 
-// Array operations
+PG_FUNCTION_INFO_V1(bson_get_bool_array);
+Datum
+bson_get_bool_array(PG_FUNCTION_ARGS)
+{
+    return bson_get_array(fcinfo, BOOLOID);
+}
 
-PG_FUNCTION_INFO_V1(bson_array_size);
+PG_FUNCTION_INFO_V1(bson_get_timestamptz_array);
 Datum
-bson_array_size(PG_FUNCTION_ARGS)
+bson_get_timestamptz_array(PG_FUNCTION_ARGS)
 {
-    bytea* arg = GETARG_BSON(0);
-    mongo::BSONObj object(VARDATA_ANY(arg));
+    return bson_get_array(fcinfo, TIMESTAMPTZOID);
+}
 
-    text* arg2 = PG_GETARG_TEXT_P(1);
-    std::string field_name(VARDATA(arg2),  VARSIZE(arg2)-VARHDRSZ);
+PG_FUNCTION_INFO_V1(bson_get_bson);
+Datum
+bson_get_bson(PG_FUNCTION_ARGS)
+{
+    const compiled_path* path = get_cached_path(fcinfo, 1);
 
-    mongo::BSONElement el = object.getFieldDotted(field_name);
+    mongo::BSONElement el = get_field_detoast(PG_GETARG_DATUM(0), path);
     if (el.eoo())
     {
         PG_RETURN_NULL();
     }
-    else if (el.type() == mongo::Array)
+    else
     {
-        PG_RETURN_INT32(el.embeddedObject().nFields());
+        return element_to_bson(el);
     }
-    else
+}
+
+// Multiple fields in one call.
+//
+// Paths are compiled once and kept in fn_extra, together with the description of result columns.
+struct get_many_cache
+{
+    MemoryContext context; // holds the cache, replaced when the paths change
+    ArrayType* paths_array; // copy of the argument, to detect changes
+    int n_paths;
+    compiled_path** paths;
+
+    // record result only
+    TupleDesc tupdesc;
+    Oid bson_oid;
+    FmgrInfo* input_functions; // for types not converted directly
+    Oid* input_ioparams;
+};
+
+static get_many_cache* get_many_paths(PG_FUNCTION_ARGS)
+{
+    ArrayType* paths_array = PG_GETARG_ARRAYTYPE_P(1);
+    get_many_cache* cache = reinterpret_cast<get_many_cache*>(fcinfo->flinfo->fn_extra);
+
+    if (cache != NULL
+        && VARSIZE(cache->paths_array) == VARSIZE(paths_array)
+        && std::memcmp(cache->paths_array, paths_array, VARSIZE(paths_array)) == 0)
     {
-        // scalar (or non-array object)
-        PG_RETURN_INT32(1);
+        return cache;
+    }
+
+    Datum* elements;
+    bool* nulls;
+    int n_elements;
+    deconstruct_array(paths_array, TEXTOID, -1, false, 'i', &elements, &nulls, &n_elements);
+
+    MemoryContext ctx = new_cache_context(fcinfo->flinfo->fn_mcxt, cache != NULL ? cache->context : NULL);
+    fcinfo->flinfo->fn_extra = NULL;
+    cache = reinterpret_cast<get_many_cache*>(MemoryContextAllocZero(ctx, sizeof(get_many_cache)));
+    cache->context = ctx;
+    cache->paths_array = reinterpret_cast<ArrayType*>(MemoryContextAlloc(ctx, VARSIZE(paths_array)));
+    std::memcpy(cache->paths_array, paths_array, VARSIZE(paths_array));
+    cache->n_paths = n_elements;
+    cache->paths = reinterpret_cast<compiled_path**>(MemoryContextAlloc(ctx, sizeof(compiled_path*) * (n_elements + 1)));
+
+    for (int i = 0; i < n_elements; i++)
+    {
+        if (nulls[i])
+        {
+            ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED), errmsg("field path can not be null")));
+        }
+        text* t = DatumGetTextP(elements[i]);
+        cache->paths[i] = compile_text_path(t, ctx);
     }
+
+    fcinfo->flinfo->fn_extra = cache;
+    return cache;
 }
 
-PG_FUNCTION_INFO_V1(bson_unwind_array);
+PG_FUNCTION_INFO_V1(bson_get_many);
 Datum
-bson_unwind_array(PG_FUNCTION_ARGS)
+bson_get_many(PG_FUNCTION_ARGS)
 {
-    FuncCallContext  *funcctx;
+    bytea* arg = GETARG_BSON(0);
+    mongo::BSONObj object(VARDATA_ANY(arg));
 
-    typedef std::vector<mongo::BSONElement> ElementVector;
+    get_many_cache* cache = get_many_paths(fcinfo);
 
-    struct FunctionContext
+    if (cache->tupdesc == NULL)
     {
-        ElementVector array;
-        mongo::BSONObj deepCopy;
-    };
+        TupleDesc tupdesc;
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        {
+            ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                errmsg("function returning record called in context that cannot accept type record")));
+        }
+        if (tupdesc->natts != cache->n_paths)
+        {
+            ereport(ERROR,
+                (errcode(ERRCODE_DATATYPE_MISMATCH),
+                errmsg("number of paths (%d) does not match number of result columns (%d)", cache->n_paths, tupdesc->natts)));
+        }
 
-    if (SRF_IS_FIRSTCALL())
-    {
-        funcctx = SRF_FIRSTCALL_INIT();
-        MemoryContext oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+        MemoryContext ctx = cache->context;
+        MemoryContext oldcontext = MemoryContextSwitchTo(ctx);
+        tupdesc = CreateTupleDescCopy(tupdesc);
+        BlessTupleDesc(tupdesc);
+        MemoryContextSwitchTo(oldcontext);
 
-        bytea* arg = GETARG_BSON(0);
-        mongo::BSONObj object(VARDATA_ANY(arg));
+        cache->bson_oid = get_fn_expr_argtype(fcinfo->flinfo, 0);
+        cache->input_functions = reinterpret_cast<FmgrInfo*>(MemoryContextAllocZero(ctx, sizeof(FmgrInfo) * (tupdesc->natts + 1)));
+        cache->input_ioparams = reinterpret_cast<Oid*>(MemoryContextAllocZero(ctx, sizeof(Oid) * (tupdesc->natts + 1)));
+        for (int i = 0; i < tupdesc->natts; i++)
+        {
+            Oid typid = TupleDescAttr(tupdesc, i)->atttypid;
+            if (typid != TEXTOID && typid != INT4OID && typid != INT8OID && typid != FLOAT8OID && typid != cache->bson_oid)
+            {
+                Oid input;
+                getTypeInputInfo(typid, &input, &cache->input_ioparams[i]);
+                fmgr_info_cxt(input, &cache->input_functions[i], ctx);
+            }
+        }
+        cache->tupdesc = tupdesc;
+    }
 
-        text* arg2 = PG_GETARG_TEXT_P(1);
-        std::string field_name(VARDATA(arg2),  VARSIZE(arg2)-VARHDRSZ);
+    TupleDesc tupdesc = cache->tupdesc;
+    std::vector<mongo::BSONElement> fields(cache->n_paths + 1);
+    get_fields(object, cache->paths, cache->n_paths, &fields[0]);
 
-        // deep-copy thr object into call context
-        // I'm not using palloc. To do it correctly, I'd have to use custom allocators
-        FunctionContext* context = new FunctionContext();
-        context->deepCopy = object.copy();
-        funcctx->user_fctx = context;
+    Datum* values = reinterpret_cast<Datum*>(palloc(sizeof(Datum) * (tupdesc->natts + 1)));
+    bool* nulls = reinterpret_cast<bool*>(palloc(sizeof(bool) * (tupdesc->natts + 1)));
+
+    for (int i = 0; i < tupdesc->natts; i++)
+    {
+        const mongo::BSONElement& e = fields[i];
+        const char* path = cache->paths[i]->path;
+        Oid typid = TupleDescAttr(tupdesc, i)->atttypid;
 
-        mongo::BSONElement el = object.getFieldDotted(field_name);
-        if (el.eoo())
+        nulls[i] = e.eoo();
+        if (nulls[i])
+        {
+            values[i] = (Datum) 0;
+        }
+        else if (typid == TEXTOID)
+        {
+            values[i] = convert_field<std::string>(fcinfo, e, path);
+        }
+        else if (typid == INT4OID)
+        {
+            values[i] = convert_field<int>(fcinfo, e, path);
+        }
+        else if (typid == INT8OID)
+        {
+            values[i] = convert_field<int64>(fcinfo, e, path);
+        }
+        else if (typid == FLOAT8OID)
         {
-            // nothing, leave tyhe array empty
+            values[i] = convert_field<double>(fcinfo, e, path);
         }
-        else if (el.type() == mongo::Array)
+        else if (typid == cache->bson_oid)
         {
-            ElementVector array = el.Array();
-            context->array.swap(array);
+            values[i] = element_to_bson(e);
         }
         else
         {
-            context->array.push_back(el);
+            // via text representation
+            text* t = DatumGetTextP(convert_field<std::string>(fcinfo, e, path));
+            values[i] = InputFunctionCall(&cache->input_functions[i], text_to_cstring(t),
+                cache->input_ioparams[i], TupleDescAttr(tupdesc, i)->atttypmod);
         }
-
-        MemoryContextSwitchTo(oldcontext);
     }
 
-    funcctx = SRF_PERCALL_SETUP();
+    HeapTuple tuple = heap_form_tuple(tupdesc, values, nulls);
+    return HeapTupleGetDatum(tuple);
+}
 
-    FunctionContext* context = reinterpret_cast<FunctionContext*>(funcctx->user_fctx);
+PG_FUNCTION_INFO_V1(bson_get_many_text);
+Datum
+bson_get_many_text(PG_FUNCTION_ARGS)
+{
+    bytea* arg = GETARG_BSON(0);
+    mongo::BSONObj object(VARDATA_ANY(arg));
 
-    if (funcctx->call_cntr == context->array.size())
+    get_many_cache* cache = get_many_paths(fcinfo);
+    const int n = cache->n_paths;
+    if (n == 0)
     {
-        delete context;
-        SRF_RETURN_DONE(funcctx);
+        PG_RETURN_ARRAYTYPE_P(construct_empty_array(TEXTOID));
     }
-    else
+
+    std::vector<mongo::BSONElement> fields(n);
+    get_fields(object, cache->paths, n, &fields[0]);
+
+    Datum* values = reinterpret_cast<Datum*>(palloc(sizeof(Datum) * (n + 1)));
+    bool* nulls = reinterpret_cast<bool*>(palloc(sizeof(bool) * (n + 1)));
+    for (int i = 0; i < n; i++)
     {
-        const mongo::BSONElement el = context->array[funcctx->call_cntr];
-        mongo::BSONObj objToReturn;
+        nulls[i] = fields[i].eoo();
+        values[i] = nulls[i] ? (Datum) 0 : convert_field<std::string>(fcinfo, fields[i], cache->paths[i]->path);
+    }
+
+    int dims[1] = { n };
+    int lbs[1] = { 1 };
+    ArrayType* result = construct_md_array(values, nulls, 1, dims, lbs, TEXTOID, -1, false, 'i');
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+// Converts composite type to BSON
+//
+// Code of this function is based on row_to_json
+PG_FUNCTION_INFO_V1(row_to_bson);
+Datum
+row_to_bson(PG_FUNCTION_ARGS)
+{
+    PGBSON_LOG << "row_to_bson" << PGBSON_ENDL;
+    Datum record = PG_GETARG_DATUM(0);
+    bson_builder builder;
+
+    composite_to_bson(fcinfo->flinfo, builder.builder(), record);
+
+    Datum result = PointerGetDatum(builder.finish());
+    check_built_bson(result, ERRCODE_CHARACTER_NOT_IN_REPERTOIRE);
+    return result;
+}
+
+// Moves named top-level fields to the front of the object, in the order of names.
+// Lookups of these fields in a large document stored uncompressed then read only a short prefix.
+PG_FUNCTION_INFO_V1(bson_move_fields);
+Datum
+bson_move_fields(PG_FUNCTION_ARGS)
+{
+    bytea* arg = GETARG_BSON(0);
+    mongo::BSONObj object(VARDATA_ANY(arg));
+
+    Datum* names;
+    bool* nulls;
+    int n_names;
+    deconstruct_array(PG_GETARG_ARRAYTYPE_P(1), TEXTOID, -1, false, 'i', &names, &nulls, &n_names);
 
-        if (el.isABSONObj())
+    bson_builder builder(object.objsize());
+    std::vector<const char*> moved;
+    for (int i = 0; i < n_names; i++)
+    {
+        if (nulls[i])
         {
-            objToReturn = el.embeddedObject();
+            ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED), errmsg("field name can not be null")));
         }
-        else
+        mongo::BSONElement e = object.getField(text_to_cstring(DatumGetTextPP(names[i])));
+        if (!e.eoo() && std::find(moved.begin(), moved.end(), e.rawdata()) == moved.end())
+        {
+            builder.builder().append(e);
+            moved.push_back(e.rawdata());
+        }
+    }
+
+    if (moved.empty())
+    {
+        PG_RETURN_BYTEA_P(arg);
+    }
+
+    mongo::BSONObjIterator it(object);
+    while (it.more())
+    {
+        mongo::BSONElement e = it.next();
+        if (std::find(moved.begin(), moved.end(), e.rawdata()) == moved.end())
         {
-            mongo::BSONObjBuilder builder;
-            builder.appendAs(el, "");
-            objToReturn = builder.obj();
+            builder.builder().append(e);
         }
+    }
+
+    PG_RETURN_BYTEA_P(builder.finish());
+}
+
+// bsonx - bson with field directory
+
+PG_FUNCTION_INFO_V1(bsonx_in);
+Datum
+bsonx_in(PG_FUNCTION_ARGS)
+{
+    char* arg = PG_GETARG_CSTRING(0);
+    int length = std::strlen(arg);
+    const char* json = server_to_utf8(arg, &length);
+    Datum result;
+    try
+    {
+        bytea* parsed = json_to_bson(json, length);
+        if (parsed != NULL)
+            return return_bsonx(mongo::BSONObj(VARDATA(parsed)));
+
+        mongo::BSONObj object = mongo::fromjson(json, NULL);
+        result = return_bsonx(object);
+    }
+    catch(...)
+    {
+        ereport(
+            ERROR,
+            (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION), errmsg("invalid input syntax for BSON"))
+        );
+    }
+    check_built_bson(result, ERRCODE_INVALID_TEXT_REPRESENTATION);
+    return result;
+}
 
-        SRF_RETURN_NEXT(funcctx, return_bson(objToReturn));
+PG_FUNCTION_INFO_V1(bsonx_recv);
+Datum
+bsonx_recv(PG_FUNCTION_ARGS)
+{
+    StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
+    int32 size = receive_bson(buf);
+    try
+    {
+        mongo::BSONObj object(buf->data + buf->cursor);
+        buf->cursor += size;
+        return return_bsonx(object);
+    }
+    catch(...)
+    {
+        ereport(
+            ERROR,
+            (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION), errmsg("invalid binary input for BSON"))
+        );
     }
+}
+
+// sends plain bson, without the directory
+PG_FUNCTION_INFO_V1(bsonx_send);
+Datum
+bsonx_send(PG_FUNCTION_ARGS)
+{
+    bytea* arg = GETARG_BSON(0);
+    mongo::BSONObj object(VARDATA_ANY(arg));
+    return return_bson(object);
+}
+
+PG_FUNCTION_INFO_V1(bson_to_bsonx);
+Datum
+bson_to_bsonx(PG_FUNCTION_ARGS)
+{
+    bytea* arg = GETARG_BSON(0);
+    mongo::BSONObj object(VARDATA_ANY(arg));
+    return return_bsonx(object);
+}
+
+PG_FUNCTION_INFO_V1(bsonx_to_bson);
+Datum
+bsonx_to_bson(PG_FUNCTION_ARGS)
+{
+    bytea* arg = GETARG_BSON(0);
+    mongo::BSONObj object(VARDATA_ANY(arg));
+    return return_bson(object);
+}
 
+PG_FUNCTION_INFO_V1(bsonx_get_text);
+Datum
+bsonx_get_text(PG_FUNCTION_ARGS)
+{
+    return bsonx_get<std::string>(fcinfo);
+}
 
+PG_FUNCTION_INFO_V1(bsonx_get_int);
+Datum
+bsonx_get_int(PG_FUNCTION_ARGS)
+{
+    return bsonx_get<int>(fcinfo);
+}
+
+PG_FUNCTION_INFO_V1(bsonx_get_double);
+Datum
+bsonx_get_double(PG_FUNCTION_ARGS)
+{
+    return bsonx_get<double>(fcinfo);
+}
+
+PG_FUNCTION_INFO_V1(bsonx_get_bigint);
+Datum
+bsonx_get_bigint(PG_FUNCTION_ARGS)
+{
+    return bsonx_get<int64>(fcinfo);
+}
+
+PG_FUNCTION_INFO_V1(bsonx_get_bson);
+Datum
+bsonx_get_bson(PG_FUNCTION_ARGS)
+{
+    bytea* arg = GETARG_BSON(0);
+    const compiled_path* path = get_cached_path(fcinfo, 1);
+
+    mongo::BSONElement el = get_field_indexed(VARDATA_ANY(arg), VARSIZE_ANY_EXHDR(arg), path);
+    if (el.eoo())
+    {
+        PG_RETURN_NULL();
+    }
+    else
+    {
+        return element_to_bson(el);
+    }
+}
+
+PG_FUNCTION_INFO_V1(row_to_bsonx);
+Datum
+row_to_bsonx(PG_FUNCTION_ARGS)
+{
+    Datum record = PG_GETARG_DATUM(0);
+    bson_builder builder;
+
+    composite_to_bson(fcinfo->flinfo, builder.builder(), record);
+
+    bytea* document = builder.finish();
+    Datum result = return_bsonx(mongo::BSONObj(VARDATA(document)));
+    check_built_bson(result, ERRCODE_CHARACTER_NOT_IN_REPERTOIRE);
+    return result;
+}
+
+// Conversion to rows, inverse of row_to_bson
+//
+// The first argument gives the row type, and for bson_populate_record values of missing fields.
+// The conversion plan is cached in fn_extra; bson_populate_recordset materializes its result,
+// so fn_extra is not used by the SRF machinery.
+
+static populate_plan* get_populate_plan_arg(PG_FUNCTION_ARGS, HeapTupleHeader base)
+{
+    Oid type = get_fn_expr_argtype(fcinfo->flinfo, 0);
+    int32 typmod = -1;
+    if (type == RECORDOID)
+    {
+        if (base == NULL)
+        {
+            ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                errmsg("first argument must be a row of named composite type, or a non-null record")));
+        }
+        type = HeapTupleHeaderGetTypeId(base);
+        typmod = HeapTupleHeaderGetTypMod(base);
+    }
+    else if (!type_is_rowtype(type))
+    {
+        ereport(ERROR,
+            (errcode(ERRCODE_DATATYPE_MISMATCH),
+            errmsg("first argument must be of composite type")));
+    }
+
+    return get_populate_plan(reinterpret_cast<populate_plan**>(&fcinfo->flinfo->fn_extra),
+        type, typmod, fcinfo->flinfo->fn_mcxt);
+}
+
+PG_FUNCTION_INFO_V1(bson_populate_record);
+Datum
+bson_populate_record(PG_FUNCTION_ARGS)
+{
+    HeapTupleHeader base = PG_ARGISNULL(0) ? NULL : PG_GETARG_HEAPTUPLEHEADER(0);
+    if (PG_ARGISNULL(1))
+    {
+        if (base == NULL)
+            PG_RETURN_NULL();
+        PG_RETURN_DATUM(PG_GETARG_DATUM(0));
+    }
+
+    populate_plan* plan = get_populate_plan_arg(fcinfo, base);
+    bytea* arg = GETARG_BSON(1);
+    try
+    {
+        return HeapTupleGetDatum(populate_row(plan, base, mongo::BSONObj(VARDATA_ANY(arg))));
+    }
+    catch(...)
+    {
+        ereport(
+            ERROR,
+            (errcode(ERRCODE_DATA_CORRUPTED), errmsg("can not convert BSON to row"))
+        );
+    }
+}
+
+PG_FUNCTION_INFO_V1(bson_populate_recordset);
+Datum
+bson_populate_recordset(PG_FUNCTION_ARGS)
+{
+    ReturnSetInfo* rsi = reinterpret_cast<ReturnSetInfo*>(fcinfo->resultinfo);
+    if (rsi == NULL || !IsA(rsi, ReturnSetInfo) || (rsi->allowedModes & SFRM_Materialize) == 0)
+    {
+        ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+            errmsg("set-valued function called in context that cannot accept a set")));
+    }
+
+    HeapTupleHeader base = PG_ARGISNULL(0) ? NULL : PG_GETARG_HEAPTUPLEHEADER(0);
+    populate_plan* plan = get_populate_plan_arg(fcinfo, base);
+
+    MemoryContext oldcontext = MemoryContextSwitchTo(rsi->econtext->ecxt_per_query_memory);
+    Tuplestorestate* store = tuplestore_begin_heap(rsi->allowedModes & SFRM_Materialize_Random, false, work_mem);
+    TupleDesc tupdesc = CreateTupleDescCopy(get_populate_tupdesc(plan));
+    MemoryContextSwitchTo(oldcontext);
+
+    if (!PG_ARGISNULL(1))
+    {
+        ArrayType* documents = PG_GETARG_ARRAYTYPE_P(1);
+        Datum* elements;
+        bool* nulls;
+        int n_elements;
+        deconstruct_array(documents, ARR_ELEMTYPE(documents), -1, false, 'i', &elements, &nulls, &n_elements);
+
+        for (int i = 0; i < n_elements; i++)
+        {
+            if (nulls[i])
+                continue;
+
+            bytea* document = DatumGetBson(elements[i]);
+            HeapTuple tuple = NULL;
+            try
+            {
+                tuple = populate_row(plan, base, mongo::BSONObj(VARDATA_ANY(document)));
+            }
+            catch(...)
+            {
+                ereport(
+                    ERROR,
+                    (errcode(ERRCODE_DATA_CORRUPTED), errmsg("can not convert BSON to row"))
+                );
+            }
+            tuplestore_puttuple(store, tuple);
+            heap_freetuple(tuple);
+        }
+    }
+
+    rsi->returnMode = SFRM_Materialize;
+    rsi->setResult = store;
+    rsi->setDesc = tupdesc;
+    PG_RETURN_NULL();
+}
+
+#if PG_VERSION_NUM >= 90400
+
+// jsonb casts
+
+PG_FUNCTION_INFO_V1(jsonb_to_bson);
+Datum
+jsonb_to_bson(PG_FUNCTION_ARGS)
+{
+    Jsonb* arg = reinterpret_cast<Jsonb*>(PG_DETOAST_DATUM(PG_GETARG_DATUM(0)));
+    Datum result;
+    try
+    {
+        result = PointerGetDatum(bson_from_jsonb(arg));
+    }
+    catch(...)
+    {
+        ereport(
+            ERROR,
+            (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED), errmsg("can not convert jsonb to BSON"))
+        );
+    }
+    // jsonb strings are valid UTF-8, but nesting is not limited
+    check_built_bson(result, ERRCODE_PROGRAM_LIMIT_EXCEEDED);
+    return result;
+}
+
+PG_FUNCTION_INFO_V1(bson_to_jsonb);
+Datum
+bson_to_jsonb(PG_FUNCTION_ARGS)
+{
+    bytea* arg = GETARG_BSON(0);
+    try
+    {
+        PG_RETURN_POINTER(jsonb_from_bson(mongo::BSONObj(VARDATA_ANY(arg))));
+    }
+    catch(...)
+    {
+        ereport(
+            ERROR,
+            (errcode(ERRCODE_DATA_CORRUPTED), errmsg("can not convert BSON to jsonb"))
+        );
+    }
+}
+
+#endif
+
+// logical comparison
+
+static int compare_args(PG_FUNCTION_ARGS)
+{
+    bytea* arg0 = GETARG_BSON(0);
+    bytea* arg1 = GETARG_BSON(1);
+    return compare_objects(VARDATA_ANY(arg0), VARDATA_ANY(arg1));
+}
+
+PG_FUNCTION_INFO_V1(bson_compare);
+Datum
+bson_compare(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_INT32(compare_args(fcinfo));
+}
+
+PG_FUNCTION_INFO_V1(bson_equal);
+Datum
+bson_equal(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_BOOL(compare_args(fcinfo) == 0);
+}
+
+PG_FUNCTION_INFO_V1(bson_not_equal);
+Datum
+bson_not_equal(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_BOOL(compare_args(fcinfo) != 0);
+}
+
+PG_FUNCTION_INFO_V1(bson_lt);
+Datum
+bson_lt(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_BOOL(compare_args(fcinfo) < 0);
+}
+
+PG_FUNCTION_INFO_V1(bson_lte);
+Datum
+bson_lte(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_BOOL(compare_args(fcinfo) <= 0);
+}
+
+PG_FUNCTION_INFO_V1(bson_gt);
+Datum
+bson_gt(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_BOOL(compare_args(fcinfo) > 0);
+}
+
+PG_FUNCTION_INFO_V1(bson_gte);
+Datum
+bson_gte(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_BOOL(compare_args(fcinfo) >= 0);
+}
+
+// sort support
+
+static int bson_fastcmp(Datum x, Datum y, SortSupport ssup)
+{
+    bytea* arg0 = DatumGetBson(x);
+    bytea* arg1 = DatumGetBson(y);
+    int result = compare_objects(VARDATA_ANY(arg0), VARDATA_ANY(arg1));
+
+    if ((Pointer) arg0 != DatumGetPointer(x))
+        pfree(arg0);
+    if ((Pointer) arg1 != DatumGetPointer(y))
+        pfree(arg1);
+
+    return result;
+}
+
+#if PG_VERSION_NUM >= 90500
+
+struct bson_sortsupport_state
+{
+    int64 input_count;
+    bool estimating;
+    hyperLogLogState abbr_card;
+};
+
+static int bson_abbrev_cmp(Datum x, Datum y, SortSupport ssup)
+{
+    if (x > y)
+        return 1;
+    else if (x == y)
+        return 0;
+    else
+        return -1;
+}
+
+static Datum bson_abbrev_convert(Datum original, SortSupport ssup)
+{
+    bson_sortsupport_state* state = reinterpret_cast<bson_sortsupport_state*>(ssup->ssup_extra);
+    bytea* arg = DatumGetBson(original);
+
+    Datum key = abbreviate_bson(mongo::BSONObj(VARDATA_ANY(arg)));
+
+    state->input_count++;
+    if (state->estimating)
+    {
+        uint32 h = DatumGetUInt32(hash_any(reinterpret_cast<unsigned char*>(&key), sizeof(key)));
+        addHyperLogLog(&state->abbr_card, h);
+    }
+
+    if ((Pointer) arg != DatumGetPointer(original))
+        pfree(arg);
+
+    return key;
+}
+
+// abbreviation is abandoned when keys turn out not to be distinct enough,
+// with the same heuristic as for uuid
+static bool bson_abbrev_abort(int memtupcount, SortSupport ssup)
+{
+    bson_sortsupport_state* state = reinterpret_cast<bson_sortsupport_state*>(ssup->ssup_extra);
+
+    if (memtupcount < 10000 || state->input_count < 10000 || !state->estimating)
+        return false;
+
+    double abbr_card = estimateHyperLogLog(&state->abbr_card);
+
+    // enough distinct keys seen to trust the abbreviation for the rest of the sort
+    if (abbr_card > 100000.0)
+    {
+        state->estimating = false;
+        return false;
+    }
+
+    if (abbr_card < state->input_count / 2000.0 + 0.5)
+    {
+        PGBSON_LOG << "bson_abbrev_abort: aborting abbreviation, cardinality " << abbr_card << PGBSON_ENDL;
+        return true;
+    }
+
+    return false;
+}
+
+#endif
+
+PG_FUNCTION_INFO_V1(bson_sortsupport);
+Datum
+bson_sortsupport(PG_FUNCTION_ARGS)
+{
+    SortSupport ssup = (SortSupport) PG_GETARG_POINTER(0);
+
+    ssup->comparator = bson_fastcmp;
+
+#if PG_VERSION_NUM >= 90500
+    if (ssup->abbreviate)
+    {
+        MemoryContext oldcontext = MemoryContextSwitchTo(ssup->ssup_cxt);
+
+        bson_sortsupport_state* state = reinterpret_cast<bson_sortsupport_state*>(palloc(sizeof(bson_sortsupport_state)));
+        state->input_count = 0;
+        state->estimating = true;
+        initHyperLogLog(&state->abbr_card, 10);
+
+        ssup->ssup_extra = state;
+        ssup->comparator = bson_abbrev_cmp;
+        ssup->abbrev_converter = bson_abbrev_convert;
+        ssup->abbrev_abort = bson_abbrev_abort;
+        ssup->abbrev_full_comparator = bson_fastcmp;
+
+        MemoryContextSwitchTo(oldcontext);
+    }
+#endif
+
+    PG_RETURN_VOID();
+}
+
+// binary equality
+PG_FUNCTION_INFO_V1(bson_binary_equal);
+Datum
+bson_binary_equal(PG_FUNCTION_ARGS)
+{
+    bytea* arg0 = GETARG_BSON(0);
+    bytea* arg1 = GETARG_BSON(1);
+    mongo::BSONObj object0(VARDATA_ANY(arg0));
+    mongo::BSONObj object1(VARDATA_ANY(arg1));
+
+    PG_RETURN_BOOL(object0.binaryEqual(object1));
+}
+
+PG_FUNCTION_INFO_V1(bson_binary_not_equal);
+Datum
+bson_binary_not_equal(PG_FUNCTION_ARGS)
+{
+    bytea* arg0 = GETARG_BSON(0);
+    bytea* arg1 = GETARG_BSON(1);
+    mongo::BSONObj object0(VARDATA_ANY(arg0));
+    mongo::BSONObj object1(VARDATA_ANY(arg1));
+
+    PG_RETURN_BOOL(!object0.binaryEqual(object1));
+}
+
+// hash of binary representation, used by bson_hash_ops (for ==); it must not change,
+// existing hash indexes hold its values
+PG_FUNCTION_INFO_V1(bson_hash);
+Datum
+bson_hash(PG_FUNCTION_ARGS)
+{
+    bytea* arg0 = GETARG_BSON(0);
+    mongo::BSONObj object0(VARDATA_ANY(arg0));
+
+    PG_RETURN_INT32(object0.hash());
+}
+
+// hash, consistent with logical equality
+PG_FUNCTION_INFO_V1(bson_hash_logical);
+Datum
+bson_hash_logical(PG_FUNCTION_ARGS)
+{
+    bytea* arg0 = GETARG_BSON(0);
+    mongo::BSONObj object0(VARDATA_ANY(arg0));
+
+    PG_RETURN_INT32(static_cast<int32>(bson_logical_hash(object0, 0)));
+}
+
+PG_FUNCTION_INFO_V1(bson_hash_logical_extended);
+Datum
+bson_hash_logical_extended(PG_FUNCTION_ARGS)
+{
+    bytea* arg0 = GETARG_BSON(0);
+    mongo::BSONObj object0(VARDATA_ANY(arg0));
+
+    PG_RETURN_INT64(static_cast<int64>(bson_logical_hash(object0, PG_GETARG_INT64(1))));
+}
+
+// MurmurHash3 of binary representation
+PG_FUNCTION_INFO_V1(bson_binary_hash);
+Datum
+bson_binary_hash(PG_FUNCTION_ARGS)
+{
+    bytea* arg0 = GETARG_BSON(0);
+    mongo::BSONObj object0(VARDATA_ANY(arg0));
+
+    PG_RETURN_INT32(static_cast<int32>(bson_raw_hash(object0, 0)));
+}
+
+PG_FUNCTION_INFO_V1(bson_binary_hash_extended);
+Datum
+bson_binary_hash_extended(PG_FUNCTION_ARGS)
+{
+    bytea* arg0 = GETARG_BSON(0);
+    mongo::BSONObj object0(VARDATA_ANY(arg0));
+
+    PG_RETURN_INT64(static_cast<int64>(bson_raw_hash(object0, PG_GETARG_INT64(1))));
+}
+
+// Array operations
+
+PG_FUNCTION_INFO_V1(bson_array_size);
+Datum
+bson_array_size(PG_FUNCTION_ARGS)
+{
+    const compiled_path* path = get_cached_path(fcinfo, 1);
+
+    mongo::BSONElement el = get_field_detoast(PG_GETARG_DATUM(0), path);
+    if (el.eoo())
+    {
+        PG_RETURN_NULL();
+    }
+    else if (el.type() == mongo::Array)
+    {
+        PG_RETURN_INT32(count_fields(el.embeddedObject()));
+    }
+    else
+    {
+        // scalar (or non-array object)
+        PG_RETURN_INT32(1);
+    }
+}
+
+// element of unwound array as bson value, scalars are wrapped in a document with empty field name
+static Datum unwind_element(const mongo::BSONElement& el)
+{
+    if (el.isABSONObj())
+    {
+        return return_bson(el.embeddedObject());
+    }
+    else
+    {
+        bson_builder builder(el.size() + 8);
+        builder.builder().appendAs(el, "");
+        return PointerGetDatum(builder.finish());
+    }
+}
+
+// first element to return: the first array element, or the field itself if it's not an array
+// sets *single if only one element is to be returned, returns NULL if there is nothing to return
+static const char* unwind_start(const mongo::BSONElement& el, bool* single)
+{
+    *single = false;
+    if (el.eoo())
+    {
+        return NULL;
+    }
+    else if (el.type() == mongo::Array)
+    {
+        const char* first = el.embeddedObject().objdata() + 4;
+        return *first == mongo::EOO ? NULL : first;
+    }
+    else
+    {
+        *single = true;
+        return el.rawdata();
+    }
+}
+
+// Materialize mode: all elements go to a tuplestore in one call.
+// Each element's value is freed once stored, so memory doesn't grow with array length.
+static void unwind_materialize(ReturnSetInfo* rsi, const char* next, bool single)
+{
+    MemoryContext oldcontext = MemoryContextSwitchTo(rsi->econtext->ecxt_per_query_memory);
+    Tuplestorestate* store = tuplestore_begin_heap(rsi->allowedModes & SFRM_Materialize_Random, false, work_mem);
+    TupleDesc tupdesc = CreateTupleDescCopy(rsi->expectedDesc);
+    MemoryContextSwitchTo(oldcontext);
+
+    while (next != NULL)
+    {
+        mongo::BSONElement el(next);
+        next = single ? NULL : next + element_size(next);
+        if (next != NULL && *next == mongo::EOO)
+            next = NULL;
+
+        Datum value = unwind_element(el);
+        bool isnull = false;
+        tuplestore_putvalues(store, tupdesc, &value, &isnull);
+        pfree(DatumGetPointer(value));
+    }
+
+    rsi->returnMode = SFRM_Materialize;
+    rsi->setResult = store;
+    rsi->setDesc = tupdesc;
+}
+
+PG_FUNCTION_INFO_V1(bson_unwind_array);
+Datum
+bson_unwind_array(PG_FUNCTION_ARGS)
+{
+    FuncCallContext  *funcctx;
+
+    // position in the array: elements are read in place from the argument,
+    // which stays valid for all calls (detoasted copy is in multi_call_memory_ctx)
+    struct FunctionContext
+    {
+        const char* next; // next element to return, NULL at the end
+        bool single; // field is not an array, return it once
+    };
+
+    // FROM clause: materialize in one call, skipping per-row call overhead
+    ReturnSetInfo* rsi = reinterpret_cast<ReturnSetInfo*>(fcinfo->resultinfo);
+    if (rsi != NULL && IsA(rsi, ReturnSetInfo) && (rsi->allowedModes & SFRM_Materialize) != 0
+        && rsi->expectedDesc != NULL)
+    {
+        bytea* arg = GETARG_BSON(0);
+        const compiled_path* path = get_cached_path(fcinfo, 1);
+
+        bool single;
+        const char* first = unwind_start(get_field(mongo::BSONObj(VARDATA_ANY(arg)), path), &single);
+        unwind_materialize(rsi, first, single);
+        PG_RETURN_NULL();
+    }
+
+    if (SRF_IS_FIRSTCALL())
+    {
+        funcctx = SRF_FIRSTCALL_INIT();
+        MemoryContext oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        bytea* arg = GETARG_BSON(0);
+
+        // fn_extra is used by the SRF machinery, compile the path locally
+        text* arg2 = PG_GETARG_TEXT_P(1);
+        compiled_path* path = compile_text_path(arg2, CurrentMemoryContext);
+
+        FunctionContext* context = reinterpret_cast<FunctionContext*>(palloc0(sizeof(FunctionContext)));
+        context->next = unwind_start(get_field(mongo::BSONObj(VARDATA_ANY(arg)), path), &context->single);
+        funcctx->user_fctx = context;
+
+        MemoryContextSwitchTo(oldcontext);
+    }
+
+    funcctx = SRF_PERCALL_SETUP();
+
+    FunctionContext* context = reinterpret_cast<FunctionContext*>(funcctx->user_fctx);
+
+    if (context->next == NULL)
+    {
+        SRF_RETURN_DONE(funcctx);
+    }
+    else
+    {
+        mongo::BSONElement el(context->next);
+        context->next = context->single ? NULL : context->next + element_size(context->next);
+        if (context->next != NULL && *context->next == mongo::EOO)
+            context->next = NULL;
+
+        SRF_RETURN_NEXT(funcctx, unwind_element(el));
+    }
+}
+
+// nested arrays with fields of the elements, see pgbson_populate.hpp
+PG_FUNCTION_INFO_V1(bson_unwind);
+Datum
+bson_unwind(PG_FUNCTION_ARGS)
+{
+    ReturnSetInfo* rsi = reinterpret_cast<ReturnSetInfo*>(fcinfo->resultinfo);
+    if (rsi == NULL || !IsA(rsi, ReturnSetInfo) || (rsi->allowedModes & SFRM_Materialize) == 0
+        || rsi->expectedDesc == NULL)
+    {
+        ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+            errmsg("bson_unwind must be called in FROM clause, with a column definition list")));
+    }
+
+    bytea* arg = GETARG_BSON(0);
+    ArrayType* array_paths = PG_GETARG_ARRAYTYPE_P(1);
+    ArrayType* field_paths = PG_GETARG_ARRAYTYPE_P(2);
+
+    // the result is materialized, so fn_extra is free for the plan
+    unwind_plan* plan = get_unwind_plan(reinterpret_cast<unwind_plan**>(&fcinfo->flinfo->fn_extra),
+        array_paths, field_paths, rsi->expectedDesc, fcinfo->flinfo->fn_mcxt);
+
+    MemoryContext oldcontext = MemoryContextSwitchTo(rsi->econtext->ecxt_per_query_memory);
+    Tuplestorestate* store = tuplestore_begin_heap(rsi->allowedModes & SFRM_Materialize_Random, false, work_mem);
+    TupleDesc tupdesc = CreateTupleDescCopy(get_unwind_tupdesc(plan));
+    MemoryContextSwitchTo(oldcontext);
+
+    try
+    {
+        unwind_document(plan, mongo::BSONObj(VARDATA_ANY(arg)), store);
+    }
+    catch(...)
+    {
+        ereport(
+            ERROR,
+            (errcode(ERRCODE_DATA_CORRUPTED), errmsg("can not unwind BSON"))
+        );
+    }
+
+    rsi->returnMode = SFRM_Materialize;
+    rsi->setResult = store;
+    rsi->setDesc = tupdesc;
+    PG_RETURN_NULL();
+}
+
+// Index keys, see pgbson_key.hpp
+
+PG_FUNCTION_INFO_V1(bson_index_key);
+Datum
+bson_index_key(PG_FUNCTION_ARGS)
+{
+    bytea* arg = GETARG_BSON(0);
+    bytea* pattern_arg = GETARG_BSON(1);
+    key_pattern* pattern = get_key_pattern(reinterpret_cast<key_pattern**>(&fcinfo->flinfo->fn_extra),
+        mongo::BSONObj(VARDATA_ANY(pattern_arg)), fcinfo->flinfo->fn_mcxt);
+    try
+    {
+        PG_RETURN_BYTEA_P(build_index_key(pattern, mongo::BSONObj(VARDATA_ANY(arg))));
+    }
+    catch(...)
+    {
+        ereport(
+            ERROR,
+            (errcode(ERRCODE_DATA_CORRUPTED), errmsg("can not build index key"))
+        );
+    }
+}
+
+// bsonkey text and binary representation is that of bytea
+PG_FUNCTION_INFO_V1(bsonkey_in);
+Datum
+bsonkey_in(PG_FUNCTION_ARGS)
+{
+    return DirectFunctionCall1(byteain, PG_GETARG_DATUM(0));
+}
+
+PG_FUNCTION_INFO_V1(bsonkey_out);
+Datum
+bsonkey_out(PG_FUNCTION_ARGS)
+{
+    return DirectFunctionCall1(byteaout, PG_GETARG_DATUM(0));
+}
+
+PG_FUNCTION_INFO_V1(bsonkey_recv);
+Datum
+bsonkey_recv(PG_FUNCTION_ARGS)
+{
+    return DirectFunctionCall1(bytearecv, PG_GETARG_DATUM(0));
+}
+
+PG_FUNCTION_INFO_V1(bsonkey_send);
+Datum
+bsonkey_send(PG_FUNCTION_ARGS)
+{
+    return DirectFunctionCall1(byteasend, PG_GETARG_DATUM(0));
+}
+
+// keys compare bytewise, a key sorts before its extensions
+static int compare_keys(bytea* x, bytea* y)
+{
+    int length0 = VARSIZE_ANY_EXHDR(x);
+    int length1 = VARSIZE_ANY_EXHDR(y);
+    int result = std::memcmp(VARDATA_ANY(x), VARDATA_ANY(y), std::min(length0, length1));
+    if (result != 0)
+        return result;
+    return length0 - length1;
+}
+
+static int compare_key_args(PG_FUNCTION_ARGS)
+{
+    return compare_keys(PG_GETARG_BYTEA_PP(0), PG_GETARG_BYTEA_PP(1));
+}
+
+PG_FUNCTION_INFO_V1(bsonkey_compare);
+Datum
+bsonkey_compare(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_INT32(compare_key_args(fcinfo));
+}
+
+PG_FUNCTION_INFO_V1(bsonkey_equal);
+Datum
+bsonkey_equal(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_BOOL(compare_key_args(fcinfo) == 0);
+}
+
+PG_FUNCTION_INFO_V1(bsonkey_not_equal);
+Datum
+bsonkey_not_equal(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_BOOL(compare_key_args(fcinfo) != 0);
+}
+
+PG_FUNCTION_INFO_V1(bsonkey_lt);
+Datum
+bsonkey_lt(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_BOOL(compare_key_args(fcinfo) < 0);
+}
+
+PG_FUNCTION_INFO_V1(bsonkey_lte);
+Datum
+bsonkey_lte(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_BOOL(compare_key_args(fcinfo) <= 0);
+}
+
+PG_FUNCTION_INFO_V1(bsonkey_gt);
+Datum
+bsonkey_gt(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_BOOL(compare_key_args(fcinfo) > 0);
+}
+
+PG_FUNCTION_INFO_V1(bsonkey_gte);
+Datum
+bsonkey_gte(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_BOOL(compare_key_args(fcinfo) >= 0);
+}
+
+static int bsonkey_fastcmp(Datum x, Datum y, SortSupport ssup)
+{
+    bytea* arg0 = DatumGetByteaPP(x);
+    bytea* arg1 = DatumGetByteaPP(y);
+    int result = compare_keys(arg0, arg1);
+
+    if ((Pointer) arg0 != DatumGetPointer(x))
+        pfree(arg0);
+    if ((Pointer) arg1 != DatumGetPointer(y))
+        pfree(arg1);
+
+    return result;
+}
+
+#if PG_VERSION_NUM >= 90500
+
+// the first bytes of the key, big-endian, zero padded (so that a key sorts before its extensions)
+static Datum bsonkey_abbrev_convert(Datum original, SortSupport ssup)
+{
+    bson_sortsupport_state* state = reinterpret_cast<bson_sortsupport_state*>(ssup->ssup_extra);
+    bytea* arg = DatumGetByteaPP(original);
+
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(VARDATA_ANY(arg));
+    int length = VARSIZE_ANY_EXHDR(arg);
+    Datum key = 0;
+    for (int i = 0; i < SIZEOF_DATUM; i++)
+        key = (key << 8) | (i < length ? data[i] : 0);
+
+    state->input_count++;
+    if (state->estimating)
+    {
+        uint32 h = DatumGetUInt32(hash_any(reinterpret_cast<unsigned char*>(&key), sizeof(key)));
+        addHyperLogLog(&state->abbr_card, h);
+    }
+
+    if ((Pointer) arg != DatumGetPointer(original))
+        pfree(arg);
+
+    return key;
+}
+
+#endif
+
+PG_FUNCTION_INFO_V1(bsonkey_sortsupport);
+Datum
+bsonkey_sortsupport(PG_FUNCTION_ARGS)
+{
+    SortSupport ssup = (SortSupport) PG_GETARG_POINTER(0);
+
+    ssup->comparator = bsonkey_fastcmp;
+
+#if PG_VERSION_NUM >= 90500
+    if (ssup->abbreviate)
+    {
+        MemoryContext oldcontext = MemoryContextSwitchTo(ssup->ssup_cxt);
+
+        bson_sortsupport_state* state = reinterpret_cast<bson_sortsupport_state*>(palloc(sizeof(bson_sortsupport_state)));
+        state->input_count = 0;
+        state->estimating = true;
+        initHyperLogLog(&state->abbr_card, 10);
+
+        ssup->ssup_extra = state;
+        ssup->comparator = bson_abbrev_cmp;
+        ssup->abbrev_converter = bsonkey_abbrev_convert;
+        ssup->abbrev_abort = bson_abbrev_abort;
+        ssup->abbrev_full_comparator = bsonkey_fastcmp;
+
+        MemoryContextSwitchTo(oldcontext);
+    }
+#endif
+
+    PG_RETURN_VOID();
+}
+
+// Statistics
+
+PG_FUNCTION_INFO_V1(bson_typanalyze);
+Datum
+bson_typanalyze(PG_FUNCTION_ARGS)
+{
+    VacAttrStats* stats = reinterpret_cast<VacAttrStats*>(PG_GETARG_POINTER(0));
+
+    PG_RETURN_BOOL(setup_bson_analyze(stats));
+}
+
+PG_FUNCTION_INFO_V1(bson_exists);
+Datum
+bson_exists(PG_FUNCTION_ARGS)
+{
+    const compiled_path* path = get_cached_path(fcinfo, 1);
+
+    mongo::BSONElement e = get_field_detoast(PG_GETARG_DATUM(0), path);
+    PG_RETURN_BOOL(!e.eoo());
+}
+
+// restriction selectivity of ?
+PG_FUNCTION_INFO_V1(bson_exists_sel);
+Datum
+bson_exists_sel(PG_FUNCTION_ARGS)
+{
+    PlannerInfo* root = reinterpret_cast<PlannerInfo*>(PG_GETARG_POINTER(0));
+    List* args = reinterpret_cast<List*>(PG_GETARG_POINTER(2));
+    int varRelid = PG_GETARG_INT32(3);
+
+    PG_RETURN_FLOAT8(exists_selectivity(root, args, varRelid));
+}
+
+// restriction selectivity of ?|
+PG_FUNCTION_INFO_V1(bson_exists_any_sel);
+Datum
+bson_exists_any_sel(PG_FUNCTION_ARGS)
+{
+    PlannerInfo* root = reinterpret_cast<PlannerInfo*>(PG_GETARG_POINTER(0));
+    List* args = reinterpret_cast<List*>(PG_GETARG_POINTER(2));
+    int varRelid = PG_GETARG_INT32(3);
+
+    PG_RETURN_FLOAT8(exists_many_selectivity(root, args, varRelid, false));
+}
+
+// restriction selectivity of ?&
+PG_FUNCTION_INFO_V1(bson_exists_all_sel);
+Datum
+bson_exists_all_sel(PG_FUNCTION_ARGS)
+{
+    PlannerInfo* root = reinterpret_cast<PlannerInfo*>(PG_GETARG_POINTER(0));
+    List* args = reinterpret_cast<List*>(PG_GETARG_POINTER(2));
+    int varRelid = PG_GETARG_INT32(3);
+
+    PG_RETURN_FLOAT8(exists_many_selectivity(root, args, varRelid, true));
+}
+
+// restriction selectivity of @>
+PG_FUNCTION_INFO_V1(bson_contains_sel);
+Datum
+bson_contains_sel(PG_FUNCTION_ARGS)
+{
+    PlannerInfo* root = reinterpret_cast<PlannerInfo*>(PG_GETARG_POINTER(0));
+    List* args = reinterpret_cast<List*>(PG_GETARG_POINTER(2));
+    int varRelid = PG_GETARG_INT32(3);
+
+    PG_RETURN_FLOAT8(contains_selectivity(root, args, varRelid));
+}
+
+// per-path statistics of a column, collected by ANALYZE
+PG_FUNCTION_INFO_V1(bson_path_stats);
+Datum
+bson_path_stats(PG_FUNCTION_ARGS)
+{
+    FuncCallContext  *funcctx;
+
+    struct FunctionContext
+    {
+        Datum* paths;
+        std::size_t n_paths;
+    };
+
+    if (SRF_IS_FIRSTCALL())
+    {
+        funcctx = SRF_FIRSTCALL_INIT();
+
+        Oid relid = PG_GETARG_OID(0);
+        text* column = PG_GETARG_TEXT_PP(1);
+        std::string column_name(VARDATA_ANY(column), VARSIZE_ANY_EXHDR(column));
+
+        AttrNumber attnum = get_attnum(relid, column_name.c_str());
+        if (attnum == InvalidAttrNumber)
+        {
+            ereport(
+                ERROR,
+                (errcode(ERRCODE_UNDEFINED_COLUMN), errmsg("column \"%s\" does not exist", column_name.c_str()))
+            );
+        }
+        // column privileges are checked only if there is no table privilege, as in has_column_privilege
+        if (pg_class_aclcheck(relid, GetUserId(), ACL_SELECT) != ACLCHECK_OK
+            && pg_attribute_aclcheck(relid, attnum, GetUserId(), ACL_SELECT) != ACLCHECK_OK)
+        {
+            ereport(
+                ERROR,
+                (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE), errmsg("permission denied for column \"%s\"", column_name.c_str()))
+            );
+        }
+
+        Oid atttype;
+        int32 atttypmod;
+        Oid attcollation;
+        get_atttypetypmodcoll(relid, attnum, &atttype, &atttypmod, &attcollation);
+
+        MemoryContext oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        FunctionContext* context = reinterpret_cast<FunctionContext*>(palloc0(sizeof(FunctionContext)));
+        funcctx->user_fctx = context;
+
+        HeapTuple tuple = SearchSysCache3(STATRELATTINH,
+            ObjectIdGetDatum(relid), Int16GetDatum(attnum), BoolGetDatum(false));
+        if (HeapTupleIsValid(tuple))
+        {
+            path_statistics statistics(tuple, atttype, atttypmod);
+            const std::vector<mongo::BSONObj>& paths = statistics.paths();
+
+            context->n_paths = paths.size();
+            context->paths = reinterpret_cast<Datum*>(palloc(sizeof(Datum) * (paths.size() + 1)));
+            for (std::size_t i = 0; i < paths.size(); i++)
+            {
+                context->paths[i] = return_bson(paths[i]);
+            }
+
+            ReleaseSysCache(tuple);
+        }
+
+        MemoryContextSwitchTo(oldcontext);
+    }
+
+    funcctx = SRF_PERCALL_SETUP();
+
+    FunctionContext* context = reinterpret_cast<FunctionContext*>(funcctx->user_fctx);
+
+    if (funcctx->call_cntr == context->n_paths)
+    {
+        SRF_RETURN_DONE(funcctx);
+    }
+    else
+    {
+        // SRF_RETURN_NEXT increments call_cntr before evaluating the result
+        Datum path = context->paths[funcctx->call_cntr];
+        SRF_RETURN_NEXT(funcctx, path);
+    }
+}
+
+// Containment and GIN index support
+
+PG_FUNCTION_INFO_V1(bson_contains);
+Datum
+bson_contains(PG_FUNCTION_ARGS)
+{
+    bytea* arg0 = GETARG_BSON(0);
+    bytea* arg1 = GETARG_BSON(1);
+
+    PG_RETURN_BOOL(bson_object_contains(mongo::BSONObj(VARDATA_ANY(arg0)), mongo::BSONObj(VARDATA_ANY(arg1))));
+}
+
+PG_FUNCTION_INFO_V1(bson_contained);
+Datum
+bson_contained(PG_FUNCTION_ARGS)
+{
+    bytea* arg0 = GETARG_BSON(0);
+    bytea* arg1 = GETARG_BSON(1);
+
+    PG_RETURN_BOOL(bson_object_contains(mongo::BSONObj(VARDATA_ANY(arg1)), mongo::BSONObj(VARDATA_ANY(arg0))));
+}
+
+// number of paths from text[] argument found in the object, nulls are skipped
+static int count_existing_paths(PG_FUNCTION_ARGS, int* n_paths)
+{
+    bytea* arg = GETARG_BSON(0);
+    mongo::BSONObj object(VARDATA_ANY(arg));
+
+    Datum* paths;
+    bool* nulls;
+    int n;
+    deconstruct_array(PG_GETARG_ARRAYTYPE_P(1), TEXTOID, -1, false, 'i', &paths, &nulls, &n);
+
+    int found = 0;
+    *n_paths = 0;
+    for (int i = 0; i < n; i++)
+    {
+        if (nulls[i])
+            continue;
+
+        text* path_text = DatumGetTextPP(paths[i]);
+        compiled_path* path = compile_text_path(path_text, CurrentMemoryContext);
+        if (!get_field(object, path).eoo())
+            found++;
+        (*n_paths)++;
+        pfree(path);
+    }
+    return found;
+}
+
+PG_FUNCTION_INFO_V1(bson_exists_any);
+Datum
+bson_exists_any(PG_FUNCTION_ARGS)
+{
+    int n_paths;
+    PG_RETURN_BOOL(count_existing_paths(fcinfo, &n_paths) > 0);
+}
+
+PG_FUNCTION_INFO_V1(bson_exists_all);
+Datum
+bson_exists_all(PG_FUNCTION_ARGS)
+{
+    int n_paths;
+    PG_RETURN_BOOL(count_existing_paths(fcinfo, &n_paths) == n_paths);
+}
+
+static Datum* return_entries(const std::vector<int32>& entries, int32* nentries)
+{
+    *nentries = entries.size();
+    if (entries.empty())
+        return NULL;
+
+    Datum* result = reinterpret_cast<Datum*>(palloc(sizeof(Datum) * entries.size()));
+    for (std::size_t i = 0; i < entries.size(); i++)
+    {
+        result[i] = Int32GetDatum(entries[i]);
+    }
+    return result;
+}
+
+static Datum gin_extract_value_common(PG_FUNCTION_ARGS, bool with_values)
+{
+    bytea* arg = GETARG_BSON(0);
+    int32* nentries = reinterpret_cast<int32*>(PG_GETARG_POINTER(1));
+
+    std::vector<int32> entries;
+    gin_extract_value(mongo::BSONObj(VARDATA_ANY(arg)), with_values, entries);
+
+    PG_RETURN_POINTER(return_entries(entries, nentries));
+}
+
+static Datum gin_extract_query_common(PG_FUNCTION_ARGS, bool with_values)
+{
+    int32* nentries = reinterpret_cast<int32*>(PG_GETARG_POINTER(1));
+    StrategyNumber strategy = PG_GETARG_UINT16(2);
+    int32* searchMode = reinterpret_cast<int32*>(PG_GETARG_POINTER(6));
+
+    std::vector<int32> entries;
+    bool search_all = false;
+
+    if (strategy == gin_contains_strategy)
+    {
+        bytea* query = GETARG_BSON(0);
+        gin_extract_contains_query(mongo::BSONObj(VARDATA_ANY(query)), with_values, entries);
+        search_all = entries.empty();
+    }
+    else if (strategy == gin_exists_strategy)
+    {
+        text* path = PG_GETARG_TEXT_PP(0);
+        int32 entry;
+        if (gin_extract_path(VARDATA_ANY(path), VARSIZE_ANY_EXHDR(path), entry))
+            entries.push_back(entry);
+        else
+            search_all = true;
+    }
+    else if (strategy == gin_exists_any_strategy || strategy == gin_exists_all_strategy)
+    {
+        Datum* paths;
+        bool* nulls;
+        int n_paths;
+        deconstruct_array(PG_GETARG_ARRAYTYPE_P(0), TEXTOID, -1, false, 'i', &paths, &nulls, &n_paths);
+
+        bool unindexed = false;
+        for (int i = 0; i < n_paths; i++)
+        {
+            if (nulls[i])
+                continue;
+
+            text* path = DatumGetTextPP(paths[i]);
+            int32 entry;
+            if (gin_extract_path(VARDATA_ANY(path), VARSIZE_ANY_EXHDR(path), entry))
+                entries.push_back(entry);
+            else
+                unindexed = true;
+        }
+
+        if (strategy == gin_exists_any_strategy && unindexed)
+        {
+            // any document may match
+            entries.clear();
+            search_all = true;
+        }
+        else if (strategy == gin_exists_all_strategy && entries.empty())
+        {
+            search_all = true;
+        }
+        // no entries for ?| means nothing matches
+    }
+    else
+    {
+        elog(ERROR, "unrecognized strategy number: %d", strategy);
+    }
+
+    if (search_all)
+        *searchMode = GIN_SEARCH_MODE_ALL;
+
+    PG_RETURN_POINTER(return_entries(entries, nentries));
+}
+
+PG_FUNCTION_INFO_V1(bson_gin_extract_value);
+Datum
+bson_gin_extract_value(PG_FUNCTION_ARGS)
+{
+    return gin_extract_value_common(fcinfo, true);
+}
+
+PG_FUNCTION_INFO_V1(bson_gin_extract_query);
+Datum
+bson_gin_extract_query(PG_FUNCTION_ARGS)
+{
+    return gin_extract_query_common(fcinfo, true);
+}
+
+PG_FUNCTION_INFO_V1(bson_gin_path_extract_value);
+Datum
+bson_gin_path_extract_value(PG_FUNCTION_ARGS)
+{
+    return gin_extract_value_common(fcinfo, false);
+}
+
+PG_FUNCTION_INFO_V1(bson_gin_path_extract_query);
+Datum
+bson_gin_path_extract_query(PG_FUNCTION_ARGS)
+{
+    return gin_extract_query_common(fcinfo, false);
+}
+
+PG_FUNCTION_INFO_V1(bson_gin_consistent);
+Datum
+bson_gin_consistent(PG_FUNCTION_ARGS)
+{
+    bool* check = reinterpret_cast<bool*>(PG_GETARG_POINTER(0));
+    StrategyNumber strategy = PG_GETARG_UINT16(1);
+    int32 nkeys = PG_GETARG_INT32(3);
+    bool* recheck = reinterpret_cast<bool*>(PG_GETARG_POINTER(5));
+
+    // entries are hashes
+    *recheck = true;
+
+    if (strategy == gin_exists_any_strategy && nkeys > 0)
+    {
+        for (int32 i = 0; i < nkeys; i++)
+        {
+            if (check[i])
+                PG_RETURN_BOOL(true);
+        }
+        PG_RETURN_BOOL(false);
+    }
+    else
+    {
+        for (int32 i = 0; i < nkeys; i++)
+        {
+            if (!check[i])
+                PG_RETURN_BOOL(false);
+        }
+        PG_RETURN_BOOL(true);
+    }
+}
+
+// MongoDB queries
+
+PG_FUNCTION_INFO_V1(bson_match);
+Datum
+bson_match(PG_FUNCTION_ARGS)
+{
+    try
+    {
+        const match_node* matcher = get_cached_matcher(fcinfo, 1);
+
+        bytea* arg = GETARG_BSON(0);
+        PG_RETURN_BOOL(matcher->matches(mongo::BSONObj(VARDATA_ANY(arg))));
+    }
+    catch(const query_error& e)
+    {
+        ereport(
+            ERROR,
+            (errcode(ERRCODE_INVALID_PARAMETER_VALUE), errmsg("invalid query: %s", e.message.c_str()))
+        );
+    }
+    catch(const std::exception& e)
+    {
+        ereport(
+            ERROR,
+            (errcode(ERRCODE_INTERNAL_ERROR), errmsg("can not match query: %s", e.what()))
+        );
+    }
+    PG_RETURN_NULL(); // never reached
+}
+
+// restriction selectivity of @@
+PG_FUNCTION_INFO_V1(bson_match_sel);
+Datum
+bson_match_sel(PG_FUNCTION_ARGS)
+{
+    PlannerInfo* root = reinterpret_cast<PlannerInfo*>(PG_GETARG_POINTER(0));
+    List* args = reinterpret_cast<List*>(PG_GETARG_POINTER(2));
+    int varRelid = PG_GETARG_INT32(3);
+
+    PG_RETURN_FLOAT8(match_selectivity(root, args, varRelid));
+}
+
+// Planner support
+
+PG_FUNCTION_INFO_V1(bson_getter_support);
+Datum
+bson_getter_support(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 120000
+    PG_RETURN_POINTER(getter_support(reinterpret_cast<Node*>(PG_GETARG_POINTER(0))));
+#else
+    PG_RETURN_POINTER(NULL);
+#endif
+}
+
+PG_FUNCTION_INFO_V1(bson_exists_support);
+Datum
+bson_exists_support(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 120000
+    PG_RETURN_POINTER(exists_support(reinterpret_cast<Node*>(PG_GETARG_POINTER(0))));
+#else
+    PG_RETURN_POINTER(NULL);
+#endif
+}
+
+PG_FUNCTION_INFO_V1(bson_unwind_support);
+Datum
+bson_unwind_support(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 120000
+    PG_RETURN_POINTER(unwind_support(reinterpret_cast<Node*>(PG_GETARG_POINTER(0))));
+#else
+    PG_RETURN_POINTER(NULL);
+#endif
 }
 
 } // extern C
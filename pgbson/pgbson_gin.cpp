@@ -0,0 +1,217 @@
+// Copyright (c) 2012-2013 Maciej Gajewski <maciej.gajewski0@gmail.com>
+// 
+// Permission to use, copy, modify, and distribute this software and its documentation for any purpose, without fee, and without a written agreement is hereby granted,
+// provided that the above copyright notice and this paragraph and the following two paragraphs appear in all copies.
+// 
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, 
+// ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+// THE AUTHOR SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+// THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE AUTHOR HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+
+#include "pgbson_gin.hpp"
+#include "pgbson_hash.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+namespace {
+
+bool element_contains(const mongo::BSONElement& a, const mongo::BSONElement& b);
+
+bool object_contains(const mongo::BSONObj& a, const mongo::BSONObj& b)
+{
+    mongo::BSONObjIterator it(b);
+    while (it.more())
+    {
+        mongo::BSONElement be = it.next();
+        mongo::BSONElement ae = a.getField(be.fieldName());
+        if (ae.eoo() || !element_contains(ae, be))
+            return false;
+    }
+    return true;
+}
+
+bool element_contains(const mongo::BSONElement& a, const mongo::BSONElement& b)
+{
+    if (b.type() == mongo::Array)
+    {
+        if (a.type() != mongo::Array)
+            return false;
+
+        // every element of b in some element of a
+        mongo::BSONObjIterator bi(b.embeddedObject());
+        while (bi.more())
+        {
+            mongo::BSONElement be = bi.next();
+            bool found = false;
+            mongo::BSONObjIterator ai(a.embeddedObject());
+            while (ai.more() && !found)
+            {
+                found = element_contains(ai.next(), be);
+            }
+            if (!found)
+                return false;
+        }
+        return true;
+    }
+    else if (a.type() == mongo::Array)
+    {
+        // multi-key: scalar or object in any element
+        mongo::BSONObjIterator ai(a.embeddedObject());
+        while (ai.more())
+        {
+            if (element_contains(ai.next(), b))
+                return true;
+        }
+        return false;
+    }
+    else if (b.type() == mongo::Object)
+    {
+        return a.type() == mongo::Object && object_contains(a.embeddedObject(), b.embeddedObject());
+    }
+    else
+    {
+        return a.woCompare(b, false) == 0;
+    }
+}
+
+int32 path_entry(const std::string& path)
+{
+    return static_cast<int32>(bson_path_hash(path.data(), path.length()));
+}
+
+int32 value_entry(const std::string& path, const mongo::BSONElement& value)
+{
+    return static_cast<int32>(bson_path_value_hash(path.data(), path.length(), value));
+}
+
+std::string child_path(const std::string& parent, const char* name)
+{
+    std::string path(parent);
+    path += '.';
+    path += name;
+    return path;
+}
+
+// array elements are added with the path of the array, and without path entries
+void extract_element(const mongo::BSONElement& e, const std::string& path, bool is_field, bool with_values, std::vector<int32>& entries)
+{
+    if (is_field)
+        entries.push_back(path_entry(path));
+
+    if (e.type() == mongo::Object)
+    {
+        mongo::BSONObjIterator it(e.embeddedObject());
+        while (it.more())
+        {
+            mongo::BSONElement child = it.next();
+            extract_element(child, child_path(path, child.fieldName()), true, with_values, entries);
+        }
+    }
+    else if (e.type() == mongo::Array)
+    {
+        mongo::BSONObjIterator it(e.embeddedObject());
+        while (it.more())
+        {
+            extract_element(it.next(), path, false, with_values, entries);
+        }
+    }
+    else if (with_values)
+    {
+        entries.push_back(value_entry(path, e));
+    }
+}
+
+// entries which must be present in a document containing e at path
+void extract_query_element(const mongo::BSONElement& e, const std::string& path, bool with_values, std::vector<int32>& entries)
+{
+    if (e.isABSONObj())
+    {
+        mongo::BSONObj object = e.embeddedObject();
+        if (!with_values || object.isEmpty())
+            entries.push_back(path_entry(path));
+
+        mongo::BSONObjIterator it(object);
+        while (it.more())
+        {
+            mongo::BSONElement child = it.next();
+            if (e.type() == mongo::Object)
+                extract_query_element(child, child_path(path, child.fieldName()), with_values, entries);
+            else
+                extract_query_element(child, path, with_values, entries);
+        }
+    }
+    else if (with_values)
+    {
+        entries.push_back(value_entry(path, e));
+    }
+    else
+    {
+        entries.push_back(path_entry(path));
+    }
+}
+
+void sort_unique(std::vector<int32>& entries)
+{
+    std::sort(entries.begin(), entries.end());
+    entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+}
+
+}
+
+bool bson_object_contains(const mongo::BSONObj& a, const mongo::BSONObj& b)
+{
+    return object_contains(a, b);
+}
+
+void gin_extract_value(const mongo::BSONObj& object, bool with_values, std::vector<int32>& entries)
+{
+    mongo::BSONObjIterator it(object);
+    while (it.more())
+    {
+        mongo::BSONElement e = it.next();
+        extract_element(e, e.fieldName(), true, with_values, entries);
+    }
+    sort_unique(entries);
+}
+
+void gin_extract_contains_query(const mongo::BSONObj& query, bool with_values, std::vector<int32>& entries)
+{
+    mongo::BSONObjIterator it(query);
+    while (it.more())
+    {
+        mongo::BSONElement e = it.next();
+        extract_query_element(e, e.fieldName(), with_values, entries);
+    }
+    sort_unique(entries);
+}
+
+bool gin_extract_path(const char* path, int length, int32& entry)
+{
+    // hashed like the UTF-8 field names of documents
+    path = server_to_utf8(path, &length);
+
+    // getFieldDotted works on c-strings
+    length = strnlen(path, length);
+
+    int segment_start = 0;
+    for (int i = 0; i <= length; i++)
+    {
+        if (i == length || path[i] == '.')
+        {
+            bool numeric = i > segment_start;
+            for (int j = segment_start; j < i && numeric; j++)
+            {
+                numeric = path[j] >= '0' && path[j] <= '9';
+            }
+            if (numeric)
+                return false;
+            segment_start = i + 1;
+        }
+    }
+
+    entry = static_cast<int32>(bson_path_hash(path, length));
+    return true;
+}
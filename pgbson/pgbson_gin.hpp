@@ -0,0 +1,55 @@
+// Copyright (c) 2012-2013 Maciej Gajewski <maciej.gajewski0@gmail.com>
+// 
+// Permission to use, copy, modify, and distribute this software and its documentation for any purpose, without fee, and without a written agreement is hereby granted,
+// provided that the above copyright notice and this paragraph and the following two paragraphs appear in all copies.
+// 
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, 
+// ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+// THE AUTHOR SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+// THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE AUTHOR HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+
+#ifndef PGBSON_GIN_HPP
+#define PGBSON_GIN_HPP
+
+#include "pgbson_internal.hpp"
+
+extern "C" {
+#include <access/gin.h>
+}
+
+#include <vector>
+
+// Containment and GIN index support.
+//
+// a @> b if every field of b is in a with a containing value: objects contain
+// their fields recursively, arrays contain their elements (in any order), arrays
+// in a are searched for scalars and objects of b (like MongoDB multi-key indexes)
+// and scalars are compared as by the = operator.
+//
+// GIN entries are 32-bit hashes (int4). For every path in the document there is:
+//  - path entry, hash of the dotted path. Array elements don't add path segments,
+//    so paths of {"a":[{"b":1}]} are "a" and "a.b"
+//  - value entry, hash of the path and scalar value (bson_gin_ops only)
+// Hashes may collide, so all operators are rechecked.
+
+// strategy numbers, same as for jsonb
+const StrategyNumber gin_contains_strategy = 7;
+const StrategyNumber gin_exists_strategy = 9;
+const StrategyNumber gin_exists_any_strategy = 10;
+const StrategyNumber gin_exists_all_strategy = 11;
+
+bool bson_object_contains(const mongo::BSONObj& a, const mongo::BSONObj& b);
+
+// entries of indexed document, sorted and unique
+void gin_extract_value(const mongo::BSONObj& object, bool with_values, std::vector<int32>& entries);
+
+// entries required by @> query, sorted and unique. No entries means the query matches everything.
+void gin_extract_contains_query(const mongo::BSONObj& query, bool with_values, std::vector<int32>& entries);
+
+// path entry, for ? operators, path is in the database encoding
+// returns false if the path can't be looked up in the index: numeric segments may address array
+// elements, which are not indexed by position
+bool gin_extract_path(const char* path, int length, int32& entry);
+
+#endif
@@ -0,0 +1,188 @@
+// Copyright (c) 2012-2013 Maciej Gajewski <maciej.gajewski0@gmail.com>
+// 
+// Permission to use, copy, modify, and distribute this software and its documentation for any purpose, without fee, and without a written agreement is hereby granted,
+// provided that the above copyright notice and this paragraph and the following two paragraphs appear in all copies.
+// 
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, 
+// ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+// THE AUTHOR SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+// THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE AUTHOR HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+
+#include "pgbson_hash.hpp"
+#include "pgbson_scan.hpp"
+
+#include "third_party/murmurhash3/MurmurHash3.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+// Streaming hasher. Data is collected in blocks, each block is hashed together
+// with 128-bit result of the previous one
+class block_hasher
+{
+public:
+
+    block_hasher(uint64 seed)
+    {
+        _state[0] = seed;
+        _state[1] = 0;
+        std::memcpy(_buffer, _state, state_size);
+        _pos = state_size;
+    }
+
+    void add(const void* data, std::size_t length)
+    {
+        const char* p = reinterpret_cast<const char*>(data);
+        while (length > 0)
+        {
+            std::size_t n = std::min(length, sizeof(_buffer) - _pos);
+            std::memcpy(_buffer + _pos, p, n);
+            _pos += n;
+            p += n;
+            length -= n;
+            if (_pos == sizeof(_buffer))
+                flush();
+        }
+    }
+
+    void add_byte(unsigned char b)
+    {
+        _buffer[_pos++] = b;
+        if (_pos == sizeof(_buffer))
+            flush();
+    }
+
+    uint64 finish()
+    {
+        flush();
+        return _state[0];
+    }
+
+private:
+
+    static const std::size_t state_size = 2 * sizeof(uint64);
+
+    void flush()
+    {
+        MurmurHash3_x64_128(_buffer, _pos, 0, _state);
+        std::memcpy(_buffer, _state, state_size);
+        _pos = state_size;
+    }
+
+    uint64 _state[2];
+    char _buffer[1024];
+    std::size_t _pos;
+};
+
+void hash_object(block_hasher& h, const mongo::BSONObj& object);
+
+// canonical type, shifted to be non-zero; zero ends the object
+void hash_type(block_hasher& h, const mongo::BSONElement& e)
+{
+    // canonical types are in range -1 .. 127
+    h.add_byte(static_cast<unsigned char>(e.canonicalType() + 2));
+}
+
+// value only, without the type and the field name
+void hash_value(block_hasher& h, const mongo::BSONElement& e)
+{
+    switch(e.type())
+    {
+        case mongo::NumberDouble:
+        case mongo::NumberInt:
+        case mongo::NumberLong:
+        {
+            // compared as doubles when types differ
+            double d = e.number();
+            if (d != d)
+                d = std::numeric_limits<double>::quiet_NaN(); // all NaNs are equal
+            else if (d == 0.0)
+                d = 0.0; // -0.0 == 0.0
+            h.add(&d, sizeof(d));
+            break;
+        }
+
+        case mongo::String:
+        case mongo::Symbol:
+        case mongo::Code:
+            h.add(e.value(), e.valuestrsize() + 4);
+            break;
+
+        case mongo::Object:
+        case mongo::Array:
+            hash_object(h, e.embeddedObject());
+            break;
+
+        case mongo::BinData:
+        case mongo::jstOID:
+        case mongo::Bool:
+        case mongo::Date:
+        case mongo::Timestamp:
+        case mongo::RegEx:
+        case mongo::DBRef:
+            h.add(e.value(), e.valuesize());
+            break;
+
+        case mongo::CodeWScope:
+            // scope is compared as c-string, only the code is hashed
+            h.add(e.codeWScopeCode(), std::strlen(e.codeWScopeCode()));
+            break;
+
+        default:
+            // null, undefined, min and max key - type only
+            break;
+    }
+}
+
+void hash_object(block_hasher& h, const mongo::BSONObj& object)
+{
+    bson_scanner it(object);
+    while (it.more())
+    {
+        mongo::BSONElement e = it.next();
+
+        hash_type(h, e);
+        h.add(e.fieldName(), it.name_size());
+        hash_value(h, e);
+    }
+    h.add_byte(0);
+}
+
+}
+
+uint64 bson_logical_hash(const mongo::BSONObj& object, uint64 seed)
+{
+    block_hasher h(seed);
+    hash_object(h, object);
+    return h.finish();
+}
+
+uint64 bson_raw_hash(const mongo::BSONObj& object, uint64 seed)
+{
+    block_hasher h(seed);
+    h.add(object.objdata(), object.objsize());
+    return h.finish();
+}
+
+uint64 bson_path_hash(const char* path, std::size_t length)
+{
+    block_hasher h(0);
+    h.add_byte('P');
+    h.add(path, length);
+    return h.finish();
+}
+
+uint64 bson_path_value_hash(const char* path, std::size_t length, const mongo::BSONElement& value)
+{
+    block_hasher h(0);
+    h.add_byte('V');
+    h.add(path, length);
+    h.add_byte(0);
+    hash_type(h, value);
+    hash_value(h, value);
+    return h.finish();
+}
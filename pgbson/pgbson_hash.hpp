@@ -0,0 +1,35 @@
+// Copyright (c) 2012-2013 Maciej Gajewski <maciej.gajewski0@gmail.com>
+// 
+// Permission to use, copy, modify, and distribute this software and its documentation for any purpose, without fee, and without a written agreement is hereby granted,
+// provided that the above copyright notice and this paragraph and the following two paragraphs appear in all copies.
+// 
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, 
+// ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+// THE AUTHOR SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+// THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE AUTHOR HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+
+#ifndef PGBSON_HASH_HPP
+#define PGBSON_HASH_HPP
+
+#include "pgbson_internal.hpp"
+
+// Hashing, based on MurmurHash3.
+//
+// Logical hash is computed over a canonical form of the object, so objects equal
+// according to woCompare (bson = operator) have equal hashes: numbers are hashed as doubles
+// (1, 1L and 1.0 collide), types as their canonical types.
+// Binary hash is computed over the raw bytes, for bson == operator.
+//
+// 32-bit hashes are the low bits of 64-bit hashes with seed 0, as extended hash support functions require.
+
+uint64 bson_logical_hash(const mongo::BSONObj& object, uint64 seed);
+
+uint64 bson_raw_hash(const mongo::BSONObj& object, uint64 seed);
+
+// Hashes of dotted path, and of path with a scalar value (hashed like in logical hash), used as GIN entries.
+uint64 bson_path_hash(const char* path, std::size_t length);
+
+uint64 bson_path_value_hash(const char* path, std::size_t length, const mongo::BSONElement& value);
+
+#endif
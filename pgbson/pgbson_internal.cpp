@@ -10,10 +10,28 @@
 // THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE AUTHOR HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
 
 #include "pgbson_internal.hpp"
+#include "pgbson_jsonb.hpp"
+#include "pgbson_scan.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <vector>
 
 extern "C" {
 #include <utils/numeric.h>
+#include <utils/date.h>
+#include <utils/uuid.h>
+#include <mb/pg_wchar.h>
+#if PG_VERSION_NUM >= 130000
+#include <access/detoast.h>
+#include <access/heaptoast.h>
+#else
 #include <access/tuptoaster.h>
+#endif
 }
 
 Datum return_string(const std::string& s)
@@ -43,6 +61,82 @@ Datum return_bson(const mongo::BSONObj& b)
     PG_RETURN_BYTEA_P(new_bytea);
 }
 
+// no conversion in UTF-8 databases, or SQL_ASCII ones (where text is taken as it is, as before)
+static bool same_encoding()
+{
+    int encoding = GetDatabaseEncoding();
+    return encoding == PG_UTF8 || encoding == PG_SQL_ASCII;
+}
+
+const char* server_to_utf8(const char* s, int* length)
+{
+    if (same_encoding())
+        return s;
+
+#if PG_VERSION_NUM >= 90300
+    const char* converted = pg_server_to_any(s, *length, PG_UTF8);
+#else
+    const char* converted = reinterpret_cast<const char*>(pg_do_encoding_conversion(
+        reinterpret_cast<unsigned char*>(const_cast<char*>(s)), *length, GetDatabaseEncoding(), PG_UTF8));
+#endif
+    if (converted != s)
+        *length = std::strlen(converted);
+    return converted;
+}
+
+const char* utf8_to_server(const char* s, int* length)
+{
+    if (same_encoding())
+        return s;
+
+#if PG_VERSION_NUM >= 90300
+    const char* converted = pg_any_to_server(s, *length, PG_UTF8);
+#else
+    const char* converted = reinterpret_cast<const char*>(pg_do_encoding_conversion(
+        reinterpret_cast<unsigned char*>(const_cast<char*>(s)), *length, PG_UTF8, GetDatabaseEncoding()));
+#endif
+    if (converted != s)
+        *length = std::strlen(converted);
+    return converted;
+}
+
+static void* builder_palloc(std::size_t size)
+{
+    return palloc(size);
+}
+
+static void* builder_repalloc(void* p, std::size_t size)
+{
+    return p == NULL ? palloc(size) : repalloc(p, size);
+}
+
+static void builder_pfree(void* p)
+{
+    pfree(p);
+}
+
+static const mongo::BufAllocatorFunctions palloc_functions = { builder_palloc, builder_repalloc, builder_pfree };
+
+bson_builder::bson_builder(int initial_size)
+    : _buffer(VARHDRSZ + initial_size, &palloc_functions), _builder(reserve_header(_buffer))
+{
+}
+
+mongo::BufBuilder& bson_builder::reserve_header(mongo::BufBuilder& buffer)
+{
+    buffer.skip(VARHDRSZ);
+    return buffer;
+}
+
+bytea* bson_builder::finish()
+{
+    _builder.done();
+    bytea* result = reinterpret_cast<bytea*>(_buffer.buf());
+    SET_VARSIZE(result, _buffer.len());
+    _buffer.decouple();
+    return result;
+}
+
 std::string get_typename(Oid typid)
 {
     HeapTuple	tp;
@@ -61,178 +155,462 @@ std::string get_typename(Oid typid)
 }
 
 
-void composite_to_bson(mongo::BSONObjBuilder& builder, Datum composite)
+// Row conversion
+//
+// Conversion of a row type is planned once: field names, converter for each column,
+// output functions of types converted through text. A plan is kept in fn_extra, in its own child
+// context of fn_mcxt; anonymous records nested in a column have their own plan in the column,
+// in a child context of the row's plan.
+
+struct row_plan;
+struct column_plan;
+
+typedef void (*column_converter)(mongo::BSONObjBuilder& builder, const char* name, Datum value, column_plan* column);
+
+struct column_plan
 {
-    PGBSON_LOG << "BEGIN composite_to_bson" << PGBSON_ENDL;
+    const char* name; // NULL for dropped columns
+    column_converter convert;
+    FmgrInfo output; // types converted with text output
+    bool is_varlena;
+    row_plan* record; // anonymous records, planned for the first value
+    column_plan* element; // arrays: conversion of elements
+    int16 elmlen;
+    bool elmbyval;
+    char elmalign;
+    MemoryContext context;
+};
 
-    HeapTupleHeader td;
-    Oid         tupType;
-    int32       tupTypmod;
-    TupleDesc   tupdesc;
-    HeapTupleData tmptup;
+struct row_plan
+{
+    MemoryContext context; // holds the plan, deleted when the plan is replaced
+    Oid type;
+    int32 typmod;
+    TupleDesc tupdesc;
+    column_plan* columns;
+    Datum* values; // heap_deform_tuple output
+    bool* nulls;
+};
 
-    td = DatumGetHeapTupleHeader(composite);
+static row_plan* plan_row(Oid type, int32 typmod, MemoryContext ctx);
+static void convert_row(mongo::BSONObjBuilder& builder, Datum composite, row_plan** plan, MemoryContext ctx);
 
-    /* Extract rowtype info and find a tupdesc */
-    tupType = HeapTupleHeaderGetTypeId(td);
-    tupTypmod = HeapTupleHeaderGetTypMod(td);
-    tupdesc = lookup_rowtype_tupdesc(tupType, tupTypmod);
+static void convert_bool(mongo::BSONObjBuilder& builder, const char* name, Datum value, column_plan*)
+{
+    builder.append(name, DatumGetBool(value));
+}
 
-    /* Build a temporary HeapTuple control structure */
-    tmptup.t_len = HeapTupleHeaderGetDatumLength(td);
-    tmptup.t_data = td;
-    HeapTupleData* tuple = &tmptup;
+static void convert_char(mongo::BSONObjBuilder& builder, const char* name, Datum value, column_plan*)
+{
+    char c = DatumGetChar(value);
+    builder.append(name, mongo::StringData(&c, 1));
+}
 
-    for (int i = 0; i < tupdesc->natts; i++)
-    {
-        bool isnull;
+static void convert_int2(mongo::BSONObjBuilder& builder, const char* name, Datum value, column_plan*)
+{
+    builder.append(name, DatumGetInt16(value));
+}
 
-        if (tupdesc->attrs[i]->attisdropped)
-            continue;
+static void convert_int4(mongo::BSONObjBuilder& builder, const char* name, Datum value, column_plan*)
+{
+    builder.append(name, DatumGetInt32(value));
+}
 
-        const char* field_name = NameStr(tupdesc->attrs[i]->attname);
-        Datum val = heap_getattr(tuple, i + 1, tupdesc, &isnull);
-        datum_to_bson(field_name, builder, val, isnull, tupdesc->attrs[i]->atttypid);
+static void convert_int8(mongo::BSONObjBuilder& builder, const char* name, Datum value, column_plan*)
+{
+    builder.append(name, (long long)DatumGetInt64(value));
+}
+
+static void convert_float4(mongo::BSONObjBuilder& builder, const char* name, Datum value, column_plan*)
+{
+    builder.append(name, DatumGetFloat4(value));
+}
+
+static void convert_float8(mongo::BSONObjBuilder& builder, const char* name, Datum value, column_plan*)
+{
+    builder.append(name, DatumGetFloat8(value));
+}
+
+// text, json and xml
+static void convert_text(mongo::BSONObjBuilder& builder, const char* name, Datum value, column_plan*)
+{
+    text* t = DatumGetTextPP(value);
+    int length = VARSIZE_ANY_EXHDR(t);
+    const char* s = server_to_utf8(VARDATA_ANY(t), &length);
+    builder.append(name, mongo::StringData(s, length));
+}
 
+// milliseconds since the Unix epoch, as in BSON Date. Infinite values are mapped to the extremes
+static long long timestamp_to_date(Timestamp ts)
+{
+    if (TIMESTAMP_IS_NOBEGIN(ts))
+        return std::numeric_limits<long long>::min();
+    if (TIMESTAMP_IS_NOEND(ts))
+        return std::numeric_limits<long long>::max();
+
+    const long long epoch_offset = (long long)(POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * SECS_PER_DAY * 1000;
+    #if PG_VERSION_NUM >= 100000 || defined(HAVE_INT64_TIMESTAMP)
+    // microseconds, rounded towards minus infinity
+    long long ms = ts / 1000;
+    if (ts % 1000 < 0)
+        ms--;
+    return ms + epoch_offset;
+    #else
+    // seconds, as double
+    return (long long)std::floor(ts * 1000.0) + epoch_offset;
+    #endif
+}
+
+// inverse of timestamp_to_date
+Timestamp bson_date_to_timestamp(long long ms)
+{
+    Timestamp ts;
+    if (ms == std::numeric_limits<long long>::min())
+    {
+        TIMESTAMP_NOBEGIN(ts);
+        return ts;
+    }
+    if (ms == std::numeric_limits<long long>::max())
+    {
+        TIMESTAMP_NOEND(ts);
+        return ts;
     }
 
-    ReleaseTupleDesc(tupdesc);
-    PGBSON_LOG << "END composite_to_bson" << PGBSON_ENDL;
+    ms -= (long long)(POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * SECS_PER_DAY * 1000;
+    #if PG_VERSION_NUM >= 100000 || defined(HAVE_INT64_TIMESTAMP)
+    ts = ms * 1000;
+    #else
+    ts = ms / 1000.0;
+    #endif
+    return ts;
 }
 
-void datum_to_bson(const char* field_name, mongo::BSONObjBuilder& builder,
-    Datum val, bool is_null, Oid typid)
+// timestamp and timestamptz
+static void convert_timestamp(mongo::BSONObjBuilder& builder, const char* name, Datum value, column_plan*)
 {
-    PGBSON_LOG << "BEGIN datum_to_bson, field_name=" << field_name << ", typeid=" << typid << PGBSON_ENDL;
+    builder.appendDate(name, mongo::Date_t(timestamp_to_date(DatumGetTimestamp(value))));
+}
 
-    if (field_name == NULL)
+static void convert_date(mongo::BSONObjBuilder& builder, const char* name, Datum value, column_plan*)
+{
+    DateADT date = DatumGetDateADT(value);
+    long long ms;
+    if (DATE_IS_NOBEGIN(date))
+        ms = std::numeric_limits<long long>::min();
+    else if (DATE_IS_NOEND(date))
+        ms = std::numeric_limits<long long>::max();
+    else
+        ms = ((long long)date + POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * SECS_PER_DAY * 1000;
+
+    builder.appendDate(name, mongo::Date_t(ms));
+}
+
+bool numeric_to_int64(Datum numeric, double d, int64* result)
+{
+    // the margin keeps numeric_int8 from overflowing on values rounded to a double in range
+    if (d != std::floor(d) || std::fabs(d) >= 9.2e18)
+        return false;
+
+    Datum i = DirectFunctionCall1(numeric_int8, numeric);
+    if (!DatumGetBool(DirectFunctionCall2(numeric_eq, DirectFunctionCall1(int8_numeric, i), numeric)))
+        return false;
+
+    *result = DatumGetInt64(i);
+    return true;
+}
+
+// int64 if the value is integral and in range, double if it prints back as the same number,
+// string otherwise
+static void convert_numeric(mongo::BSONObjBuilder& builder, const char* name, Datum value, column_plan*)
+{
+    double d = DatumGetFloat8(DirectFunctionCall1(numeric_float8, value));
+    if (d != d || std::fabs(d) > std::numeric_limits<double>::max())
+    {
+        builder.append(name, d);
+        return;
+    }
+
+    int64 i;
+    if (numeric_to_int64(value, d, &i))
     {
-        field_name = "";
+        builder.append(name, (long long)i);
+        return;
     }
 
-    if (is_null)
+    if (DatumGetBool(DirectFunctionCall2(numeric_eq, DirectFunctionCall1(float8_numeric, Float8GetDatum(d)), value)))
     {
-        builder.appendNull(field_name);
+        builder.append(name, d);
     }
     else
     {
-        switch(typid)
-        {
-            case BOOLOID:
-                 builder.append(field_name, DatumGetBool(val));
-                 break;
+        char* outstr = DatumGetCString(DirectFunctionCall1(numeric_out, value));
+        builder.append(name, outstr);
+        pfree(outstr);
+    }
+}
 
-            case CHAROID:
-            {
-                char c = DatumGetChar(val);
-                builder.append(field_name, &c, 1);
-                break;
-            }
+static void convert_bytea(mongo::BSONObjBuilder& builder, const char* name, Datum value, column_plan*)
+{
+    bytea* b = DatumGetByteaPP(value);
+    builder.appendBinData(name, VARSIZE_ANY_EXHDR(b), mongo::BinDataGeneral, VARDATA_ANY(b));
+}
 
-            case INT8OID:
-                builder.append(field_name, (long long)DatumGetInt64(val));
-                break;
+#if PG_VERSION_NUM >= 90400
+static void convert_jsonb(mongo::BSONObjBuilder& builder, const char* name, Datum value, column_plan*)
+{
+    append_jsonb(builder, name, reinterpret_cast<Jsonb*>(PG_DETOAST_DATUM(value)));
+}
+#endif
 
-            case INT2OID:
-                builder.append(field_name, DatumGetInt16(val));
-                break;
+static void convert_uuid(mongo::BSONObjBuilder& builder, const char* name, Datum value, column_plan*)
+{
+    pg_uuid_t* uuid = DatumGetUUIDP(value);
+    builder.appendBinData(name, UUID_LEN, mongo::newUUID, uuid->data);
+}
 
-            case INT4OID:
-                builder.append(field_name, DatumGetInt32(val));
-                break;
+static void convert_bson(mongo::BSONObjBuilder& builder, const char* name, Datum value, column_plan*)
+{
+    bytea* data = DatumGetBson(value);
+    builder.append(name, mongo::BSONObj(VARDATA_ANY(data)));
+}
 
-            case TEXTOID:
-            case JSONOID:
-            case XMLOID:
-            {
-                text* t = DatumGetTextP(val);
-                builder.append(field_name, VARDATA(t), VARSIZE(t)-VARHDRSZ+1);
-                break;
-            }
+static void convert_record(mongo::BSONObjBuilder& builder, const char* name, Datum value, column_plan* column)
+{
+    mongo::BSONObjBuilder sub(builder.subobjStart(name));
+    convert_row(sub, value, &column->record, column->context);
+    sub.done();
+}
 
-            case FLOAT4OID:
-                builder.append(field_name, DatumGetFloat4(val));
-                break;
+// other types: text output
+static void convert_output(mongo::BSONObjBuilder& builder, const char* name, Datum value, column_plan* column)
+{
+    Datum out_val = value;
+    /*
+     * If we have a toasted datum, forcibly detoast it here to avoid
+     * memory leakage inside the type's output routine.
+     */
+    if (column->is_varlena)
+    {
+        out_val = PointerGetDatum(PG_DETOAST_DATUM(value));
+    }
 
-            case FLOAT8OID:
-                builder.append(field_name, DatumGetFloat8(val));
-                break;
+    char* outstr = OutputFunctionCall(&column->output, out_val);
+    int length = std::strlen(outstr);
+    const char* s = server_to_utf8(outstr, &length);
+    builder.append(name, mongo::StringData(s, length));
+    if (s != outstr)
+        pfree(const_cast<char*>(s));
+    pfree(outstr);
 
-            case RECORDOID:
-            {
-                mongo::BSONObjBuilder sub(builder.subobjStart(field_name));
-                composite_to_bson(sub, val);
-                sub.done();
-                break;
-            }
+    /* Clean up detoasted copy, if any */
+    if (value != out_val)
+        pfree(DatumGetPointer(out_val));
+}
+
+const char* index_name(int index, char* buffer)
+{
+    char* p = buffer + 11;
+    *p = '\0';
+    do
+    {
+        *--p = '0' + index % 10;
+        index /= 10;
+    } while (index > 0);
+    return p;
+}
+
+// one dimension of the array, elements are consumed from values and nulls
+static void convert_array_dimension(mongo::BSONObjBuilder& builder, const char* name, int ndim, const int* dims,
+    const Datum* values, const bool* nulls, int* index, column_plan* element)
+{
+    mongo::BSONObjBuilder sub(builder.subarrayStart(name));
+    char buffer[12];
+    for (int i = 0; i < dims[0]; i++)
+    {
+        const char* key = index_name(i, buffer);
+        if (ndim > 1)
+        {
+            convert_array_dimension(sub, key, ndim - 1, dims + 1, values, nulls, index, element);
+        }
+        else
+        {
+            if (nulls[*index])
+                sub.appendNull(key);
+            else
+                element->convert(sub, key, values[*index], element);
+            (*index)++;
+        }
+    }
+    sub.done();
+}
+
+// multidimensional arrays become nested arrays, the lower bounds are not kept
+static void convert_array(mongo::BSONObjBuilder& builder, const char* name, Datum value, column_plan* column)
+{
+    ArrayType* array = DatumGetArrayTypeP(value);
+    int ndim = ARR_NDIM(array);
+    if (ndim == 0)
+    {
+        builder.appendArray(name, mongo::BSONObj());
+        return;
+    }
+
+    Datum* values;
+    bool* nulls;
+    int count;
+    deconstruct_array(array, ARR_ELEMTYPE(array), column->elmlen, column->elmbyval, column->elmalign,
+        &values, &nulls, &count);
+
+    int index = 0;
+    convert_array_dimension(builder, name, ndim, ARR_DIMS(array), values, nulls, &index, column->element);
+
+    pfree(values);
+    pfree(nulls);
+}
+
+static void plan_column(column_plan* column, Oid typid, MemoryContext ctx)
+{
+    column->context = ctx;
+    Oid element_type = get_element_type(typid);
+    if (element_type != InvalidOid)
+    {
+        // element conversion is chosen once per array type
+        get_typlenbyvalalign(element_type, &column->elmlen, &column->elmbyval, &column->elmalign);
+        column->element = reinterpret_cast<column_plan*>(MemoryContextAllocZero(ctx, sizeof(column_plan)));
+        plan_column(column->element, element_type, ctx);
+        column->convert = convert_array;
+        return;
+    }
+
+    switch(typid)
+    {
+        case BOOLOID: column->convert = convert_bool; break;
+        case CHAROID: column->convert = convert_char; break;
+        case INT2OID: column->convert = convert_int2; break;
+        case INT4OID: column->convert = convert_int4; break;
+        case INT8OID: column->convert = convert_int8; break;
+        case FLOAT4OID: column->convert = convert_float4; break;
+        case FLOAT8OID: column->convert = convert_float8; break;
+        case TEXTOID:
+        case JSONOID:
+        case XMLOID: column->convert = convert_text; break;
+        case TIMESTAMPOID:
+        case TIMESTAMPTZOID: column->convert = convert_timestamp; break;
+        case DATEOID: column->convert = convert_date; break;
+        case NUMERICOID: column->convert = convert_numeric; break;
+        case BYTEAOID: column->convert = convert_bytea; break;
+        case UUIDOID: column->convert = convert_uuid; break;
+#if PG_VERSION_NUM >= 90400
+        case JSONBOID: column->convert = convert_jsonb; break;
+#endif
+        case RECORDOID: column->convert = convert_record; break;
 
-            case TIMESTAMPOID:
+        default:
+            if (get_typename(typid) == "bson")
             {
-                Timestamp ts = DatumGetTimestamp(val);
-                #ifdef HAVE_INT64_TIMESTAMP
-                mongo::Date_t date(ts);
-                #else
-                mongo::Date_t date(ts * 1000);
-                #endif
-
-                builder.append(field_name, date);
-                break;
+                column->convert = convert_bson;
             }
-
-            default:
+            else
             {
-                PGBSON_LOG << "datum_to_bson - unknown type, using text output." << PGBSON_ENDL;
-                PGBSON_LOG << "datum_to_bson - type=" << get_typename(typid) << PGBSON_ENDL;
-                if (get_typename(typid) == "bson")
-                {
-                    bytea* data = DatumGetBson(val);
-                    mongo::BSONObj obj(VARDATA_ANY(data));
-                    builder.append(field_name, obj);
-                }
-                else
-                {
-                    // use text output for the type
-                    bool typisvarlena = false;
-                    Oid typoutput;
-                    getTypeOutputInfo(typid, &typoutput, &typisvarlena);
-                    PGBSON_LOG << "datum_to_bson - typisvarlena=" << std::boolalpha << typisvarlena << PGBSON_ENDL;
-                    Datum out_val = val;
-                    /*
-                     * If we have a toasted datum, forcibly detoast it here to avoid
-                     * memory leakage inside the type's output routine.
-                     */
-                    if (typisvarlena)
-                    {
-                        out_val = PointerGetDatum(PG_DETOAST_DATUM(val));
-                        PGBSON_LOG << "datum_to_bson - var len valuie detoasted" << PGBSON_ENDL;
-                    }
-
-                    char* outstr = OidOutputFunctionCall(typoutput, out_val);
-                    builder.append(field_name, outstr);
-
-                    /* Clean up detoasted copy, if any */
-                    if (val != out_val)
-                        pfree(DatumGetPointer(out_val));
-                }
+                PGBSON_LOG << "plan_column - type " << typid << " converted with text output" << PGBSON_ENDL;
+                Oid typoutput;
+                getTypeOutputInfo(typid, &typoutput, &column->is_varlena);
+                fmgr_info_cxt(typoutput, &column->output, ctx);
+                column->convert = convert_output;
             }
-        } // switch
-    } // if not null
+    }
+}
+
+static row_plan* plan_row(Oid type, int32 typmod, MemoryContext ctx)
+{
+    PGBSON_LOG << "plan_row, type=" << type << ", typmod=" << typmod << PGBSON_ENDL;
+
+    TupleDesc cached = lookup_rowtype_tupdesc(type, typmod);
+    MemoryContext oldcontext = MemoryContextSwitchTo(ctx);
+    TupleDesc tupdesc = CreateTupleDescCopy(cached);
+    MemoryContextSwitchTo(oldcontext);
+    ReleaseTupleDesc(cached);
 
-    PGBSON_LOG << "END datum_to_bson, field_name=" << field_name << PGBSON_ENDL;
+    int natts = tupdesc->natts;
+    row_plan* plan = reinterpret_cast<row_plan*>(MemoryContextAllocZero(ctx, sizeof(row_plan)));
+    plan->type = type;
+    plan->typmod = typmod;
+    plan->tupdesc = tupdesc;
+    plan->columns = reinterpret_cast<column_plan*>(MemoryContextAllocZero(ctx, sizeof(column_plan) * (natts + 1)));
+    plan->values = reinterpret_cast<Datum*>(MemoryContextAlloc(ctx, sizeof(Datum) * (natts + 1)));
+    plan->nulls = reinterpret_cast<bool*>(MemoryContextAlloc(ctx, sizeof(bool) * (natts + 1)));
 
+    for (int i = 0; i < natts; i++)
+    {
+        Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+        if (attr->attisdropped)
+            continue;
+
+        // field names are UTF-8
+        int length = std::strlen(NameStr(attr->attname));
+        const char* name = server_to_utf8(NameStr(attr->attname), &length);
+        plan->columns[i].name = name == NameStr(attr->attname) ? name : MemoryContextStrdup(ctx, name);
+        plan_column(&plan->columns[i], attr->atttypid, ctx);
+    }
+
+    return plan;
+}
+
+// plan is replaced when the row type changes, in a new child context of ctx
+static void convert_row(mongo::BSONObjBuilder& builder, Datum composite, row_plan** plan, MemoryContext ctx)
+{
+    HeapTupleHeader td = DatumGetHeapTupleHeader(composite);
+    Oid type = HeapTupleHeaderGetTypeId(td);
+    int32 typmod = HeapTupleHeaderGetTypMod(td);
+
+    if (*plan == NULL || (*plan)->type != type || (*plan)->typmod != typmod)
+    {
+        MemoryContext context = new_cache_context(ctx, *plan != NULL ? (*plan)->context : NULL);
+        *plan = NULL;
+        *plan = plan_row(type, typmod, context);
+        (*plan)->context = context;
+    }
+    row_plan* p = *plan;
+
+    HeapTupleData tuple;
+    tuple.t_len = HeapTupleHeaderGetDatumLength(td);
+    tuple.t_data = td;
+    heap_deform_tuple(&tuple, p->tupdesc, p->values, p->nulls);
+
+    for (int i = 0; i < p->tupdesc->natts; i++)
+    {
+        column_plan* column = &p->columns[i];
+        if (column->name == NULL)
+            continue;
+
+        if (p->nulls[i])
+            builder.appendNull(column->name);
+        else
+            column->convert(builder, column->name, p->values[i], column);
+    }
+}
+
+void composite_to_bson(FmgrInfo* flinfo, mongo::BSONObjBuilder& builder, Datum composite)
+{
+    PGBSON_LOG << "BEGIN composite_to_bson" << PGBSON_ENDL;
+    convert_row(builder, composite, reinterpret_cast<row_plan**>(&flinfo->fn_extra), flinfo->fn_mcxt);
+    PGBSON_LOG << "END composite_to_bson" << PGBSON_ENDL;
 }
 
 template<>
 Datum convert_element<std::string>(PG_FUNCTION_ARGS, const mongo::BSONElement e)
 {
+    if (e.type() == mongo::String || e.type() == mongo::DBRef || e.type() == mongo::Symbol)
+    {
+        // converted before any object with a destructor is created, the conversion may report an error
+        int length = e.valuestrsize() - 1;
+        const char* s = utf8_to_server(e.valuestr(), &length);
+        return PointerGetDatum(cstring_to_text_with_len(s, length));
+    }
+
     std::stringstream ss;
     switch(e.type())
     {
-        case mongo::String:
-        case mongo::DBRef:
-        case mongo::Symbol:
-            return return_string(std::string(e.valuestr(), e.valuestrsize()-1));
-
         case mongo::NumberDouble:
             ss << e._numberDouble();
             break;
@@ -326,3 +704,524 @@ const char* bson_type_name(const mongo::BSONElement& e)
     return mongo::typeName(e.type());
 }
 
+
+compiled_path* compile_path(const char* path, int length, MemoryContext ctx)
+{
+    // getFieldDotted works on c-strings, so anything after embedded null is ignored
+    length = strnlen(path, length);
+
+    int n_segments = 1;
+    for (int i = 0; i < length; i++)
+    {
+        if (path[i] == '.')
+            n_segments++;
+    }
+
+    std::size_t header_size = offsetof(compiled_path, segments) + n_segments * sizeof(compiled_path_segment);
+    compiled_path* compiled = (compiled_path*) MemoryContextAlloc(ctx, header_size + length + 1);
+
+    compiled->length = length;
+    compiled->n_segments = n_segments;
+    compiled->path = reinterpret_cast<char*>(compiled) + header_size;
+    std::memcpy(compiled->path, path, length);
+    compiled->path[length] = 0;
+
+    int segment = 0;
+    int begin = 0;
+    for (int i = 0; i <= length; i++)
+    {
+        if (i == length || path[i] == '.')
+        {
+            compiled->segments[segment].offset = begin;
+            compiled->segments[segment].length = i - begin;
+            segment++;
+            begin = i + 1;
+        }
+    }
+
+    return compiled;
+}
+
+compiled_path* compile_text_path(const text* path, MemoryContext ctx)
+{
+    int length = VARSIZE_ANY_EXHDR(path);
+    const char* utf8 = server_to_utf8(VARDATA_ANY(path), &length);
+    return compile_path(utf8, length, ctx);
+}
+
+const compiled_path* get_cached_path(PG_FUNCTION_ARGS, int argno)
+{
+    text* arg = PG_GETARG_TEXT_P(argno);
+    int length = VARSIZE(arg) - VARHDRSZ;
+    const char* path = server_to_utf8(VARDATA(arg), &length); // field names are UTF-8
+
+    compiled_path* cached = reinterpret_cast<compiled_path*>(fcinfo->flinfo->fn_extra);
+    if (cached != NULL
+        && cached->length == length
+        && std::memcmp(cached->path, path, length) == 0)
+    {
+        return cached;
+    }
+
+    PGBSON_LOG << "get_cached_path: compiling path" << PGBSON_ENDL;
+    compiled_path* compiled = compile_path(path, length, fcinfo->flinfo->fn_mcxt);
+    if (cached != NULL)
+        pfree(cached);
+    fcinfo->flinfo->fn_extra = compiled;
+
+    return compiled;
+}
+
+MemoryContext new_cache_context(MemoryContext parent, MemoryContext previous)
+{
+    if (previous != NULL)
+        MemoryContextDelete(previous);
+    return AllocSetContextCreate(parent, "pgbson cache",
+        ALLOCSET_SMALL_MINSIZE, ALLOCSET_SMALL_INITSIZE, ALLOCSET_DEFAULT_MAXSIZE);
+}
+
+// true if the null-terminated field name equals name of given length
+static inline bool field_name_equals(const char* field_name, const char* name, int length)
+{
+    return field_name[0] == name[0] // quick reject on the first byte
+        && std::strncmp(field_name, name, length) == 0
+        && field_name[length] == 0;
+}
+
+mongo::BSONElement get_field_level(const mongo::BSONObj& object, const compiled_path* path, int segment,
+    mongo::BSONElement* segment_field)
+{
+    const compiled_path_segment& s = path->segments[segment];
+    const char* rest = path->path + s.offset;
+    int rest_length = path->length - s.offset;
+    bool last = segment == path->n_segments - 1;
+
+    // single pass: look for the rest of the path as a literal name (it takes precedence)
+    // and remember the first field named like the current segment
+    *segment_field = mongo::BSONElement();
+    bson_scanner it(object);
+    while (it.more())
+    {
+        mongo::BSONElement e = it.next();
+        const char* name = e.fieldName();
+        if (field_name_matches(name, it.name_size(), rest, rest_length))
+            return e;
+
+        if (!last && segment_field->eoo() && field_name_matches(name, it.name_size(), rest, s.length))
+            *segment_field = e;
+    }
+
+    return mongo::BSONElement();
+}
+
+mongo::BSONElement get_field(const mongo::BSONObj& object, const compiled_path* path)
+{
+    mongo::BSONObj current = object;
+
+    for (int segment = 0; segment < path->n_segments; segment++)
+    {
+        mongo::BSONElement segment_field;
+        mongo::BSONElement e = get_field_level(current, path, segment, &segment_field);
+        if (!e.eoo())
+            return e;
+
+        if (segment_field.eoo())
+            return mongo::BSONElement();
+
+        mongo::BSONType t = segment_field.type();
+        if (t != mongo::Object && t != mongo::Array)
+            return mongo::BSONElement();
+
+        current = segment_field.embeddedObject();
+    }
+
+    return mongo::BSONElement();
+}
+
+// one level of get_fields. indices are the paths (with at least level+1 segments) still looked up in object
+static void get_fields_level(const mongo::BSONObj& object, int level,
+    const compiled_path* const* paths, const std::vector<int>& indices, mongo::BSONElement* results)
+{
+    const int n = indices.size();
+    std::vector<mongo::BSONElement> segment_fields(n);
+    int pending = n;
+
+    bson_scanner it(object);
+    while (pending > 0 && it.more())
+    {
+        mongo::BSONElement e = it.next();
+        const char* name = e.fieldName();
+        const int name_size = it.name_size();
+
+        for (int i = 0; i < n; i++)
+        {
+            const int idx = indices[i];
+            if (!results[idx].eoo())
+                continue;
+
+            const compiled_path* path = paths[idx];
+            const compiled_path_segment& s = path->segments[level];
+            if (field_name_matches(name, name_size, path->path + s.offset, path->length - s.offset))
+            {
+                // literal match of the rest of the path takes precedence
+                results[idx] = e;
+                pending--;
+            }
+            else if (level < path->n_segments - 1
+                && segment_fields[i].eoo()
+                && field_name_matches(name, name_size, path->path + s.offset, s.length))
+            {
+                segment_fields[i] = e;
+            }
+        }
+    }
+
+    // descend, visiting each sub-object once for all the paths going through it
+    std::vector<bool> visited(n, false);
+    for (int i = 0; i < n; i++)
+    {
+        if (visited[i] || !results[indices[i]].eoo() || segment_fields[i].eoo())
+            continue;
+
+        mongo::BSONType t = segment_fields[i].type();
+        if (t != mongo::Object && t != mongo::Array)
+            continue;
+
+        std::vector<int> sub_indices;
+        for (int j = i; j < n; j++)
+        {
+            if (!visited[j] && results[indices[j]].eoo()
+                && segment_fields[j].rawdata() == segment_fields[i].rawdata())
+            {
+                visited[j] = true;
+                sub_indices.push_back(indices[j]);
+            }
+        }
+
+        get_fields_level(segment_fields[i].embeddedObject(), level + 1, paths, sub_indices, results);
+    }
+}
+
+void get_fields(const mongo::BSONObj& object, const compiled_path* const* paths, int n_paths, mongo::BSONElement* results)
+{
+    std::vector<int> indices(n_paths);
+    for (int i = 0; i < n_paths; i++)
+    {
+        results[i] = mongo::BSONElement();
+        indices[i] = i;
+    }
+
+    get_fields_level(object, 0, paths, indices, results);
+}
+
+Datum element_to_bson(const mongo::BSONElement& e)
+{
+    if (e.type() == mongo::Object)
+    {
+        return return_bson(e.embeddedObject());
+    }
+    else
+    {
+        // build object with sinle, anonymous field
+        bson_builder builder(e.size() + 8);
+        builder.builder().appendAs(e, "");
+        PG_RETURN_BYTEA_P(builder.finish());
+    }
+}
+
+int element_size_bounded(const char* p, const char* end)
+{
+    if (p >= end)
+        return -1;
+
+    const char* name = p + 1;
+    const char* name_end = reinterpret_cast<const char*>(std::memchr(name, 0, end - name));
+    if (name_end == NULL)
+        return -1;
+
+    const char* value = name_end + 1;
+    const int header = value - p;
+    int32 length;
+
+    switch(static_cast<signed char>(*p))
+    {
+        case mongo::EOO:
+            return 1;
+
+        case mongo::Undefined:
+        case mongo::jstNULL:
+        case mongo::MaxKey:
+        case mongo::MinKey:
+            return header;
+
+        case mongo::Bool:
+            return header + 1;
+
+        case mongo::NumberInt:
+            return header + 4;
+
+        case mongo::Timestamp:
+        case mongo::Date:
+        case mongo::NumberDouble:
+        case mongo::NumberLong:
+            return header + 8;
+
+        case mongo::jstOID:
+            return header + 12;
+
+        case mongo::Symbol:
+        case mongo::Code:
+        case mongo::String:
+            if (value + 4 > end)
+                return -1;
+            std::memcpy(&length, value, 4);
+            return header + 4 + length;
+
+        case mongo::DBRef:
+            if (value + 4 > end)
+                return -1;
+            std::memcpy(&length, value, 4);
+            return header + 4 + length + 12;
+
+        case mongo::BinData:
+            if (value + 4 > end)
+                return -1;
+            std::memcpy(&length, value, 4);
+            return header + 4 + 1 + length;
+
+        case mongo::CodeWScope:
+        case mongo::Object:
+        case mongo::Array:
+            if (value + 4 > end)
+                return -1;
+            std::memcpy(&length, value, 4);
+            return header + length;
+
+        case mongo::RegEx:
+        {
+            const char* pattern_end = reinterpret_cast<const char*>(std::memchr(value, 0, end - value));
+            if (pattern_end == NULL)
+                return -1;
+            const char* flags_end = reinterpret_cast<const char*>(std::memchr(pattern_end + 1, 0, end - pattern_end - 1));
+            if (flags_end == NULL)
+                return -1;
+            return flags_end + 1 - p;
+        }
+
+        default:
+            return -1;
+    }
+}
+
+bool get_field_prefix(const char* data, std::size_t available, const compiled_path* path, mongo::BSONElement* result)
+{
+    const char* end = data + available;
+    const char* object = data;
+
+    for (int segment = 0; segment < path->n_segments; segment++)
+    {
+        const compiled_path_segment& s = path->segments[segment];
+        const char* rest = path->path + s.offset;
+        int rest_length = path->length - s.offset;
+        bool last = segment == path->n_segments - 1;
+
+        if (object + 4 > end)
+            return false;
+        int32 objsize;
+        std::memcpy(&objsize, object, 4);
+        const char* object_end = object + objsize - 1; // the terminating EOO
+
+        const char* segment_field = NULL;
+        const char* pos = object + 4;
+        while (pos < object_end)
+        {
+            int size = element_size_bounded(pos, end);
+            if (size < 0)
+                return false;
+
+            const char* name = pos + 1;
+            if (field_name_equals(name, rest, rest_length))
+            {
+                if (pos + size > end)
+                    return false;
+                *result = mongo::BSONElement(pos);
+                return true;
+            }
+
+            if (!last && segment_field == NULL && field_name_equals(name, rest, s.length))
+                segment_field = pos;
+
+            pos += size;
+        }
+
+        if (segment_field == NULL
+            || (*segment_field != mongo::Object && *segment_field != mongo::Array))
+        {
+            *result = mongo::BSONElement();
+            return true;
+        }
+
+        object = segment_field + 1 + std::strlen(segment_field + 1) + 1;
+    }
+
+    *result = mongo::BSONElement();
+    return true;
+}
+
+// first slice fetched from external values
+static const int32 initial_slice_size = 2048;
+
+static bool is_external_uncompressed(Datum datum)
+{
+    struct varlena* attr = reinterpret_cast<struct varlena*>(DatumGetPointer(datum));
+
+#ifdef VARATT_IS_EXTERNAL_ONDISK
+    if (!VARATT_IS_EXTERNAL_ONDISK(attr))
+        return false;
+#else
+    if (!VARATT_IS_EXTERNAL(attr))
+        return false;
+#endif
+
+    struct varatt_external toast_pointer;
+    VARATT_EXTERNAL_GET_POINTER(toast_pointer, attr);
+#ifdef VARATT_EXTERNAL_IS_COMPRESSED
+    return !VARATT_EXTERNAL_IS_COMPRESSED(toast_pointer);
+#else
+    return toast_pointer.va_extsize >= toast_pointer.va_rawsize - VARHDRSZ;
+#endif
+}
+
+mongo::BSONElement get_field_detoast(Datum datum, const compiled_path* path)
+{
+    if (is_external_uncompressed(datum))
+    {
+        int32 total = toast_raw_datum_size(datum) - VARHDRSZ;
+        // int64, so that the last multiplication can't overflow for values over 512MB
+        for (int64 slice_size = initial_slice_size; slice_size < total; slice_size *= 4)
+        {
+            struct varlena* slice = PG_DETOAST_DATUM_SLICE(datum, 0, slice_size);
+
+            mongo::BSONElement e;
+            if (get_field_prefix(VARDATA(slice), VARSIZE(slice) - VARHDRSZ, path, &e))
+            {
+                PGBSON_LOG << "get_field_detoast: found in slice of " << slice_size << " bytes" << PGBSON_ENDL;
+                return e; // points into the slice, which is left to the memory context
+            }
+            pfree(slice);
+        }
+    }
+
+    bytea* data = DatumGetBson(datum);
+    return get_field(mongo::BSONObj(VARDATA_ANY(data)), path);
+}
+
+uint64 order_preserving_double(double d)
+{
+    if (d != d)
+        return 0; // NaN is less than any number
+    if (d == 0.0)
+        d = 0.0; // -0.0 == 0.0
+
+    uint64 bits;
+    std::memcpy(&bits, &d, sizeof(bits));
+    const uint64 sign = UINT64CONST(0x8000000000000000);
+    return (bits & sign) ? ~bits : (bits | sign);
+}
+
+// appends big-endian bytes of value
+static void append_uint64(unsigned char* buf, int& pos, int size, uint64 value)
+{
+    for (int shift = 56; shift >= 0 && pos < size; shift -= 8)
+        buf[pos++] = static_cast<unsigned char>(value >> shift);
+}
+
+Datum abbreviate_bson(const mongo::BSONObj& object)
+{
+    const int size = SIZEOF_DATUM;
+    unsigned char buf[size];
+    std::memset(buf, 0, size);
+
+    // empty object is less than all the others, and gets zero key
+    mongo::BSONObjIterator it(object);
+    if (it.more())
+    {
+        mongo::BSONElement e = it.next();
+        int pos = 0;
+
+        // canonical types are in range -1 (MinKey) .. 127 (MaxKey), shifted to be non-zero
+        buf[pos++] = static_cast<unsigned char>(e.canonicalType() + 2);
+
+        // field name compared with strcmp, terminator included
+        const char* name = e.fieldName();
+        bool name_complete = false;
+        while (pos < size)
+        {
+            buf[pos++] = static_cast<unsigned char>(*name);
+            if (*name == 0)
+            {
+                name_complete = true;
+                break;
+            }
+            name++;
+        }
+
+        if (name_complete)
+        {
+            switch(e.type())
+            {
+                case mongo::NumberDouble:
+                case mongo::NumberInt:
+                case mongo::NumberLong:
+                    // integers are compared exactly only with integers, via double otherwise.
+                    // double conversion is monotonic, so the prefix is consistent with both
+                    append_uint64(buf, pos, size, order_preserving_double(e.number()));
+                    break;
+
+                case mongo::String:
+                case mongo::Symbol:
+                case mongo::Code:
+                {
+                    // memcmp, then length; zero padding keeps shorter strings first
+                    int len = e.valuestrsize() - 1;
+                    const char* str = e.valuestr();
+                    for (int i = 0; i < len && pos < size; i++)
+                        buf[pos++] = static_cast<unsigned char>(str[i]);
+                    break;
+                }
+
+                case mongo::jstOID:
+                {
+                    const char* oid = e.value();
+                    for (int i = 0; i < 12 && pos < size; i++)
+                        buf[pos++] = static_cast<unsigned char>(oid[i]);
+                    break;
+                }
+
+                case mongo::Bool:
+                    if (pos < size)
+                        buf[pos++] = e.boolean() ? 1 : 0;
+                    break;
+
+                // Date and Timestamp share canonical type, but are compared as signed and unsigned.
+                // Mixing them in one column doesn't order consistently even without abbreviation.
+                case mongo::Date:
+                    append_uint64(buf, pos, size, static_cast<uint64>(e.date().millis) ^ UINT64CONST(0x8000000000000000));
+                    break;
+
+                case mongo::Timestamp:
+                    append_uint64(buf, pos, size, static_cast<uint64>(e.date().millis));
+                    break;
+
+                default:
+                    // no value prefix, equal keys are resolved by full comparison
+                    break;
+            }
+        }
+    }
+
+    Datum key = 0;
+    for (int i = 0; i < size; i++)
+        key = (key << 8) | buf[i];
+    return key;
+}
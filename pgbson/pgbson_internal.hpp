@@ -26,15 +26,35 @@ extern "C" {
 #include <utils/lsyscache.h>
 #include <utils/syscache.h>
 #include <utils/timestamp.h>
+#include <utils/array.h>
+#include <utils/builtins.h>
 #include <parser/parse_coerce.h>
 #include <catalog/pg_type.h>
 #include <funcapi.h>
 #include <lib/stringinfo.h>
+#include <utils/sortsupport.h>
+#include <utils/tuplestore.h>
+#include <miscadmin.h>
+#include <access/hash.h>
+#if PG_VERSION_NUM >= 130000
+#include <common/hashfn.h>
+#elif PG_VERSION_NUM >= 120000
+#include <utils/hashutils.h>
+#endif
+#if PG_VERSION_NUM >= 90500
+#include <lib/hyperloglog.h>
+#endif
 
 // bson access macros
 #define DatumGetBson(X) ((bytea *) PG_DETOAST_DATUM_PACKED(X))
 #define GETARG_BSON(n)  DatumGetBson(PG_GETARG_DATUM(n))
 
+// tuple descriptor attributes are an array of pointers before PostgreSQL 11, of structs since;
+// this accessor covers both (it's defined by the headers of 11 and of recent minor releases of 10)
+#ifndef TupleDescAttr
+#define TupleDescAttr(tupdesc, i) ((tupdesc)->attrs[(i)])
+#endif
+
 }
 
 #include <string>
@@ -60,7 +80,35 @@ Datum return_string(const std::string& s);
 Datum return_cstring(const std::string& s);
 Datum return_bson(const mongo::BSONObj& b);
 
-inline mongo::BSONObj datum_get_bson(Datum* val)
+// BSON strings are UTF-8, text is in the database encoding. Both return s itself if no conversion
+// is needed (UTF-8 or SQL_ASCII database), otherwise a palloc-ed, null-terminated copy, and update
+// *length. Characters that can't be represented in the target encoding raise an error.
+const char* server_to_utf8(const char* s, int* length);
+const char* utf8_to_server(const char* s, int* length);
+
+// Object builder with the buffer palloc-ed in the current memory context. Space for varlena header
+// is reserved in front of the object, so the result is returned without copying.
+// The memory is released with the context, also when an error is raised during building.
+class bson_builder
+{
+public:
+
+    explicit bson_builder(int initial_size = 512);
+
+    mongo::BSONObjBuilder& builder() { return _builder; }
+
+    // finishes the object, returns bson varlena. The builder can't be used afterwards
+    bytea* finish();
+
+private:
+
+    static mongo::BufBuilder& reserve_header(mongo::BufBuilder& buffer);
+
+    mongo::BufBuilder _buffer;
+    mongo::BSONObjBuilder _builder;
+};
+
+inline mongo::BSONObj datum_get_bson(Datum val)
 {
     bytea* data = DatumGetBson(val);
     return mongo::BSONObj(VARDATA_ANY(data));
@@ -68,6 +116,15 @@ inline mongo::BSONObj datum_get_bson(Datum* val)
 
 std::string get_typename(Oid typid);
 
+// array field names, "0", "1", ...; buffer must have 12 bytes
+const char* index_name(int index, char* buffer);
+
+// numeric as int64, if it's integral and in range. d is the numeric converted to double
+bool numeric_to_int64(Datum numeric, double d, int64* result);
+
+// BSON Date (milliseconds since the Unix epoch) as timestamp, extreme values as infinities
+Timestamp bson_date_to_timestamp(long long ms);
+
 // bson object inspection
 
 
@@ -95,18 +152,102 @@ struct convertion_error
 
 const char* bson_type_name(const mongo::BSONElement& e);
 
+// compiled (dotted) field path
+//
+// The path is split into segments once. Lookup follows the semantics of BSONObj::getFieldDotted:
+// on each level the remaining part of the path is tried as a literal field name first,
+// then the walk descends into the object or array named by the next segment.
+// Allocated as a single palloc chunk, so it can be kept in fn_extra.
+
+struct compiled_path_segment
+{
+    int offset; // offset of the segment in path
+    int length;
+};
+
+struct compiled_path
+{
+    int length; // path length, excluding the null terminator
+    int n_segments;
+    char* path; // null-terminated copy of the path, stored after the segments
+    compiled_path_segment segments[1]; // actually n_segments
+};
+
+compiled_path* compile_path(const char* path, int length, MemoryContext ctx);
+
+// compiles path given as text in the database encoding
+compiled_path* compile_text_path(const text* path, MemoryContext ctx);
+
+// returns path compiled from function argument, cached in fn_extra between calls
+const compiled_path* get_cached_path(PG_FUNCTION_ARGS, int argno);
+
+// context for a cache kept in fn_extra which is rebuilt when an argument changes: a new child of parent
+// (fn_mcxt), previous one (if not NULL) is deleted with everything allocated in it
+MemoryContext new_cache_context(MemoryContext parent, MemoryContext previous);
+
+mongo::BSONElement get_field(const mongo::BSONObj& object, const compiled_path* path);
+
+// one step of get_field: returns the field named like the rest of the path starting at given segment,
+// if there is none, sets segment_field to the first field named like the segment (or eoo)
+mongo::BSONElement get_field_level(const mongo::BSONObj& object, const compiled_path* path, int segment,
+    mongo::BSONElement* segment_field);
+
+// looks up several paths in one walk over the object. results[i] is eoo if paths[i] doesn't exist
+void get_fields(const mongo::BSONObj& object, const compiled_path* const* paths, int n_paths, mongo::BSONElement* results);
+
+// returns size of BSON element starting at p, -1 if the bytes needed to compute it are not within [p, end)
+// or the type is unknown
+int element_size_bounded(const char* p, const char* end);
+
+// field lookup on a prefix of the document (available bytes of it)
+// returns false if the prefix is too short to tell
+bool get_field_prefix(const char* data, std::size_t available, const compiled_path* path, mongo::BSONElement* result);
+
+// field lookup on bson datum. Values stored externally without compression are detoasted
+// in growing slices, only as much as the lookup needs
+mongo::BSONElement get_field_detoast(Datum datum, const compiled_path* path);
+
+// converts element, reports conversion errors
+template<typename FieldType>
+Datum convert_field(PG_FUNCTION_ARGS, const mongo::BSONElement e, const char* field_name)
+{
+    try
+    {
+        return convert_element<FieldType>(fcinfo, e);
+    }
+    catch(const convertion_error& ex)
+    {
+        ereport(
+            ERROR,
+                (
+                errcode(ERRCODE_INTERNAL_ERROR),
+                errmsg("Field %s is of type %s and can not be converted to %s",
+                    field_name, bson_type_name(e), ex.target_type)
+                )
+            );
+    }
+    catch(const std::exception& ex)
+    {
+        ereport(
+            ERROR,
+                (
+                errcode(ERRCODE_INTERNAL_ERROR),
+                errmsg("Error converting filed %s of type %s: %s",
+                    field_name, bson_type_name(e), ex.what())
+                )
+            );
+    }
+    return (Datum) 0; // not reached
+}
+
 template<typename FieldType>
 static
 Datum bson_get(PG_FUNCTION_ARGS)
 {
-    bytea* arg = GETARG_BSON(0);
-    mongo::BSONObj object(VARDATA_ANY(arg));
-
-    text* arg2 = PG_GETARG_TEXT_P(1);
-    std::string field_name(VARDATA(arg2),  VARSIZE(arg2)-VARHDRSZ);
+    const compiled_path* path = get_cached_path(fcinfo, 1);
 
-    PGBSON_LOG << "bson_get: field: " << field_name << PGBSON_ENDL;
-    mongo::BSONElement e = object.getFieldDotted(field_name);
+    PGBSON_LOG << "bson_get: field: " << path->path << PGBSON_ENDL;
+    mongo::BSONElement e = get_field_detoast(PG_GETARG_DATUM(0), path);
     if (e.eoo())
     {
         PGBSON_LOG << "bson_get: no such field" << PGBSON_ENDL;
@@ -115,40 +256,24 @@ Datum bson_get(PG_FUNCTION_ARGS)
     }
     else
     {
-        try
-        {
-            return convert_element<FieldType>(fcinfo, e);
-        }
-        catch(const convertion_error& ex)
-        {
-            ereport(
-                ERROR,
-                    (
-                    errcode(ERRCODE_INTERNAL_ERROR),
-                    errmsg("Field %s is of type %s and can not be converted to %s",
-                        field_name.c_str(), bson_type_name(e), ex.target_type)
-                    )
-                );
-        }
-        catch(const std::exception& ex)
-        {
-            ereport(
-                ERROR,
-                    (
-                    errcode(ERRCODE_INTERNAL_ERROR),
-                    errmsg("Error converting filed %s of type %s: %s",
-                        field_name.c_str(), bson_type_name(e), ex.what())
-                    )
-                );
-        }
+        return convert_field<FieldType>(fcinfo, e, path->path);
     }
 }
 
-// bson manipulation/creation
+// returns element as bson. Objects are returned as they are,
+// other values are wrapped in object with single, anonymous field
+Datum element_to_bson(const mongo::BSONElement& e);
 
-void composite_to_bson(mongo::BSONObjBuilder& builder, Datum composite);
+// maps double to unsigned integer with the same order (compareElementValues order, NaN first)
+uint64 order_preserving_double(double d);
+
+// abbreviated key for sorting: order-preserving prefix built from the first element's
+// canonical type, field name and value. If keys differ, they compare like the objects (woCompare)
+Datum abbreviate_bson(const mongo::BSONObj& object);
+
+// bson manipulation/creation
 
-void datum_to_bson(const char* field_name, mongo::BSONObjBuilder& builder,
-    Datum val, bool is_null, Oid typid);
+// appends fields of the row, conversion plan for the row type is cached in fn_extra
+void composite_to_bson(FmgrInfo* flinfo, mongo::BSONObjBuilder& builder, Datum composite);
 
 #endif
@@ -0,0 +1,1378 @@
+// Copyright (c) 2012-2013 Maciej Gajewski <maciej.gajewski0@gmail.com>
+// 
+// Permission to use, copy, modify, and distribute this software and its documentation for any purpose, without fee, and without a written agreement is hereby granted,
+// provided that the above copyright notice and this paragraph and the following two paragraphs appear in all copies.
+// 
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, 
+// ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+// THE AUTHOR SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+// THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE AUTHOR HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+
+#include "pgbson_json.hpp"
+#include "pgbson_validate.hpp"
+#include "pgbson_scan.hpp"
+
+#include "mongo/util/base64.h"
+
+extern "C" {
+#include <miscadmin.h>
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PGBSON_JSON_SIMD
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+
+namespace {
+
+// thrown when the input is left to mongo::fromjson
+struct unsupported_json {};
+
+// string scanning
+//
+// Returns the first byte in [p, end) which needs attention inside of a string: quote, backslash,
+// control character or non-ASCII byte (start of UTF-8 sequence to validate). Returns end if there is none.
+
+struct string_stop_table
+{
+    bool stop[256];
+
+    string_stop_table()
+    {
+        for (int c = 0; c < 256; c++)
+            stop[c] = c < 0x20 || c >= 0x80 || c == '"' || c == '\\';
+    }
+};
+
+const string_stop_table string_stops;
+
+const char* scan_string_scalar(const char* p, const char* end)
+{
+    while (p < end && !string_stops.stop[static_cast<unsigned char>(*p)])
+        p++;
+    return p;
+}
+
+#ifdef PGBSON_JSON_SIMD
+
+__attribute__((target("sse4.2")))
+const char* scan_string_sse42(const char* p, const char* end)
+{
+    // byte ranges to stop at: 00-1f, '"', '\\', 80-ff
+    const __m128i ranges = _mm_setr_epi8(0x00, 0x1f, '"', '"', '\\', '\\', (char) 0x80, (char) 0xff,
+        0, 0, 0, 0, 0, 0, 0, 0);
+    while (end - p >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int index = _mm_cmpestri(ranges, 8, chunk, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+        if (index < 16)
+            return p + index;
+        p += 16;
+    }
+    return scan_string_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+const char* scan_string_avx2(const char* p, const char* end)
+{
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i last_control = _mm256_set1_epi8(0x1f);
+    while (end - p >= 32)
+    {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i stops = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote), _mm256_cmpeq_epi8(chunk, backslash)),
+            _mm256_cmpeq_epi8(_mm256_min_epu8(chunk, last_control), chunk)); // chunk <= 0x1f
+        // non-ASCII bytes have the high bit set already
+        uint32 mask = static_cast<uint32>(_mm256_movemask_epi8(_mm256_or_si256(stops, chunk)));
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return scan_string_scalar(p, end);
+}
+
+#endif
+
+typedef const char* (*scan_string_function)(const char* p, const char* end);
+
+scan_string_function choose_scan_string()
+{
+#ifdef PGBSON_JSON_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return scan_string_avx2;
+    if (__builtin_cpu_supports("sse4.2"))
+        return scan_string_sse42;
+#endif
+    return scan_string_scalar;
+}
+
+const scan_string_function scan_string = choose_scan_string();
+
+inline bool is_space(char c)
+{
+    // same as isspace() in C locale, used by mongo::fromjson
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' || c == '\f';
+}
+
+inline bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+inline int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// palloc-ed varlena, growing as BSON is written
+class output_buffer
+{
+public:
+
+    explicit output_buffer(std::size_t initial_capacity)
+    {
+        _capacity = VARHDRSZ + initial_capacity;
+        _data = reinterpret_cast<char*>(palloc(_capacity));
+        _size = VARHDRSZ;
+    }
+
+    char* data() const { return _data; }
+    std::size_t size() const { return _size; }
+
+    void truncate(std::size_t size) { _size = size; }
+
+    void put_byte(char c)
+    {
+        reserve(1);
+        _data[_size++] = c;
+    }
+
+    void put(const void* p, std::size_t length)
+    {
+        reserve(length);
+        std::memcpy(_data + _size, p, length);
+        _size += length;
+    }
+
+    template<typename T>
+    void put_number(T value) // little-endian, as the rest of the driver assumes
+    {
+        put(&value, sizeof(value));
+    }
+
+    void set_byte(std::size_t pos, char c) { _data[pos] = c; }
+
+    // array index as element name
+    void put_index(uint32 index)
+    {
+        char digits[10];
+        int n = 0;
+        do
+        {
+            digits[n++] = '0' + index % 10;
+            index /= 10;
+        } while (index > 0);
+
+        reserve(n + 1);
+        while (n > 0)
+            _data[_size++] = digits[--n];
+        _data[_size++] = 0;
+    }
+
+    // document (object or array) is started with length placeholder, filled when it's finished
+    std::size_t begin_document()
+    {
+        std::size_t start = _size;
+        put_number<int32>(0);
+        return start;
+    }
+
+    void end_document(std::size_t start)
+    {
+        put_byte(0);
+        int32 length = _size - start;
+        std::memcpy(_data + start, &length, sizeof(length));
+    }
+
+    void reserve(std::size_t n)
+    {
+        if (_size + n > _capacity)
+            grow(n);
+    }
+
+private:
+
+    void grow(std::size_t n)
+    {
+        // mongo::fromjson fails on objects over the limit, leave them to it
+        std::size_t max_size = VARHDRSZ + mongo::BSONObjMaxInternalSize;
+        if (_size + n > max_size)
+            throw unsupported_json();
+
+        std::size_t new_capacity = std::max(_capacity * 2, _size + n);
+        new_capacity = std::min(new_capacity, max_size);
+        _data = reinterpret_cast<char*>(repalloc(_data, new_capacity));
+        _capacity = new_capacity;
+    }
+
+    char* _data;
+    std::size_t _size;
+    std::size_t _capacity;
+};
+
+// extended JSON objects: {"$oid": ...} etc.
+enum extended_kind
+{
+    extended_none,
+    extended_oid,
+    extended_binary,
+    extended_date,
+    extended_timestamp,
+    extended_regex,
+    extended_ref,
+    extended_undefined
+};
+
+extended_kind get_extended_kind(const char* name)
+{
+    if (name[0] != '$')
+        return extended_none;
+    if (std::strcmp(name, "$oid") == 0)
+        return extended_oid;
+    if (std::strcmp(name, "$binary") == 0)
+        return extended_binary;
+    if (std::strcmp(name, "$date") == 0)
+        return extended_date;
+    if (std::strcmp(name, "$timestamp") == 0)
+        return extended_timestamp;
+    if (std::strcmp(name, "$regex") == 0)
+        return extended_regex;
+    if (std::strcmp(name, "$ref") == 0)
+        return extended_ref;
+    if (std::strcmp(name, "$undefined") == 0)
+        return extended_undefined;
+    return extended_none;
+}
+
+// Recursive descent parser. Follows mongo::JParse, everything it doesn't handle the same way throws unsupported_json.
+// Elements are written as type placeholder, name and value; the type is set once the value is parsed.
+class json_parser
+{
+public:
+
+    json_parser(const char* json, std::size_t length)
+        : _p(json), _end(json + length), _depth(0), _out(length + 64)
+    {
+    }
+
+    bytea* parse()
+    {
+        skip_space();
+        expect('{');
+        parse_object(false);
+        if (_out.size() > VARHDRSZ + mongo::BSONObjMaxInternalSize)
+            throw unsupported_json();
+
+        SET_VARSIZE(_out.data(), _out.size());
+        return reinterpret_cast<bytea*>(_out.data());
+    }
+
+    bytea* buffer() const { return reinterpret_cast<bytea*>(_out.data()); }
+
+private:
+
+    void skip_space()
+    {
+        while (is_space(*_p))
+            _p++;
+    }
+
+    void expect(char c)
+    {
+        skip_space();
+        if (*_p != c)
+            throw unsupported_json();
+        _p++;
+    }
+
+    // matches token without word boundary check, as mongo::fromjson does
+    bool accept_token(const char* token, std::size_t length)
+    {
+        if (std::strncmp(_p, token, length) != 0)
+            return false;
+        _p += length;
+        return true;
+    }
+
+    // parses object after '{', returns type of the written value (Object, unless it was extended JSON)
+    char parse_object(bool nested)
+    {
+        check_stack_depth();
+
+        std::size_t start = _out.begin_document();
+        skip_space();
+        if (*_p == '}')
+        {
+            _p++;
+            _out.end_document(start);
+            return mongo::Object;
+        }
+
+        std::size_t type_pos = _out.size();
+        _out.put_byte(0);
+        parse_name();
+
+        extended_kind kind = get_extended_kind(_out.data() + type_pos + 1);
+        if (kind != extended_none)
+        {
+            if (!nested)
+                throw unsupported_json(); // reserved name in top-level object
+            _out.truncate(start);
+            char type = parse_extended(kind);
+            expect('}');
+            return type;
+        }
+
+        for (;;)
+        {
+            expect(':');
+            parse_value(type_pos);
+
+            skip_space();
+            if (*_p == ',')
+            {
+                _p++;
+                type_pos = _out.size();
+                _out.put_byte(0);
+                parse_name();
+            }
+            else if (*_p == '}')
+            {
+                _p++;
+                break;
+            }
+            else
+            {
+                throw unsupported_json();
+            }
+        }
+
+        _out.end_document(start);
+        return mongo::Object;
+    }
+
+    // parses array after '['
+    void parse_array()
+    {
+        check_stack_depth();
+
+        std::size_t start = _out.begin_document();
+        skip_space();
+        if (*_p == ']')
+        {
+            _p++;
+            _out.end_document(start);
+            return;
+        }
+
+        for (uint32 index = 0;; index++)
+        {
+            std::size_t type_pos = _out.size();
+            _out.put_byte(0);
+            _out.put_index(index);
+            parse_value(type_pos);
+
+            skip_space();
+            if (*_p == ',')
+            {
+                _p++;
+            }
+            else if (*_p == ']')
+            {
+                _p++;
+                break;
+            }
+            else
+            {
+                throw unsupported_json();
+            }
+        }
+
+        _out.end_document(start);
+    }
+
+    void parse_value(std::size_t type_pos)
+    {
+        skip_space();
+        char type;
+        switch (*_p)
+        {
+            case '{':
+                _p++;
+                enter();
+                type = parse_object(true);
+                _depth--;
+                break;
+
+            case '[':
+                _p++;
+                enter();
+                parse_array();
+                _depth--;
+                type = mongo::Array;
+                break;
+
+            case '"':
+            {
+                _p++;
+                std::size_t length_pos = _out.size();
+                _out.put_number<int32>(0);
+                parse_string();
+                _out.put_byte(0);
+                int32 length = _out.size() - length_pos - sizeof(int32);
+                std::memcpy(_out.data() + length_pos, &length, sizeof(length));
+                type = mongo::String;
+                break;
+            }
+
+            case 't':
+                if (!accept_token("true", 4))
+                    throw unsupported_json();
+                _out.put_byte(1);
+                type = mongo::Bool;
+                break;
+
+            case 'f':
+                if (!accept_token("false", 5))
+                    throw unsupported_json();
+                _out.put_byte(0);
+                type = mongo::Bool;
+                break;
+
+            case 'n':
+                if (!accept_token("null", 4))
+                    throw unsupported_json(); // may be 'new Date(...)'
+                type = mongo::jstNULL;
+                break;
+
+            default:
+                type = parse_number();
+                break;
+        }
+        _out.set_byte(type_pos, type);
+    }
+
+    // name after opening quote, written with null terminator
+    void parse_name()
+    {
+        skip_space();
+        if (*_p != '"')
+            throw unsupported_json();
+        _p++;
+        parse_string();
+        _out.put_byte(0);
+    }
+
+    // string contents after opening quote, up to and including closing quote
+    // strings with null characters are left to mongo::fromjson
+    void parse_string()
+    {
+        for (;;)
+        {
+            const char* stop = scan_string(_p, _end);
+            _out.put(_p, stop - _p);
+            _p = stop;
+            if (_p == _end)
+                throw unsupported_json();
+
+            unsigned char c = *_p;
+            if (c == '"')
+            {
+                _p++;
+                return;
+            }
+            else if (c == '\\')
+            {
+                parse_escape();
+            }
+            else if (c >= 0x80)
+            {
+                int length = utf8_sequence_length(
+                    reinterpret_cast<const unsigned char*>(_p), reinterpret_cast<const unsigned char*>(_end));
+                if (length == 0)
+                    throw unsupported_json();
+                _out.put(_p, length);
+                _p += length;
+            }
+            else
+            {
+                throw unsupported_json(); // control character
+            }
+        }
+    }
+
+    void parse_escape()
+    {
+        char c;
+        switch (_p[1])
+        {
+            case '"':  c = '"'; break;
+            case '\'': c = '\''; break;
+            case '\\': c = '\\'; break;
+            case '/':  c = '/'; break;
+            case 'b':  c = '\b'; break;
+            case 'f':  c = '\f'; break;
+            case 'n':  c = '\n'; break;
+            case 'r':  c = '\r'; break;
+            case 't':  c = '\t'; break;
+            case 'v':  c = '\v'; break;
+            case 'u':
+                parse_unicode_escape();
+                return;
+            default:
+                throw unsupported_json();
+        }
+        _out.put_byte(c);
+        _p += 2;
+    }
+
+    // \uXXXX, or a surrogate pair as two escapes. mongo::fromjson encodes surrogates one by one,
+    // which is not valid UTF-8, so unpaired surrogates are left to it and rejected by the validator
+    void parse_unicode_escape()
+    {
+        uint32 code = parse_hex4(_p + 2);
+        _p += 6;
+        if (code == 0 || (code >= 0xdc00 && code <= 0xdfff))
+            throw unsupported_json();
+
+        if (code >= 0xd800 && code <= 0xdbff)
+        {
+            if (_p[0] != '\\' || _p[1] != 'u')
+                throw unsupported_json();
+            uint32 low = parse_hex4(_p + 2);
+            if (low < 0xdc00 || low > 0xdfff)
+                throw unsupported_json();
+            _p += 6;
+            code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+        }
+
+        if (code < 0x80)
+        {
+            _out.put_byte(code);
+        }
+        else if (code < 0x800)
+        {
+            _out.put_byte(0xc0 | (code >> 6));
+            _out.put_byte(0x80 | (code & 0x3f));
+        }
+        else if (code < 0x10000)
+        {
+            _out.put_byte(0xe0 | (code >> 12));
+            _out.put_byte(0x80 | ((code >> 6) & 0x3f));
+            _out.put_byte(0x80 | (code & 0x3f));
+        }
+        else
+        {
+            _out.put_byte(0xf0 | (code >> 18));
+            _out.put_byte(0x80 | ((code >> 12) & 0x3f));
+            _out.put_byte(0x80 | ((code >> 6) & 0x3f));
+            _out.put_byte(0x80 | (code & 0x3f));
+        }
+    }
+
+    // 4 hex digits
+    static uint32 parse_hex4(const char* p)
+    {
+        uint32 code = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            int digit = hex_value(p[i]); // stops at the null terminator
+            if (digit < 0)
+                throw unsupported_json();
+            code = code * 16 + digit;
+        }
+        return code;
+    }
+
+    // JSON number. Integers are converted directly, other numbers with the same strtod/strtoll
+    // logic as mongo::fromjson: int if it fits, then long long, then double
+    char parse_number()
+    {
+        const char* start = _p;
+        const char* q = _p;
+        if (*q == '-')
+            q++;
+        if (!is_digit(*q))
+            throw unsupported_json(); // NaN, Infinity, constructors...
+
+        const char* digits = q;
+        while (is_digit(*q))
+            q++;
+        bool integer = true;
+        if (*q == '.')
+        {
+            integer = false;
+            q++;
+            while (is_digit(*q))
+                q++;
+        }
+        if (*q == 'e' || *q == 'E')
+        {
+            integer = false;
+            q++;
+            if (*q == '+' || *q == '-')
+                q++;
+            if (!is_digit(*q))
+                throw unsupported_json();
+            while (is_digit(*q))
+                q++;
+        }
+
+        if (integer && q - digits <= 18)
+        {
+            int64 value = 0;
+            for (const char* d = digits; d < q; d++)
+                value = value * 10 + (*d - '0');
+            if (*start == '-')
+                value = -value;
+            _p = q;
+            return put_integer(value);
+        }
+
+        errno = 0;
+        char* end_double;
+        double d = std::strtod(start, &end_double);
+        if (end_double != q || errno == ERANGE)
+            throw unsupported_json();
+
+        errno = 0;
+        char* end_integer;
+        long long ll = std::strtoll(start, &end_integer, 10);
+        _p = q;
+        if (end_integer < end_double || errno == ERANGE)
+        {
+            _out.put_number<double>(d);
+            return mongo::NumberDouble;
+        }
+        return put_integer(ll);
+    }
+
+    char put_integer(int64 value)
+    {
+        if (value == static_cast<int32>(value))
+        {
+            _out.put_number<int32>(value);
+            return mongo::NumberInt;
+        }
+        _out.put_number<int64>(value);
+        return mongo::NumberLong;
+    }
+
+    // value of extended JSON object, after the reserved name
+    char parse_extended(extended_kind kind)
+    {
+        expect(':');
+        skip_space();
+        switch (kind)
+        {
+            case extended_oid:
+                parse_oid();
+                return mongo::jstOID;
+
+            case extended_binary:
+                parse_binary();
+                return mongo::BinData;
+
+            case extended_date:
+                parse_date();
+                return mongo::Date;
+
+            case extended_timestamp:
+                parse_timestamp();
+                return mongo::Timestamp;
+
+            case extended_regex:
+                parse_regex();
+                return mongo::RegEx;
+
+            case extended_undefined:
+                if (!accept_token("true", 4))
+                    throw unsupported_json();
+                return mongo::Undefined;
+
+            default:
+                throw unsupported_json(); // DBRef
+        }
+    }
+
+    // quoted string without escapes
+    std::size_t parse_raw_string(const char** contents)
+    {
+        if (*_p != '"')
+            throw unsupported_json();
+        _p++;
+        const char* start = _p;
+        while (*_p != '"')
+        {
+            if (*_p == '\\' || *_p == 0)
+                throw unsupported_json();
+            _p++;
+        }
+        *contents = start;
+        return _p++ - start;
+    }
+
+    // name of a field in extended JSON object, compared without unescaping
+    void expect_name(const char* quoted_name)
+    {
+        skip_space();
+        if (!accept_token(quoted_name, std::strlen(quoted_name)))
+            throw unsupported_json();
+    }
+
+    void parse_oid()
+    {
+        const char* hex;
+        if (parse_raw_string(&hex) != 24)
+            throw unsupported_json();
+
+        char oid[12];
+        for (int i = 0; i < 12; i++)
+        {
+            int high = hex_value(hex[2*i]);
+            int low = hex_value(hex[2*i + 1]);
+            if (high < 0 || low < 0)
+                throw unsupported_json();
+            oid[i] = high * 16 + low;
+        }
+        _out.put(oid, sizeof(oid));
+    }
+
+    void parse_binary()
+    {
+        const char* data;
+        std::size_t length = parse_raw_string(&data);
+        if (length % 4 != 0 || std::strspn(data, mongo::base64::chars) < length)
+            throw unsupported_json();
+        std::string decoded = mongo::base64::decode(std::string(data, length));
+
+        expect(',');
+        expect_name("\"$type\"");
+        expect(':');
+        skip_space();
+        const char* subtype;
+        if (parse_raw_string(&subtype) != 2 || hex_value(subtype[0]) < 0 || hex_value(subtype[1]) < 0)
+            throw unsupported_json();
+
+        _out.put_number<int32>(decoded.length());
+        _out.put_byte(hex_value(subtype[0]) * 16 + hex_value(subtype[1]));
+        _out.put(decoded.data(), decoded.length());
+    }
+
+    // milliseconds, negative or unsigned (as printed by jsonString)
+    void parse_date()
+    {
+        errno = 0;
+        char* end;
+        unsigned long long date = static_cast<unsigned long long>(std::strtoll(_p, &end, 10));
+        if (end == _p)
+            throw unsupported_json();
+        if (errno == ERANGE)
+        {
+            errno = 0;
+            date = std::strtoull(_p, &end, 10);
+            if (errno == ERANGE)
+                throw unsupported_json();
+        }
+        _p = end;
+        _out.put_number<unsigned long long>(date);
+    }
+
+    // {"t": seconds, "i": increment}
+    void parse_timestamp()
+    {
+        expect('{');
+        expect_name("\"t\"");
+        expect(':');
+        uint32 seconds = parse_timestamp_part();
+        expect(',');
+        expect_name("\"i\"");
+        expect(':');
+        uint32 increment = parse_timestamp_part();
+        expect('}');
+
+        _out.put_number<uint64>((static_cast<uint64>(seconds) << 32) | increment);
+    }
+
+    uint32 parse_timestamp_part()
+    {
+        skip_space();
+        if (*_p == '-')
+            throw unsupported_json();
+        errno = 0;
+        char* end;
+        unsigned long value = std::strtoul(_p, &end, 10);
+        if (errno == ERANGE || end == _p)
+            throw unsupported_json();
+        _p = end;
+        return value; // truncated, like in mongo::fromjson
+    }
+
+    void parse_regex()
+    {
+        if (*_p != '"')
+            throw unsupported_json();
+        _p++;
+        parse_string();
+        _out.put_byte(0);
+
+        skip_space();
+        if (*_p == ',')
+        {
+            _p++;
+            expect_name("\"$options\"");
+            expect(':');
+            skip_space();
+            const char* options;
+            std::size_t length = parse_raw_string(&options);
+            for (std::size_t i = 0; i < length; i++)
+            {
+                if (std::strchr("gims", options[i]) == NULL)
+                    throw unsupported_json();
+            }
+            _out.put(options, length);
+        }
+        _out.put_byte(0);
+    }
+
+    // too deep documents are left to mongo::fromjson, the result is then rejected by the validator
+    void enter()
+    {
+        if (_depth == max_bson_depth)
+            throw unsupported_json();
+        _depth++;
+    }
+
+    const char* _p;
+    const char* _end;
+    int _depth;
+    output_buffer _out;
+};
+
+}
+
+bytea* json_to_bson(const char* json, std::size_t length)
+{
+    if (length == 0)
+        return NULL; // empty object, mongo::fromjson handles it
+
+    json_parser parser(json, length);
+    try
+    {
+        return parser.parse();
+    }
+    catch(const unsupported_json&)
+    {
+        pfree(parser.buffer());
+        return NULL;
+    }
+}
+
+namespace {
+
+// escaped forms of bytes, as produced by mongo::escape (used by jsonString)
+struct json_escape_table
+{
+    unsigned char length[256]; // 0 if the byte is copied as is
+    char text[256][6];
+
+    json_escape_table()
+    {
+        static const char hex[] = "0123456789abcdef";
+        for (int c = 0; c < 256; c++)
+        {
+            length[c] = 0;
+            if (c < 0x20)
+            {
+                std::memcpy(text[c], "\\u00", 4);
+                text[c][4] = hex[c >> 4];
+                text[c][5] = hex[c & 0xf];
+                length[c] = 6;
+            }
+        }
+        set('"', "\\\"");
+        set('\\', "\\\\");
+        set('\b', "\\b");
+        set('\f', "\\f");
+        set('\n', "\\n");
+        set('\r', "\\r");
+        set('\t', "\\t");
+    }
+
+    void set(unsigned char c, const char* escaped)
+    {
+        length[c] = std::strlen(escaped);
+        std::memcpy(text[c], escaped, length[c]);
+    }
+};
+
+const json_escape_table json_escapes;
+
+void append_escaped(StringInfo out, const char* s, std::size_t length)
+{
+    const char* run = s;
+    const char* end = s + length;
+    for (const char* p = s; p < end; p++)
+    {
+        unsigned char c = *p;
+        if (json_escapes.length[c] != 0)
+        {
+            appendBinaryStringInfo(out, run, p - run);
+            appendBinaryStringInfo(out, json_escapes.text[c], json_escapes.length[c]);
+            run = p + 1;
+        }
+    }
+    appendBinaryStringInfo(out, run, end - run);
+}
+
+inline void append_literal(StringInfo out, const char* s)
+{
+    appendBinaryStringInfo(out, s, std::strlen(s));
+}
+
+void append_uint64(StringInfo out, uint64 value, bool negative = false)
+{
+    char buffer[24];
+    char* end = buffer + sizeof(buffer);
+    char* p = end;
+    do
+    {
+        *--p = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+    if (negative)
+        *--p = '-';
+    appendBinaryStringInfo(out, p, end - p);
+}
+
+void append_int64(StringInfo out, int64 value)
+{
+    if (value < 0)
+        append_uint64(out, -static_cast<uint64>(value), true);
+    else
+        append_uint64(out, value);
+}
+
+const int double_digits = 16; // stream precision set by jsonString
+
+#ifdef __SIZEOF_INT128__
+
+// rounds |d| (not an integer, below 2^53) to 16 significant digits. Returns false if the scaling
+// doesn't fit in 128 bits (|d| below 1e-7).
+// digits is set to the 16-digit integer, exponent to the decimal exponent of its first digit
+bool round_double(double d, uint64* digits, int* exponent)
+{
+    int binary_exponent;
+    double fraction = std::frexp(std::fabs(d), &binary_exponent); // |d| = fraction * 2^binary_exponent
+    uint64 mantissa = static_cast<uint64>(std::ldexp(fraction, 53)); // exact
+    int shift = 53 - binary_exponent; // |d| = mantissa / 2^shift, shift > 0 for non-integers
+
+    static const uint64 low = 1000000000000000ULL; // 10^15
+    static const uint64 high = 10000000000000000ULL; // 10^16
+
+    int e = static_cast<int>(std::floor(std::log10(std::fabs(d))));
+    for (;;)
+    {
+        int scale = double_digits - 1 - e; // |d| * 10^scale has 16 digits before the point
+        if (scale < 0 || scale > 22 || shift > 127)
+            return false;
+
+        unsigned __int128 power = 1;
+        for (int i = 0; i < scale; i++)
+            power *= 10;
+        unsigned __int128 scaled = mantissa * power; // < 2^53 * 10^22 < 2^127
+        uint64 q = static_cast<uint64>(scaled >> shift);
+        if (q >= high)
+        {
+            e++;
+            continue;
+        }
+        if (q < low)
+        {
+            e--;
+            continue;
+        }
+
+        // round half to even, as printf does
+        unsigned __int128 remainder = scaled - (static_cast<unsigned __int128>(q) << shift);
+        unsigned __int128 half = static_cast<unsigned __int128>(1) << (shift - 1);
+        if (remainder > half || (remainder == half && (q & 1)))
+            q++;
+        if (q == high)
+        {
+            q = low;
+            e++;
+        }
+        *digits = q;
+        *exponent = e;
+        return true;
+    }
+}
+
+#endif
+
+// formats 16 significant digits like %g
+void append_digits(StringInfo out, bool negative, uint64 digits, int exponent)
+{
+    char buffer[double_digits];
+    for (int i = double_digits - 1; i >= 0; i--)
+    {
+        buffer[i] = '0' + digits % 10;
+        digits /= 10;
+    }
+    int n = double_digits;
+    while (n > 1 && buffer[n - 1] == '0')
+        n--;
+
+    if (negative)
+        appendStringInfoChar(out, '-');
+
+    if (exponent < -4 || exponent >= double_digits)
+    {
+        appendStringInfoChar(out, buffer[0]);
+        if (n > 1)
+        {
+            appendStringInfoChar(out, '.');
+            appendBinaryStringInfo(out, buffer + 1, n - 1);
+        }
+        appendStringInfoChar(out, 'e');
+        appendStringInfoChar(out, exponent < 0 ? '-' : '+');
+        int abs_exponent = exponent < 0 ? -exponent : exponent;
+        if (abs_exponent < 10)
+            appendStringInfoChar(out, '0');
+        append_uint64(out, abs_exponent);
+    }
+    else if (exponent >= 0)
+    {
+        int integer_digits = exponent + 1;
+        appendBinaryStringInfo(out, buffer, std::min(n, integer_digits));
+        for (int i = n; i < integer_digits; i++)
+            appendStringInfoChar(out, '0');
+        if (n > integer_digits)
+        {
+            appendStringInfoChar(out, '.');
+            appendBinaryStringInfo(out, buffer + integer_digits, n - integer_digits);
+        }
+    }
+    else
+    {
+        appendStringInfoString(out, "0.");
+        for (int i = -1; i > exponent; i--)
+            appendStringInfoChar(out, '0');
+        appendBinaryStringInfo(out, buffer, n);
+    }
+}
+
+void append_double(StringInfo out, double d)
+{
+    if (d != d)
+    {
+        append_literal(out, "NaN");
+        return;
+    }
+    if (d > std::numeric_limits<double>::max() || d < -std::numeric_limits<double>::max())
+    {
+        append_literal(out, d > 0 ? "Infinity" : "-Infinity");
+        return;
+    }
+
+    // integers with up to 16 digits are printed as they are
+    if (std::fabs(d) < 9007199254740992.0 && d == std::floor(d))
+    {
+        if (d == 0 && std::signbit(d))
+            append_literal(out, "-0");
+        else
+            append_int64(out, static_cast<int64>(d));
+        return;
+    }
+
+#ifdef __SIZEOF_INT128__
+    uint64 digits;
+    int exponent;
+    if (std::fabs(d) < 9007199254740992.0 && round_double(d, &digits, &exponent))
+    {
+        append_digits(out, d < 0, digits, exponent);
+        return;
+    }
+#endif
+
+    char buffer[32];
+    int length = snprintf(buffer, sizeof(buffer), "%.16g", d);
+    appendBinaryStringInfo(out, buffer, length);
+}
+
+void append_hex(StringInfo out, const unsigned char* data, std::size_t length)
+{
+    static const char hex[] = "0123456789abcdef";
+    for (std::size_t i = 0; i < length; i++)
+    {
+        appendStringInfoChar(out, hex[data[i] >> 4]);
+        appendStringInfoChar(out, hex[data[i] & 0xf]);
+    }
+}
+
+void append_base64(StringInfo out, const unsigned char* data, int length)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    enlargeStringInfo(out, (length + 2) / 3 * 4);
+    char* p = out->data + out->len;
+    int i = 0;
+    for (; i + 3 <= length; i += 3)
+    {
+        uint32 triple = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+        *p++ = alphabet[triple >> 18];
+        *p++ = alphabet[(triple >> 12) & 0x3f];
+        *p++ = alphabet[(triple >> 6) & 0x3f];
+        *p++ = alphabet[triple & 0x3f];
+    }
+    if (length - i == 1)
+    {
+        *p++ = alphabet[data[i] >> 2];
+        *p++ = alphabet[(data[i] & 0x3) << 4];
+        *p++ = '=';
+        *p++ = '=';
+    }
+    else if (length - i == 2)
+    {
+        *p++ = alphabet[data[i] >> 2];
+        *p++ = alphabet[((data[i] & 0x3) << 4) | (data[i + 1] >> 4)];
+        *p++ = alphabet[(data[i + 1] & 0xf) << 2];
+        *p++ = '=';
+    }
+    out->len = p - out->data;
+    *p = 0;
+}
+
+// values other than objects and arrays
+void append_scalar(StringInfo out, const mongo::BSONElement& e)
+{
+    switch (e.type())
+    {
+        case mongo::String:
+        case mongo::Symbol:
+            appendStringInfoChar(out, '"');
+            append_escaped(out, e.valuestr(), e.valuestrsize() - 1);
+            appendStringInfoChar(out, '"');
+            break;
+
+        case mongo::NumberLong:
+            append_int64(out, e._numberLong());
+            break;
+
+        case mongo::NumberInt:
+            append_int64(out, e._numberInt());
+            break;
+
+        case mongo::NumberDouble:
+            append_double(out, e._numberDouble());
+            break;
+
+        case mongo::Bool:
+            append_literal(out, e.boolean() ? "true" : "false");
+            break;
+
+        case mongo::jstNULL:
+            append_literal(out, "null");
+            break;
+
+        case mongo::Undefined:
+            append_literal(out, "{ \"$undefined\" : true }");
+            break;
+
+        case mongo::jstOID:
+            append_literal(out, "{ \"$oid\" : \"");
+            append_hex(out, reinterpret_cast<const unsigned char*>(e.value()), 12);
+            append_literal(out, "\" }");
+            break;
+
+        case mongo::BinData:
+        {
+            int length;
+            const char* data = e.binData(length);
+            append_literal(out, "{ \"$binary\" : \"");
+            append_base64(out, reinterpret_cast<const unsigned char*>(data), length);
+            append_literal(out, "\", \"$type\" : \"");
+            unsigned char subtype = e.binDataType();
+            append_hex(out, &subtype, 1);
+            append_literal(out, "\" }");
+            break;
+        }
+
+        case mongo::Date:
+            append_literal(out, "{ \"$date\" : ");
+            append_int64(out, e.date().asInt64());
+            append_literal(out, " }");
+            break;
+
+        case mongo::RegEx:
+            append_literal(out, "{ \"$regex\" : \"");
+            append_escaped(out, e.regex(), std::strlen(e.regex()));
+            append_literal(out, "\", \"$options\" : \"");
+            append_literal(out, e.regexFlags());
+            append_literal(out, "\" }");
+            break;
+
+        case mongo::Timestamp:
+            append_literal(out, "{ \"$timestamp\" : { \"t\" : ");
+            append_uint64(out, e.timestampTime() / 1000);
+            append_literal(out, ", \"i\" : ");
+            append_uint64(out, e.timestampInc());
+            append_literal(out, " } }");
+            break;
+
+        case mongo::MinKey:
+            append_literal(out, "{ \"$minKey\" : 1 }");
+            break;
+
+        case mongo::MaxKey:
+            append_literal(out, "{ \"$maxKey\" : 1 }");
+            break;
+
+        default:
+            // Code, CodeWScope, DBRef; throws for unknown types
+            append_literal(out, e.jsonString(mongo::Strict, false).c_str());
+            break;
+    }
+}
+
+// document being written
+struct json_frame
+{
+    const char* next; // next element
+    bool is_array;
+    bool first;
+    long position; // array position, gaps in sparse arrays are written as undefined
+};
+
+class json_writer
+{
+public:
+
+    explicit json_writer(StringInfo out)
+        : _out(out), _depth(0), _capacity(16)
+    {
+        _stack = reinterpret_cast<json_frame*>(palloc(_capacity * sizeof(json_frame)));
+    }
+
+    ~json_writer()
+    {
+        pfree(_stack);
+    }
+
+    void write(const char* data)
+    {
+        open(data, false);
+        while (_depth > 0)
+        {
+            json_frame& frame = _stack[_depth - 1];
+            if (*frame.next == mongo::EOO)
+            {
+                append_literal(_out, frame.is_array ? " ]" : " }");
+                _depth--;
+                continue;
+            }
+
+            mongo::BSONElement e(frame.next);
+            frame.next += element_size(frame.next);
+
+            if (!frame.first)
+                append_literal(_out, ", ");
+            frame.first = false;
+
+            if (frame.is_array)
+            {
+                // same as jsonString
+                for (long index = std::strtol(e.fieldName(), NULL, 10); index > frame.position; frame.position++)
+                    append_literal(_out, "undefined, ");
+                frame.position++;
+            }
+            else
+            {
+                appendStringInfoChar(_out, '"');
+                append_escaped(_out, e.fieldName(), e.fieldNameSize() - 1);
+                append_literal(_out, "\" : ");
+            }
+
+            // frame reference is not used after this, open() may move the stack
+            if (e.type() == mongo::Object)
+                open(e.value(), false);
+            else if (e.type() == mongo::Array)
+                open(e.value(), true);
+            else
+                append_scalar(_out, e);
+        }
+    }
+
+private:
+
+    void open(const char* data, bool is_array)
+    {
+        int32 size;
+        std::memcpy(&size, data, sizeof(size));
+        if (size <= 5)
+        {
+            append_literal(_out, is_array ? "[]" : "{}");
+            return;
+        }
+
+        append_literal(_out, is_array ? "[ " : "{ ");
+        if (_depth == _capacity)
+        {
+            _capacity *= 2;
+            _stack = reinterpret_cast<json_frame*>(repalloc(_stack, _capacity * sizeof(json_frame)));
+        }
+        json_frame& frame = _stack[_depth++];
+        frame.next = data + sizeof(int32);
+        frame.is_array = is_array;
+        frame.first = true;
+        frame.position = 0;
+    }
+
+    StringInfo _out;
+    json_frame* _stack;
+    int _depth;
+    int _capacity;
+};
+
+}
+
+void bson_to_json(StringInfo out, const char* data)
+{
+    json_writer writer(out);
+    writer.write(data);
+}
+
+void append_json_double(StringInfo out, double d)
+{
+    append_double(out, d);
+}
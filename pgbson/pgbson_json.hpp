@@ -0,0 +1,47 @@
+// Copyright (c) 2012-2013 Maciej Gajewski <maciej.gajewski0@gmail.com>
+// 
+// Permission to use, copy, modify, and distribute this software and its documentation for any purpose, without fee, and without a written agreement is hereby granted,
+// provided that the above copyright notice and this paragraph and the following two paragraphs appear in all copies.
+// 
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, 
+// ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+// THE AUTHOR SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+// THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE AUTHOR HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+
+#ifndef PGBSON_JSON_HPP
+#define PGBSON_JSON_HPP
+
+#include "pgbson_internal.hpp"
+
+// JSON input and output, used by bson_in and bson_out.
+//
+// Input
+//
+// The input is parsed in a single pass and BSON is written directly into a palloc-ed varlena.
+// String contents are scanned 16 or 32 bytes at a time with SSE4.2 or AVX2 (chosen at runtime,
+// with a scalar fallback), non-ASCII characters are checked to be valid UTF-8.
+//
+// Only the common subset of the syntax accepted by mongo::fromjson is handled: JSON with
+// double-quoted names and $oid, $date, $regex, $binary, $timestamp and $undefined objects.
+// Shell syntax (ObjectId(...), /regex/, unquoted or single-quoted names, NaN...), invalid input
+// and documents over the BSON size limit are left to mongo::fromjson, so the result of bson_in
+// doesn't depend on which parser was used.
+
+// returns bson varlena, or NULL if the input should be parsed with mongo::fromjson
+// json must be null-terminated
+bytea* json_to_bson(const char* json, std::size_t length);
+
+// Output
+//
+// Appends JSON of the object to the StringInfo, byte-identical to BSONObj::jsonString() (strict, not pretty).
+// Nested documents are walked with an explicit stack, strings are escaped using a table, numbers and
+// dates are formatted without iostreams. Doubles are printed like printf("%.16g"): values with a
+// fraction in the common range are rounded exactly with 128-bit integers, others use snprintf.
+// Types without special handling (Code, DBRef...) fall back to BSONElement::jsonString.
+void bson_to_json(StringInfo out, const char* data);
+
+// appends a double formatted as in bson_to_json
+void append_json_double(StringInfo out, double d);
+
+#endif
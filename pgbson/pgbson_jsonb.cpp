@@ -0,0 +1,573 @@
+// Copyright (c) 2012-2013 Maciej Gajewski <maciej.gajewski0@gmail.com>
+// 
+// Permission to use, copy, modify, and distribute this software and its documentation for any purpose, without fee, and without a written agreement is hereby granted,
+// provided that the above copyright notice and this paragraph and the following two paragraphs appear in all copies.
+// 
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, 
+// ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+// THE AUTHOR SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+// THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE AUTHOR HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+
+#include "pgbson_jsonb.hpp"
+#include "pgbson_json.hpp"
+
+#if PG_VERSION_NUM >= 90400
+
+#include "mongo/util/base64.h"
+
+extern "C" {
+#include <miscadmin.h>
+#include <utils/numeric.h>
+}
+
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <string>
+
+namespace {
+
+#if PG_VERSION_NUM >= 90500
+typedef JsonbIteratorToken jsonb_token;
+#else
+typedef int jsonb_token;
+#endif
+
+// jsonb -> BSON
+
+// jsonb strings are in the database encoding, BSON ones in UTF-8
+mongo::StringData string_data(const JsonbValue& v)
+{
+    int length = v.val.string.len;
+    const char* s = server_to_utf8(v.val.string.val, &length);
+    return mongo::StringData(s, length);
+}
+
+bool is_string(const JsonbValue* v, std::size_t length)
+{
+    return v != NULL && v->type == jbvString && static_cast<std::size_t>(v->val.string.len) == length;
+}
+
+bool is_integer(const JsonbValue* v, int64* result)
+{
+    if (v == NULL || v->type != jbvNumeric)
+        return false;
+    Datum numeric = NumericGetDatum(v->val.numeric);
+    double d = DatumGetFloat8(DirectFunctionCall1(numeric_float8, numeric));
+    return numeric_to_int64(numeric, d, result);
+}
+
+void append_number(mongo::BSONObjBuilder& builder, const mongo::StringData& name, Numeric n)
+{
+    Datum numeric = NumericGetDatum(n);
+    double d = DatumGetFloat8(DirectFunctionCall1(numeric_float8, numeric));
+    int64 i;
+    if (!numeric_to_int64(numeric, d, &i))
+        builder.append(name, d);
+    else if (i >= INT_MIN && i <= INT_MAX)
+        builder.append(name, static_cast<int>(i));
+    else
+        builder.append(name, static_cast<long long>(i));
+}
+
+// fields of a small object with all names starting with '$', candidate for extended JSON
+struct extended_fields
+{
+    int count;
+    JsonbValue names[2];
+    JsonbValue values[2];
+
+    bool read(JsonbContainer* container)
+    {
+        count = 0;
+        uint32 size = container->header & JB_CMASK;
+        if (size == 0 || size > 2)
+            return false;
+
+        JsonbIterator* it = JsonbIteratorInit(container);
+        JsonbValue v;
+        jsonb_token token;
+        while ((token = JsonbIteratorNext(&it, &v, true)) != WJB_DONE)
+        {
+            if (token == WJB_KEY)
+            {
+                if (v.val.string.len == 0 || v.val.string.val[0] != '$')
+                    return false;
+                names[count] = v;
+            }
+            else if (token == WJB_VALUE)
+            {
+                values[count++] = v;
+            }
+        }
+        return true;
+    }
+
+    const JsonbValue* get(const char* name) const
+    {
+        std::size_t length = std::strlen(name);
+        for (int i = 0; i < count; i++)
+        {
+            if (static_cast<std::size_t>(names[i].val.string.len) == length && std::memcmp(names[i].val.string.val, name, length) == 0)
+                return &values[i];
+        }
+        return NULL;
+    }
+};
+
+int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+bool parse_hex(const JsonbValue& v, unsigned char* out, std::size_t size)
+{
+    const char* hex = v.val.string.val;
+    for (std::size_t i = 0; i < size; i++)
+    {
+        int high = hex_value(hex[2*i]);
+        int low = hex_value(hex[2*i + 1]);
+        if (high < 0 || low < 0)
+            return false;
+        out[i] = high * 16 + low;
+    }
+    return true;
+}
+
+const JsonbValue* find_member(JsonbContainer* container, const char* name)
+{
+    JsonbValue key;
+    key.type = jbvString;
+    key.val.string.val = const_cast<char*>(name);
+    key.val.string.len = std::strlen(name);
+    return findJsonbValueFromContainer(container, JB_FOBJECT, &key);
+}
+
+// appends the BSON type of an object in extended form, returns false if it's a plain object
+bool append_extended(mongo::BSONObjBuilder& builder, const mongo::StringData& name, const extended_fields& fields)
+{
+    if (fields.count == 1)
+    {
+        const JsonbValue* v;
+        int64 i;
+        if ((v = fields.get("$oid")) != NULL)
+        {
+            unsigned char oid[12];
+            if (!is_string(v, 24) || !parse_hex(*v, oid, 12))
+                return false;
+            builder.append(name, mongo::OID(oid));
+            return true;
+        }
+        if ((v = fields.get("$date")) != NULL)
+        {
+            if (!is_integer(v, &i))
+                return false;
+            builder.appendDate(name, mongo::Date_t(i));
+            return true;
+        }
+        if ((v = fields.get("$undefined")) != NULL)
+        {
+            if (v->type != jbvBool || !v->val.boolean)
+                return false;
+            builder.appendUndefined(name);
+            return true;
+        }
+        bool min_key = (v = fields.get("$minKey")) != NULL;
+        if (min_key || (v = fields.get("$maxKey")) != NULL)
+        {
+            if (!is_integer(v, &i) || i != 1)
+                return false;
+            if (min_key)
+                builder.appendMinKey(name);
+            else
+                builder.appendMaxKey(name);
+            return true;
+        }
+        if ((v = fields.get("$timestamp")) != NULL)
+        {
+            if (v->type != jbvBinary || !(v->val.binary.data->header & JB_FOBJECT)
+                || (v->val.binary.data->header & JB_CMASK) != 2)
+                return false;
+            int64 seconds, increment;
+            if (!is_integer(find_member(v->val.binary.data, "t"), &seconds) || seconds < 0 || seconds > UINT_MAX
+                || !is_integer(find_member(v->val.binary.data, "i"), &increment) || increment < 0 || increment > UINT_MAX)
+                return false;
+            builder.appendTimestamp(name, (static_cast<unsigned long long>(seconds) << 32) | static_cast<unsigned long long>(increment));
+            return true;
+        }
+    }
+    else if (fields.count == 2)
+    {
+        const JsonbValue* data = fields.get("$binary");
+        const JsonbValue* subtype = fields.get("$type");
+        if (data != NULL && subtype != NULL)
+        {
+            unsigned char type;
+            if (data->type != jbvString || !is_string(subtype, 2) || !parse_hex(*subtype, &type, 1))
+                return false;
+            std::string encoded(data->val.string.val, data->val.string.len);
+            if (encoded.length() % 4 != 0 || std::strspn(encoded.c_str(), mongo::base64::chars) < encoded.length())
+                return false;
+            std::string decoded = mongo::base64::decode(encoded);
+            builder.appendBinData(name, decoded.length(), static_cast<mongo::BinDataType>(type), decoded.data());
+            return true;
+        }
+
+        const JsonbValue* regex = fields.get("$regex");
+        const JsonbValue* options = fields.get("$options");
+        if (regex != NULL && options != NULL)
+        {
+            if (regex->type != jbvString || options->type != jbvString)
+                return false;
+            builder.appendRegex(name, string_data(*regex), string_data(*options));
+            return true;
+        }
+    }
+    return false;
+}
+
+void append_container(mongo::BSONObjBuilder& builder, JsonbContainer* container);
+
+void append_value(mongo::BSONObjBuilder& builder, const mongo::StringData& name, const JsonbValue& v)
+{
+    switch (v.type)
+    {
+        case jbvNull:
+            builder.appendNull(name);
+            break;
+
+        case jbvString:
+            builder.append(name, string_data(v));
+            break;
+
+        case jbvNumeric:
+            append_number(builder, name, v.val.numeric);
+            break;
+
+        case jbvBool:
+            builder.appendBool(name, v.val.boolean);
+            break;
+
+        case jbvBinary:
+        {
+            JsonbContainer* container = v.val.binary.data;
+            if (container->header & JB_FOBJECT)
+            {
+                extended_fields fields;
+                if (fields.read(container) && append_extended(builder, name, fields))
+                    break;
+
+                mongo::BSONObjBuilder sub(builder.subobjStart(name));
+                append_container(sub, container);
+                sub.done();
+            }
+            else
+            {
+                mongo::BSONObjBuilder sub(builder.subarrayStart(name));
+                append_container(sub, container);
+                sub.done();
+            }
+            break;
+        }
+
+        default:
+            // nested values are not expanded by the iterator
+            throw convertion_error("bson");
+    }
+}
+
+void append_container(mongo::BSONObjBuilder& builder, JsonbContainer* container)
+{
+    check_stack_depth();
+
+    JsonbIterator* it = JsonbIteratorInit(container);
+    JsonbValue key = JsonbValue();
+    JsonbValue v;
+    jsonb_token token;
+    int index = 0;
+    char buffer[12];
+    while ((token = JsonbIteratorNext(&it, &v, true)) != WJB_DONE)
+    {
+        if (token == WJB_KEY)
+            key = v;
+        else if (token == WJB_VALUE)
+            append_value(builder, string_data(key), v);
+        else if (token == WJB_ELEM)
+            append_value(builder, index_name(index++, buffer), v);
+    }
+}
+
+// BSON -> jsonb
+
+void push_string(JsonbParseState** state, jsonb_token token, const char* s, std::size_t length)
+{
+    int converted_length = length;
+    JsonbValue v;
+    v.type = jbvString;
+    v.val.string.val = const_cast<char*>(utf8_to_server(s, &converted_length));
+    v.val.string.len = converted_length;
+    pushJsonbValue(state, token, &v);
+}
+
+// the string must live until the jsonb is built
+void push_string(JsonbParseState** state, jsonb_token token, const std::string& s)
+{
+    push_string(state, token, pnstrdup(s.data(), s.length()), s.length());
+}
+
+void push_key(JsonbParseState** state, const char* name)
+{
+    push_string(state, WJB_KEY, name, std::strlen(name));
+}
+
+void push_numeric(JsonbParseState** state, jsonb_token token, Datum numeric)
+{
+    JsonbValue v;
+    v.type = jbvNumeric;
+    v.val.numeric = DatumGetNumeric(numeric);
+    pushJsonbValue(state, token, &v);
+}
+
+void push_int(JsonbParseState** state, jsonb_token token, long long value)
+{
+    push_numeric(state, token, DirectFunctionCall1(int8_numeric, Int64GetDatum(value)));
+}
+
+void push_bool(JsonbParseState** state, jsonb_token token, bool value)
+{
+    JsonbValue v;
+    v.type = jbvBool;
+    v.val.boolean = value;
+    pushJsonbValue(state, token, &v);
+}
+
+std::string hex(const void* data, std::size_t length)
+{
+    static const char digits[] = "0123456789abcdef";
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    std::string result(length * 2, '0');
+    for (std::size_t i = 0; i < length; i++)
+    {
+        result[2*i] = digits[p[i] >> 4];
+        result[2*i + 1] = digits[p[i] & 15];
+    }
+    return result;
+}
+
+JsonbValue* push_object(JsonbParseState** state, const mongo::BSONObj& object, bool is_array);
+
+void push_element(JsonbParseState** state, jsonb_token token, const mongo::BSONElement& e)
+{
+    switch (e.type())
+    {
+        case mongo::NumberDouble:
+        {
+            double d = e._numberDouble();
+            if (d != d)
+                push_string(state, token, "NaN", 3);
+            else if (std::fabs(d) > std::numeric_limits<double>::max())
+                push_string(state, token, d > 0 ? "Infinity" : "-Infinity", d > 0 ? 8 : 9);
+            else
+            {
+                // the digits bson_out prints (16 significant), float8_numeric would keep only 15
+                StringInfoData digits;
+                initStringInfo(&digits);
+                append_json_double(&digits, d);
+                push_numeric(state, token, DirectFunctionCall3(numeric_in, CStringGetDatum(digits.data),
+                    ObjectIdGetDatum(InvalidOid), Int32GetDatum(-1)));
+                pfree(digits.data);
+            }
+            break;
+        }
+
+        case mongo::NumberInt:
+            push_numeric(state, token, DirectFunctionCall1(int4_numeric, Int32GetDatum(e._numberInt())));
+            break;
+
+        case mongo::NumberLong:
+            push_int(state, token, e._numberLong());
+            break;
+
+        case mongo::String:
+        case mongo::Symbol:
+        case mongo::Code:
+            push_string(state, token, e.valuestr(), e.valuestrsize() - 1);
+            break;
+
+        case mongo::Object:
+        case mongo::Array:
+            push_object(state, e.embeddedObject(), e.type() == mongo::Array);
+            break;
+
+        case mongo::Bool:
+            push_bool(state, token, e.boolean());
+            break;
+
+        case mongo::jstNULL:
+        {
+            JsonbValue v;
+            v.type = jbvNull;
+            pushJsonbValue(state, token, &v);
+            break;
+        }
+
+        case mongo::Undefined:
+            pushJsonbValue(state, WJB_BEGIN_OBJECT, NULL);
+            push_key(state, "$undefined");
+            push_bool(state, WJB_VALUE, true);
+            pushJsonbValue(state, WJB_END_OBJECT, NULL);
+            break;
+
+        case mongo::jstOID:
+            pushJsonbValue(state, WJB_BEGIN_OBJECT, NULL);
+            push_key(state, "$oid");
+            push_string(state, WJB_VALUE, hex(e.value(), 12));
+            pushJsonbValue(state, WJB_END_OBJECT, NULL);
+            break;
+
+        case mongo::Date:
+            pushJsonbValue(state, WJB_BEGIN_OBJECT, NULL);
+            push_key(state, "$date");
+            push_int(state, WJB_VALUE, e.date().asInt64());
+            pushJsonbValue(state, WJB_END_OBJECT, NULL);
+            break;
+
+        case mongo::BinData:
+        {
+            int length;
+            const char* data = e.binData(length);
+            unsigned char subtype = e.binDataType();
+            pushJsonbValue(state, WJB_BEGIN_OBJECT, NULL);
+            push_key(state, "$binary");
+            push_string(state, WJB_VALUE, mongo::base64::encode(data, length));
+            push_key(state, "$type");
+            push_string(state, WJB_VALUE, hex(&subtype, 1));
+            pushJsonbValue(state, WJB_END_OBJECT, NULL);
+            break;
+        }
+
+        case mongo::RegEx:
+            pushJsonbValue(state, WJB_BEGIN_OBJECT, NULL);
+            push_key(state, "$regex");
+            push_string(state, WJB_VALUE, e.regex(), std::strlen(e.regex()));
+            push_key(state, "$options");
+            push_string(state, WJB_VALUE, e.regexFlags(), std::strlen(e.regexFlags()));
+            pushJsonbValue(state, WJB_END_OBJECT, NULL);
+            break;
+
+        case mongo::Timestamp:
+            pushJsonbValue(state, WJB_BEGIN_OBJECT, NULL);
+            push_key(state, "$timestamp");
+            pushJsonbValue(state, WJB_BEGIN_OBJECT, NULL);
+            push_key(state, "t");
+            push_int(state, WJB_VALUE, e.timestampTime() / 1000);
+            push_key(state, "i");
+            push_int(state, WJB_VALUE, e.timestampInc());
+            pushJsonbValue(state, WJB_END_OBJECT, NULL);
+            pushJsonbValue(state, WJB_END_OBJECT, NULL);
+            break;
+
+        case mongo::MinKey:
+        case mongo::MaxKey:
+            pushJsonbValue(state, WJB_BEGIN_OBJECT, NULL);
+            push_key(state, e.type() == mongo::MinKey ? "$minKey" : "$maxKey");
+            push_int(state, WJB_VALUE, 1);
+            pushJsonbValue(state, WJB_END_OBJECT, NULL);
+            break;
+
+        case mongo::DBRef:
+            pushJsonbValue(state, WJB_BEGIN_OBJECT, NULL);
+            push_key(state, "$ref");
+            push_string(state, WJB_VALUE, e.dbrefNS(), std::strlen(e.dbrefNS()));
+            push_key(state, "$id");
+            push_string(state, WJB_VALUE, e.dbrefOID().str());
+            pushJsonbValue(state, WJB_END_OBJECT, NULL);
+            break;
+
+        case mongo::CodeWScope:
+        {
+            mongo::BSONObj scope = e.codeWScopeObject();
+            if (scope.isEmpty())
+            {
+                push_string(state, token, e.codeWScopeCode(), e.codeWScopeCodeLen() - 1);
+                break;
+            }
+            pushJsonbValue(state, WJB_BEGIN_OBJECT, NULL);
+            push_key(state, "$code");
+            push_string(state, WJB_VALUE, e.codeWScopeCode(), e.codeWScopeCodeLen() - 1);
+            push_key(state, "$scope");
+            push_object(state, scope, false);
+            pushJsonbValue(state, WJB_END_OBJECT, NULL);
+            break;
+        }
+
+        default:
+            throw convertion_error("jsonb");
+    }
+}
+
+JsonbValue* push_object(JsonbParseState** state, const mongo::BSONObj& object, bool is_array)
+{
+    check_stack_depth();
+
+    pushJsonbValue(state, is_array ? WJB_BEGIN_ARRAY : WJB_BEGIN_OBJECT, NULL);
+    mongo::BSONObjIterator it(object);
+    while (it.more())
+    {
+        mongo::BSONElement e = it.next();
+        if (!is_array)
+            push_string(state, WJB_KEY, e.fieldName(), e.fieldNameSize() - 1);
+        push_element(state, is_array ? WJB_ELEM : WJB_VALUE, e);
+    }
+    return pushJsonbValue(state, is_array ? WJB_END_ARRAY : WJB_END_OBJECT, NULL);
+}
+
+}
+
+bytea* bson_from_jsonb(Jsonb* jsonb)
+{
+    if (!JB_ROOT_IS_OBJECT(jsonb))
+    {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE), errmsg("only jsonb objects can be converted to bson")));
+    }
+
+    bson_builder builder(VARSIZE(jsonb));
+    append_container(builder.builder(), &jsonb->root);
+    return builder.finish();
+}
+
+void append_jsonb(mongo::BSONObjBuilder& builder, const mongo::StringData& name, Jsonb* jsonb)
+{
+    JsonbValue v;
+    if (JB_ROOT_IS_SCALAR(jsonb))
+    {
+        // scalar is stored as one-element array
+        JsonbIterator* it = JsonbIteratorInit(&jsonb->root);
+        while (JsonbIteratorNext(&it, &v, true) != WJB_ELEM)
+            ;
+    }
+    else
+    {
+        v.type = jbvBinary;
+        v.val.binary.data = &jsonb->root;
+        v.val.binary.len = VARSIZE(jsonb) - VARHDRSZ;
+    }
+    append_value(builder, name, v);
+}
+
+Jsonb* jsonb_from_bson(const mongo::BSONObj& object)
+{
+    JsonbParseState* state = NULL;
+    JsonbValue* result = push_object(&state, object, false);
+    return JsonbValueToJsonb(result);
+}
+
+#endif
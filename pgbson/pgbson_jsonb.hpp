@@ -0,0 +1,61 @@
+// Copyright (c) 2012-2013 Maciej Gajewski <maciej.gajewski0@gmail.com>
+// 
+// Permission to use, copy, modify, and distribute this software and its documentation for any purpose, without fee, and without a written agreement is hereby granted,
+// provided that the above copyright notice and this paragraph and the following two paragraphs appear in all copies.
+// 
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, 
+// ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+// THE AUTHOR SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+// THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE AUTHOR HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+
+#ifndef PGBSON_JSONB_HPP
+#define PGBSON_JSONB_HPP
+
+#include "pgbson_internal.hpp"
+
+// Conversion between jsonb and BSON, without text representation (PostgreSQL 9.4 and newer).
+//
+// jsonb is read with JsonbIterator and written with pushJsonbValue. Types are mapped as in text I/O,
+// so x::jsonb gives the same value as x::text::jsonb:
+//
+//  BSON                        jsonb
+//  double                      number; NaN and infinities as strings "NaN", "Infinity", "-Infinity"
+//  int32, int64                number
+//  string, symbol, code        string
+//  object, array               object, array
+//  bool, null                  bool, null
+//  undefined                   {"$undefined": true}
+//  ObjectId                    {"$oid": "<24 hex digits>"}
+//  Date                        {"$date": <milliseconds>}
+//  binary data                 {"$binary": "<base64>", "$type": "<2 hex digits>"}
+//  regular expression          {"$regex": "...", "$options": "..."}
+//  timestamp                   {"$timestamp": {"t": <seconds>, "i": <increment>}}
+//  min/max key                 {"$minKey": 1}, {"$maxKey": 1}
+//  DBRef                       {"$ref": "<ns>", "$id": "<24 hex digits>"}
+//  code with scope             {"$code": "...", "$scope": {...}}, string if the scope is empty
+//
+// In the other direction numbers become int32 or int64 when integral and in range, double
+// otherwise; objects in one of the extended forms above (except DBRef and code with scope)
+// become the BSON type. Field order is that of jsonb (keys sorted by length, then bytewise).
+// Doubles are converted to numeric from the digits bson_out prints (up to 16 significant), not with
+// float8::numeric, which keeps 15.
+
+#if PG_VERSION_NUM >= 90400
+
+extern "C" {
+#include <utils/jsonb.h>
+}
+
+// converts jsonb object to bson varlena, raises an error for other jsonb values
+bytea* bson_from_jsonb(Jsonb* jsonb);
+
+// appends jsonb value of any kind as a field
+void append_jsonb(mongo::BSONObjBuilder& builder, const mongo::StringData& name, Jsonb* jsonb);
+
+// converts BSON object to jsonb
+Jsonb* jsonb_from_bson(const mongo::BSONObj& object);
+
+#endif
+
+#endif
@@ -0,0 +1,264 @@
+// Copyright (c) 2012-2013 Maciej Gajewski <maciej.gajewski0@gmail.com>
+// 
+// Permission to use, copy, modify, and distribute this software and its documentation for any purpose, without fee, and without a written agreement is hereby granted,
+// provided that the above copyright notice and this paragraph and the following two paragraphs appear in all copies.
+// 
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, 
+// ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+// THE AUTHOR SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+// THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE AUTHOR HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+
+#include "pgbson_key.hpp"
+#include "pgbson_scan.hpp"
+
+#include <climits>
+#include <cstring>
+#include <new>
+
+struct key_pattern
+{
+    MemoryContext context; // holds the compiled pattern, replaced when the pattern changes
+    char* pattern; // copy of the pattern document, to tell if the cached one can be used
+    int pattern_size;
+    int n_fields;
+    const compiled_path** paths;
+    bool* descending;
+    mongo::BSONElement* found;
+};
+
+namespace {
+
+// type bytes are canonical types -1 (MinKey) .. 127 (MaxKey) shifted above the object terminator
+const unsigned char object_end = 0;
+
+unsigned char type_byte(const mongo::BSONElement& e)
+{
+    return static_cast<unsigned char>(e.canonicalType() + 2);
+}
+
+void put_byte(StringInfo out, unsigned char c)
+{
+    appendStringInfoCharMacro(out, static_cast<char>(c));
+}
+
+void put_uint32(StringInfo out, uint32 value)
+{
+    for (int shift = 24; shift >= 0; shift -= 8)
+        put_byte(out, static_cast<unsigned char>(value >> shift));
+}
+
+void put_uint64(StringInfo out, uint64 value)
+{
+    for (int shift = 56; shift >= 0; shift -= 8)
+        put_byte(out, static_cast<unsigned char>(value >> shift));
+}
+
+// signed value, with the sign bit flipped so that negative numbers sort first
+void put_int64(StringInfo out, int64 value)
+{
+    put_uint64(out, static_cast<uint64>(value) ^ UINT64CONST(0x8000000000000000));
+}
+
+// 0x00 is escaped as 0x00 0xff and the terminator is 0x00 0x00, so a string sorts before its extensions
+void put_string(StringInfo out, const char* s, std::size_t length)
+{
+    const char* end = s + length;
+    while (s < end)
+    {
+        const char* zero = reinterpret_cast<const char*>(std::memchr(s, 0, end - s));
+        if (zero == NULL)
+        {
+            appendBinaryStringInfo(out, s, end - s);
+            break;
+        }
+        appendBinaryStringInfo(out, s, zero - s);
+        put_byte(out, 0x00);
+        put_byte(out, 0xff);
+        s = zero + 1;
+    }
+    put_byte(out, 0x00);
+    put_byte(out, 0x00);
+}
+
+void put_value(StringInfo out, const mongo::BSONElement& e);
+
+// elements in woCompare order: type, name, value
+void put_object(StringInfo out, const char* objdata)
+{
+    bson_scanner it(objdata);
+    while (it.more())
+    {
+        mongo::BSONElement e = it.next();
+        put_byte(out, type_byte(e));
+        put_string(out, e.fieldName(), it.name_size() - 1);
+        put_value(out, e);
+    }
+    put_byte(out, object_end);
+}
+
+// value without the type byte, in compareElementValues order
+void put_value(StringInfo out, const mongo::BSONElement& e)
+{
+    switch (e.type())
+    {
+        case mongo::NumberDouble:
+        case mongo::NumberInt:
+            put_uint64(out, order_preserving_double(e.number()));
+            put_int64(out, 0);
+            break;
+
+        case mongo::NumberLong:
+        {
+            // int64 beyond 2^53 is not exact as double, the remainder tells such values apart
+            long long value = e._numberLong();
+            double d = static_cast<double>(value);
+            long long rounded = d >= 9223372036854775807.0 ? LLONG_MAX : static_cast<long long>(d);
+            put_uint64(out, order_preserving_double(d));
+            put_int64(out, value - rounded);
+            break;
+        }
+
+        case mongo::String:
+        case mongo::Symbol:
+        case mongo::Code:
+            put_string(out, e.valuestr(), e.valuestrsize() - 1);
+            break;
+
+        case mongo::Object:
+        case mongo::Array:
+            put_object(out, e.value());
+            break;
+
+        case mongo::BinData:
+        {
+            int length = e.objsize(); // without the subtype byte
+            put_uint32(out, length);
+            appendBinaryStringInfo(out, e.value() + 4, length + 1);
+            break;
+        }
+
+        case mongo::jstOID:
+            appendBinaryStringInfo(out, e.value(), 12);
+            break;
+
+        case mongo::Bool:
+            put_byte(out, *e.value());
+            break;
+
+        case mongo::Date:
+            put_int64(out, static_cast<long long>(e.date().millis));
+            break;
+
+        case mongo::Timestamp:
+            put_uint64(out, e.date().millis);
+            break;
+
+        case mongo::RegEx:
+            put_string(out, e.regex(), std::strlen(e.regex()));
+            put_string(out, e.regexFlags(), std::strlen(e.regexFlags()));
+            break;
+
+        case mongo::DBRef:
+            put_uint32(out, e.valuesize());
+            appendBinaryStringInfo(out, e.value(), e.valuesize());
+            break;
+
+        case mongo::CodeWScope:
+        {
+            // compared with strcmp, the scope as well
+            const char* scope = e.codeWScopeScopeDataUnsafe();
+            put_string(out, e.codeWScopeCode(), std::strlen(e.codeWScopeCode()));
+            put_string(out, scope, std::strlen(scope));
+            break;
+        }
+
+        default:
+            // null, undefined, min and max key: the type byte only
+            break;
+    }
+}
+
+key_pattern* compile_key_pattern(const mongo::BSONObj& pattern, MemoryContext ctx)
+{
+    int n_fields = pattern.nFields();
+    if (n_fields == 0)
+    {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE), errmsg("key pattern must have at least one field")));
+    }
+
+    key_pattern* compiled = reinterpret_cast<key_pattern*>(MemoryContextAllocZero(ctx, sizeof(key_pattern)));
+    compiled->context = ctx;
+    compiled->pattern = reinterpret_cast<char*>(MemoryContextAlloc(ctx, pattern.objsize()));
+    std::memcpy(compiled->pattern, pattern.objdata(), pattern.objsize());
+    compiled->pattern_size = pattern.objsize();
+    compiled->n_fields = n_fields;
+    compiled->paths = reinterpret_cast<const compiled_path**>(MemoryContextAlloc(ctx, sizeof(compiled_path*) * n_fields));
+    compiled->descending = reinterpret_cast<bool*>(MemoryContextAlloc(ctx, sizeof(bool) * n_fields));
+    compiled->found = reinterpret_cast<mongo::BSONElement*>(MemoryContextAlloc(ctx, sizeof(mongo::BSONElement) * n_fields));
+
+    mongo::BSONObjIterator it(pattern);
+    for (int i = 0; i < n_fields; i++)
+    {
+        mongo::BSONElement e = it.next();
+        if (!e.isNumber())
+        {
+            ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                errmsg("key pattern field \"%s\" must be a number (1 or -1)", e.fieldName())));
+        }
+        compiled->paths[i] = compile_path(e.fieldName(), e.fieldNameSize() - 1, ctx);
+        compiled->descending[i] = e.number() < 0;
+        new (&compiled->found[i]) mongo::BSONElement();
+    }
+
+    return compiled;
+}
+
+}
+
+key_pattern* get_key_pattern(key_pattern** cache, const mongo::BSONObj& pattern, MemoryContext ctx)
+{
+    key_pattern* compiled = *cache;
+    if (compiled == NULL
+        || compiled->pattern_size != pattern.objsize()
+        || std::memcmp(compiled->pattern, pattern.objdata(), pattern.objsize()) != 0)
+    {
+        MemoryContext context = new_cache_context(ctx, compiled != NULL ? compiled->context : NULL);
+        *cache = NULL;
+        *cache = compile_key_pattern(pattern, context);
+    }
+    return *cache;
+}
+
+bytea* build_index_key(const key_pattern* pattern, const mongo::BSONObj& document)
+{
+    StringInfoData out;
+    initStringInfo(&out);
+    appendStringInfoSpaces(&out, VARHDRSZ);
+
+    get_fields(document, pattern->paths, pattern->n_fields, pattern->found);
+    for (int i = 0; i < pattern->n_fields; i++)
+    {
+        const mongo::BSONElement& e = pattern->found[i];
+        int start = out.len;
+        if (e.eoo())
+        {
+            put_byte(&out, static_cast<unsigned char>(mongo::canonicalizeBSONType(mongo::jstNULL) + 2));
+        }
+        else
+        {
+            put_byte(&out, type_byte(e));
+            put_value(&out, e);
+        }
+
+        if (pattern->descending[i])
+        {
+            for (int j = start; j < out.len; j++)
+                out.data[j] = ~out.data[j];
+        }
+    }
+
+    SET_VARSIZE(out.data, out.len);
+    return reinterpret_cast<bytea*>(out.data);
+}
@@ -0,0 +1,52 @@
+// Copyright (c) 2012-2013 Maciej Gajewski <maciej.gajewski0@gmail.com>
+// 
+// Permission to use, copy, modify, and distribute this software and its documentation for any purpose, without fee, and without a written agreement is hereby granted,
+// provided that the above copyright notice and this paragraph and the following two paragraphs appear in all copies.
+// 
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, 
+// ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+// THE AUTHOR SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+// THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE AUTHOR HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+
+#ifndef PGBSON_KEY_HPP
+#define PGBSON_KEY_HPP
+
+#include "pgbson_internal.hpp"
+
+// Index keys (bsonkey type): fields named in a MongoDB key pattern ({a: 1, b: -1}), encoded so that
+// keys compare with memcmp (shorter first on a common prefix) in the order of BSONObj::woCompare
+// with the pattern as ordering, i.e. MongoDB index order.
+//
+// Each field is a type byte (canonical type, so all numbers sort together) and the value:
+//
+//  number                  order-preserving double, then the int64 remainder lost in the conversion
+//  string, symbol, code    bytes with 0x00 escaped as 0x00 0xff, terminated with 0x00 0x00
+//  object, array           per element: type byte, name and value as above; terminated with 0x00
+//  binary data             big-endian length, subtype and bytes (shorter data sorts first)
+//  ObjectId, bool          raw bytes
+//  Date, timestamp         big-endian, Date signed
+//  regex, code with scope  pattern and options, code and scope, as strings
+//  DBRef                   big-endian length and raw bytes
+//  null, min/max key       the type byte only
+//
+// Every value encoding is self-delimiting, so descending fields are simply stored bit-inverted.
+// Missing fields are encoded as null, as in MongoDB indexes. Arrays are keyed as whole values,
+// they are not expanded into one key per element.
+//
+// The order refines woCompare where the latter isn't a total order: NumberLong values that
+// round to the same double are still distinct, and Date sorts before timestamp with equal bits.
+//
+// KeyV1 from the vendored db/key.h is not used: its implementation is not part of the driver
+// and its keys compare with a type-aware function, not bytewise.
+
+struct key_pattern;
+
+// returns compiled key pattern, the one in *cache is reused if it's for the same pattern.
+// A new one is compiled in a child context of ctx, which replaces the context of the previous one
+key_pattern* get_key_pattern(key_pattern** cache, const mongo::BSONObj& pattern, MemoryContext ctx);
+
+// builds palloc-ed bsonkey varlena
+bytea* build_index_key(const key_pattern* pattern, const mongo::BSONObj& document);
+
+#endif
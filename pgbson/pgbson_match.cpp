@@ -0,0 +1,989 @@
+// Copyright (c) 2012-2013 Maciej Gajewski <maciej.gajewski0@gmail.com>
+// 
+// Permission to use, copy, modify, and distribute this software and its documentation for any purpose, without fee, and without a written agreement is hereby granted,
+// provided that the above copyright notice and this paragraph and the following two paragraphs appear in all copies.
+// 
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, 
+// ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+// THE AUTHOR SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+// THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE AUTHOR HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+
+#include "pgbson_match.hpp"
+#include "pgbson_scan.hpp"
+
+extern "C" {
+#include <catalog/pg_collation.h>
+#include <mb/pg_wchar.h>
+#include <regex/regex.h>
+}
+
+#include <cstring>
+#include <vector>
+
+namespace {
+
+// Values of different canonical types are never equal, and are not ordered by comparisons
+bool same_type(const mongo::BSONElement& a, const mongo::BSONElement& b)
+{
+    return a.canonicalType() == b.canonicalType();
+}
+
+bool values_equal(const mongo::BSONElement& a, const mongo::BSONElement& b)
+{
+    return same_type(a, b) && a.woCompare(b, false) == 0;
+}
+
+bool is_operator(const char* name)
+{
+    return name[0] == '$';
+}
+
+// object with operators, like {$gt: 1}
+bool is_operator_object(const mongo::BSONElement& e)
+{
+    return e.type() == mongo::Object && is_operator(e.embeddedObject().firstElementFieldName());
+}
+
+class regex_matcher
+{
+public:
+
+    regex_matcher(const char* pattern, const char* options)
+    {
+        int flags = REG_ADVANCED;
+        bool dot_all = false;
+        for (const char* o = options; *o != 0; o++)
+        {
+            switch(*o)
+            {
+                case 'i': flags |= REG_ICASE; break;
+                case 'm': flags |= REG_NLANCH; break;
+                case 's': dot_all = true; break;
+                case 'x': flags |= REG_EXPANDED; break;
+                default:
+                    throw query_error(std::string("unsupported regular expression option: ") + *o);
+            }
+        }
+        if (!dot_all)
+            flags |= REG_NLSTOP;
+
+        int length = std::strlen(pattern);
+        std::vector<pg_wchar> wide(length + 1);
+        // pattern and strings are UTF-8 whatever the database encoding
+        int wide_length = pg_encoding_mb2wchar_with_len(PG_UTF8, pattern, &wide[0], length);
+
+        int result = pg_regcomp(&_regex, &wide[0], wide_length, flags, DEFAULT_COLLATION_OID);
+        if (result != REG_OKAY)
+        {
+            char message[100];
+            pg_regerror(result, &_regex, message, sizeof(message));
+            throw query_error(std::string("invalid regular expression: ") + message);
+        }
+    }
+
+    ~regex_matcher()
+    {
+        pg_regfree(&_regex);
+    }
+
+    bool matches(const char* data, int length) const
+    {
+        // the buffer grows to the longest string seen
+        if (_buffer.size() < std::size_t(length) + 1)
+            _buffer.resize(length + 1);
+
+        int wide_length = pg_encoding_mb2wchar_with_len(PG_UTF8, data, &_buffer[0], length);
+        int result = pg_regexec(&_regex, &_buffer[0], wide_length, 0, NULL, 0, NULL, 0);
+        if (result == REG_OKAY)
+            return true;
+        else if (result == REG_NOMATCH)
+            return false;
+
+        char message[100];
+        pg_regerror(result, &_regex, message, sizeof(message));
+        throw query_error(std::string("regular expression failed: ") + message);
+    }
+
+    bool matches(const mongo::BSONElement& e) const
+    {
+        return (e.type() == mongo::String || e.type() == mongo::Symbol)
+            && matches(e.valuestr(), e.valuestrsize() - 1);
+    }
+
+private:
+
+    regex_matcher(const regex_matcher&);
+    regex_matcher& operator=(const regex_matcher&);
+
+    mutable regex_t _regex;
+    mutable std::vector<pg_wchar> _buffer;
+};
+
+// Conditions test a single value
+
+class condition
+{
+public:
+    virtual ~condition() { }
+    virtual bool matches(const mongo::BSONElement& e) const = 0;
+    // if true, field matches if the value, or any element of array value, matches
+    virtual bool expands_arrays() const { return true; }
+    // if true, field matches if it's missing
+    virtual bool matches_missing() const { return false; }
+};
+
+typedef std::vector<condition*> condition_vector;
+
+void delete_conditions(condition_vector& conditions)
+{
+    for (std::size_t i = 0; i < conditions.size(); i++)
+        delete conditions[i];
+    conditions.clear();
+}
+
+// adds condition, deletes it if the vector can't take it
+void add_condition(condition_vector& conditions, condition* c)
+{
+    try
+    {
+        conditions.push_back(c);
+    }
+    catch(...)
+    {
+        delete c;
+        throw;
+    }
+}
+
+class equal_condition : public condition
+{
+public:
+    equal_condition(const mongo::BSONElement& value) : _value(value) { }
+
+    bool matches(const mongo::BSONElement& e) const { return values_equal(e, _value); }
+    bool matches_missing() const { return _value.isNull(); }
+
+private:
+    mongo::BSONElement _value;
+};
+
+class regex_condition : public condition
+{
+public:
+    regex_condition(const char* pattern, const char* options) : _regex(pattern, options) { }
+
+    bool matches(const mongo::BSONElement& e) const { return _regex.matches(e); }
+
+private:
+    regex_matcher _regex;
+};
+
+class compare_condition : public condition
+{
+public:
+    enum comparison { less, less_equal, greater, greater_equal };
+
+    compare_condition(comparison op, const mongo::BSONElement& value) : _op(op), _value(value) { }
+
+    bool matches(const mongo::BSONElement& e) const
+    {
+        if (!same_type(e, _value))
+            return false;
+
+        int c = e.woCompare(_value, false);
+        switch(_op)
+        {
+            case less: return c < 0;
+            case less_equal: return c <= 0;
+            case greater: return c > 0;
+            default: return c >= 0;
+        }
+    }
+
+    bool matches_missing() const
+    {
+        return _value.isNull() && (_op == less_equal || _op == greater_equal);
+    }
+
+private:
+    comparison _op;
+    mongo::BSONElement _value;
+};
+
+class in_condition : public condition
+{
+public:
+    in_condition(const mongo::BSONObj& values) : _has_null(false)
+    {
+        try
+        {
+            mongo::BSONObjIterator it(values);
+            while (it.more())
+            {
+                mongo::BSONElement e = it.next();
+                if (e.type() == mongo::RegEx)
+                {
+                    add_condition(_conditions, new regex_condition(e.regex(), e.regexFlags()));
+                }
+                else
+                {
+                    _has_null = _has_null || e.isNull();
+                    add_condition(_conditions, new equal_condition(e));
+                }
+            }
+        }
+        catch(...)
+        {
+            delete_conditions(_conditions);
+            throw;
+        }
+    }
+
+    ~in_condition() { delete_conditions(_conditions); }
+
+    bool matches(const mongo::BSONElement& e) const
+    {
+        for (std::size_t i = 0; i < _conditions.size(); i++)
+        {
+            if (_conditions[i]->matches(e))
+                return true;
+        }
+        return false;
+    }
+
+    bool matches_missing() const { return _has_null; }
+
+private:
+    condition_vector _conditions;
+    bool _has_null;
+};
+
+class exists_condition : public condition
+{
+public:
+    exists_condition(bool exists) : _exists(exists) { }
+
+    bool matches(const mongo::BSONElement&) const { return _exists; }
+    bool expands_arrays() const { return false; }
+    bool matches_missing() const { return !_exists; }
+
+private:
+    bool _exists;
+};
+
+class type_condition : public condition
+{
+public:
+    type_condition(int type) : _type(type) { }
+
+    bool matches(const mongo::BSONElement& e) const { return e.type() == _type; }
+
+private:
+    int _type;
+};
+
+class size_condition : public condition
+{
+public:
+    size_condition(int size) : _size(size) { }
+
+    bool matches(const mongo::BSONElement& e) const
+    {
+        return e.type() == mongo::Array && count_fields(e.embeddedObject()) == _size;
+    }
+    bool expands_arrays() const { return false; }
+
+private:
+    int _size;
+};
+
+class mod_condition : public condition
+{
+public:
+    mod_condition(long long divisor, long long remainder) : _divisor(divisor), _remainder(remainder) { }
+
+    bool matches(const mongo::BSONElement& e) const
+    {
+        if (!e.isNumber())
+            return false;
+        // LLONG_MIN % -1 overflows (SIGFPE on x86), the remainder of division by -1 is always 0
+        long long r = _divisor == -1 ? 0 : e.numberLong() % _divisor;
+        return r == _remainder;
+    }
+
+private:
+    long long _divisor;
+    long long _remainder;
+};
+
+// all conditions must match the value
+class and_condition : public condition
+{
+public:
+    ~and_condition() { delete_conditions(_conditions); }
+
+    void add(condition* c) { add_condition(_conditions, c); }
+
+    bool matches(const mongo::BSONElement& e) const
+    {
+        for (std::size_t i = 0; i < _conditions.size(); i++)
+        {
+            if (!_conditions[i]->matches(e))
+                return false;
+        }
+        return true;
+    }
+
+private:
+    condition_vector _conditions;
+};
+
+class not_condition : public condition
+{
+public:
+    not_condition(condition* c) : _condition(c) { }
+    ~not_condition() { delete _condition; }
+
+    bool matches(const mongo::BSONElement& e) const { return !_condition->matches(e); }
+
+private:
+    condition* _condition;
+};
+
+// array containing values matching all conditions
+class all_condition : public condition
+{
+public:
+    ~all_condition() { delete_conditions(_conditions); }
+
+    void add(condition* c) { add_condition(_conditions, c); }
+
+    bool matches(const mongo::BSONElement& e) const
+    {
+        if (_conditions.empty())
+            return false;
+
+        for (std::size_t i = 0; i < _conditions.size(); i++)
+        {
+            if (!matches_value_or_element(*_conditions[i], e))
+                return false;
+        }
+        return true;
+    }
+
+    bool expands_arrays() const { return false; }
+
+private:
+
+    static bool matches_value_or_element(const condition& c, const mongo::BSONElement& e)
+    {
+        if (c.matches(e))
+            return true;
+        if (e.type() == mongo::Array)
+        {
+            mongo::BSONObjIterator it(e.embeddedObject());
+            while (it.more())
+            {
+                if (c.matches(it.next()))
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    condition_vector _conditions;
+};
+
+// array with element matching a query (for objects), or conditions
+class elem_match_condition : public condition
+{
+public:
+    elem_match_condition(match_node* query) : _query(query), _conditions(NULL) { }
+    elem_match_condition(condition* conditions) : _query(NULL), _conditions(conditions) { }
+    ~elem_match_condition() { delete _query; delete _conditions; }
+
+    bool matches(const mongo::BSONElement& e) const
+    {
+        if (e.type() != mongo::Array)
+            return false;
+
+        mongo::BSONObjIterator it(e.embeddedObject());
+        while (it.more())
+        {
+            mongo::BSONElement element = it.next();
+            if (_query != NULL)
+            {
+                if (element.type() == mongo::Object && _query->matches(element.embeddedObject()))
+                    return true;
+            }
+            else if (_conditions->matches(element))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool expands_arrays() const { return false; }
+
+private:
+    match_node* _query;
+    condition* _conditions;
+};
+
+// Match nodes test the whole object
+
+typedef std::vector<match_node*> node_vector;
+
+class logical_node : public match_node
+{
+public:
+    enum kind { and_kind, or_kind, nor_kind };
+
+    logical_node(kind k) : _kind(k) { }
+
+    ~logical_node()
+    {
+        for (std::size_t i = 0; i < _children.size(); i++)
+            delete _children[i];
+    }
+
+    // takes ownership
+    void add(match_node* child)
+    {
+        try
+        {
+            _children.push_back(child);
+        }
+        catch(...)
+        {
+            delete child;
+            throw;
+        }
+    }
+
+    bool matches(const mongo::BSONObj& object) const
+    {
+        // and: all match, or: any matches, nor: none matches
+        const bool stop_on = _kind != and_kind;
+        for (std::size_t i = 0; i < _children.size(); i++)
+        {
+            if (_children[i]->matches(object) == stop_on)
+                return _kind == or_kind;
+        }
+        return _kind != or_kind;
+    }
+
+private:
+    kind _kind;
+    node_vector _children;
+};
+
+class not_node : public match_node
+{
+public:
+    not_node(match_node* child) : _child(child) { }
+    ~not_node() { delete _child; }
+
+    bool matches(const mongo::BSONObj& object) const { return !_child->matches(object); }
+
+private:
+    match_node* _child;
+};
+
+// condition on values found at a path
+class field_node : public match_node
+{
+public:
+
+    field_node(const std::string& path, condition* c) : _condition(c)
+    {
+        try
+        {
+            std::size_t start = 0;
+            while (true)
+            {
+                std::size_t dot = path.find('.', start);
+                _segments.push_back(path.substr(start, dot == std::string::npos ? std::string::npos : dot - start));
+                if (dot == std::string::npos)
+                    break;
+                start = dot + 1;
+            }
+        }
+        catch(...)
+        {
+            delete c;
+            throw;
+        }
+    }
+
+    ~field_node() { delete _condition; }
+
+    bool matches(const mongo::BSONObj& object) const
+    {
+        bool found = false;
+        if (any_value(object, 0, found))
+            return true;
+        return !found && _condition->matches_missing();
+    }
+
+private:
+
+    bool test(const mongo::BSONElement& e) const
+    {
+        if (_condition->matches(e))
+            return true;
+
+        if (e.type() == mongo::Array && _condition->expands_arrays())
+        {
+            mongo::BSONObjIterator it(e.embeddedObject());
+            while (it.more())
+            {
+                if (_condition->matches(it.next()))
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    // tests values at the path, starting from segment; stops on first match
+    bool any_value(const mongo::BSONObj& object, std::size_t segment, bool& found) const
+    {
+        mongo::BSONElement e = object.getField(_segments[segment]);
+        if (e.eoo())
+            return false;
+
+        if (segment + 1 == _segments.size())
+        {
+            found = true;
+            return test(e);
+        }
+
+        if (e.type() == mongo::Object)
+        {
+            return any_value(e.embeddedObject(), segment + 1, found);
+        }
+        else if (e.type() == mongo::Array)
+        {
+            // element by position
+            if (any_value(e.embeddedObject(), segment + 1, found))
+                return true;
+
+            // path in each element
+            mongo::BSONObjIterator it(e.embeddedObject());
+            while (it.more())
+            {
+                mongo::BSONElement element = it.next();
+                if (element.type() == mongo::Object && any_value(element.embeddedObject(), segment + 1, found))
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    std::vector<std::string> _segments;
+    condition* _condition;
+};
+
+// Compilation
+
+match_node* new_field_node(const std::string& path, condition* c, bool negated)
+{
+    match_node* node = new field_node(path, c);
+    if (negated)
+    {
+        try
+        {
+            node = new not_node(node);
+        }
+        catch(...)
+        {
+            delete node;
+            throw;
+        }
+    }
+    return node;
+}
+
+condition* compile_element_conditions(const mongo::BSONObj& operators);
+
+std::string invalid_argument(const char* op, const char* expected)
+{
+    return std::string(op) + " needs " + expected;
+}
+
+// condition of a single operator, NULL if the operator is handled elsewhere ($options)
+// $ne and $nin return the positive condition and set negated
+condition* compile_condition(const mongo::BSONElement& op, const mongo::BSONObj& operators, bool& negated)
+{
+    const char* name = op.fieldName();
+    negated = false;
+
+    if (std::strcmp(name, "$eq") == 0)
+    {
+        return new equal_condition(op);
+    }
+    else if (std::strcmp(name, "$ne") == 0)
+    {
+        negated = true;
+        return new equal_condition(op);
+    }
+    else if (std::strcmp(name, "$gt") == 0)
+    {
+        return new compare_condition(compare_condition::greater, op);
+    }
+    else if (std::strcmp(name, "$gte") == 0)
+    {
+        return new compare_condition(compare_condition::greater_equal, op);
+    }
+    else if (std::strcmp(name, "$lt") == 0)
+    {
+        return new compare_condition(compare_condition::less, op);
+    }
+    else if (std::strcmp(name, "$lte") == 0)
+    {
+        return new compare_condition(compare_condition::less_equal, op);
+    }
+    else if (std::strcmp(name, "$in") == 0 || std::strcmp(name, "$nin") == 0)
+    {
+        if (op.type() != mongo::Array)
+            throw query_error(invalid_argument(name, "an array"));
+        negated = std::strcmp(name, "$nin") == 0;
+        return new in_condition(op.embeddedObject());
+    }
+    else if (std::strcmp(name, "$exists") == 0)
+    {
+        return new exists_condition(op.trueValue());
+    }
+    else if (std::strcmp(name, "$type") == 0)
+    {
+        if (!op.isNumber())
+            throw query_error(invalid_argument(name, "a number"));
+        return new type_condition(op.numberInt());
+    }
+    else if (std::strcmp(name, "$size") == 0)
+    {
+        if (!op.isNumber())
+            throw query_error(invalid_argument(name, "a number"));
+        return new size_condition(op.numberInt());
+    }
+    else if (std::strcmp(name, "$mod") == 0)
+    {
+        if (op.type() != mongo::Array || op.embeddedObject().nFields() != 2)
+            throw query_error(invalid_argument(name, "an array of divisor and remainder"));
+        mongo::BSONElement divisor = op.embeddedObject()["0"];
+        mongo::BSONElement remainder = op.embeddedObject()["1"];
+        if (!divisor.isNumber() || !remainder.isNumber() || divisor.numberLong() == 0)
+            throw query_error(invalid_argument(name, "a non-zero divisor and a remainder"));
+        return new mod_condition(divisor.numberLong(), remainder.numberLong());
+    }
+    else if (std::strcmp(name, "$regex") == 0)
+    {
+        mongo::BSONElement options = operators["$options"];
+        if (op.type() == mongo::RegEx)
+            return new regex_condition(op.regex(), options.type() == mongo::String ? options.valuestr() : op.regexFlags());
+        else if (op.type() == mongo::String)
+            return new regex_condition(op.valuestr(), options.type() == mongo::String ? options.valuestr() : "");
+        else
+            throw query_error(invalid_argument(name, "a string or a regular expression"));
+    }
+    else if (std::strcmp(name, "$options") == 0)
+    {
+        if (operators["$regex"].eoo())
+            throw query_error("$options needs $regex");
+        return NULL;
+    }
+    else if (std::strcmp(name, "$all") == 0)
+    {
+        if (op.type() != mongo::Array)
+            throw query_error(invalid_argument(name, "an array"));
+
+        all_condition* all = new all_condition();
+        try
+        {
+            mongo::BSONObjIterator it(op.embeddedObject());
+            while (it.more())
+            {
+                mongo::BSONElement e = it.next();
+                if (e.type() == mongo::RegEx)
+                {
+                    all->add(new regex_condition(e.regex(), e.regexFlags()));
+                }
+                else if (is_operator_object(e) && std::strcmp(e.embeddedObject().firstElementFieldName(), "$elemMatch") == 0)
+                {
+                    bool ignored;
+                    all->add(compile_condition(e.embeddedObject().firstElement(), e.embeddedObject(), ignored));
+                }
+                else
+                {
+                    all->add(new equal_condition(e));
+                }
+            }
+        }
+        catch(...)
+        {
+            delete all;
+            throw;
+        }
+        return all;
+    }
+    else if (std::strcmp(name, "$elemMatch") == 0)
+    {
+        if (op.type() != mongo::Object)
+            throw query_error(invalid_argument(name, "an object"));
+
+        mongo::BSONObj query = op.embeddedObject();
+        if (is_operator(query.firstElementFieldName()))
+        {
+            condition* conditions = compile_element_conditions(query);
+            try
+            {
+                return new elem_match_condition(conditions);
+            }
+            catch(...)
+            {
+                delete conditions;
+                throw;
+            }
+        }
+        else
+        {
+            match_node* node = compile_query(query);
+            try
+            {
+                return new elem_match_condition(node);
+            }
+            catch(...)
+            {
+                delete node;
+                throw;
+            }
+        }
+    }
+    else
+    {
+        throw query_error(std::string("unsupported query operator: ") + name);
+    }
+}
+
+// operators applied to a single value (array element in $elemMatch)
+condition* compile_element_conditions(const mongo::BSONObj& operators)
+{
+    and_condition* result = new and_condition();
+    try
+    {
+        mongo::BSONObjIterator it(operators);
+        while (it.more())
+        {
+            mongo::BSONElement op = it.next();
+            condition* c = NULL;
+
+            if (std::strcmp(op.fieldName(), "$not") == 0)
+            {
+                if (op.type() == mongo::Object)
+                    c = compile_element_conditions(op.embeddedObject());
+                else if (op.type() == mongo::RegEx)
+                    c = new regex_condition(op.regex(), op.regexFlags());
+                else
+                    throw query_error(invalid_argument("$not", "an object or a regular expression"));
+                result->add(new not_condition(c));
+            }
+            else
+            {
+                bool negated;
+                c = compile_condition(op, operators, negated);
+                if (c != NULL)
+                    result->add(negated ? new not_condition(c) : c);
+            }
+        }
+    }
+    catch(...)
+    {
+        delete result;
+        throw;
+    }
+    return result;
+}
+
+// operators applied to a field, like {a: {$gt: 1, $lt: 5}}
+// each operator is tested separately, so they may be satisfied by different array elements
+void compile_field_operators(logical_node& target, const std::string& path, const mongo::BSONObj& operators)
+{
+    mongo::BSONObjIterator it(operators);
+    while (it.more())
+    {
+        mongo::BSONElement op = it.next();
+
+        if (std::strcmp(op.fieldName(), "$not") == 0)
+        {
+            match_node* inner = NULL;
+            if (op.type() == mongo::Object)
+            {
+                logical_node* all = new logical_node(logical_node::and_kind);
+                try
+                {
+                    compile_field_operators(*all, path, op.embeddedObject());
+                }
+                catch(...)
+                {
+                    delete all;
+                    throw;
+                }
+                inner = all;
+            }
+            else if (op.type() == mongo::RegEx)
+            {
+                inner = new_field_node(path, new regex_condition(op.regex(), op.regexFlags()), false);
+            }
+            else
+            {
+                throw query_error(invalid_argument("$not", "an object or a regular expression"));
+            }
+            target.add(new not_node(inner));
+        }
+        else
+        {
+            bool negated;
+            condition* c = compile_condition(op, operators, negated);
+            if (c != NULL)
+                target.add(new_field_node(path, c, negated));
+        }
+    }
+}
+
+}
+
+match_node* compile_query(const mongo::BSONObj& query)
+{
+    logical_node* result = new logical_node(logical_node::and_kind);
+    try
+    {
+        mongo::BSONObjIterator it(query);
+        while (it.more())
+        {
+            mongo::BSONElement e = it.next();
+            const char* name = e.fieldName();
+
+            if (is_operator(name))
+            {
+                logical_node::kind kind;
+                if (std::strcmp(name, "$and") == 0)
+                    kind = logical_node::and_kind;
+                else if (std::strcmp(name, "$or") == 0)
+                    kind = logical_node::or_kind;
+                else if (std::strcmp(name, "$nor") == 0)
+                    kind = logical_node::nor_kind;
+                else if (std::strcmp(name, "$comment") == 0)
+                    continue;
+                else
+                    throw query_error(std::string("unsupported query operator: ") + name);
+
+                if (e.type() != mongo::Array || e.embeddedObject().isEmpty())
+                    throw query_error(invalid_argument(name, "a non-empty array"));
+
+                logical_node* node = new logical_node(kind);
+                result->add(node);
+
+                mongo::BSONObjIterator subqueries(e.embeddedObject());
+                while (subqueries.more())
+                {
+                    mongo::BSONElement subquery = subqueries.next();
+                    if (subquery.type() != mongo::Object)
+                        throw query_error(invalid_argument(name, "an array of objects"));
+                    node->add(compile_query(subquery.embeddedObject()));
+                }
+            }
+            else if (is_operator_object(e))
+            {
+                compile_field_operators(*result, name, e.embeddedObject());
+            }
+            else if (e.type() == mongo::RegEx)
+            {
+                result->add(new_field_node(name, new regex_condition(e.regex(), e.regexFlags()), false));
+            }
+            else
+            {
+                result->add(new_field_node(name, new equal_condition(e), false));
+            }
+        }
+    }
+    catch(...)
+    {
+        delete result;
+        throw;
+    }
+    return result;
+}
+
+// compiled query kept in fn_extra
+struct match_cache
+{
+    MemoryContext context; // the query and regular expressions, replaced with the query
+    int length;
+    char* query;
+    match_node* matcher;
+#if PG_VERSION_NUM >= 90500
+    MemoryContextCallback callback;
+#endif
+};
+
+#if PG_VERSION_NUM >= 90500
+// matcher is allocated with new. Registered on the context of the query, so that it runs
+// while the regular expressions are still there (a parent context deletes children first)
+static void free_cached_matcher(void* arg)
+{
+    match_cache* cache = reinterpret_cast<match_cache*>(arg);
+    delete cache->matcher;
+    cache->matcher = NULL;
+}
+#endif
+
+const match_node* get_cached_matcher(PG_FUNCTION_ARGS, int argno)
+{
+    bytea* arg = GETARG_BSON(argno);
+    const char* query = VARDATA_ANY(arg);
+    int length = VARSIZE_ANY_EXHDR(arg);
+
+    match_cache* cache = reinterpret_cast<match_cache*>(fcinfo->flinfo->fn_extra);
+    if (cache == NULL)
+    {
+        cache = reinterpret_cast<match_cache*>(MemoryContextAllocZero(fcinfo->flinfo->fn_mcxt, sizeof(match_cache)));
+        fcinfo->flinfo->fn_extra = cache;
+    }
+    else if (cache->matcher != NULL
+        && cache->length == length
+        && std::memcmp(cache->query, query, length) == 0)
+    {
+        return cache->matcher;
+    }
+
+    PGBSON_LOG << "get_cached_matcher: compiling query" << PGBSON_ENDL;
+    // regular expressions are freed into their context (palloc-ed since PostgreSQL 16), so before it's deleted
+    delete cache->matcher;
+    cache->matcher = NULL;
+    cache->context = new_cache_context(fcinfo->flinfo->fn_mcxt, cache->context);
+#if PG_VERSION_NUM >= 90500
+    cache->callback.func = free_cached_matcher;
+    cache->callback.arg = cache;
+    MemoryContextRegisterResetCallback(cache->context, &cache->callback);
+#endif
+
+    // the matcher refers to the query
+    cache->query = reinterpret_cast<char*>(MemoryContextAlloc(cache->context, length));
+    std::memcpy(cache->query, query, length);
+    cache->length = length;
+
+    MemoryContext old_context = MemoryContextSwitchTo(cache->context);
+    try
+    {
+        cache->matcher = compile_query(mongo::BSONObj(cache->query));
+    }
+    catch(...)
+    {
+        MemoryContextSwitchTo(old_context);
+        throw;
+    }
+    MemoryContextSwitchTo(old_context);
+    return cache->matcher;
+}
@@ -0,0 +1,51 @@
+// Copyright (c) 2012-2013 Maciej Gajewski <maciej.gajewski0@gmail.com>
+// 
+// Permission to use, copy, modify, and distribute this software and its documentation for any purpose, without fee, and without a written agreement is hereby granted,
+// provided that the above copyright notice and this paragraph and the following two paragraphs appear in all copies.
+// 
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, 
+// ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+// THE AUTHOR SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+// THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE AUTHOR HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+
+#ifndef PGBSON_MATCH_HPP
+#define PGBSON_MATCH_HPP
+
+#include "pgbson_internal.hpp"
+
+#include <string>
+
+// MongoDB query matcher.
+//
+// Supports field equality, $eq, $ne, $gt, $gte, $lt, $lte, $in, $nin, $exists, $type, $size,
+// $all, $elemMatch, $mod, $regex (with $options), $not, and $and, $or, $nor.
+// Paths are dotted, array elements are searched (and can be addressed by position),
+// like in MongoDB. $where and geo operators are not supported.
+//
+// Query is compiled once into a tree of matchers, regular expressions (PostgreSQL
+// regex engine, ARE syntax) are compiled as well. Matching doesn't allocate memory.
+
+// exception used to report invalid queries
+struct query_error
+{
+    std::string message;
+    query_error(const std::string& m) : message(m) { }
+};
+
+class match_node
+{
+public:
+    virtual ~match_node() { }
+    virtual bool matches(const mongo::BSONObj& object) const = 0;
+};
+
+// throws query_error
+// the matcher refers to the query values, the query must outlive it
+match_node* compile_query(const mongo::BSONObj& query);
+
+// compiled query from the argument, cached in fn_extra
+// the query is compiled again only if it changes
+const match_node* get_cached_matcher(PG_FUNCTION_ARGS, int argno);
+
+#endif
@@ -0,0 +1,229 @@
+// Copyright (c) 2012-2013 Maciej Gajewski <maciej.gajewski0@gmail.com>
+// 
+// Permission to use, copy, modify, and distribute this software and its documentation for any purpose, without fee, and without a written agreement is hereby granted,
+// provided that the above copyright notice and this paragraph and the following two paragraphs appear in all copies.
+// 
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, 
+// ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+// THE AUTHOR SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+// THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE AUTHOR HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+
+#include "pgbson_planner.hpp"
+
+#if PG_VERSION_NUM >= 120000
+
+#include "pgbson_stats.hpp"
+
+extern "C" {
+#include <catalog/namespace.h>
+#include <nodes/makefuncs.h>
+#include <nodes/nodeFuncs.h>
+#include <optimizer/optimizer.h>
+#include <optimizer/paths.h>
+#include <parser/parse_oper.h>
+#include <parser/parsetree.h>
+}
+
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+List* call_arguments(Node* node)
+{
+    if (node == NULL)
+        return NIL;
+    else if (IsA(node, FuncExpr))
+        return reinterpret_cast<FuncExpr*>(node)->args;
+    else if (IsA(node, OpExpr))
+        return reinterpret_cast<OpExpr*>(node)->args;
+    else
+        return NIL;
+}
+
+// number of path segments, if the path is a constant
+int path_segments(Node* arg)
+{
+    if (arg == NULL || !IsA(arg, Const) || reinterpret_cast<Const*>(arg)->constisnull)
+        return 1;
+
+    text* path = DatumGetTextPP(reinterpret_cast<Const*>(arg)->constvalue);
+    const char* data = VARDATA_ANY(path);
+    int length = VARSIZE_ANY_EXHDR(path);
+
+    int segments = 1;
+    for (int i = 0; i < length; i++)
+    {
+        if (data[i] == '.')
+            segments++;
+    }
+    return segments;
+}
+
+// average width of the document: from column statistics if it's a plain column, otherwise a guess
+int32 document_width(PlannerInfo* root, Node* arg)
+{
+    if (root != NULL && IsA(arg, Var))
+    {
+        Var* var = reinterpret_cast<Var*>(arg);
+        if (var->varlevelsup == 0 && !IS_SPECIAL_VARNO(var->varno) && int(var->varno) <= list_length(root->parse->rtable))
+        {
+            RangeTblEntry* rte = planner_rt_fetch(var->varno, root);
+            if (rte->rtekind == RTE_RELATION)
+            {
+                int32 width = get_attavgwidth(rte->relid, var->varattno);
+                if (width > 0)
+                    return width;
+            }
+        }
+    }
+    return get_typavgwidth(exprType(arg), exprTypmod(arg));
+}
+
+// per-call cost of looking up path in the document
+double lookup_cost(PlannerInfo* root, List* args)
+{
+    Node* document = reinterpret_cast<Node*>(linitial(args));
+    Node* path = list_length(args) > 1 ? reinterpret_cast<Node*>(lsecond(args)) : NULL;
+
+    double width = document_width(root, document);
+
+    // bsonx lookup is a binary search in the directory
+    double scanned = get_typename(exprType(document)) == "bsonx" ? std::log(width + 1.0) / std::log(2.0) : width;
+
+    return cpu_operator_cost * (1.0 + lookup_cost_per_segment * path_segments(path) + scanned / lookup_bytes_per_operator);
+}
+
+Node* cost_request(SupportRequestCost* request)
+{
+    List* args = call_arguments(request->node);
+    if (list_length(args) < 1)
+        return NULL;
+
+    request->startup = 0;
+    request->per_tuple = lookup_cost(request->root, args);
+    return reinterpret_cast<Node*>(request);
+}
+
+// OID of the ? operator, from the same schema as bson_exists
+Oid exists_operator(Oid funcid, Oid document_type)
+{
+    char* schema = get_namespace_name(get_func_namespace(funcid));
+    if (schema == NULL)
+        return InvalidOid;
+
+    List* name = list_make2(makeString(schema), makeString(pstrdup("?")));
+    return LookupOperName(NULL, name, document_type, TEXTOID, true, -1);
+}
+
+Node* index_condition_request(SupportRequestIndexCondition* request)
+{
+    // only the function form, ? operator is matched by the planner itself
+    if (!IsA(request->node, FuncExpr) || request->indexarg != 0)
+        return NULL;
+
+    List* args = reinterpret_cast<FuncExpr*>(request->node)->args;
+    if (list_length(args) != 2)
+        return NULL;
+
+    Node* document = reinterpret_cast<Node*>(linitial(args));
+    Node* path = reinterpret_cast<Node*>(lsecond(args));
+    if (!is_pseudo_constant_for_index(request->root, path, request->index))
+        return NULL;
+
+    Oid opno = exists_operator(request->funcid, exprType(document));
+    if (!OidIsValid(opno) || !op_in_opfamily(opno, request->opfamily))
+        return NULL;
+
+    Expr* clause = make_opclause(opno, BOOLOID, false,
+        reinterpret_cast<Expr*>(document), reinterpret_cast<Expr*>(path), InvalidOid, InvalidOid);
+
+    request->lossy = false;
+    return reinterpret_cast<Node*>(list_make1(clause));
+}
+
+Node* selectivity_request(SupportRequestSelectivity* request)
+{
+    if (request->is_join)
+        return NULL;
+
+    request->selectivity = exists_selectivity(request->root, request->args, request->varRelid);
+    return reinterpret_cast<Node*>(request);
+}
+
+Node* rows_request(SupportRequestRows* request)
+{
+    List* args = call_arguments(request->node);
+    if (list_length(args) != 2)
+        return NULL;
+
+    Node* document = reinterpret_cast<Node*>(linitial(args));
+    Node* path = reinterpret_cast<Node*>(lsecond(args));
+    if (!IsA(document, Const) || !IsA(path, Const))
+        return NULL;
+
+    Const* document_const = reinterpret_cast<Const*>(document);
+    Const* path_const = reinterpret_cast<Const*>(path);
+    if (document_const->constisnull || path_const->constisnull)
+    {
+        request->rows = 0;
+        return reinterpret_cast<Node*>(request);
+    }
+
+    text* path_text = DatumGetTextPP(path_const->constvalue);
+    compiled_path* compiled = compile_text_path(path_text, CurrentMemoryContext);
+
+    try
+    {
+        mongo::BSONElement e = get_field_detoast(document_const->constvalue, compiled);
+        if (e.eoo())
+            request->rows = 0;
+        else if (e.type() == mongo::Array)
+            request->rows = e.embeddedObject().nFields();
+        else
+            request->rows = 1;
+    }
+    catch(...)
+    {
+        pfree(compiled);
+        return NULL;
+    }
+
+    pfree(compiled);
+    return reinterpret_cast<Node*>(request);
+}
+
+}
+
+Node* getter_support(Node* request)
+{
+    if (IsA(request, SupportRequestCost))
+        return cost_request(reinterpret_cast<SupportRequestCost*>(request));
+
+    return NULL;
+}
+
+Node* exists_support(Node* request)
+{
+    if (IsA(request, SupportRequestCost))
+        return cost_request(reinterpret_cast<SupportRequestCost*>(request));
+    else if (IsA(request, SupportRequestSelectivity))
+        return selectivity_request(reinterpret_cast<SupportRequestSelectivity*>(request));
+    else if (IsA(request, SupportRequestIndexCondition))
+        return index_condition_request(reinterpret_cast<SupportRequestIndexCondition*>(request));
+
+    return NULL;
+}
+
+Node* unwind_support(Node* request)
+{
+    if (IsA(request, SupportRequestCost))
+        return cost_request(reinterpret_cast<SupportRequestCost*>(request));
+    else if (IsA(request, SupportRequestRows))
+        return rows_request(reinterpret_cast<SupportRequestRows*>(request));
+
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,47 @@
+// Copyright (c) 2012-2013 Maciej Gajewski <maciej.gajewski0@gmail.com>
+// 
+// Permission to use, copy, modify, and distribute this software and its documentation for any purpose, without fee, and without a written agreement is hereby granted,
+// provided that the above copyright notice and this paragraph and the following two paragraphs appear in all copies.
+// 
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, 
+// ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+// THE AUTHOR SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+// THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE AUTHOR HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+
+#ifndef PGBSON_PLANNER_HPP
+#define PGBSON_PLANNER_HPP
+
+#include "pgbson_internal.hpp"
+
+// Planner support functions (prosupport), available since PostgreSQL 12.
+// Each function takes a support request node and returns the answer, or NULL
+// if it can't help with the request.
+
+#if PG_VERSION_NUM >= 120000
+
+extern "C" {
+#include <nodes/supportnodes.h>
+}
+
+// cost of field lookup in a single document
+// scans the document, so cost grows with path depth and average width of the document
+const double lookup_cost_per_segment = 1.0;
+const double lookup_bytes_per_operator = 128.0;
+
+// getters: bson_get_*, bson_array_size
+// answers: cost
+Node* getter_support(Node* request);
+
+// bson_exists
+// answers: cost, selectivity, and turns bson_exists(column, path) into column ? path index
+// condition if the column is indexed with operator class supporting ?
+Node* exists_support(Node* request);
+
+// bson_unwind_array
+// answers: cost, number of rows for constant arguments
+Node* unwind_support(Node* request);
+
+#endif
+
+#endif
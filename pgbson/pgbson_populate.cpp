@@ -0,0 +1,859 @@
+// Copyright (c) 2012-2013 Maciej Gajewski <maciej.gajewski0@gmail.com>
+// 
+// Permission to use, copy, modify, and distribute this software and its documentation for any purpose, without fee, and without a written agreement is hereby granted,
+// provided that the above copyright notice and this paragraph and the following two paragraphs appear in all copies.
+// 
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, 
+// ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+// THE AUTHOR SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+// THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE AUTHOR HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+
+#include "pgbson_populate.hpp"
+#include "pgbson_jsonb.hpp"
+
+extern "C" {
+#include <miscadmin.h>
+#include <utils/date.h>
+#include <utils/uuid.h>
+#include <utils/memutils.h>
+}
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <string>
+#include <vector>
+
+struct populate_column;
+
+typedef Datum (*field_converter)(const mongo::BSONElement& e, populate_column* column);
+
+struct populate_column
+{
+    const char* name; // NULL for dropped columns
+    int name_length;
+    int32 typmod;
+    field_converter convert;
+    FmgrInfo input; // conversion through text
+    Oid ioparam;
+    populate_plan* record; // composite types
+    populate_column* element; // arrays
+    Oid element_type;
+    int16 elmlen;
+    bool elmbyval;
+    char elmalign;
+};
+
+// open addressing, size is a power of two
+struct populate_slot
+{
+    int column; // -1 if empty
+    uint32 hash;
+};
+
+struct populate_plan
+{
+    MemoryContext context; // holds the plan made by get_populate_plan, replaced when the type changes
+    Oid type;
+    int32 typmod;
+    TupleDesc tupdesc;
+    populate_column* columns;
+    populate_slot* slots;
+    uint32 slot_mask;
+    Datum* values;
+    bool* nulls;
+    bool* filled;
+};
+
+namespace {
+
+uint32 hash_name(const char* name, int length)
+{
+    return DatumGetUInt32(hash_any(reinterpret_cast<const unsigned char*>(name), length));
+}
+
+// text conversion
+
+// text of BSON strings converted to the database encoding, as a palloc-ed string
+char* utf8_to_server_copy(const char* s, int length)
+{
+    const char* converted = utf8_to_server(s, &length);
+    return converted == s ? pnstrdup(s, length) : const_cast<char*>(converted);
+}
+
+Datum from_text(const mongo::BSONElement& e, populate_column* column)
+{
+    char* s;
+    if (e.type() == mongo::String)
+    {
+        s = utf8_to_server_copy(e.valuestr(), e.valuestrsize() - 1);
+    }
+    else if (e.isABSONObj())
+    {
+        std::string json = e.jsonString(mongo::Strict, false);
+        s = utf8_to_server_copy(json.c_str(), json.size());
+    }
+    else
+    {
+        // already in the database encoding
+        s = text_to_cstring(DatumGetTextP(convert_field<std::string>(NULL, e, e.fieldName())));
+    }
+    return InputFunctionCall(&column->input, s, column->ioparam, column->typmod);
+}
+
+// json and jsonb: any value as JSON
+Datum from_json(const mongo::BSONElement& e, populate_column* column)
+{
+    std::string json = e.jsonString(mongo::Strict, false);
+    return InputFunctionCall(&column->input, utf8_to_server_copy(json.c_str(), json.size()), column->ioparam, column->typmod);
+}
+
+Datum from_jsonb(const mongo::BSONElement& e, populate_column* column)
+{
+#if PG_VERSION_NUM >= 90400
+    if (e.type() == mongo::Object)
+        return PointerGetDatum(jsonb_from_bson(e.embeddedObject()));
+#endif
+    return from_json(e, column);
+}
+
+// direct conversions
+
+bool integer_value(const mongo::BSONElement& e, int64* result)
+{
+    switch (e.type())
+    {
+        case mongo::NumberInt:
+            *result = e._numberInt();
+            return true;
+        case mongo::NumberLong:
+            *result = e._numberLong();
+            return true;
+        case mongo::NumberDouble:
+        {
+            double d = e._numberDouble();
+            if (d != std::floor(d) || std::fabs(d) >= 9.2e18)
+                return false;
+            *result = static_cast<int64>(d);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+Datum to_bool(const mongo::BSONElement& e, populate_column* column)
+{
+    if (e.type() == mongo::Bool)
+        return BoolGetDatum(e.boolean());
+    return from_text(e, column);
+}
+
+Datum to_int2(const mongo::BSONElement& e, populate_column* column)
+{
+    int64 i;
+    if (integer_value(e, &i) && i >= SHRT_MIN && i <= SHRT_MAX)
+        return Int16GetDatum(static_cast<int16>(i));
+    return from_text(e, column);
+}
+
+Datum to_int4(const mongo::BSONElement& e, populate_column* column)
+{
+    int64 i;
+    if (integer_value(e, &i) && i >= INT_MIN && i <= INT_MAX)
+        return Int32GetDatum(static_cast<int32>(i));
+    return from_text(e, column);
+}
+
+Datum to_int8(const mongo::BSONElement& e, populate_column* column)
+{
+    int64 i;
+    if (integer_value(e, &i))
+        return Int64GetDatum(i);
+    return from_text(e, column);
+}
+
+Datum to_float4(const mongo::BSONElement& e, populate_column* column)
+{
+    if (e.isNumber())
+        return Float4GetDatum(static_cast<float>(e.number()));
+    return from_text(e, column);
+}
+
+Datum to_float8(const mongo::BSONElement& e, populate_column* column)
+{
+    if (e.isNumber())
+        return Float8GetDatum(e.number());
+    return from_text(e, column);
+}
+
+Datum to_numeric(const mongo::BSONElement& e, populate_column* column)
+{
+    switch (e.type())
+    {
+        case mongo::NumberInt:
+            return DirectFunctionCall1(int4_numeric, Int32GetDatum(e._numberInt()));
+        case mongo::NumberLong:
+            return DirectFunctionCall1(int8_numeric, Int64GetDatum(e._numberLong()));
+        case mongo::NumberDouble:
+            return DirectFunctionCall1(float8_numeric, Float8GetDatum(e._numberDouble()));
+        default:
+            return from_text(e, column);
+    }
+}
+
+Datum to_text(const mongo::BSONElement& e, populate_column* column)
+{
+    if (e.type() == mongo::String)
+    {
+        int length = e.valuestrsize() - 1;
+        const char* s = utf8_to_server(e.valuestr(), &length);
+        return PointerGetDatum(cstring_to_text_with_len(s, length));
+    }
+    return from_text(e, column);
+}
+
+Datum to_timestamp(const mongo::BSONElement& e, populate_column* column)
+{
+    if (e.type() == mongo::Date)
+        return TimestampGetDatum(bson_date_to_timestamp(e.date().asInt64()));
+    return from_text(e, column);
+}
+
+Datum to_date(const mongo::BSONElement& e, populate_column* column)
+{
+    if (e.type() != mongo::Date)
+        return from_text(e, column);
+
+    long long ms = e.date().asInt64();
+    DateADT date;
+    if (ms == std::numeric_limits<long long>::min())
+    {
+        DATE_NOBEGIN(date);
+    }
+    else if (ms == std::numeric_limits<long long>::max())
+    {
+        DATE_NOEND(date);
+    }
+    else
+    {
+        const long long ms_per_day = SECS_PER_DAY * 1000LL;
+        long long days = ms / ms_per_day;
+        if (ms % ms_per_day < 0)
+            days--;
+        date = days - (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE);
+    }
+    return DateADTGetDatum(date);
+}
+
+Datum to_bytea(const mongo::BSONElement& e, populate_column* column)
+{
+    if (e.type() != mongo::BinData)
+        return from_text(e, column);
+
+    int length;
+    const char* data = e.binData(length);
+    bytea* result = reinterpret_cast<bytea*>(palloc(length + VARHDRSZ));
+    SET_VARSIZE(result, length + VARHDRSZ);
+    std::memcpy(VARDATA(result), data, length);
+    return PointerGetDatum(result);
+}
+
+Datum to_uuid(const mongo::BSONElement& e, populate_column* column)
+{
+    if (e.type() != mongo::BinData)
+        return from_text(e, column);
+
+    int length;
+    const char* data = e.binData(length);
+    if (length != UUID_LEN)
+        return from_text(e, column);
+
+    pg_uuid_t* uuid = reinterpret_cast<pg_uuid_t*>(palloc(sizeof(pg_uuid_t)));
+    std::memcpy(uuid->data, data, UUID_LEN);
+    return UUIDPGetDatum(uuid);
+}
+
+Datum to_bson(const mongo::BSONElement& e, populate_column*)
+{
+    return element_to_bson(e);
+}
+
+Datum to_record(const mongo::BSONElement& e, populate_column* column)
+{
+    if (e.type() != mongo::Object)
+        return from_text(e, column);
+
+    check_stack_depth();
+    return HeapTupleGetDatum(populate_row(column->record, NULL, e.embeddedObject()));
+}
+
+Datum to_array(const mongo::BSONElement& e, populate_column* column)
+{
+    if (e.type() != mongo::Array)
+        return from_text(e, column);
+
+    mongo::BSONObj array = e.embeddedObject();
+    int n = array.nFields();
+    Datum* values = reinterpret_cast<Datum*>(palloc(sizeof(Datum) * (n + 1)));
+    bool* nulls = reinterpret_cast<bool*>(palloc(sizeof(bool) * (n + 1)));
+
+    int i = 0;
+    mongo::BSONObjIterator it(array);
+    while (it.more())
+    {
+        mongo::BSONElement element = it.next();
+        if (element.type() == mongo::Array)
+        {
+            ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                errmsg("field %s: nested arrays can not be converted to PostgreSQL arrays", e.fieldName())));
+        }
+        nulls[i] = element.isNull() || element.type() == mongo::Undefined;
+        values[i] = nulls[i] ? (Datum) 0 : column->element->convert(element, column->element);
+        i++;
+    }
+
+    int dims[1] = { n };
+    int lbs[1] = { 1 };
+    ArrayType* result = construct_md_array(values, nulls, 1, dims, lbs,
+        column->element_type, column->elmlen, column->elmbyval, column->elmalign);
+    return PointerGetDatum(result);
+}
+
+void plan_column(populate_column* column, Oid typid, int32 typmod, MemoryContext ctx)
+{
+    column->typmod = typmod;
+
+    // every type has input function, for values of other BSON types
+    Oid input;
+    getTypeInputInfo(typid, &input, &column->ioparam);
+    fmgr_info_cxt(input, &column->input, ctx);
+
+    Oid element_type = get_element_type(typid);
+    if (element_type != InvalidOid)
+    {
+        column->element_type = element_type;
+        get_typlenbyvalalign(element_type, &column->elmlen, &column->elmbyval, &column->elmalign);
+        column->element = reinterpret_cast<populate_column*>(MemoryContextAllocZero(ctx, sizeof(populate_column)));
+        plan_column(column->element, element_type, typmod, ctx);
+        column->convert = to_array;
+        return;
+    }
+
+    switch (typid)
+    {
+        case BOOLOID: column->convert = to_bool; break;
+        case INT2OID: column->convert = to_int2; break;
+        case INT4OID: column->convert = to_int4; break;
+        case INT8OID: column->convert = to_int8; break;
+        case FLOAT4OID: column->convert = to_float4; break;
+        case FLOAT8OID: column->convert = to_float8; break;
+        case NUMERICOID: column->convert = to_numeric; break;
+        case TEXTOID: column->convert = to_text; break;
+        case TIMESTAMPOID:
+        case TIMESTAMPTZOID: column->convert = to_timestamp; break;
+        case DATEOID: column->convert = to_date; break;
+        case BYTEAOID: column->convert = to_bytea; break;
+        case UUIDOID: column->convert = to_uuid; break;
+        case JSONOID: column->convert = from_json; break;
+#if PG_VERSION_NUM >= 90400
+        case JSONBOID: column->convert = from_jsonb; break;
+#endif
+
+        default:
+            if (type_is_rowtype(typid) && typid != RECORDOID)
+            {
+                column->record = get_populate_plan(&column->record, typid, -1, ctx);
+                column->convert = to_record;
+            }
+            else if (get_typename(typid) == "bson")
+            {
+                column->convert = to_bson;
+            }
+            else
+            {
+                column->convert = from_text;
+            }
+    }
+}
+
+// plan for a copy of tupdesc
+populate_plan* plan_columns(TupleDesc source, Oid type, int32 typmod, MemoryContext ctx)
+{
+    MemoryContext oldcontext = MemoryContextSwitchTo(ctx);
+    TupleDesc tupdesc = CreateTupleDescCopy(source);
+    BlessTupleDesc(tupdesc);
+    MemoryContextSwitchTo(oldcontext);
+
+    int natts = tupdesc->natts;
+    populate_plan* plan = reinterpret_cast<populate_plan*>(MemoryContextAllocZero(ctx, sizeof(populate_plan)));
+    plan->type = type;
+    plan->typmod = typmod;
+    plan->tupdesc = tupdesc;
+    plan->columns = reinterpret_cast<populate_column*>(MemoryContextAllocZero(ctx, sizeof(populate_column) * (natts + 1)));
+    plan->values = reinterpret_cast<Datum*>(MemoryContextAlloc(ctx, sizeof(Datum) * (natts + 1)));
+    plan->nulls = reinterpret_cast<bool*>(MemoryContextAlloc(ctx, sizeof(bool) * (natts + 1)));
+    plan->filled = reinterpret_cast<bool*>(MemoryContextAlloc(ctx, sizeof(bool) * (natts + 1)));
+
+    uint32 n_slots = 8;
+    while (n_slots < 2 * static_cast<uint32>(natts))
+        n_slots *= 2;
+    plan->slot_mask = n_slots - 1;
+    plan->slots = reinterpret_cast<populate_slot*>(MemoryContextAlloc(ctx, sizeof(populate_slot) * n_slots));
+    for (uint32 i = 0; i < n_slots; i++)
+        plan->slots[i].column = -1;
+
+    for (int i = 0; i < natts; i++)
+    {
+        Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+        if (attr->attisdropped)
+            continue;
+
+        populate_column* column = &plan->columns[i];
+        // matched with UTF-8 field names
+        int length = std::strlen(NameStr(attr->attname));
+        const char* name = server_to_utf8(NameStr(attr->attname), &length);
+        column->name = name == NameStr(attr->attname) ? name : MemoryContextStrdup(ctx, name);
+        column->name_length = length;
+        plan_column(column, attr->atttypid, attr->atttypmod, ctx);
+
+        uint32 hash = hash_name(column->name, column->name_length);
+        uint32 slot = hash & plan->slot_mask;
+        while (plan->slots[slot].column >= 0)
+            slot = (slot + 1) & plan->slot_mask;
+        plan->slots[slot].column = i;
+        plan->slots[slot].hash = hash;
+    }
+
+    return plan;
+}
+
+populate_plan* plan_populate(Oid type, int32 typmod, MemoryContext ctx)
+{
+    PGBSON_LOG << "plan_populate, type=" << type << ", typmod=" << typmod << PGBSON_ENDL;
+
+    TupleDesc cached = lookup_rowtype_tupdesc(type, typmod);
+    populate_plan* plan = plan_columns(cached, type, typmod, ctx);
+    ReleaseTupleDesc(cached);
+    return plan;
+}
+
+int find_column(const populate_plan* plan, const char* name, int length)
+{
+    uint32 hash = hash_name(name, length);
+    for (uint32 slot = hash & plan->slot_mask; plan->slots[slot].column >= 0; slot = (slot + 1) & plan->slot_mask)
+    {
+        const populate_slot& s = plan->slots[slot];
+        const populate_column& column = plan->columns[s.column];
+        if (s.hash == hash && column.name_length == length && std::memcmp(column.name, name, length) == 0)
+            return s.column;
+    }
+    return -1;
+}
+
+}
+
+populate_plan* get_populate_plan(populate_plan** cache, Oid type, int32 typmod, MemoryContext ctx)
+{
+    if (*cache == NULL || (*cache)->type != type || (*cache)->typmod != typmod)
+    {
+        MemoryContext context = new_cache_context(ctx, *cache != NULL ? (*cache)->context : NULL);
+        *cache = NULL;
+        *cache = plan_populate(type, typmod, context);
+        (*cache)->context = context;
+    }
+    return *cache;
+}
+
+TupleDesc get_populate_tupdesc(const populate_plan* plan)
+{
+    return plan->tupdesc;
+}
+
+HeapTuple populate_row(populate_plan* plan, HeapTupleHeader base, const mongo::BSONObj& object)
+{
+    int natts = plan->tupdesc->natts;
+    std::fill(plan->filled, plan->filled + natts, false);
+
+    if (base != NULL)
+    {
+        HeapTupleData tuple;
+        tuple.t_len = HeapTupleHeaderGetDatumLength(base);
+        tuple.t_data = base;
+        heap_deform_tuple(&tuple, plan->tupdesc, plan->values, plan->nulls);
+    }
+    else
+    {
+        std::fill(plan->nulls, plan->nulls + natts, true);
+    }
+
+    mongo::BSONObjIterator it(object);
+    while (it.more())
+    {
+        mongo::BSONElement e = it.next();
+        int i = find_column(plan, e.fieldName(), e.fieldNameSize() - 1);
+        if (i < 0 || plan->filled[i])
+            continue;
+
+        plan->filled[i] = true;
+        if (e.isNull() || e.type() == mongo::Undefined)
+        {
+            plan->nulls[i] = true;
+        }
+        else
+        {
+            populate_column* column = &plan->columns[i];
+            plan->values[i] = column->convert(e, column);
+            plan->nulls[i] = false;
+        }
+    }
+
+    return heap_form_tuple(plan->tupdesc, plan->values, plan->nulls);
+}
+
+// Unwinding
+
+struct unwind_field
+{
+    int level; // -1: the document
+    compiled_path* path; // relative to the level's element, NULL for the element itself
+};
+
+struct unwind_plan
+{
+    MemoryContext context; // holds the plan, replaced when the arguments change
+    populate_plan* columns;
+
+    // arguments the plan was made for
+    ArrayType* array_paths;
+    ArrayType* field_paths;
+
+    int n_levels;
+    compiled_path** levels; // relative to the element of the previous level
+    bool* ordinal_int8; // type of ordinality columns, int8 or int4
+
+    int n_fields;
+    unwind_field* fields;
+
+    // fields looked up in each level's element, indexed by level + 1
+    int* n_level_fields;
+    compiled_path*** level_paths;
+    int** level_columns;
+    mongo::BSONElement* found;
+
+    // current row
+    const char* document;
+    const char** elements; // current element of each level
+    int64* ordinals;
+
+    MemoryContext row_context;
+};
+
+namespace {
+
+bool same_array(ArrayType* a, ArrayType* b)
+{
+    return VARSIZE(a) == VARSIZE(b) && std::memcmp(a, b, VARSIZE(a)) == 0;
+}
+
+std::vector<std::string> text_array_strings(ArrayType* array, const char* argument)
+{
+    Datum* elements;
+    bool* nulls;
+    int n;
+    deconstruct_array(array, TEXTOID, -1, false, 'i', &elements, &nulls, &n);
+
+    std::vector<std::string> result;
+    for (int i = 0; i < n; i++)
+    {
+        if (nulls[i])
+        {
+            ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED), errmsg("%s must not contain nulls", argument)));
+        }
+        text* t = DatumGetTextPP(elements[i]);
+        int length = VARSIZE_ANY_EXHDR(t);
+        const char* path = server_to_utf8(VARDATA_ANY(t), &length);
+        result.push_back(std::string(path, length));
+    }
+    return result;
+}
+
+// true if path is inside the (array) path prefix; rest is set to the relative path, empty for prefix itself
+bool path_within(const std::string& path, const std::string& prefix, std::string* rest)
+{
+    if (path == prefix)
+    {
+        rest->clear();
+        return true;
+    }
+    if (path.size() > prefix.size() && path.compare(0, prefix.size(), prefix) == 0 && path[prefix.size()] == '.')
+    {
+        *rest = path.substr(prefix.size() + 1);
+        return true;
+    }
+    return false;
+}
+
+compiled_path* compile_string(const std::string& path, MemoryContext ctx)
+{
+    return compile_path(path.c_str(), path.size(), ctx);
+}
+
+unwind_plan* plan_unwind(ArrayType* array_paths, ArrayType* field_paths, TupleDesc tupdesc, MemoryContext ctx)
+{
+    std::vector<std::string> levels = text_array_strings(array_paths, "array paths");
+    std::vector<std::string> fields = text_array_strings(field_paths, "field paths");
+
+    const int n_levels = levels.size();
+    const int n_fields = fields.size();
+    if (n_levels == 0)
+    {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE), errmsg("at least one array path is required")));
+    }
+    if (tupdesc->natts != n_levels + n_fields)
+    {
+        ereport(ERROR,
+            (errcode(ERRCODE_DATATYPE_MISMATCH),
+            errmsg("bson_unwind returns %d columns: ordinality of %d arrays and %d fields, %d given",
+                n_levels + n_fields, n_levels, n_fields, tupdesc->natts)));
+    }
+
+    unwind_plan* plan = reinterpret_cast<unwind_plan*>(MemoryContextAllocZero(ctx, sizeof(unwind_plan)));
+    plan->columns = plan_columns(tupdesc, RECORDOID, -1, ctx);
+
+    plan->array_paths = reinterpret_cast<ArrayType*>(MemoryContextAlloc(ctx, VARSIZE(array_paths)));
+    std::memcpy(plan->array_paths, array_paths, VARSIZE(array_paths));
+    plan->field_paths = reinterpret_cast<ArrayType*>(MemoryContextAlloc(ctx, VARSIZE(field_paths)));
+    std::memcpy(plan->field_paths, field_paths, VARSIZE(field_paths));
+
+    plan->n_levels = n_levels;
+    plan->levels = reinterpret_cast<compiled_path**>(MemoryContextAlloc(ctx, sizeof(compiled_path*) * n_levels));
+    plan->ordinal_int8 = reinterpret_cast<bool*>(MemoryContextAlloc(ctx, sizeof(bool) * n_levels));
+    for (int i = 0; i < n_levels; i++)
+    {
+        // each array path is within the previous one, like paths of consecutive $unwind stages
+        std::string rest = levels[i];
+        if (i > 0 && (!path_within(levels[i], levels[i - 1], &rest) || rest.empty()))
+        {
+            ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                errmsg("array path \"%s\" is not within \"%s\"", levels[i].c_str(), levels[i - 1].c_str())));
+        }
+        plan->levels[i] = compile_string(rest, ctx);
+
+        Oid type = TupleDescAttr(plan->columns->tupdesc, i)->atttypid;
+        if (type != INT4OID && type != INT8OID)
+        {
+            ereport(ERROR,
+                (errcode(ERRCODE_DATATYPE_MISMATCH),
+                errmsg("ordinality column %d must be integer or bigint", i + 1)));
+        }
+        plan->ordinal_int8[i] = type == INT8OID;
+    }
+
+    // each field belongs to the deepest level containing it
+    plan->n_fields = n_fields;
+    plan->fields = reinterpret_cast<unwind_field*>(MemoryContextAllocZero(ctx, sizeof(unwind_field) * (n_fields + 1)));
+    plan->n_level_fields = reinterpret_cast<int*>(MemoryContextAllocZero(ctx, sizeof(int) * (n_levels + 1)));
+    for (int i = 0; i < n_fields; i++)
+    {
+        unwind_field* field = &plan->fields[i];
+        field->level = -1;
+        std::string rest = fields[i];
+        for (int level = n_levels - 1; level >= 0; level--)
+        {
+            if (path_within(fields[i], levels[level], &rest))
+            {
+                field->level = level;
+                break;
+            }
+        }
+        if (!rest.empty())
+        {
+            field->path = compile_string(rest, ctx);
+            plan->n_level_fields[field->level + 1]++;
+        }
+    }
+
+    plan->level_paths = reinterpret_cast<compiled_path***>(MemoryContextAllocZero(ctx, sizeof(compiled_path**) * (n_levels + 1)));
+    plan->level_columns = reinterpret_cast<int**>(MemoryContextAllocZero(ctx, sizeof(int*) * (n_levels + 1)));
+    for (int level = -1; level < n_levels; level++)
+    {
+        int n = plan->n_level_fields[level + 1];
+        plan->level_paths[level + 1] = reinterpret_cast<compiled_path**>(MemoryContextAlloc(ctx, sizeof(compiled_path*) * (n + 1)));
+        plan->level_columns[level + 1] = reinterpret_cast<int*>(MemoryContextAlloc(ctx, sizeof(int) * (n + 1)));
+
+        int j = 0;
+        for (int i = 0; i < n_fields; i++)
+        {
+            if (plan->fields[i].level == level && plan->fields[i].path != NULL)
+            {
+                plan->level_paths[level + 1][j] = plan->fields[i].path;
+                plan->level_columns[level + 1][j] = n_levels + i;
+                j++;
+            }
+        }
+    }
+    plan->found = reinterpret_cast<mongo::BSONElement*>(MemoryContextAlloc(ctx, sizeof(mongo::BSONElement) * (n_fields + 1)));
+    for (int i = 0; i < n_fields; i++)
+        new (&plan->found[i]) mongo::BSONElement();
+
+    plan->elements = reinterpret_cast<const char**>(MemoryContextAllocZero(ctx, sizeof(const char*) * n_levels));
+    plan->ordinals = reinterpret_cast<int64*>(MemoryContextAllocZero(ctx, sizeof(int64) * n_levels));
+    plan->row_context = AllocSetContextCreate(ctx, "bson_unwind row",
+        ALLOCSET_DEFAULT_MINSIZE, ALLOCSET_DEFAULT_INITSIZE, ALLOCSET_DEFAULT_MAXSIZE);
+
+    return plan;
+}
+
+void set_value(unwind_plan* plan, int column, const mongo::BSONElement& e)
+{
+    populate_plan* columns = plan->columns;
+    if (e.eoo() || e.isNull() || e.type() == mongo::Undefined)
+    {
+        columns->nulls[column] = true;
+    }
+    else
+    {
+        populate_column* c = &columns->columns[column];
+        columns->values[column] = c->convert(e, c);
+        columns->nulls[column] = false;
+    }
+}
+
+void emit_row(unwind_plan* plan, Tuplestorestate* store)
+{
+    populate_plan* columns = plan->columns;
+
+    MemoryContextReset(plan->row_context);
+    MemoryContext oldcontext = MemoryContextSwitchTo(plan->row_context);
+
+    for (int i = 0; i < plan->n_levels; i++)
+    {
+        columns->values[i] = plan->ordinal_int8[i] ? Int64GetDatum(plan->ordinals[i]) : Int32GetDatum(plan->ordinals[i]);
+        columns->nulls[i] = false;
+    }
+
+    // fields of each level in one walk over its element
+    for (int level = -1; level < plan->n_levels; level++)
+    {
+        int n = plan->n_level_fields[level + 1];
+        if (n == 0)
+            continue;
+
+        mongo::BSONObj object;
+        if (level < 0)
+        {
+            object = mongo::BSONObj(plan->document);
+        }
+        else
+        {
+            mongo::BSONElement element(plan->elements[level]);
+            if (element.isABSONObj())
+                object = element.embeddedObject();
+        }
+
+        const int* field_columns = plan->level_columns[level + 1];
+        if (object.isEmpty())
+        {
+            for (int j = 0; j < n; j++)
+                columns->nulls[field_columns[j]] = true;
+            continue;
+        }
+
+        get_fields(object, plan->level_paths[level + 1], n, plan->found);
+        for (int j = 0; j < n; j++)
+            set_value(plan, field_columns[j], plan->found[j]);
+    }
+
+    // array elements themselves
+    for (int i = 0; i < plan->n_fields; i++)
+    {
+        const unwind_field& field = plan->fields[i];
+        if (field.path != NULL)
+            continue;
+
+        if (field.level < 0)
+        {
+            // empty field path: the whole document
+            columns->values[plan->n_levels + i] = return_bson(mongo::BSONObj(plan->document));
+            columns->nulls[plan->n_levels + i] = false;
+        }
+        else
+        {
+            set_value(plan, plan->n_levels + i, mongo::BSONElement(plan->elements[field.level]));
+        }
+    }
+
+    tuplestore_putvalues(store, columns->tupdesc, columns->values, columns->nulls);
+    MemoryContextSwitchTo(oldcontext);
+}
+
+void unwind_level(unwind_plan* plan, Tuplestorestate* store, int level, const mongo::BSONObj& parent)
+{
+    mongo::BSONElement e = get_field(parent, plan->levels[level]);
+    if (e.eoo())
+        return;
+
+    // not an array: unwound as a single element, like bson_unwind_array
+    const char* next = e.rawdata();
+    bool single = true;
+    if (e.type() == mongo::Array)
+    {
+        next = e.embeddedObject().objdata() + 4;
+        single = false;
+    }
+
+    int64 ordinal = 0;
+    while (*next != mongo::EOO)
+    {
+        mongo::BSONElement element(next);
+        plan->elements[level] = next;
+        plan->ordinals[level] = ++ordinal;
+
+        if (level + 1 == plan->n_levels)
+        {
+            emit_row(plan, store);
+        }
+        else if (element.isABSONObj())
+        {
+            unwind_level(plan, store, level + 1, element.embeddedObject());
+        }
+
+        if (single)
+            break;
+        next += element.size();
+    }
+}
+
+}
+
+unwind_plan* get_unwind_plan(unwind_plan** cache, ArrayType* array_paths, ArrayType* field_paths,
+    TupleDesc tupdesc, MemoryContext ctx)
+{
+    unwind_plan* plan = *cache;
+    if (plan == NULL || !same_array(plan->array_paths, array_paths) || !same_array(plan->field_paths, field_paths)
+        || plan->columns->tupdesc->natts != tupdesc->natts)
+    {
+        MemoryContext context = new_cache_context(ctx, plan != NULL ? plan->context : NULL);
+        *cache = NULL;
+        *cache = plan_unwind(array_paths, field_paths, tupdesc, context);
+        (*cache)->context = context;
+    }
+    return *cache;
+}
+
+TupleDesc get_unwind_tupdesc(const unwind_plan* plan)
+{
+    return plan->columns->tupdesc;
+}
+
+void unwind_document(unwind_plan* plan, const mongo::BSONObj& document, Tuplestorestate* store)
+{
+    plan->document = document.objdata();
+    unwind_level(plan, store, 0, document);
+}
@@ -0,0 +1,62 @@
+// Copyright (c) 2012-2013 Maciej Gajewski <maciej.gajewski0@gmail.com>
+// 
+// Permission to use, copy, modify, and distribute this software and its documentation for any purpose, without fee, and without a written agreement is hereby granted,
+// provided that the above copyright notice and this paragraph and the following two paragraphs appear in all copies.
+// 
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, 
+// ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+// THE AUTHOR SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+// THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE AUTHOR HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+
+#ifndef PGBSON_POPULATE_HPP
+#define PGBSON_POPULATE_HPP
+
+#include "pgbson_internal.hpp"
+
+// Conversion of BSON documents to rows of a composite type, the inverse of row_to_bson.
+//
+// The plan for a row type is built once per (type, typmod): a hash table mapping field names
+// to columns and a converter for each column. Each document is walked once and fields are matched
+// to columns by hash. Fields without a column are ignored, columns without a field are NULL or
+// taken from the base row; of repeated fields the first is used.
+//
+// Values are converted directly when the BSON type corresponds to the column type: numbers,
+// strings and booleans, Date to timestamp, timestamptz and date, binary data to bytea and uuid,
+// objects to bson, jsonb and composite types, arrays to one-dimensional arrays. Other values go
+// through text and the input function of the column type; objects and arrays as JSON.
+// null and undefined become NULL.
+
+struct populate_plan;
+
+// returns plan for the row type, the plan in *cache is reused if it's for the same type.
+// A new one is made in a child context of ctx, which replaces the context of the previous one
+populate_plan* get_populate_plan(populate_plan** cache, Oid type, int32 typmod, MemoryContext ctx);
+
+TupleDesc get_populate_tupdesc(const populate_plan* plan);
+
+// base is a row of the type providing values of missing fields, or NULL
+HeapTuple populate_row(populate_plan* plan, HeapTupleHeader base, const mongo::BSONObj& object);
+
+// Unwinding of nested arrays, with fields of the elements, into rows.
+//
+// Array paths are full paths, each within the previous one, like paths of consecutive $unwind stages:
+// {"orders", "orders.items"} gives a row for every item of every order. Field paths are full paths as well,
+// each is looked up in the element of the deepest array containing it (or in the document), with
+// one walk per element for all its fields; a field path equal to an array path gives the element itself.
+// Rows have an ordinality column (1-based position) per array, then a column per field.
+// Missing arrays and elements without the next array give no rows; a non-array value is a single element.
+
+struct unwind_plan;
+
+// returns plan for the arguments and the tuple descriptor of the result, *cache is reused if it's for the same arguments.
+// A new one is made in a child context of ctx, which replaces the context of the previous one
+unwind_plan* get_unwind_plan(unwind_plan** cache, ArrayType* array_paths, ArrayType* field_paths,
+    TupleDesc tupdesc, MemoryContext ctx);
+
+TupleDesc get_unwind_tupdesc(const unwind_plan* plan);
+
+// puts rows unwound from the document into the store
+void unwind_document(unwind_plan* plan, const mongo::BSONObj& document, Tuplestorestate* store);
+
+#endif
@@ -0,0 +1,92 @@
+// Copyright (c) 2012-2013 Maciej Gajewski <maciej.gajewski0@gmail.com>
+// 
+// Permission to use, copy, modify, and distribute this software and its documentation for any purpose, without fee, and without a written agreement is hereby granted,
+// provided that the above copyright notice and this paragraph and the following two paragraphs appear in all copies.
+// 
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, 
+// ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+// THE AUTHOR SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+// THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE AUTHOR HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+
+#include "pgbson_scan.hpp"
+
+#include <algorithm>
+
+element_size_table::element_size_table()
+{
+    std::memset(value_size, value_other, sizeof(value_size));
+    std::memset(prefix_extra, 0, sizeof(prefix_extra));
+
+    value_size[static_cast<unsigned char>(mongo::MinKey)] = 0;
+    value_size[mongo::MaxKey] = 0;
+    value_size[mongo::Undefined] = 0;
+    value_size[mongo::jstNULL] = 0;
+    value_size[mongo::Bool] = 1;
+    value_size[mongo::NumberInt] = 4;
+    value_size[mongo::NumberDouble] = 8;
+    value_size[mongo::NumberLong] = 8;
+    value_size[mongo::Date] = 8;
+    value_size[mongo::Timestamp] = 8;
+    value_size[mongo::jstOID] = 12;
+
+    // the length counts the terminator, not itself
+    value_size[mongo::String] = value_length_prefixed;
+    prefix_extra[mongo::String] = 4;
+    value_size[mongo::Code] = value_length_prefixed;
+    prefix_extra[mongo::Code] = 4;
+    value_size[mongo::Symbol] = value_length_prefixed;
+    prefix_extra[mongo::Symbol] = 4;
+    value_size[mongo::DBRef] = value_length_prefixed;
+    prefix_extra[mongo::DBRef] = 4 + 12;
+    // subtype byte is not counted
+    value_size[mongo::BinData] = value_length_prefixed;
+    prefix_extra[mongo::BinData] = 4 + 1;
+    // the whole value is counted
+    value_size[mongo::Object] = value_length_prefixed;
+    value_size[mongo::Array] = value_length_prefixed;
+    value_size[mongo::CodeWScope] = value_length_prefixed;
+}
+
+const element_size_table element_sizes;
+
+int count_fields(const mongo::BSONObj& object)
+{
+    int n = 0;
+    for (const char* p = object.objdata() + 4; *p != mongo::EOO; p += element_size(p))
+        n++;
+    return n;
+}
+
+int compare_objects(const char* left, const char* right)
+{
+    bson_scanner l(left);
+    bson_scanner r(right);
+    for (;;)
+    {
+        if (!l.more())
+            return r.more() ? -1 : 0;
+        if (!r.more())
+            return 1;
+
+        mongo::BSONElement a = l.next();
+        mongo::BSONElement b = r.next();
+
+        // BSONElement::woCompare
+        int x = a.canonicalType() - b.canonicalType();
+        if (x != 0 && (!a.isNumber() || !b.isNumber()))
+            return x;
+
+        // strcmp, the sizes include terminators
+        x = std::memcmp(a.fieldName(), b.fieldName(), std::min(l.name_size(), r.name_size()));
+        if (x != 0)
+            return x;
+
+        if (a.type() == mongo::Object || a.type() == mongo::Array)
+            x = compare_objects(a.value(), b.value());
+        else
+            x = mongo::compareElementValues(a, b);
+        if (x != 0)
+            return x;
+    }
+}
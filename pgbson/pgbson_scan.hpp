@@ -0,0 +1,142 @@
+// Copyright (c) 2012-2013 Maciej Gajewski <maciej.gajewski0@gmail.com>
+// 
+// Permission to use, copy, modify, and distribute this software and its documentation for any purpose, without fee, and without a written agreement is hereby granted,
+// provided that the above copyright notice and this paragraph and the following two paragraphs appear in all copies.
+// 
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, 
+// ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+// THE AUTHOR SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+// THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE AUTHOR HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+
+#ifndef PGBSON_SCAN_HPP
+#define PGBSON_SCAN_HPP
+
+#include "pgbson_internal.hpp"
+
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Element scanning for stored (validated) documents, used instead of BSONObjIterator on hot paths.
+//
+// BSONElement::size() switches on the type and calls strlen on the field name. Here fixed value sizes
+// come from a table indexed by type code, and the name terminator is found inline with SSE2, 16 bytes
+// per step. The scanner keeps the name size, so names can be compared by length and first byte
+// before memcmp. Elements are plain BSONElements.
+
+struct element_size_table
+{
+    // fixed value size, or value_length_prefixed (int32 length plus prefix_extra bytes), or value_other
+    // (regular expressions and invalid types, left to BSONElement::size())
+    signed char value_size[256];
+    signed char prefix_extra[256];
+
+    element_size_table();
+};
+
+const signed char value_length_prefixed = -1;
+const signed char value_other = -2;
+
+extern const element_size_table element_sizes;
+
+// size of field name, terminator included
+inline int field_name_size(const char* name)
+{
+#ifdef __SSE2__
+    // aligned loads don't cross pages, so reading around the name is safe
+    const char* block = reinterpret_cast<const char*>(reinterpret_cast<uintptr_t>(name) & ~uintptr_t(15));
+    const __m128i zero = _mm_setzero_si128();
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(block)), zero));
+    mask >>= name - block;
+    if (mask != 0)
+        return __builtin_ctz(mask) + 1;
+
+    for (;;)
+    {
+        block += 16;
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(block)), zero));
+        if (mask != 0)
+            return block + __builtin_ctz(mask) - name + 1;
+    }
+#else
+    return std::strlen(name) + 1;
+#endif
+}
+
+// size of element with known field name size
+inline int element_size(const char* element, int name_size)
+{
+    unsigned char type = static_cast<unsigned char>(*element);
+    int header = 1 + name_size;
+    int value_size = element_sizes.value_size[type];
+    if (value_size >= 0)
+        return header + value_size;
+
+    if (value_size == value_length_prefixed)
+    {
+        int32 length;
+        std::memcpy(&length, element + header, 4);
+        return header + length + element_sizes.prefix_extra[type];
+    }
+
+    return mongo::BSONElement(element).size();
+}
+
+inline int element_size(const char* element)
+{
+    return element_size(element, field_name_size(element + 1));
+}
+
+// true if the field name of given size (terminator included) equals name of given length
+inline bool field_name_matches(const char* field_name, int name_size, const char* name, int length)
+{
+    return name_size == length + 1
+        && (length == 0 || (field_name[0] == name[0] && std::memcmp(field_name, name, length) == 0));
+}
+
+class bson_scanner
+{
+public:
+
+    explicit bson_scanner(const char* objdata)
+        : _next(objdata + 4), _name_size(0)
+    {
+    }
+
+    explicit bson_scanner(const mongo::BSONObj& object)
+        : _next(object.objdata() + 4), _name_size(0)
+    {
+    }
+
+    bool more() const { return *_next != mongo::EOO; }
+
+    mongo::BSONElement next()
+    {
+        const char* element = _next;
+        _name_size = field_name_size(element + 1);
+        _next += element_size(element, _name_size);
+        return mongo::BSONElement(element);
+    }
+
+    // name size of the last element returned by next(), terminator included
+    int name_size() const { return _name_size; }
+
+    // the element following the last one returned by next()
+    const char* position() const { return _next; }
+
+private:
+
+    const char* _next;
+    int _name_size;
+};
+
+// same as BSONObj::nFields()
+int count_fields(const mongo::BSONObj& object);
+
+// same as BSONObj::woCompare(other), the result has the same sign
+int compare_objects(const char* left, const char* right);
+
+#endif
@@ -0,0 +1,794 @@
+// Copyright (c) 2012-2013 Maciej Gajewski <maciej.gajewski0@gmail.com>
+// 
+// Permission to use, copy, modify, and distribute this software and its documentation for any purpose, without fee, and without a written agreement is hereby granted,
+// provided that the above copyright notice and this paragraph and the following two paragraphs appear in all copies.
+// 
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, 
+// ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+// THE AUTHOR SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+// THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE AUTHOR HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+
+#include "pgbson_stats.hpp"
+
+extern "C" {
+#include <catalog/pg_statistic.h>
+}
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <string>
+#include <utility>
+
+namespace {
+
+// limits memory used while counting paths in the sample
+const std::size_t stats_max_tracked_paths = 10000;
+
+// standard statistics, replaced by compute_bson_stats
+struct analyze_extra
+{
+    AnalyzeAttrComputeStatsFunc std_compute_stats;
+    void* std_extra_data;
+};
+
+struct path_count
+{
+    int docs;
+    int last_doc;
+};
+
+typedef std::map<std::string, path_count> path_count_map;
+
+struct element_less
+{
+    bool operator()(const mongo::BSONElement& a, const mongo::BSONElement& b) const
+    {
+        return a.woCompare(b, false) < 0;
+    }
+};
+
+struct value_group
+{
+    std::size_t first;
+    int count;
+};
+
+struct group_more_common
+{
+    bool operator()(const value_group& a, const value_group& b) const
+    {
+        return a.count > b.count;
+    }
+};
+
+int stats_target(VacAttrStats* stats)
+{
+#if PG_VERSION_NUM >= 170000
+    int target = stats->attstattarget;
+#else
+    int target = stats->attr->attstattarget;
+#endif
+    if (target < 0)
+        target = default_statistics_target;
+    return target;
+}
+
+// counts documents containing each path, descending into sub-objects (but not arrays)
+void count_paths(const mongo::BSONObj& object, const std::string& prefix, int depth, int doc, path_count_map& counts)
+{
+    mongo::BSONObjIterator it(object);
+    while (it.more())
+    {
+        mongo::BSONElement e = it.next();
+        std::string path = prefix + e.fieldName();
+
+        path_count_map::iterator found = counts.find(path);
+        if (found == counts.end())
+        {
+            if (counts.size() >= stats_max_tracked_paths)
+                continue;
+            path_count count = { 0, -1 };
+            found = counts.insert(std::make_pair(path, count)).first;
+        }
+        if (found->second.last_doc != doc)
+        {
+            found->second.docs++;
+            found->second.last_doc = doc;
+        }
+
+        if (e.type() == mongo::Object && depth + 1 < stats_max_depth)
+        {
+            count_paths(e.embeddedObject(), path + ".", depth + 1, doc, counts);
+        }
+    }
+}
+
+// builds statistics document for single path
+// values - the path in all sampled documents containing it
+mongo::BSONObj build_path_stats(const std::string& path, const std::vector<mongo::BSONElement>& values, int n_docs, int target)
+{
+    const int n_present = values.size();
+
+    int n_null = 0;
+    std::map<std::string, int> types;
+    std::vector<mongo::BSONElement> sorted;
+    sorted.reserve(values.size());
+
+    for (std::size_t i = 0; i < values.size(); i++)
+    {
+        const mongo::BSONElement& e = values[i];
+        types[bson_type_name(e)]++;
+        if (e.isNull())
+            n_null++;
+        else if (e.size() <= stats_max_value_size)
+            sorted.push_back(e);
+    }
+
+    std::sort(sorted.begin(), sorted.end(), element_less());
+
+    std::vector<value_group> groups;
+    for (std::size_t i = 0; i < sorted.size(); i++)
+    {
+        if (groups.empty() || sorted[i].woCompare(sorted[groups.back().first], false) != 0)
+        {
+            value_group group = { i, 1 };
+            groups.push_back(group);
+        }
+        else
+        {
+            groups.back().count++;
+        }
+    }
+
+    // most common values: repeated values, most frequent first
+    std::vector<value_group> common;
+    for (std::size_t i = 0; i < groups.size(); i++)
+    {
+        if (groups[i].count >= 2)
+            common.push_back(groups[i]);
+    }
+    std::stable_sort(common.begin(), common.end(), group_more_common());
+    if (common.size() > std::size_t(target))
+        common.resize(target);
+
+    // histogram: remaining values
+    std::vector<bool> is_common(sorted.size(), false);
+    for (std::size_t i = 0; i < common.size(); i++)
+        is_common[common[i].first] = true;
+
+    std::vector<mongo::BSONElement> rest;
+    std::size_t rest_distinct = 0;
+    for (std::size_t i = 0; i < groups.size(); i++)
+    {
+        if (is_common[groups[i].first])
+            continue;
+        rest_distinct++;
+        for (int j = 0; j < groups[i].count; j++)
+            rest.push_back(sorted[groups[i].first + j]);
+    }
+
+    mongo::BSONObjBuilder builder;
+    builder.append("path", path);
+    builder.append("frac", double(n_present) / n_docs);
+    builder.append("null_frac", double(n_null) / n_present);
+
+    mongo::BSONObjBuilder types_builder(builder.subobjStart("types"));
+    for (std::map<std::string, int>::const_iterator it = types.begin(); it != types.end(); ++it)
+    {
+        types_builder.append(it->first, double(it->second) / n_present);
+    }
+    types_builder.done();
+
+    builder.append("nd", int(groups.size()));
+
+    mongo::BSONArrayBuilder mcv(builder.subarrayStart("mcv"));
+    for (std::size_t i = 0; i < common.size(); i++)
+        mcv.append(sorted[common[i].first]);
+    mcv.done();
+
+    mongo::BSONArrayBuilder mcf(builder.subarrayStart("mcf"));
+    for (std::size_t i = 0; i < common.size(); i++)
+        mcf.append(double(common[i].count) / n_present);
+    mcf.done();
+
+    mongo::BSONArrayBuilder hist(builder.subarrayStart("hist"));
+    std::size_t n_bounds = std::min(rest_distinct, std::size_t(target) + 1);
+    if (n_bounds >= 2)
+    {
+        for (std::size_t i = 0; i < n_bounds; i++)
+        {
+            std::size_t position = (int64(i) * int64(rest.size() - 1)) / int64(n_bounds - 1);
+            hist.append(rest[position]);
+        }
+    }
+    hist.done();
+
+    return builder.obj();
+}
+
+void compute_bson_stats(VacAttrStatsP stats, AnalyzeAttrFetchFunc fetchfunc, int samplerows, double totalrows)
+{
+    analyze_extra* extra = reinterpret_cast<analyze_extra*>(stats->extra_data);
+
+    // standard statistics of the whole documents first
+    stats->extra_data = extra->std_extra_data;
+    extra->std_compute_stats(stats, fetchfunc, samplerows, totalrows);
+    stats->extra_data = extra;
+
+    if (!stats->stats_valid)
+        return;
+
+    int slot = 0;
+    while (slot < STATISTIC_NUM_SLOTS && stats->stakind[slot] != 0)
+        slot++;
+    if (slot == STATISTIC_NUM_SLOTS)
+        return;
+
+    const int target = stats_target(stats);
+
+    std::vector<bytea*> documents;
+    for (int i = 0; i < samplerows; i++)
+    {
+        vacuum_delay_point();
+
+        bool isnull = false;
+        Datum value = fetchfunc(stats, i, &isnull);
+        if (!isnull)
+            documents.push_back(DatumGetBson(value));
+    }
+    if (documents.empty())
+        return;
+
+    try
+    {
+        path_count_map counts;
+        for (std::size_t i = 0; i < documents.size(); i++)
+        {
+            count_paths(mongo::BSONObj(VARDATA_ANY(documents[i])), std::string(), 0, i, counts);
+        }
+
+        // most common paths
+        std::vector<std::pair<int, std::string> > common;
+        for (path_count_map::const_iterator it = counts.begin(); it != counts.end(); ++it)
+        {
+            common.push_back(std::make_pair(-it->second.docs, it->first));
+        }
+        std::sort(common.begin(), common.end());
+        if (common.size() > std::size_t(target))
+            common.resize(target);
+
+        std::vector<mongo::BSONObj> results;
+        std::vector<mongo::BSONElement> values;
+        for (std::size_t i = 0; i < common.size(); i++)
+        {
+            const std::string& path = common[i].second;
+            compiled_path* compiled = compile_path(path.c_str(), path.length(), CurrentMemoryContext);
+
+            values.clear();
+            for (std::size_t j = 0; j < documents.size(); j++)
+            {
+                mongo::BSONElement e = get_field(mongo::BSONObj(VARDATA_ANY(documents[j])), compiled);
+                if (!e.eoo())
+                    values.push_back(e);
+            }
+            pfree(compiled);
+
+            if (!values.empty())
+                results.push_back(build_path_stats(path, values, documents.size(), target));
+        }
+
+        if (results.empty())
+            return;
+
+        MemoryContext old_context = MemoryContextSwitchTo(stats->anl_context);
+
+        Datum* stavalues = reinterpret_cast<Datum*>(palloc(results.size() * sizeof(Datum)));
+        for (std::size_t i = 0; i < results.size(); i++)
+        {
+            stavalues[i] = return_bson(results[i]);
+        }
+        float4* stanumbers = reinterpret_cast<float4*>(palloc(2 * sizeof(float4)));
+        stanumbers[0] = documents.size();
+        stanumbers[1] = counts.size();
+
+        MemoryContextSwitchTo(old_context);
+
+        stats->stakind[slot] = STATISTIC_KIND_BSON_PATHS;
+        stats->staop[slot] = InvalidOid;
+        stats->stavalues[slot] = stavalues;
+        stats->numvalues[slot] = results.size();
+        stats->stanumbers[slot] = stanumbers;
+        stats->numnumbers[slot] = 2;
+        stats->statypid[slot] = stats->attrtypid;
+        stats->statyplen[slot] = -1;
+        stats->statypbyval[slot] = false;
+        stats->statypalign[slot] = 'i';
+    }
+    catch(const std::exception& e)
+    {
+        ereport(
+            WARNING,
+            (errmsg("could not compute bson path statistics: %s", e.what()))
+        );
+    }
+}
+
+}
+
+bool setup_bson_analyze(VacAttrStats* stats)
+{
+    if (!std_typanalyze(stats))
+        return false;
+
+    analyze_extra* extra = reinterpret_cast<analyze_extra*>(palloc(sizeof(analyze_extra)));
+    extra->std_compute_stats = stats->compute_stats;
+    extra->std_extra_data = stats->extra_data;
+
+    stats->compute_stats = compute_bson_stats;
+    stats->extra_data = extra;
+
+    return true;
+}
+
+// path_statistics
+
+path_statistics::path_statistics(VariableStatData* vardata)
+    : _valid(false), _null_frac(0.0), _sampled(0.0), _n_paths(0)
+{
+    if (HeapTupleIsValid(vardata->statsTuple))
+    {
+        load(vardata->statsTuple, vardata->atttype, vardata->atttypmod);
+    }
+}
+
+path_statistics::path_statistics(HeapTuple stats_tuple, Oid atttype, int32 atttypmod)
+    : _valid(false), _null_frac(0.0), _sampled(0.0), _n_paths(0)
+{
+    if (HeapTupleIsValid(stats_tuple))
+    {
+        load(stats_tuple, atttype, atttypmod);
+    }
+}
+
+void path_statistics::load(HeapTuple stats_tuple, Oid atttype, int32 atttypmod)
+{
+    _null_frac = reinterpret_cast<Form_pg_statistic>(GETSTRUCT(stats_tuple))->stanullfrac;
+
+#if PG_VERSION_NUM >= 110000
+    AttStatsSlot slot;
+    if (get_attstatsslot(&slot, stats_tuple, STATISTIC_KIND_BSON_PATHS, InvalidOid, ATTSTATSSLOT_VALUES | ATTSTATSSLOT_NUMBERS))
+    {
+        load_slot(slot.values, slot.nvalues, slot.numbers, slot.nnumbers);
+        free_attstatsslot(&slot);
+    }
+#else
+    Datum* values = NULL;
+    int nvalues = 0;
+    float4* numbers = NULL;
+    int nnumbers = 0;
+    if (get_attstatsslot(stats_tuple, atttype, atttypmod, STATISTIC_KIND_BSON_PATHS, InvalidOid, NULL,
+        &values, &nvalues, &numbers, &nnumbers))
+    {
+        load_slot(values, nvalues, numbers, nnumbers);
+        free_attstatsslot(atttype, values, nvalues, numbers, nnumbers);
+    }
+#endif
+}
+
+void path_statistics::load_slot(const Datum* values, int nvalues, const float4* numbers, int nnumbers)
+{
+    if (nnumbers < 2 || numbers[0] <= 0)
+        return;
+
+    _sampled = numbers[0];
+    _n_paths = numbers[1];
+
+    _paths.reserve(nvalues);
+    for (int i = 0; i < nvalues; i++)
+    {
+        bytea* data = DatumGetBson(values[i]);
+        _paths.push_back(mongo::BSONObj(VARDATA_ANY(data)).getOwned());
+    }
+    _valid = true;
+}
+
+mongo::BSONObj path_statistics::find(const char* path) const
+{
+    for (std::size_t i = 0; i < _paths.size(); i++)
+    {
+        if (std::strcmp(_paths[i].getStringField("path"), path) == 0)
+            return _paths[i];
+    }
+    return mongo::BSONObj();
+}
+
+double path_statistics::rare_frac() const
+{
+    if (_paths.empty())
+        return default_path_sel;
+
+    // all paths seen in the sample were collected - this one wasn't seen at all
+    if (_paths.size() >= std::size_t(_n_paths))
+        return 0.5 / _sampled;
+
+    // less common than any collected path
+    return _paths.back()["frac"].number() / 2;
+}
+
+double path_statistics::exists_frac(const char* path) const
+{
+    mongo::BSONObj path_stats = find(path);
+    if (path_stats.isEmpty())
+        return rare_frac();
+
+    return path_stats["frac"].number();
+}
+
+double path_statistics::eq_frac(const char* path, const mongo::BSONElement& value) const
+{
+    mongo::BSONObj path_stats = find(path);
+    if (path_stats.isEmpty())
+        return rare_frac() * DEFAULT_EQ_SEL;
+
+    const double frac = path_stats["frac"].number();
+    const double null_frac = path_stats["null_frac"].number();
+    if (value.isNull())
+        return frac * null_frac;
+
+    double mcv_total = 0.0;
+    int n_mcv = 0;
+    mongo::BSONObjIterator mcv(path_stats["mcv"].embeddedObject());
+    mongo::BSONObjIterator mcf(path_stats["mcf"].embeddedObject());
+    while (mcv.more() && mcf.more())
+    {
+        mongo::BSONElement v = mcv.next();
+        double f = mcf.next().number();
+        if (v.woCompare(value, false) == 0)
+            return frac * f;
+        mcv_total += f;
+        n_mcv++;
+    }
+
+    // spread remaining values evenly among the other distinct values
+    double rest = std::max(0.0, 1.0 - null_frac - mcv_total);
+    int n_other = std::max(1, path_stats["nd"].numberInt() - n_mcv);
+
+    double result = frac * rest / n_other;
+    CLAMP_PROBABILITY(result);
+    return result;
+}
+
+double path_statistics::range_frac(const char* path, const mongo::BSONElement& value, bool less) const
+{
+    mongo::BSONObj path_stats = find(path);
+    if (path_stats.isEmpty())
+        return rare_frac() * DEFAULT_INEQ_SEL;
+
+    const double frac = path_stats["frac"].number();
+    const double null_frac = path_stats["null_frac"].number();
+
+    double mcv_frac = 0.0;
+    double mcv_total = 0.0;
+    mongo::BSONObjIterator mcv(path_stats["mcv"].embeddedObject());
+    mongo::BSONObjIterator mcf(path_stats["mcf"].embeddedObject());
+    while (mcv.more() && mcf.more())
+    {
+        mongo::BSONElement v = mcv.next();
+        double f = mcf.next().number();
+        int cmp = v.woCompare(value, false);
+        if (less ? cmp < 0 : cmp > 0)
+            mcv_frac += f;
+        mcv_total += f;
+    }
+
+    std::vector<mongo::BSONElement> bounds;
+    mongo::BSONObjIterator hist(path_stats["hist"].embeddedObject());
+    while (hist.more())
+        bounds.push_back(hist.next());
+
+    double hist_frac = DEFAULT_INEQ_SEL;
+    if (bounds.size() >= 2)
+    {
+        // number of bounds <= value
+        std::size_t below = std::upper_bound(bounds.begin(), bounds.end(), value, element_less()) - bounds.begin();
+
+        double position;
+        if (below == 0)
+        {
+            position = 0.0;
+        }
+        else if (below == bounds.size())
+        {
+            position = 1.0;
+        }
+        else
+        {
+            const mongo::BSONElement& low = bounds[below - 1];
+            const mongo::BSONElement& high = bounds[below];
+            double in_bucket = 0.5;
+            if (low.isNumber() && high.isNumber() && value.isNumber() && high.number() > low.number())
+            {
+                in_bucket = (value.number() - low.number()) / (high.number() - low.number());
+            }
+            position = (below - 1 + in_bucket) / (bounds.size() - 1);
+        }
+        hist_frac = less ? position : 1.0 - position;
+    }
+
+    double rest = std::max(0.0, 1.0 - null_frac - mcv_total);
+    double result = frac * (mcv_frac + rest * hist_frac);
+    CLAMP_PROBABILITY(result);
+    return result;
+}
+
+namespace {
+
+// path argument, compared with the UTF-8 paths of the statistics
+std::string path_to_utf8(const text* arg)
+{
+    int length = VARSIZE_ANY_EXHDR(arg);
+    const char* path = server_to_utf8(VARDATA_ANY(arg), &length);
+    return std::string(path, length);
+}
+
+// Estimates restriction "column op constant" with estimate(statistics, constant).
+// Falls back to default_path_sel if there are no statistics.
+template<typename Estimate>
+double estimate_restriction(PlannerInfo* root, List* args, int varRelid, const Estimate& estimate)
+{
+    VariableStatData vardata;
+    Node* other;
+    bool varonleft;
+
+    if (!get_restriction_variable(root, args, varRelid, &vardata, &other, &varonleft))
+    {
+        return default_path_sel;
+    }
+
+    double selectivity = default_path_sel;
+    if (varonleft && IsA(other, Const) && !reinterpret_cast<Const*>(other)->constisnull)
+    {
+        try
+        {
+            path_statistics statistics(&vardata);
+            if (statistics.valid())
+            {
+                selectivity = estimate(statistics, reinterpret_cast<Const*>(other)->constvalue) * (1.0 - statistics.null_frac());
+            }
+        }
+        catch(...)
+        {
+            // corrupted statistics, use the default
+        }
+    }
+
+    ReleaseVariableStats(vardata);
+
+    CLAMP_PROBABILITY(selectivity);
+    return selectivity;
+}
+
+struct exists_estimate
+{
+    double operator()(const path_statistics& statistics, Datum constant) const
+    {
+        text* arg = DatumGetTextPP(constant);
+        std::string path = path_to_utf8(arg);
+        return statistics.exists_frac(path.c_str());
+    }
+};
+
+// paths are assumed to be independent
+struct exists_many_estimate
+{
+    bool all;
+
+    double operator()(const path_statistics& statistics, Datum constant) const
+    {
+        Datum* paths;
+        bool* nulls;
+        int n_paths;
+        deconstruct_array(DatumGetArrayTypeP(constant), TEXTOID, -1, false, 'i', &paths, &nulls, &n_paths);
+
+        double none_frac = 1.0;
+        double all_frac = 1.0;
+        for (int i = 0; i < n_paths; i++)
+        {
+            if (nulls[i])
+                continue;
+
+            text* arg = DatumGetTextPP(paths[i]);
+            std::string path = path_to_utf8(arg);
+            double frac = statistics.exists_frac(path.c_str());
+            none_frac *= 1.0 - frac;
+            all_frac *= frac;
+        }
+        return all ? all_frac : 1.0 - none_frac;
+    }
+};
+
+// fields are assumed to be independent; scalars reached through objects are estimated
+// as equality, anything else (arrays, empty objects) as path existence
+struct contains_estimate
+{
+    double operator()(const path_statistics& statistics, Datum constant) const
+    {
+        bytea* query = DatumGetBson(constant);
+        return object_frac(statistics, mongo::BSONObj(VARDATA_ANY(query)), std::string());
+    }
+
+    double object_frac(const path_statistics& statistics, const mongo::BSONObj& object, const std::string& prefix) const
+    {
+        double frac = 1.0;
+        mongo::BSONObjIterator it(object);
+        while (it.more())
+        {
+            mongo::BSONElement e = it.next();
+            std::string path = prefix + e.fieldName();
+
+            if (e.type() == mongo::Object && !e.embeddedObject().isEmpty())
+                frac *= object_frac(statistics, e.embeddedObject(), path + ".");
+            else if (e.isABSONObj())
+                frac *= statistics.exists_frac(path.c_str());
+            else
+                frac *= statistics.eq_frac(path.c_str(), e);
+        }
+        return frac;
+    }
+};
+
+// MongoDB query: fields are assumed to be independent
+struct match_estimate
+{
+    double operator()(const path_statistics& statistics, Datum constant) const
+    {
+        bytea* query = DatumGetBson(constant);
+        return query_frac(statistics, mongo::BSONObj(VARDATA_ANY(query)));
+    }
+
+    double query_frac(const path_statistics& statistics, const mongo::BSONObj& query) const
+    {
+        double frac = 1.0;
+        mongo::BSONObjIterator it(query);
+        while (it.more())
+        {
+            mongo::BSONElement e = it.next();
+            const char* name = e.fieldName();
+
+            if (name[0] == '$')
+            {
+                frac *= logical_frac(statistics, e);
+            }
+            else if (e.type() == mongo::Object && e.embeddedObject().firstElementFieldName()[0] == '$')
+            {
+                frac *= operators_frac(statistics, name, e.embeddedObject());
+            }
+            else if (e.type() == mongo::RegEx)
+            {
+                frac *= statistics.exists_frac(name) * DEFAULT_MATCH_SEL;
+            }
+            else
+            {
+                frac *= equal_frac(statistics, name, e);
+            }
+        }
+        return frac;
+    }
+
+    double logical_frac(const path_statistics& statistics, const mongo::BSONElement& e) const
+    {
+        const char* name = e.fieldName();
+        if (e.type() != mongo::Array)
+            return 1.0;
+
+        double all_frac = 1.0;
+        double none_frac = 1.0;
+        mongo::BSONObjIterator it(e.embeddedObject());
+        while (it.more())
+        {
+            mongo::BSONElement subquery = it.next();
+            if (subquery.type() != mongo::Object)
+                continue;
+            double frac = query_frac(statistics, subquery.embeddedObject());
+            all_frac *= frac;
+            none_frac *= 1.0 - frac;
+        }
+
+        if (std::strcmp(name, "$and") == 0)
+            return all_frac;
+        else if (std::strcmp(name, "$or") == 0)
+            return 1.0 - none_frac;
+        else if (std::strcmp(name, "$nor") == 0)
+            return none_frac;
+        else
+            return 1.0;
+    }
+
+    // null matches missing fields as well
+    double equal_frac(const path_statistics& statistics, const char* path, const mongo::BSONElement& value) const
+    {
+        double frac = statistics.eq_frac(path, value);
+        if (value.isNull())
+            frac += 1.0 - statistics.exists_frac(path);
+        return frac;
+    }
+
+    double operators_frac(const path_statistics& statistics, const char* path, const mongo::BSONObj& operators) const
+    {
+        double frac = 1.0;
+        mongo::BSONObjIterator it(operators);
+        while (it.more())
+        {
+            mongo::BSONElement op = it.next();
+            const char* name = op.fieldName();
+
+            if (std::strcmp(name, "$eq") == 0)
+                frac *= equal_frac(statistics, path, op);
+            else if (std::strcmp(name, "$ne") == 0)
+                frac *= 1.0 - equal_frac(statistics, path, op);
+            else if (std::strcmp(name, "$gt") == 0)
+                frac *= statistics.range_frac(path, op, false);
+            else if (std::strcmp(name, "$gte") == 0)
+                frac *= statistics.range_frac(path, op, false) + statistics.eq_frac(path, op);
+            else if (std::strcmp(name, "$lt") == 0)
+                frac *= statistics.range_frac(path, op, true);
+            else if (std::strcmp(name, "$lte") == 0)
+                frac *= statistics.range_frac(path, op, true) + statistics.eq_frac(path, op);
+            else if (std::strcmp(name, "$in") == 0)
+                frac *= in_frac(statistics, path, op);
+            else if (std::strcmp(name, "$nin") == 0)
+                frac *= 1.0 - in_frac(statistics, path, op);
+            else if (std::strcmp(name, "$exists") == 0)
+                frac *= op.trueValue() ? statistics.exists_frac(path) : 1.0 - statistics.exists_frac(path);
+            else if (std::strcmp(name, "$regex") == 0)
+                frac *= statistics.exists_frac(path) * DEFAULT_MATCH_SEL;
+            else if (std::strcmp(name, "$options") != 0)
+                frac *= statistics.exists_frac(path) * DEFAULT_INEQ_SEL;
+        }
+        return frac;
+    }
+
+    double in_frac(const path_statistics& statistics, const char* path, const mongo::BSONElement& values) const
+    {
+        if (values.type() != mongo::Array)
+            return 1.0;
+
+        double frac = 0.0;
+        mongo::BSONObjIterator it(values.embeddedObject());
+        while (it.more())
+        {
+            mongo::BSONElement value = it.next();
+            if (value.type() == mongo::RegEx)
+                frac += statistics.exists_frac(path) * DEFAULT_MATCH_SEL;
+            else
+                frac += equal_frac(statistics, path, value);
+        }
+        return std::min(frac, 1.0);
+    }
+};
+
+}
+
+double exists_selectivity(PlannerInfo* root, List* args, int varRelid)
+{
+    return estimate_restriction(root, args, varRelid, exists_estimate());
+}
+
+double exists_many_selectivity(PlannerInfo* root, List* args, int varRelid, bool all)
+{
+    exists_many_estimate estimate;
+    estimate.all = all;
+    return estimate_restriction(root, args, varRelid, estimate);
+}
+
+double contains_selectivity(PlannerInfo* root, List* args, int varRelid)
+{
+    return estimate_restriction(root, args, varRelid, contains_estimate());
+}
+
+double match_selectivity(PlannerInfo* root, List* args, int varRelid)
+{
+    return estimate_restriction(root, args, varRelid, match_estimate());
+}
@@ -0,0 +1,116 @@
+// Copyright (c) 2012-2013 Maciej Gajewski <maciej.gajewski0@gmail.com>
+// 
+// Permission to use, copy, modify, and distribute this software and its documentation for any purpose, without fee, and without a written agreement is hereby granted,
+// provided that the above copyright notice and this paragraph and the following two paragraphs appear in all copies.
+// 
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, 
+// ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+// THE AUTHOR SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+// THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE AUTHOR HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+
+#ifndef PGBSON_STATS_HPP
+#define PGBSON_STATS_HPP
+
+#include "pgbson_internal.hpp"
+
+extern "C" {
+#include <commands/vacuum.h>
+#include <miscadmin.h>
+#include <utils/acl.h>
+#include <utils/selfuncs.h>
+}
+
+#include <vector>
+
+// Per-path statistics.
+//
+// ANALYZE computes the standard statistics of the column, then walks the sampled documents
+// and finds the most common paths (up to the statistics target). For each path it stores
+// a bson document in an extra pg_statistic slot:
+//
+//  { "path" : "a.b",
+//    "frac" : fraction of documents containing the path,
+//    "null_frac" : fraction of those where the value is null,
+//    "types" : { type name : fraction, ... },
+//    "nd" : number of distinct values in the sample,
+//    "mcv" : [ most common values ], "mcf" : [ their frequencies ],
+//    "hist" : [ histogram bounds of the other values ] }
+//
+// Frequencies are relative to the documents containing the path. Slot numbers
+// hold the number of sampled documents and the number of distinct paths seen.
+
+const int STATISTIC_KIND_BSON_PATHS = 5870;
+
+// maximum depth of paths collected
+const int stats_max_depth = 8;
+
+// values larger than that are not used as most common values or histogram bounds
+const int stats_max_value_size = 1024;
+
+// selectivity of path conditions when there are no statistics
+const double default_path_sel = 0.1;
+
+// installs bson statistics computation, called from typanalyze
+bool setup_bson_analyze(VacAttrStats* stats);
+
+// Selectivity of path operators, args as passed to restriction estimator
+
+// bson ? text
+double exists_selectivity(PlannerInfo* root, List* args, int varRelid);
+
+// bson ?& text[] (all = true) and bson ?| text[]
+double exists_many_selectivity(PlannerInfo* root, List* args, int varRelid, bool all);
+
+// bson @> bson
+double contains_selectivity(PlannerInfo* root, List* args, int varRelid);
+
+// bson @@ bson (MongoDB query)
+double match_selectivity(PlannerInfo* root, List* args, int varRelid);
+
+// per-path statistics of a variable, as used by selectivity estimators
+class path_statistics
+{
+public:
+
+    // reads the statistics of the variable (vardata->statsTuple)
+    path_statistics(VariableStatData* vardata);
+    // reads the statistics from pg_statistic tuple
+    path_statistics(HeapTuple stats_tuple, Oid atttype, int32 atttypmod);
+
+    // false if there are no statistics
+    bool valid() const { return _valid; }
+
+    // fraction of null values in the column
+    double null_frac() const { return _null_frac; }
+
+    // All the fractions below are relative to non-null values of the column.
+    // Paths not found in the statistics are assumed to be rare.
+
+    // fraction of documents containing the path
+    double exists_frac(const char* path) const;
+
+    // fraction of documents where the path is equal to the value
+    double eq_frac(const char* path, const mongo::BSONElement& value) const;
+
+    // fraction of documents where the path is less (or greater) than the value
+    double range_frac(const char* path, const mongo::BSONElement& value, bool less) const;
+
+    // per-path documents, as described above
+    const std::vector<mongo::BSONObj>& paths() const { return _paths; }
+
+private:
+
+    void load(HeapTuple stats_tuple, Oid atttype, int32 atttypmod);
+    void load_slot(const Datum* values, int nvalues, const float4* numbers, int nnumbers);
+    mongo::BSONObj find(const char* path) const;
+    double rare_frac() const;
+
+    bool _valid;
+    double _null_frac;
+    double _sampled;
+    int _n_paths;
+    std::vector<mongo::BSONObj> _paths;
+};
+
+#endif
@@ -0,0 +1,345 @@
+// Copyright (c) 2012-2013 Maciej Gajewski <maciej.gajewski0@gmail.com>
+// 
+// Permission to use, copy, modify, and distribute this software and its documentation for any purpose, without fee, and without a written agreement is hereby granted,
+// provided that the above copyright notice and this paragraph and the following two paragraphs appear in all copies.
+// 
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, 
+// ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+// THE AUTHOR SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+// THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE AUTHOR HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+
+#include "pgbson_validate.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PGBSON_VALIDATE_SIMD
+#include <immintrin.h>
+#endif
+
+#include <cstring>
+
+namespace {
+
+// ASCII scanning: returns the first non-ASCII byte in [p, end), end if there is none
+
+const char* scan_ascii_scalar(const char* p, const char* end)
+{
+    while (p < end && static_cast<unsigned char>(*p) < 0x80)
+        p++;
+    return p;
+}
+
+#ifdef PGBSON_VALIDATE_SIMD
+
+__attribute__((target("sse2")))
+const char* scan_ascii_sse2(const char* p, const char* end)
+{
+    while (end - p >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int mask = _mm_movemask_epi8(chunk);
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return scan_ascii_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+const char* scan_ascii_avx2(const char* p, const char* end)
+{
+    while (end - p >= 32)
+    {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        uint32 mask = static_cast<uint32>(_mm256_movemask_epi8(chunk));
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return scan_ascii_sse2(p, end);
+}
+
+#endif
+
+typedef const char* (*scan_ascii_function)(const char* p, const char* end);
+
+scan_ascii_function choose_scan_ascii()
+{
+#ifdef PGBSON_VALIDATE_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return scan_ascii_avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return scan_ascii_sse2;
+#endif
+    return scan_ascii_scalar;
+}
+
+const scan_ascii_function scan_ascii = choose_scan_ascii();
+
+int32 read_int32(const char* p)
+{
+    int32 i;
+    std::memcpy(&i, p, sizeof(int32));
+    return i;
+}
+
+// checks length-prefixed string (string, code, symbol) at p, not extending past end.
+// returns the end of the string, NULL if it's invalid
+const char* check_string(const char* p, const char* end)
+{
+    if (end - p < 4)
+        return NULL;
+    int32 length = read_int32(p);
+    if (length < 1 || length > end - p - 4 || p[4 + length - 1] != 0)
+        return NULL;
+    if (!is_valid_utf8(p + 4, p + 4 + length - 1))
+        return NULL;
+    return p + 4 + length;
+}
+
+// checks null-terminated string at p, returns the position after the terminator,
+// NULL if there is none before end or the string is not valid UTF-8
+const char* check_cstring(const char* p, const char* end)
+{
+    // field names are mostly short and ASCII: look at the first bytes inline, without calls
+    const char* short_end = end - p > 16 ? p + 16 : end;
+    for (const char* q = p; q < short_end && static_cast<unsigned char>(*q) < 0x80; q++)
+    {
+        if (*q == 0)
+            return q + 1;
+    }
+
+    const char* terminator = reinterpret_cast<const char*>(std::memchr(p, 0, end - p));
+    if (terminator == NULL || !is_valid_utf8(p, terminator))
+        return NULL;
+    return terminator + 1;
+}
+
+// checks the length and the terminator of an embedded object at p, not extending past end
+// returns the position of the terminator, NULL if it's invalid
+const char* check_object(const char* p, const char* end)
+{
+    if (end - p < 5)
+        return NULL;
+    int32 size = read_int32(p);
+    if (size < 5 || size > end - p || p[size - 1] != mongo::EOO)
+        return NULL;
+    return p + size - 1;
+}
+
+}
+
+int utf8_sequence_length(const unsigned char* p, const unsigned char* end)
+{
+    unsigned char c = p[0];
+    if (c >= 0xc2 && c <= 0xdf)
+    {
+        return end - p >= 2 && (p[1] & 0xc0) == 0x80 ? 2 : 0;
+    }
+    if (c >= 0xe0 && c <= 0xef)
+    {
+        if (end - p < 3 || (p[1] & 0xc0) != 0x80 || (p[2] & 0xc0) != 0x80)
+            return 0;
+        if ((c == 0xe0 && p[1] < 0xa0) || (c == 0xed && p[1] >= 0xa0))
+            return 0;
+        return 3;
+    }
+    if (c >= 0xf0 && c <= 0xf4)
+    {
+        if (end - p < 4 || (p[1] & 0xc0) != 0x80 || (p[2] & 0xc0) != 0x80 || (p[3] & 0xc0) != 0x80)
+            return 0;
+        if ((c == 0xf0 && p[1] < 0x90) || (c == 0xf4 && p[1] >= 0x90))
+            return 0;
+        return 4;
+    }
+    return 0;
+}
+
+bool is_valid_utf8(const char* p, const char* end)
+{
+    for (;;)
+    {
+        p = scan_ascii(p, end);
+        if (p == end)
+            return true;
+
+        // multibyte sequences are checked here up to the next ASCII byte, so that text in other scripts
+        // doesn't cost a call of the scanner per character
+        do
+        {
+            const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+            if (u[0] >= 0xc2 && u[0] <= 0xdf && end - p >= 2 && (u[1] & 0xc0) == 0x80)
+            {
+                p += 2; // the most common case, inline
+                continue;
+            }
+            int length = utf8_sequence_length(u, reinterpret_cast<const unsigned char*>(end));
+            if (length == 0)
+                return false;
+            p += length;
+        }
+        while (p != end && static_cast<unsigned char>(*p) >= 0x80);
+    }
+}
+
+const char* validate_bson(const char* data, std::size_t available, int32* size)
+{
+    if (available < 5)
+        return "document shorter than 5 bytes";
+
+    *size = read_int32(data);
+    if (*size < 5)
+        return "invalid document size";
+    if (static_cast<std::size_t>(*size) > available)
+        return "document size exceeds input length";
+    if (data[*size - 1] != mongo::EOO)
+        return "missing document terminator";
+
+    // terminator positions of the enclosing objects
+    const char* stack[max_bson_depth + 1];
+    int depth = 0;
+    stack[0] = data + *size - 1;
+    const char* p = data + 4;
+
+    for (;;)
+    {
+        const char* end = stack[depth];
+        if (p == end)
+        {
+            // object terminator
+            if (depth == 0)
+                return NULL;
+            depth--;
+            p++;
+            continue;
+        }
+
+        const signed char type = *p;
+        p = check_cstring(p + 1, end);
+        if (p == NULL)
+            return "invalid field name (missing terminator or not UTF-8)";
+
+        std::ptrdiff_t value_size = 0;
+        switch (type)
+        {
+            case mongo::Undefined:
+            case mongo::jstNULL:
+            case mongo::MaxKey:
+            case mongo::MinKey:
+                break;
+
+            case mongo::Bool:
+                if (end - p < 1 || (*p != 0 && *p != 1))
+                    return "invalid boolean value";
+                value_size = 1;
+                break;
+
+            case mongo::NumberInt:
+                value_size = 4;
+                break;
+
+            case mongo::Timestamp:
+            case mongo::Date:
+            case mongo::NumberDouble:
+            case mongo::NumberLong:
+                value_size = 8;
+                break;
+
+            case mongo::jstOID:
+                value_size = 12;
+                break;
+
+            case mongo::Symbol:
+            case mongo::Code:
+            case mongo::String:
+            {
+                const char* string_end = check_string(p, end);
+                if (string_end == NULL)
+                    return "invalid string (length, terminator or UTF-8)";
+                value_size = string_end - p;
+                break;
+            }
+
+            case mongo::DBRef:
+            {
+                const char* string_end = check_string(p, end);
+                if (string_end == NULL)
+                    return "invalid DBRef namespace";
+                value_size = string_end - p + 12;
+                break;
+            }
+
+            case mongo::BinData:
+            {
+                if (end - p < 5)
+                    return "invalid binary data";
+                int32 length = read_int32(p);
+                if (length < 0 || length > end - p - 5)
+                    return "invalid binary data length";
+                value_size = 5 + length;
+                break;
+            }
+
+            case mongo::RegEx:
+            {
+                const char* pattern_end = check_cstring(p, end);
+                const char* options_end = pattern_end == NULL ? NULL : check_cstring(pattern_end, end);
+                if (options_end == NULL)
+                    return "invalid regular expression";
+                value_size = options_end - p;
+                break;
+            }
+
+            case mongo::CodeWScope:
+            {
+                // int32 total size, string, scope object
+                if (end - p < 4)
+                    return "invalid code with scope";
+                int32 total = read_int32(p);
+                if (total < 14 || total > end - p)
+                    return "invalid code with scope size";
+                const char* scope = check_string(p + 4, p + total);
+                if (scope == NULL)
+                    return "invalid code with scope";
+                const char* scope_end = check_object(scope, p + total);
+                if (scope_end == NULL || scope_end + 1 != p + total)
+                    return "invalid code with scope";
+                if (depth == max_bson_depth)
+                    return "nesting too deep";
+                stack[++depth] = scope_end;
+                p = scope + 4;
+                continue;
+            }
+
+            case mongo::Object:
+            case mongo::Array:
+            {
+                const char* object_end = check_object(p, end);
+                if (object_end == NULL)
+                    return "invalid embedded object size";
+                if (depth == max_bson_depth)
+                    return "nesting too deep";
+                stack[++depth] = object_end;
+                p += 4;
+                continue;
+            }
+
+            default:
+                return "invalid type code";
+        }
+
+        if (value_size > end - p)
+            return "value extends past the end of the object";
+        p += value_size;
+    }
+}
+
+const char* validate_bson_document(const char* data, std::size_t length)
+{
+    int32 size;
+    const char* error = validate_bson(data, length, &size);
+    if (error == NULL && static_cast<std::size_t>(size) != length)
+        return "trailing bytes after the document";
+    return error;
+}
@@ -0,0 +1,45 @@
+// Copyright (c) 2012-2013 Maciej Gajewski <maciej.gajewski0@gmail.com>
+// 
+// Permission to use, copy, modify, and distribute this software and its documentation for any purpose, without fee, and without a written agreement is hereby granted,
+// provided that the above copyright notice and this paragraph and the following two paragraphs appear in all copies.
+// 
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, 
+// ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+// THE AUTHOR SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+// THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE AUTHOR HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+
+#ifndef PGBSON_VALIDATE_HPP
+#define PGBSON_VALIDATE_HPP
+
+#include "pgbson_internal.hpp"
+
+// Validation of BSON on input: binary input, documents from mongo::fromjson, row_to_bson results
+// and bytea checked with bson_is_valid.
+//
+// A single linear pass over the bytes, with an explicit stack of enclosing objects instead of recursion.
+// Every length is checked against the end of the enclosing object (and the top-level one against
+// the available bytes) before anything is read, so the validator never reads past the buffer.
+// Checked are: object and string lengths, object, string and field name terminators, type codes,
+// boolean values, nesting depth, and that field names and strings are valid UTF-8.
+//
+// UTF-8 is checked by skipping ASCII runs 16 or 32 bytes at a time (SSE2 or AVX2, chosen at startup)
+// and decoding only the non-ASCII sequences.
+
+// maximum nesting of objects and arrays, as in MongoDB
+const int max_bson_depth = 100;
+
+// validates a document starting at data, of which at most available bytes can be read.
+// returns NULL and sets *size to the document size if it's valid, the reason otherwise
+const char* validate_bson(const char* data, std::size_t available, int32* size);
+
+// validates a whole value: a document of exactly length bytes
+const char* validate_bson_document(const char* data, std::size_t length);
+
+// length of valid UTF-8 sequence starting with non-ASCII byte at p, 0 if invalid
+// (overlong forms, surrogates and code points above U+10FFFF are invalid)
+int utf8_sequence_length(const unsigned char* p, const unsigned char* end);
+
+bool is_valid_utf8(const char* p, const char* end);
+
+#endif
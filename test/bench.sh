@@ -0,0 +1,17 @@
+#!/bin/bash
+
+# micro-benchmarks, results (query timings) are printed to stdout
+# if you need to control the host, port, database name, user, password and otghers, set approipriate environment variables
+
+PSQL=psql
+CREATEDB=createdb
+DROPDB=dropdb
+BENCHDB=pgbson_bench
+
+# clean-up after previous, possibly db-crashing run
+$DROPDB --if-exists $BENCHDB
+
+# create -> run -> drop
+$CREATEDB $BENCHDB
+$PSQL $BENCHDB < bench.sql
+$DROPDB $BENCHDB
@@ -0,0 +1,370 @@
+-- Benchmarks. Each query scans a table of generated documents and aggregates the result,
+-- so the timing is dominated by the function under test. Compare timings between builds.
+
+\qecho * loading extension
+CREATE EXTENSION pgbson;
+
+\set rows 200000
+
+\qecho * generating documents
+CREATE TEMPORARY TABLE bench_nested AS
+SELECT i AS id,
+    ('{"pad1":1, "pad2":"xxxxxxxx", "pad3":[1,2,3], "l1": {"pad":1, "l2": {"pad":1, "l3": {"pad":1,'
+    || ' "l4": {"pad":1, "l5": {"pad":1, "l6":' || i || '}}}}}, "v":' || i || '}')::bson AS data
+FROM generate_series(1, :rows) AS i;
+
+CREATE TEMPORARY TABLE bench_shuffled AS
+SELECT ('{"v":' || (random() * 1e9)::int || ', "pad1":1, "pad2":"xxxxxxxx", "l1": {"pad":1, "l2": {"pad":1}}}')::bson AS data
+FROM generate_series(1, :rows) AS i;
+
+CREATE TEMPORARY TABLE bench_shuffled_text AS
+SELECT ('{"name":"' || md5(i::text) || '", "pad1":1, "pad2":"xxxxxxxx", "l1": {"pad":1, "l2": {"pad":1}}}')::bson AS data
+FROM generate_series(1, :rows) AS i;
+
+CREATE TEMPORARY TABLE bench_wide AS
+SELECT i AS id, ('{' || string_agg('"key' || k || '":' || (i + k), ', ') || '}')::bson AS data
+FROM generate_series(1, :rows / 4) AS i, generate_series(1, 500) AS k
+GROUP BY i;
+
+CREATE TEMPORARY TABLE bench_wide_x AS SELECT id, data::bsonx AS data FROM bench_wide;
+
+CREATE TEMPORARY TABLE bench_narrow AS
+SELECT i AS id, ('{' || string_agg('"key' || k || '":' || (i + k), ', ') || '}')::bson AS data
+FROM generate_series(1, :rows / 4) AS i, generate_series(1, 20) AS k
+GROUP BY i;
+
+CREATE TEMPORARY TABLE bench_narrow_x AS SELECT id, data::bsonx AS data FROM bench_narrow;
+
+CREATE TEMPORARY TABLE bench_large (data bson);
+ALTER TABLE bench_large ALTER COLUMN data SET STORAGE EXTERNAL;
+INSERT INTO bench_large
+SELECT ('{"hot":' || i || ', "payload":[' || repeat('"xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx", ', 2000) || '""]}')::bson
+FROM generate_series(1, :rows / 100) AS i;
+
+\timing on
+
+\qecho * field access by path depth
+\qecho baseline (scan only)
+SELECT count(data) FROM bench_nested;
+\qecho 1-level path
+SELECT sum(bson_get_int(data, 'v')) FROM bench_nested;
+\qecho 3-level path
+SELECT sum(bson_get_int(data, 'l1.l2.pad')) FROM bench_nested;
+\qecho 6-level path
+SELECT sum(bson_get_int(data, 'l1.l2.l3.l4.l5.l6')) FROM bench_nested;
+
+\qecho * several fields per row
+\qecho separate getters
+SELECT count(bson_get_int(data, 'v')), count(bson_get_int(data, 'pad1')), count(bson_get_text(data, 'pad2')),
+    count(bson_get_int(data, 'l1.pad')), count(bson_get_int(data, 'l1.l2.pad')), count(bson_get_int(data, 'l1.l2.l3.pad'))
+    FROM bench_nested;
+\qecho bson_get_many
+SELECT count(r.v), count(r.pad1), count(r.pad2), count(r.l1), count(r.l2), count(r.l3)
+    FROM bench_nested, bson_get_many(data, ARRAY['v', 'pad1', 'pad2', 'l1.pad', 'l1.l2.pad', 'l1.l2.l3.pad'])
+        AS r(v int, pad1 int, pad2 text, l1 int, l2 int, l3 int);
+
+\qecho * lookup cost by key position and document width, bson vs bsonx
+\qecho 500 keys, key 1
+SELECT sum(bson_get_int(data, 'key1')) FROM bench_wide;
+SELECT sum(bsonx_get_int(data, 'key1')) FROM bench_wide_x;
+\qecho 500 keys, key 250
+SELECT sum(bson_get_int(data, 'key250')) FROM bench_wide;
+SELECT sum(bsonx_get_int(data, 'key250')) FROM bench_wide_x;
+\qecho 500 keys, key 500
+SELECT sum(bson_get_int(data, 'key500')) FROM bench_wide;
+SELECT sum(bsonx_get_int(data, 'key500')) FROM bench_wide_x;
+\qecho 20 keys, key 20
+SELECT sum(bson_get_int(data, 'key20')) FROM bench_narrow;
+SELECT sum(bsonx_get_int(data, 'key20')) FROM bench_narrow_x;
+
+\qecho * field at the front of large external documents (partial detoast)
+SELECT sum(bson_get_int(data, 'hot')) FROM bench_large;
+\qecho whole document detoasted, for comparison
+SELECT sum(length(data::text)) FROM bench_large;
+
+\qecho * sorting and b-tree index build
+SET work_mem = '256MB';
+\qecho first field the same in every document, ties broken deep in the document
+SELECT count(*) FROM (SELECT data FROM bench_nested ORDER BY data) AS sorted;
+SELECT count(*) FROM (SELECT data FROM bench_nested ORDER BY data DESC) AS sorted;
+CREATE INDEX bench_nested_idx ON bench_nested USING btree (data);
+DROP INDEX bench_nested_idx;
+\qecho first field distinct, random order (abbreviated keys decide most comparisons)
+\qecho number
+SELECT count(*) FROM (SELECT data FROM bench_shuffled ORDER BY data) AS sorted;
+CREATE INDEX bench_shuffled_idx ON bench_shuffled USING btree (data);
+DROP INDEX bench_shuffled_idx;
+\qecho string
+SELECT count(*) FROM (SELECT data FROM bench_shuffled_text ORDER BY data) AS sorted;
+CREATE INDEX bench_shuffled_text_idx ON bench_shuffled_text USING btree (data);
+DROP INDEX bench_shuffled_text_idx;
+RESET work_mem;
+
+\qecho * GIN index vs expression index per path: build time
+SET maintenance_work_mem = '256MB';
+\qecho bson_gin_ops
+CREATE INDEX bench_gin_idx ON bench_nested USING gin (data);
+\qecho bson_gin_path_ops
+CREATE INDEX bench_gin_path_idx ON bench_nested USING gin (data bson_gin_path_ops);
+\qecho expression indexes, one per path
+CREATE INDEX bench_expr_v_idx ON bench_nested (bson_get_bson(data, 'v'));
+CREATE INDEX bench_expr_pad1_idx ON bench_nested (bson_get_bson(data, 'pad1'));
+CREATE INDEX bench_expr_pad2_idx ON bench_nested (bson_get_bson(data, 'pad2'));
+CREATE INDEX bench_expr_l1_idx ON bench_nested (bson_get_bson(data, 'l1.pad'));
+CREATE INDEX bench_expr_l2_idx ON bench_nested (bson_get_bson(data, 'l1.l2.pad'));
+CREATE INDEX bench_expr_l3_idx ON bench_nested (bson_get_bson(data, 'l1.l2.l3.pad'));
+CREATE INDEX bench_expr_l6_idx ON bench_nested (bson_get_bson(data, 'l1.l2.l3.l4.l5.l6'));
+RESET maintenance_work_mem;
+
+\qecho * GIN index vs expression index per path: lookups
+\qecho bson_gin_ops
+SELECT count(*) FROM bench_nested WHERE data @> '{"l1":{"l2":{"l3":{"l4":{"l5":{"l6":4242}}}}}}';
+SELECT count(*) FROM bench_nested WHERE data ? 'pad3';
+\qecho expression index
+SELECT count(*) FROM bench_nested WHERE bson_get_bson(data, 'l1.l2.l3.l4.l5.l6') = '{"":4242}'::bson;
+
+\timing off
+
+\qecho * GIN index vs expression index per path: size
+SELECT 'bson_gin_ops' AS index, pg_size_pretty(pg_relation_size('bench_gin_idx')) AS size
+UNION ALL
+SELECT 'bson_gin_path_ops', pg_size_pretty(pg_relation_size('bench_gin_path_idx'))
+UNION ALL
+SELECT 'expression indexes (7 paths)', pg_size_pretty(sum(pg_relation_size(indexrelid))::bigint)
+    FROM pg_index WHERE indexrelid::regclass::text LIKE 'bench_expr_%';
+
+DROP INDEX bench_gin_idx;
+DROP INDEX bench_gin_path_idx;
+DROP INDEX bench_expr_v_idx, bench_expr_pad1_idx, bench_expr_pad2_idx, bench_expr_l1_idx, bench_expr_l2_idx, bench_expr_l3_idx, bench_expr_l6_idx;
+
+\qecho * hash throughput (includes table scan)
+DO $$
+DECLARE
+    bytes bigint;
+    h bigint;
+    t0 timestamptz;
+    secs float8;
+BEGIN
+    SELECT sum(pg_column_size(data)) INTO bytes FROM bench_wide;
+
+    t0 := clock_timestamp();
+    SELECT sum(bson_hash(data)) INTO h FROM bench_wide;
+    secs := extract(epoch FROM clock_timestamp() - t0);
+    RAISE NOTICE 'bson_hash: % GB/s', round((bytes / secs / 1e9)::numeric, 3);
+
+    t0 := clock_timestamp();
+    SELECT sum(bson_logical_hash(data)) INTO h FROM bench_wide;
+    secs := extract(epoch FROM clock_timestamp() - t0);
+    RAISE NOTICE 'bson_logical_hash: % GB/s', round((bytes / secs / 1e9)::numeric, 3);
+
+    t0 := clock_timestamp();
+    SELECT sum(bson_binary_hash(data)) INTO h FROM bench_wide;
+    secs := extract(epoch FROM clock_timestamp() - t0);
+    RAISE NOTICE 'bson_binary_hash: % GB/s', round((bytes / secs / 1e9)::numeric, 3);
+END
+$$;
+
+\qecho * json input throughput (bson_in)
+CREATE TEMPORARY TABLE bench_json_small AS
+SELECT ('{"name":"user' || i || '", "age":' || (i % 90) || ', "tags":["a","b"], "active":true}') AS json
+FROM generate_series(1, :rows) AS i;
+CREATE TEMPORARY TABLE bench_json_wide AS SELECT data::text AS json FROM bench_wide;
+CREATE TEMPORARY TABLE bench_json_nested AS
+SELECT repeat('{"pad":"xxxxxxxx", "l":', 30) || i || repeat('}', 30) AS json
+FROM generate_series(1, :rows) AS i;
+
+DO $$
+DECLARE
+    name text;
+    bytes bigint;
+    n bigint;
+    t0 timestamptz;
+    secs float8;
+BEGIN
+    FOREACH name IN ARRAY ARRAY['bench_json_small', 'bench_json_wide', 'bench_json_nested'] LOOP
+        EXECUTE format('SELECT sum(octet_length(json)) FROM %I', name) INTO bytes;
+        t0 := clock_timestamp();
+        EXECUTE format('SELECT count(json::bson) FROM %I', name) INTO n;
+        secs := extract(epoch FROM clock_timestamp() - t0);
+        RAISE NOTICE '%: % MB/s', name, round((bytes / secs / 1e6)::numeric, 1);
+    END LOOP;
+END
+$$;
+
+\qecho * json output throughput (bson_out)
+DO $$
+DECLARE
+    name text;
+    bytes bigint;
+    n bigint;
+    t0 timestamptz;
+    secs float8;
+BEGIN
+    FOREACH name IN ARRAY ARRAY['bench_json_small', 'bench_json_wide', 'bench_json_nested'] LOOP
+        EXECUTE format('CREATE TEMPORARY TABLE %I AS SELECT json::bson AS data FROM %I', name || '_bson', name);
+        EXECUTE format('SELECT sum(octet_length(json)) FROM %I', name) INTO bytes;
+        t0 := clock_timestamp();
+        EXECUTE format('SELECT count(data::text) FROM %I', name || '_bson') INTO n;
+        secs := extract(epoch FROM clock_timestamp() - t0);
+        RAISE NOTICE '%: % MB/s', name, round((bytes / secs / 1e6)::numeric, 1);
+    END LOOP;
+END
+$$;
+
+\timing on
+
+\qecho * row_to_bson
+SELECT count(row_to_bson(row(id, 'user' || id, id * 1.5, id % 2 = 0))) FROM bench_nested;
+DO $$
+BEGIN
+    EXECUTE 'CREATE TEMPORARY TABLE bench_row_wide AS SELECT '
+        || (SELECT string_agg(format('CASE WHEN i %% %s = 0 THEN NULL ELSE %s END AS c%s, ''v'' || i AS t%s', k + 2, 'i + ' || k, k, k), ', ')
+            FROM generate_series(1, 20) AS k)
+        || ' FROM generate_series(1, 50000) AS i';
+END
+$$;
+\qecho 40 columns with nulls
+SELECT count(row_to_bson(r)) FROM bench_row_wide AS r;
+\qecho mixed types: numeric, timestamptz, date, uuid, bytea, arrays
+SELECT count(row_to_bson(row(id, id * 1.25::numeric, now() + id * interval '1 second', current_date + id % 1000,
+    md5(id::text)::uuid, decode(md5(id::text), 'hex'), ARRAY[id, id + 1, id + 2], ARRAY['a' || id, 'b' || id])))
+FROM bench_nested;
+
+\qecho * jsonb casts
+CREATE TEMPORARY TABLE bench_jsonb AS SELECT json::jsonb AS data FROM bench_json_small;
+\qecho jsonb::bson
+SELECT count(data::bson) FROM bench_jsonb;
+\qecho jsonb::text::bson, for comparison
+SELECT count(data::text::bson) FROM bench_jsonb;
+\qecho bson::jsonb
+SELECT count(data::jsonb) FROM bench_json_small_bson;
+\qecho bson::text::jsonb, for comparison
+SELECT count(data::text::jsonb) FROM bench_json_small_bson;
+
+\qecho * bson to typed rows
+CREATE TYPE bench_user AS (name text, age integer, tags text[], active boolean);
+\qecho bson_populate_record
+SELECT count((bson_populate_record(NULL::bench_user, data)).age) FROM bench_json_small_bson;
+\qecho separate getters, for comparison
+SELECT count(row(bson_get_text(data, 'name'), bson_get_int(data, 'age'), NULL::text[], NULL::boolean)::bench_user)
+FROM bench_json_small_bson;
+\qecho bson_populate_recordset
+SELECT count(*) FROM bson_populate_recordset(NULL::bench_user, (SELECT array_agg(data) FROM bench_json_small_bson));
+
+\qecho * bson_unwind_array over a 1M element array
+CREATE TEMPORARY TABLE bench_long_array AS
+SELECT ('{"a":[' || string_agg(i::text, ',') || ']}')::bson AS data FROM generate_series(1, 1000000) AS i;
+\qecho select list (value per call)
+SELECT count(*) FROM (SELECT bson_unwind_array(data, 'a') FROM bench_long_array) AS u;
+\qecho FROM clause (materialized)
+SELECT count(*) FROM bench_long_array, bson_unwind_array(data, 'a') AS u;
+
+\qecho * unwinding nested arrays with fields
+CREATE TEMPORARY TABLE bench_orders AS
+SELECT ('{"customer":"c' || i || '", "orders":[' || string_agg('{"id":' || o || ', "items":['
+    || '{"sku":"a' || o || '", "qty":1, "price":1.5}, {"sku":"b' || o || '", "qty":2, "price":2.5}, {"sku":"c' || o || '", "qty":3, "price":3.5}]}', ',')
+    || ']}')::bson AS data
+FROM generate_series(1, :rows / 10) AS i, generate_series(1, 5) AS o
+GROUP BY i;
+\qecho bson_unwind_array twice, then getters
+SELECT count(bson_get_text(item, 'sku')), sum(bson_get_int(item, 'qty')), sum(bson_get_double(item, 'price'))
+FROM bench_orders, bson_unwind_array(data, 'orders') AS o(ord), bson_unwind_array(ord, 'items') AS i(item);
+\qecho bson_unwind
+SELECT count(sku), sum(qty), sum(price)
+FROM bench_orders, bson_unwind(data, '{orders,orders.items}', '{orders.items.sku,orders.items.qty,orders.items.price}')
+    AS u(o int, i int, sku text, qty int, price float8);
+
+\qecho * typed array getters over 100-element numeric arrays
+CREATE TEMPORARY TABLE bench_series AS
+SELECT i AS id, ('{"t":' || i || ', "v":[' || (SELECT string_agg((i * k % 1000 + 0.5)::text, ',') FROM generate_series(1, 100) AS k) || ']}')::bson AS data
+FROM generate_series(1, :rows / 10) AS i;
+\qecho bson_get_double_array
+SELECT sum(array_length(bson_get_double_array(data, 'v'), 1)) FROM bench_series;
+\qecho bson_unwind_array, bson_get_double and array_agg, for comparison
+SELECT sum(array_length(a, 1)) FROM (
+    SELECT (SELECT array_agg(bson_get_double(e, '')) FROM bson_unwind_array(data, 'v') AS e) AS a FROM bench_series
+) AS s;
+
+\qecho * binary input: COPY FROM in binary format, bson_recv validates each document
+\copy (SELECT data FROM bench_json_wide_bson) TO 'bench_binary.tmp' WITH (FORMAT binary)
+SELECT pg_size_pretty(sum(octet_length(bson_send(data)))) AS copied FROM bench_json_wide_bson;
+CREATE TEMPORARY TABLE bench_recv (data bson);
+CREATE TEMPORARY TABLE bench_recv_bytea (data bytea);
+\qecho bson column
+\copy bench_recv FROM 'bench_binary.tmp' WITH (FORMAT binary)
+\qecho bytea column, the same bytes without validation, for comparison
+\copy bench_recv_bytea FROM 'bench_binary.tmp' WITH (FORMAT binary)
+\! rm -f bench_binary.tmp
+
+\qecho * text input: COPY FROM in text format, bson_in parses each line
+\copy (SELECT json FROM bench_json_small) TO 'bench_text_small.tmp'
+\copy (SELECT json FROM bench_json_wide) TO 'bench_text_wide.tmp'
+CREATE TEMPORARY TABLE bench_copy_text (data bson);
+CREATE TEMPORARY TABLE bench_copy_text_plain (data text);
+\qecho small documents, bson column
+\copy bench_copy_text FROM 'bench_text_small.tmp'
+\qecho small documents, text column, for comparison
+\copy bench_copy_text_plain FROM 'bench_text_small.tmp'
+TRUNCATE bench_copy_text, bench_copy_text_plain;
+\qecho 500 keys, bson column
+\copy bench_copy_text FROM 'bench_text_wide.tmp'
+\qecho 500 keys, text column, for comparison
+\copy bench_copy_text_plain FROM 'bench_text_wide.tmp'
+\! rm -f bench_text_small.tmp bench_text_wide.tmp
+
+\qecho * validation throughput (bson_is_valid, the check done by binary input)
+DO $$
+DECLARE
+    name text;
+    bytes bigint;
+    n bigint;
+    t0 timestamptz;
+    secs float8;
+BEGIN
+    FOREACH name IN ARRAY ARRAY['bench_json_small', 'bench_json_wide', 'bench_json_nested'] LOOP
+        EXECUTE format('CREATE TEMPORARY TABLE %I AS SELECT bson_send(data) AS data FROM %I', name || '_bytea', name || '_bson');
+        EXECUTE format('SELECT sum(octet_length(data)) FROM %I', name || '_bytea') INTO bytes;
+        t0 := clock_timestamp();
+        EXECUTE format('SELECT count(*) FROM %I WHERE bson_is_valid(data)', name || '_bytea') INTO n;
+        secs := extract(epoch FROM clock_timestamp() - t0);
+        RAISE NOTICE '%: % GB/s', name, round((bytes / secs / 1e9)::numeric, 3);
+    END LOOP;
+END
+$$;
+
+\qecho * ingest of BSON bytes from an application
+\qecho bytea::bson, validation only
+SELECT count(data::bson) FROM bench_json_wide_bytea;
+\qecho the same documents as json text, for comparison
+SELECT count(json::bson) FROM bench_json_wide;
+
+\qecho * element scanning: 100 fields with 39-byte names, 20k documents
+CREATE TEMPORARY TABLE bench_long_names AS
+SELECT i AS id, ('{' || (SELECT string_agg(format('"a_rather_long_field_name_of_forty_b_%s":%s', lpad(k::text, 3, '0'), i + k), ',')
+    FROM generate_series(1, 100) AS k) || '}')::bson AS data
+FROM generate_series(1, 20000) AS i;
+\qecho getter, last field
+SELECT sum(bson_get_int(data, 'a_rather_long_field_name_of_forty_b_100')) FROM bench_long_names;
+\qecho getter, missing field
+SELECT count(bson_get_int(data, 'a_rather_long_field_name_of_forty_b_999')) FROM bench_long_names;
+\qecho bson_array_size over 100-element arrays
+SELECT sum(bson_array_size(data, 'v')) FROM bench_series;
+\qecho comparison: sort by the whole document
+SELECT count(*) FROM (SELECT data FROM bench_long_names ORDER BY data) AS s;
+\qecho hashing
+SELECT sum(bson_logical_hash(data)) FROM bench_long_names;
+\qecho output
+SELECT sum(length(data::text)) FROM bench_long_names;
+
+\qecho * compound index keys: one bsonkey index vs an expression index per field
+\qecho index build, bson_index_key over three fields
+CREATE INDEX bench_key_idx ON bench_nested (bson_index_key(data, '{"pad2":1, "v":-1, "l1.l2.l3.l4.l5.l6":1}'));
+\qecho index build, row of bson_get_bson over the same fields, for comparison
+CREATE INDEX bench_key_row_idx ON bench_nested (bson_get_bson(data, 'pad2'), bson_get_bson(data, 'v') DESC, bson_get_bson(data, 'l1.l2.l3.l4.l5.l6'));
+\qecho sort by bson_index_key
+SELECT count(*) FROM (SELECT 1 FROM bench_nested ORDER BY bson_index_key(data, '{"pad2":1, "v":-1, "l1.l2.l3.l4.l5.l6":1}')) AS s;
+\qecho sort by the getters, for comparison
+SELECT count(*) FROM (SELECT 1 FROM bench_nested ORDER BY bson_get_bson(data, 'pad2'), bson_get_bson(data, 'v') DESC, bson_get_bson(data, 'l1.l2.l3.l4.l5.l6')) AS s;
+SELECT 'bsonkey' AS index, pg_size_pretty(pg_relation_size('bench_key_idx')) AS size
+UNION ALL
+SELECT 'bson_get_bson columns', pg_size_pretty(pg_relation_size('bench_key_row_idx'));
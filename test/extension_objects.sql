@@ -0,0 +1,35 @@
+-- describes objects of the pgbson extension, used to compare an updated installation with a new one
+
+WITH members AS (
+    SELECT classid, objid FROM pg_depend
+    WHERE refclassid = 'pg_extension'::regclass AND deptype = 'e'
+        AND refobjid = (SELECT oid FROM pg_extension WHERE extname = 'pgbson')
+)
+SELECT 'function ' || pg_get_functiondef(p.oid)
+FROM members m JOIN pg_proc p ON m.classid = 'pg_proc'::regclass AND p.oid = m.objid
+UNION ALL
+SELECT format('operator %s commutator %s negator %s code %s restrict %s join %s hashes %s merges %s',
+    o.oid::regoperator, o.oprcom::regoperator, o.oprnegate::regoperator,
+    o.oprcode, o.oprrest, o.oprjoin, o.oprcanhash, o.oprcanmerge)
+FROM members m JOIN pg_operator o ON m.classid = 'pg_operator'::regclass AND o.oid = m.objid
+UNION ALL
+SELECT format('type %s input %s output %s receive %s send %s analyze %s align %s storage %s',
+    t.typname, t.typinput, t.typoutput, t.typreceive, t.typsend, t.typanalyze, t.typalign, t.typstorage)
+FROM members m JOIN pg_type t ON m.classid = 'pg_type'::regclass AND t.oid = m.objid
+UNION ALL
+SELECT format('operator class %s using %s for %s default %s', c.opcname, a.amname, c.opcintype::regtype, c.opcdefault)
+FROM members m JOIN pg_opclass c ON m.classid = 'pg_opclass'::regclass AND c.oid = m.objid
+    JOIN pg_am a ON a.oid = c.opcmethod
+UNION ALL
+SELECT format('operator family %s using %s: operator %s %s', f.opfname, a.amname, o.amopstrategy, o.amopopr::regoperator)
+FROM members m JOIN pg_opfamily f ON m.classid = 'pg_opfamily'::regclass AND f.oid = m.objid
+    JOIN pg_am a ON a.oid = f.opfmethod JOIN pg_amop o ON o.amopfamily = f.oid
+UNION ALL
+SELECT format('operator family %s using %s: function %s %s', f.opfname, a.amname, p.amprocnum, p.amproc::regprocedure)
+FROM members m JOIN pg_opfamily f ON m.classid = 'pg_opfamily'::regclass AND f.oid = m.objid
+    JOIN pg_am a ON a.oid = f.opfmethod JOIN pg_amproc p ON p.amprocfamily = f.oid
+UNION ALL
+SELECT format('cast %s to %s with %s context %s method %s',
+    c.castsource::regtype, c.casttarget::regtype, c.castfunc::regprocedure, c.castcontext, c.castmethod)
+FROM members m JOIN pg_cast c ON m.classid = 'pg_cast'::regclass AND c.oid = m.objid
+ORDER BY 1;
@@ -6,11 +6,30 @@ PSQL=psql
 CREATEDB=createdb
 DROPDB=dropdb
 TESTDB=pgbson_test
+LATIN1DB=pgbson_test_latin1
+UPDATEDB=pgbson_test_update
 
 # clean-up after previous, possibly db-crashing test
 $DROPDB --if-exists $TESTDB
+$DROPDB --if-exists $LATIN1DB
+$DROPDB --if-exists $UPDATEDB
 
 # create -> run -> drop
 $CREATEDB $TESTDB
 $PSQL $TESTDB < test.sql
+$PSQL -At $TESTDB < extension_objects.sql > created_objects.out
 $DROPDB $TESTDB
+
+# text conversion in a database which is not UTF-8
+$CREATEDB -E LATIN1 --locale=C -T template0 $LATIN1DB
+$PSQL $LATIN1DB < test_latin1.sql
+$DROPDB $LATIN1DB
+
+# update from 1.0 must give the same objects as a new installation
+$CREATEDB $UPDATEDB
+$PSQL -q $UPDATEDB -c "CREATE EXTENSION pgbson VERSION '1.0'"
+$PSQL -q $UPDATEDB -c "ALTER EXTENSION pgbson UPDATE"
+$PSQL -At $UPDATEDB < extension_objects.sql > updated_objects.out
+$DROPDB $UPDATEDB
+diff created_objects.out updated_objects.out && echo "* extension update from 1.0: same objects as created"
+rm -f created_objects.out updated_objects.out
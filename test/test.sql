@@ -17,7 +17,7 @@ CREATE TEMPORARY TABLE results_table (
 
 \qecho * testing extension version
 INSERT INTO results_table(name, got, expected)
-VALUES ('pgbson version', pgbson_version(), '1.0');
+VALUES ('pgbson version', pgbson_version(), '1.1');
 
 
 \qecho * json format input
@@ -29,10 +29,99 @@ INSERT INTO data_table(id, data)
 VALUES
 (3, '{"array1": [ 1, 2, 3, 4, 5 ], "array2" : ["a", "b", "c"], "array3" : [{"a": 1 }, { "b" : 2.3 } ], "scalar_int" : 42 }');
 
+-- the fast parser handles JSON and extended JSON objects, shell syntax is parsed by mongo::fromjson
+INSERT INTO results_table(name, expected, got)
+SELECT 'json input: ' || name, 'true', (json::bson == shell::bson)::text
+FROM (VALUES
+    ('numbers', '{"i":1, "n":-7, "l":4294967296, "d":1.5, "e":1e3, "z":-0, "big":12345678901234567890}',
+        '{i:1, n:-7, l:4294967296, d:1.5, e:1e3, z:-0, big:12345678901234567890}'),
+    ('strings', '{"s":"a\"b\\c\/d\n\t\u00e9\u20ac zażółć 𝄞", "empty":""}', '{s:"a\"b\\c\/d\n\t\u00e9\u20ac zażółć 𝄞", empty:""}'),
+    ('nesting', '{ "a" : [ 1, [ 2, { "b" : [] } ], {} ], "c" : { "d" : { "e" : null } }, "t" : true, "f" : false }',
+        '{a:[1,[2,{b:[]}],{}], c:{d:{e:null}}, t:true, f:false}'),
+    ('$oid', '{"_id":{"$oid":"5224a2d2c1a9e8b3f6e0a1b2"}}', '{_id:ObjectId("5224a2d2c1a9e8b3f6e0a1b2")}'),
+    ('$date', '{"d":{"$date":1370000000000}}', '{d:Date(1370000000000)}'),
+    ('$timestamp', '{"t":{"$timestamp":{"t":1370000000,"i":5}}}', '{t:Timestamp(1370000000, 5)}'),
+    ('$regex', '{"r":{"$regex":"^a.*b$","$options":"i"}}', '{r:/^a.*b$/i}')
+) AS t(name, json, shell);
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'json input: $binary', '{ "b" : { "$binary" : "AQID", "$type" : "00" } }', '{"b":{"$binary":"AQID","$type":"00"}}'::bson::text;
+
+-- output is the same as of BSONObj::jsonString
+INSERT INTO results_table(name, expected, got)
+SELECT 'json output: ' || name, expected, json::bson::text
+FROM (VALUES
+    ('numbers', '{"i":1, "l":4294967296, "d":0.1, "s":0.30000000000000004, "e":1e-7, "big":1e300, "n":-2.5, "z":-0.0}',
+        '{ "i" : 1, "l" : 4294967296, "d" : 0.1, "s" : 0.3, "e" : 1e-07, "big" : 1e+300, "n" : -2.5, "z" : -0 }'),
+    ('nesting', '{"s":"a\"b\\c/d\u0001\t", "a":[1, [], {}, [{"x":null}]], "o":{}, "t":true}',
+        '{ "s" : "a\"b\\c/d\u0001\t", "a" : [ 1, [], {}, [ { "x" : null } ] ], "o" : {}, "t" : true }'),
+    ('extended', '{"_id":{"$oid":"5224a2d2c1a9e8b3f6e0a1b2"}, "d":{"$date":1370000000000}, "r":{"$regex":"a/b","$options":"i"}, "ts":{"$timestamp":{"t":5,"i":6}}, "u":{"$undefined":true}, "b":{"$binary":"AQIDBA==","$type":"80"}}',
+        '{ "_id" : { "$oid" : "5224a2d2c1a9e8b3f6e0a1b2" }, "d" : { "$date" : 1370000000000 }, "r" : { "$regex" : "a/b", "$options" : "i" }, "ts" : { "$timestamp" : { "t" : 5, "i" : 6 } }, "u" : { "$undefined" : true }, "b" : { "$binary" : "AQIDBA==", "$type" : "80" } }')
+) AS t(name, json, expected);
+
+\qecho * binary input and output
+
+\copy (SELECT data FROM data_table ORDER BY id) TO 'bson_binary.tmp' WITH (FORMAT binary)
+CREATE TEMPORARY TABLE received_table (data BSON);
+\copy received_table FROM 'bson_binary.tmp' WITH (FORMAT binary)
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'binary copy round trip',
+    (SELECT string_agg(data::text, '' ORDER BY id) FROM data_table),
+    (SELECT string_agg(data::text, '') FROM received_table);
+
+-- bson_recv rejects documents not matching their length prefix, the errors are expected
+CREATE TEMPORARY TABLE rejected_table (data BSON);
+\copy (SELECT '\x0c00000010610001000000'::bytea) TO 'bson_binary.tmp' WITH (FORMAT binary)
+\copy rejected_table FROM 'bson_binary.tmp' WITH (FORMAT binary)
+\copy (SELECT '\x0c00000010610001000000000000'::bytea) TO 'bson_binary.tmp' WITH (FORMAT binary)
+\copy rejected_table FROM 'bson_binary.tmp' WITH (FORMAT binary)
+\copy (SELECT '\x0d000000036100060000000000'::bytea) TO 'bson_binary.tmp' WITH (FORMAT binary)
+\copy rejected_table FROM 'bson_binary.tmp' WITH (FORMAT binary)
+\! rm -f bson_binary.tmp
+-- the same check in bytea::bson
+INSERT INTO rejected_table SELECT '\x0c00000010610001000000'::bytea::bson;
+INSERT INTO rejected_table SELECT '\x0e00000002610002000000ff0000'::bytea::bson;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_recv and bytea::bson reject truncated, oversized and malformed documents', '0', count(*)::text FROM rejected_table;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bytea casts: ' || name, expected, got
+FROM (VALUES
+    ('bson::bytea', encode(bson_send('{"a":1}'::bson), 'hex'), encode('{"a":1}'::bson::bytea, 'hex')),
+    ('bytea::bson', '{ "a" : 1 }', '\x0c0000001061000100000000'::bytea::bson::text),
+    ('bson_from_bytea', '{ "a" : 1 }', bson_from_bytea('\x0c0000001061000100000000'::bytea)::text),
+    ('round trip', (SELECT string_agg(data::text, '' ORDER BY id) FROM data_table),
+        (SELECT string_agg(data::bytea::bson::text, '' ORDER BY id) FROM data_table))
+) AS t(name, expected, got);
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_is_valid: ' || name, expected::text, bson_is_valid(data)::text
+FROM (VALUES
+    ('sent documents', true, (SELECT bson_send(data) FROM data_table ORDER BY id LIMIT 1)),
+    ('multibyte string', true, bson_send('{"s":"zażółć €"}'::bson)),
+    ('truncated', false, '\x0c00000010610001000000'::bytea),
+    ('trailing bytes', false, '\x0c00000010610001000000000000'::bytea),
+    ('invalid byte', false, '\x0e00000002610002000000ff0000'::bytea),
+    ('overlong form', false, '\x0f00000002610003000000c0800000'::bytea),
+    ('surrogate', false, '\x1000000002610004000000eda0800000'::bytea),
+    ('invalid field name', false, '\x0c00000010ff000100000000'::bytea)
+) AS t(name, expected, data);
+
+-- surrogate pairs are decoded, not encoded one by one
+INSERT INTO results_table(name, expected, got)
+SELECT 'json input: surrogate pair', '{"s":"😀"}'::bson::text, '{"s":"\ud83d\ude00"}'::bson::text;
+
 \qecho * bson from row
 
 CREATE TYPE nested_obj_type AS (ns TEXT);
 CREATE TYPE obj_type AS (string_field TEXT, integer_field INTEGER, nested BSON);
+CREATE TYPE nested_pair AS (f1 INTEGER, f2 TEXT);
+CREATE TYPE record_types AS (i2 SMALLINT, i8 BIGINT, f FLOAT8, n NUMERIC, b BOOLEAN);
+CREATE TYPE record_nested AS (t TEXT, a INTEGER[], r nested_pair, d DATE);
+CREATE TYPE record_json AS (j JSON, b BSON);
+CREATE TYPE record_base AS (i INTEGER, s TEXT, k INTEGER, b BOOLEAN);
 
 
 INSERT INTO data_table(id, data)
@@ -46,6 +135,75 @@ VALUES
     )
 );
 
+INSERT INTO results_table(name, expected, got)
+SELECT 'row_to_bson over rows with nulls and nested records',
+    '{ "id" : 1, "s" : "a", "c" : "x", "n" : { "f1" : 1, "f2" : null } }'
+    || '{ "id" : 2, "s" : null, "c" : "y", "n" : { "f1" : 2, "f2" : "b" } }'
+    || '{ "id" : 3, "s" : "c", "c" : null, "n" : null }',
+    string_agg(row_to_bson(t)::text, '' ORDER BY id)
+FROM (VALUES (1, 'a', 'x'::"char", row(1, NULL::text)), (2, NULL, 'y', row(2, 'b')), (3, 'c', NULL, NULL)) AS t(id, s, c, n);
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'row_to_bson type mapping: ' || name, expected, row_to_bson(v)::text
+FROM (VALUES
+    ('arrays', row(ARRAY[1, NULL, 3], ARRAY[['a', 'b'], ['c', 'd']], '{}'::int[], ARRAY[row(1)])::record,
+        '{ "f1" : [ 1, null, 3 ], "f2" : [ [ "a", "b" ], [ "c", "d" ] ], "f3" : [], "f4" : [ { "f1" : 1 } ] }'),
+    ('numeric', row(1.5::numeric, 10::numeric, 12345678901234567890::numeric, 0.1234567890123456789::numeric, 'NaN'::numeric),
+        '{ "f1" : 1.5, "f2" : 10, "f3" : "12345678901234567890", "f4" : "0.1234567890123456789", "f5" : NaN }'),
+    ('binary', row('\x010203'::bytea, 'a0eebc99-9c0b-4ef8-bb6d-6bb9bd380a11'::uuid),
+        '{ "f1" : { "$binary" : "AQID", "$type" : "00" }, "f2" : { "$binary" : "oO68mZwLTvi7bWu5vTgKEQ==", "$type" : "04" } }'),
+    ('dates', row('2013-06-01'::date, '2013-06-01 00:00:00.5+00'::timestamptz, '1969-12-31 23:59:59.9999'::timestamp),
+        '{ "f1" : { "$date" : 1370044800000 }, "f2" : { "$date" : 1370044800500 }, "f3" : { "$date" : -1 } }')
+) AS t(name, v, expected);
+
+CREATE TEMPORARY TABLE row_source (a INTEGER, dropped TEXT, b TEXT);
+INSERT INTO row_source VALUES (1, 'x', 'one'), (2, 'y', 'two');
+ALTER TABLE row_source DROP COLUMN dropped;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'row_to_bson skips dropped columns',
+    '{ "a" : 1, "b" : "one" }{ "a" : 2, "b" : "two" }', string_agg(row_to_bson(r)::text, '' ORDER BY a)
+FROM row_source AS r;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'row_to_bson larger than initial buffer',
+    repeat('x', 10000), bson_get_text(row_to_bson(row(repeat('x', 10000), 1, NULL)::obj_type), 'string_field');
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_get_bson on long string',
+    ('{"":"' || repeat('y', 2000) || '"}')::bson::text, bson_get_bson(('{"s":"' || repeat('y', 2000) || '"}')::bson, 's')::text;
+
+\qecho * row from bson
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_populate_record round trip',
+    '("from row",42,"{ ""ns"" : ""boo"" }")',
+    row(p.string_field, p.integer_field, p.nested::text)::text
+FROM (SELECT (bson_populate_record(NULL::obj_type, data)).* FROM data_table WHERE id = 2) AS p;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_populate_record type conversion: ' || name, expected, got
+FROM (VALUES
+    ('numbers', '(1,2,3.5,4.5,t)',
+        bson_populate_record(NULL::record_types, '{"i2": 1, "i8": 2.0, "f": 3.5, "n": 4.5, "b": true}')::text),
+    ('strings to numbers', '(10,20,,1.25,f)',
+        bson_populate_record(NULL::record_types, '{"i2": "10", "i8": "20", "n": "1.25", "b": "false"}')::text),
+    ('nested and arrays', '(x,"{1,2,NULL}","(3,y)",2013-06-01)',
+        bson_populate_record(NULL::record_nested,
+            '{"t": "x", "a": [1, 2, null], "r": {"f1": 3, "f2": "y", "extra": 0}, "d": {"$date": 1370044800000}}')::text),
+    ('objects to json', '("{ ""a"" : 1 }","{ ""a"" : 1 }")',
+        bson_populate_record(NULL::record_json, '{"j": {"a": 1}, "b": {"a": 1}}')::text)
+) AS t(name, expected, got);
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_populate_record: missing fields from base, first of repeated fields',
+    '(5,z,99,f)', bson_populate_record(row(1, 'z', 99, true)::record_base, '{"i": 5, "b": false, "i": 6, "unknown": 1, "x": null}')::text;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_populate_recordset', '(1,a)(2,)(3,c)', string_agg(r::text, '' ORDER BY r.f1)
+FROM bson_populate_recordset(NULL::nested_pair,
+    ARRAY['{"f1": 1, "f2": "a"}', '{"f1": 2}', NULL, '{"f2": "c", "f1": 3}']::bson[]) AS r;
+
 \qecho * Object inspection
 
 
@@ -69,6 +227,11 @@ INSERT INTO results_table(name, expected, got)
 SELECT 'bson_get_int on bson from json',
     42::text, bson_get_int(data, 'integer_field')::text  FROM data_table WHERE id = 1;
 
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_get_int on long field names',
+    '3', bson_get_int('{"a_field_name_longer_than_sixteen_bytes":1, "a_field_name_longer_than_sixteen_bytes_too":{"and_a_nested_one_as_long_as_that":3}}'::bson,
+        'a_field_name_longer_than_sixteen_bytes_too.and_a_nested_one_as_long_as_that')::text;
+
 INSERT INTO results_table(name, expected, got)
 SELECT 'bson_get_double on bson from json',
     3.14::text, bson_get_double(data, 'float')::text  FROM data_table WHERE id = 1;
@@ -85,6 +248,46 @@ INSERT INTO results_table(name, expected, got)
 SELECT 'bson_get_bigint on bson from json, integer field',
     42::text, bson_get_bigint(data, 'integer_field')::text  FROM data_table WHERE id = 1;
 
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_get_text on dotted path',
+    'boo', bson_get_text(data, 'nested.ns')  FROM data_table WHERE id = 1;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_get_text on dotted path into array',
+    'b', bson_get_text(data, 'array2.1')  FROM data_table WHERE id = 3;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_get_text on dotted path, literal dotted name takes precedence',
+    'literal', bson_get_text('{"a":{"b":"nested"}, "a.b":"literal"}'::bson, 'a.b');
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_get_text on missing dotted path',
+    'null', coalesce(bson_get_text(data, 'nested.ns.nope'), 'null')  FROM data_table WHERE id = 1;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_get_int with varying path',
+    '2,42', string_agg(bson_get_int(data, p)::text, ',' ORDER BY p)
+    FROM data_table, (VALUES ('integer_field'), ('array1.1')) AS paths(p)
+    WHERE id IN (1, 3) AND bson_get_int(data, p) IS NOT NULL;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_get_many_text',
+    '{"from json",42,boo,NULL,3.14}', bson_get_many_text(data, ARRAY['string_field', 'integer_field', 'nested.ns', 'nope', 'float'])::text
+    FROM data_table WHERE id = 1;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_get_many',
+    '(42,"from json",1099511627776,42,3.14,boo,)', r::text
+    FROM data_table, bson_get_many(data, ARRAY['integer_field', 'string_field', 'int64_filed', 'integer_field', 'float', 'nested.ns', 'nope'])
+        AS r(i int4, s text, b int8, d float8, n numeric, ns varchar, nope text)
+    WHERE id = 1;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_get_many_text with paths changing per row',
+    '1,2,3,4', string_agg(v, ',' ORDER BY i)
+    FROM (SELECT i, (bson_get_many_text('{"a":1, "b":2, "c":3, "d":4}', ARRAY[p, 'nope']))[1] AS v
+        FROM (VALUES (1, 'a'), (2, 'b'), (3, 'c'), (4, 'd')) AS paths(i, p)) AS t;
+
 \qecho * Array tools
 
 INSERT INTO results_table(name, expected, got)
@@ -103,6 +306,27 @@ INSERT INTO results_table(name, expected, got)
 SELECT 'bson_array_size on array scalar',
     1::text, bson_array_size(data, 'scalar_int')::text  FROM data_table WHERE id = 3;
 
+INSERT INTO results_table(name, expected, got)
+SELECT 'typed array getters: ' || name, expected, got
+FROM (VALUES
+    ('int4', '{1,2,3,4,5}', (SELECT bson_get_int_array(data, 'array1')::text FROM data_table WHERE id = 3)),
+    ('text', '{a,b,c}', (SELECT bson_get_text_array(data, 'array2')::text FROM data_table WHERE id = 3)),
+    ('scalar', '{42}', (SELECT bson_get_bigint_array(data, 'scalar_int')::text FROM data_table WHERE id = 3)),
+    ('missing field', 'none', (SELECT coalesce(bson_get_int_array(data, 'nope')::text, 'none') FROM data_table WHERE id = 3)),
+    ('int8 with nulls', '{1,NULL,3000000000,NULL}', bson_get_bigint_array('{"a":[1, null, 3000000000, null]}', 'a')::text),
+    ('float8', '{1.5,2,NULL}', bson_get_double_array('{"a":[1.5, 2, null]}', 'a')::text),
+    ('bool', '{t,f}', bson_get_bool_array('{"a":[true, false]}', 'a')::text),
+    ('timestamptz', '2013-06-01 00:00:00.5',
+        ((bson_get_timestamptz_array('{"a":[{"$date":1370044800500}, null]}', 'a'))[1] AT TIME ZONE 'UTC')::text),
+    ('nested path, empty array', '{}', bson_get_double_array('{"a":{"b":[]}}', 'a.b')::text),
+    ('text from numbers', '{1,x,2.5}', bson_get_text_array('{"a":[1, "x", 2.5]}', 'a')::text),
+    -- {"a": [130 nulls]} with empty array keys, 2 bytes per element
+    ('int4 nulls with empty keys', '130',
+        array_length(bson_get_int_array(decode('11010000046100' || '09010000' || repeat('0a00', 130) || '0000', 'hex')::bson, 'a'), 1)::text),
+    ('text nulls with empty keys', '130',
+        array_length(bson_get_text_array(decode('11010000046100' || '09010000' || repeat('0a00', 130) || '0000', 'hex')::bson, 'a'), 1)::text)
+) AS t(name, expected, got);
+
 \qecho * Unwind array
 
 CREATE TEMPORARY TABLE unwound_arrays
@@ -128,6 +352,192 @@ SELECT 'not existing', bson_unwind_array(data, 'nope') FROM data_table WHERE id
 
 SELECT * FROM unwound_arrays;
 
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_unwind_array in FROM (materialized): ' || name, expected, got
+FROM (VALUES
+    ('integers', '{ "" : 1 }{ "" : 2 }{ "" : 3 }',
+        (SELECT string_agg(u::text, '' ORDER BY n) FROM bson_unwind_array('{"a":[1,2,3]}', 'a') WITH ORDINALITY AS t(u, n))),
+    ('objects', '{ "x" : 1 }{ "y" : [ 2 ] }',
+        (SELECT string_agg(u::text, '' ORDER BY n) FROM bson_unwind_array('{"a":[{"x":1},{"y":[2]}]}', 'a') WITH ORDINALITY AS t(u, n))),
+    ('scalar', '{ "" : "s" }', (SELECT string_agg(u::text, '') FROM bson_unwind_array('{"a":"s"}', 'a') AS u)),
+    ('empty array', 'none', (SELECT coalesce(string_agg(u::text, ''), 'none') FROM bson_unwind_array('{"a":[]}', 'a') AS u)),
+    ('missing field', 'none', (SELECT coalesce(string_agg(u::text, ''), 'none') FROM bson_unwind_array('{"a":[1]}', 'b') AS u))
+) AS t(name, expected, got);
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_unwind: ' || name, expected, got
+FROM (VALUES
+    ('two levels with fields of each level',
+        '(1,1,c1,10,a,2)(1,2,c1,10,b,1)(2,1,c1,11,c,5)',
+        (SELECT string_agg(u::text, '' ORDER BY o, i)
+        FROM bson_unwind(('{"customer":"c1","orders":[{"id":10,"items":[{"sku":"a","qty":2},{"sku":"b","qty":1}]},'
+            || '{"id":11,"items":[{"sku":"c","qty":5.0}]},{"id":12,"items":[]},{"id":13}]}')::bson,
+            '{orders,orders.items}', '{customer,orders.id,orders.items.sku,orders.items.qty}')
+            AS u(o int, i bigint, customer text, order_id int, sku text, qty int))),
+    ('elements and missing fields',
+        '(1,1)(2,"{ ""x"" : 1 }")(3,)',
+        (SELECT string_agg(u::text, '' ORDER BY n)
+        FROM bson_unwind('{"a":[1,{"x":1},null]}', '{a}', '{a}') AS u(n int, v text))),
+    ('typed values',
+        '(1,2013-06-01,"{1,2}",t)',
+        (SELECT string_agg(u::text, '')
+        FROM bson_unwind('{"a":[{"d":{"$date":1370044800000},"l":[1,2],"b":true}]}', '{a}', '{a.d,a.l,a.b}')
+            AS u(n int, d date, l int[], b boolean))),
+    ('scalar as single element, no fields',
+        '(1)',
+        (SELECT string_agg(u::text, '') FROM bson_unwind('{"a":5}', '{a}') AS u(n int))),
+    ('array paths changing per row',
+        '(1,1)(2,2)(1,3)',
+        (SELECT string_agg(u::text, '' ORDER BY p, u.n)
+        FROM (VALUES ('a'), ('b')) AS paths(p), bson_unwind('{"a":[1,2],"b":[3]}', ARRAY[p], ARRAY[p]) AS u(n int, v int)))
+) AS t(name, expected, got);
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_unwind_array in select list over empty array', '0',
+    (SELECT count(*) FROM (SELECT bson_unwind_array('{"a":[]}', 'a')) AS u)::text;
+
+\qecho * Large, externally stored documents
+
+CREATE TEMPORARY TABLE external_table (
+    id BIGSERIAL,
+    data BSON
+);
+ALTER TABLE external_table ALTER COLUMN data SET STORAGE EXTERNAL;
+
+INSERT INTO external_table(id, data)
+SELECT 1, bson_move_fields(('{"cold":[' || string_agg('"' || repeat('x', 100) || '"', ',') || '], "tail":"tail", "nested":{"n":"n"}, "hot":"hot"}')::bson,
+    '{hot,nested,missing,hot}')
+FROM generate_series(1, 2000);
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'hot fields moved to the front',
+    '{ "hot" : "hot", "nested" : { "n" : "n" }, "cold" :', substr(data::text, 1, 51) FROM external_table WHERE id = 1;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_move_fields without fields to move',
+    '{ "a" : 1, "b" : 2 }', bson_move_fields('{"a":1, "b":2}', '{c}')::text;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_move_fields keeps other fields in order',
+    '{ "c" : 3, "a" : 1, "b" : 2, "d" : 4 }', bson_move_fields('{"a":1, "b":2, "c":3, "d":4}', '{c}')::text;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_get_text on external value, field at the front',
+    'hot', bson_get_text(data, 'hot') FROM external_table WHERE id = 1;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_get_text on external value, dotted path',
+    'n', bson_get_text(data, 'nested.n') FROM external_table WHERE id = 1;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_get_text on external value, field at the end',
+    'tail', bson_get_text(data, 'tail') FROM external_table WHERE id = 1;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_array_size on external value',
+    2000::text, bson_array_size(data, 'cold')::text FROM external_table WHERE id = 1;
+
+\qecho * BSONX
+
+CREATE TEMPORARY TABLE bsonx_table (
+    id BIGSERIAL,
+    data BSONX
+);
+
+INSERT INTO bsonx_table(id, data)
+VALUES
+(1, '{"f1":1, "f2":2, "f3":3, "f4":4, "f5":5, "f6":6, "f7":7, "f8":8, "f9":9, "f1":10, "a.b":"literal", "a":{"b":"nested"},
+    "wide":{"z":"z", "y":"y", "x":"x", "w":"w", "v":"v", "u":"u", "t":"t", "s":{"deep":"deep"}}}'),
+(2, '{"small":"small", "nested":{"f":1.5}}'::bson);
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bsonx output same as bson',
+    bsonx_to_bson(data)::text, data::text FROM bsonx_table WHERE id = 1;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bsonx_get_int, last field',
+    9::text, bsonx_get_int(data, 'f9')::text FROM bsonx_table WHERE id = 1;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bsonx_get_int, duplicated name, first wins',
+    1::text, bsonx_get_int(data, 'f1')::text FROM bsonx_table WHERE id = 1;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bsonx_get_text, literal dotted name takes precedence',
+    'literal', bsonx_get_text(data, 'a.b') FROM bsonx_table WHERE id = 1;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bsonx_get_text, nested wide object',
+    'deep', bsonx_get_text(data, 'wide.s.deep') FROM bsonx_table WHERE id = 1;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bsonx_get_text, missing field',
+    'null', coalesce(bsonx_get_text(data, 'wide.nope'), 'null') FROM bsonx_table WHERE id = 1;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bsonx_get_double, small object without directory',
+    1.5::text, bsonx_get_double(data, 'nested.f')::text FROM bsonx_table WHERE id = 2;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bsonx_get_bson',
+    '{"deep":"deep"}'::bson::text, bsonx_get_bson(data, 'wide.s')::text FROM bsonx_table WHERE id = 1;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'row_to_bsonx',
+    'from row', bsonx_get_text(row_to_bsonx(row('from row', 42, NULL)::obj_type), 'string_field');
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bsonx to bson cast is not implicit',
+    'a', castcontext::text FROM pg_cast WHERE castsource = 'bsonx'::regtype AND casttarget = 'bson'::regtype;
+
+CREATE TEMPORARY TABLE bsonx_assigned (data BSON);
+INSERT INTO bsonx_assigned SELECT data FROM bsonx_table WHERE id = 2;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bsonx assigned to bson column',
+    1.5::text, bson_get_double(data, 'nested.f')::text FROM bsonx_assigned;
+
+\qecho * jsonb casts
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson::jsonb', '{"a": 1, "b": [1, 2.5, "x", null, true], "c": {"d": {}}}',
+    '{"a":1, "b":[1, 2.5, "x", null, true], "c":{"d":{}}}'::bson::jsonb::text;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson::jsonb same as through text', true,
+    d::jsonb = d::text::jsonb
+FROM (SELECT '{"_id":{"$oid":"5224a2d2c1a9e8b3f6e0a1b2"}, "d":{"$date":1370000000000}, "r":{"$regex":"a/b","$options":"i"}, "ts":{"$timestamp":{"t":5,"i":6}}, "u":{"$undefined":true}, "b":{"$binary":"AQIDBA==","$type":"80"}, "l":5000000000}'::bson AS d) AS t;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson::jsonb keeps the 16 digits of bson output', '{"a": 1.234567890123456, "b": [0.1, -2.5]}',
+    '{"a":1.234567890123456, "b":[0.1, -2.5]}'::bson::jsonb::text;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson::jsonb of doubles same as through text', true,
+    d::jsonb = d::text::jsonb
+FROM (SELECT '{"a":1.234567890123456, "b":0.30000000000000004, "c":1e300, "d":-0.0, "e":123456789012.3456}'::bson AS d) AS t;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'jsonb::bson number types', true,
+    '{"d":1.5, "i":1, "l":5000000000, "n":-7}'::jsonb::bson == '{"d":1.5, "i":1, "l":5000000000, "n":-7}'::bson;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'jsonb::bson keys in jsonb order', '{ "a" : { "x" : 2, "y" : 3 }, "b" : 1, "aa" : 2 }',
+    '{"b":1, "aa":2, "a":{"y":3, "x":2}}'::jsonb::bson::text;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson::jsonb::bson round trip of extended types', true,
+    d::jsonb::bson == d
+FROM (SELECT '{"b":{"$binary":"AQIDBA==","$type":"80"}, "d":{"$date":1370000000000}, "o":{"$oid":"5224a2d2c1a9e8b3f6e0a1b2"}, "r":{"$regex":"a/b","$options":"i"}, "t":{"$timestamp":{"t":5,"i":6}}, "u":{"$undefined":true}}'::bson AS d) AS t;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'jsonb::bson plain objects with $ names', '{ "$x" : 1, "$oid" : 1 }',
+    '{"$oid":1, "$x":1}'::jsonb::bson::text;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'row_to_bson with jsonb columns', '{ "f1" : { "a" : [ 1, "x" ] }, "f2" : 3, "f3" : "s" }',
+    row_to_bson(row('{"a":[1,"x"]}'::jsonb, '3'::jsonb, '"s"'::jsonb))::text;
+
 \qecho * Operators
 
 INSERT INTO results_table(name, expected, got)
@@ -195,6 +605,387 @@ SELECT 'gte-eq', true, '{"a":3}'::bson >= '{"a":3}'::bson;
 INSERT INTO results_table(name, expected, got)
 SELECT 'gte-gt', true, '{"a":3}'::bson >= '{"a":2}'::bson;
 
+\qecho * Sorting
+
+CREATE TEMPORARY TABLE sort_table (
+    id INT,
+    data BSON
+);
+
+-- ids in expected order
+INSERT INTO sort_table(id, data)
+VALUES
+(10, '{"a":{"c":1}}'),
+(3, '{"a":-3}'),
+(7, '{"aaaaaaaaab":0}'),
+(1, '{}'),
+(5, '{"a":2.5}'),
+(9, '{"a":"x"}'),
+(8, '{"b":1}'),
+(2, '{"a":null}'),
+(6, '{"aaaaaaaaaa":1}'),
+(4, '{"a":1}');
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'ORDER BY bson', '1,2,3,4,5,6,7,8,9,10', string_agg(id::text, ',' ORDER BY data) FROM sort_table;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'ORDER BY bson DESC', '10,9,8,7,6,5,4,3,2,1', string_agg(id::text, ',' ORDER BY data DESC) FROM sort_table;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_compare: ' || name, expected::text, sign(bson_compare(a::bson, b::bson))::text
+FROM (VALUES
+    ('nested documents', -1, '{"x":{"y":[1,2,{"z":1}]}}', '{"x":{"y":[1,2,{"z":2}]}}'),
+    ('nested field names', 1, '{"x":{"yy":1}}', '{"x":{"y":1}}'),
+    ('numbers of different types', 0, '{"a":1, "b":[2, 4294967296]}', '{"a":1.0, "b":[2.0, 4294967296.0]}'),
+    ('long field names', -1, '{"a_field_name_longer_than_sixteen_bytes_1":1}', '{"a_field_name_longer_than_sixteen_bytes_2":0}'),
+    ('field name prefix', -1, '{"abc":1}', '{"abcd":0}'),
+    ('fewer fields', -1, '{"a":1}', '{"a":1, "b":null}')
+) AS t(name, expected, a, b);
+
+\qecho * Hashing
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_logical_hash on int, bigint and double',
+    true, bson_logical_hash(row_to_bson(row(1::integer))) = bson_logical_hash(row_to_bson(row(1::bigint)))
+        AND bson_logical_hash(row_to_bson(row(1::integer))) = bson_logical_hash(row_to_bson(row(1::float8)));
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_logical_hash on nested objects with equal numbers',
+    true, bson_logical_hash('{"a":{"b":[1, 2.0]}}'::bson) = bson_logical_hash('{"a":{"b":[1.0, 2]}}'::bson);
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_logical_hash on different objects',
+    false, bson_logical_hash('{"a":1}'::bson) = bson_logical_hash('{"b":1}'::bson);
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_hash on int and double',
+    false, bson_hash(row_to_bson(row(1::integer))) = bson_hash(row_to_bson(row(1::float8)));
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_hash of 1.0 unchanged',
+    '2029897214', bson_hash('{"a":1}'::bson)::text;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_binary_hash on int and double',
+    false, bson_binary_hash(row_to_bson(row(1::integer))) = bson_binary_hash(row_to_bson(row(1::float8)));
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'hash aggregation on =',
+    2::text, count(*)::text FROM (
+        SELECT data FROM (VALUES (row_to_bson(row(1::integer))), (row_to_bson(row(1::float8))), (row_to_bson(row(2::integer)))) AS v(data)
+        GROUP BY data
+    ) AS g;
+
+\qecho * Path existence and statistics
+
+INSERT INTO results_table(name, expected, got)
+SELECT '? on existing field',
+    true, '{"a":{"b":null}}'::bson ? 'a';
+
+INSERT INTO results_table(name, expected, got)
+SELECT '? on dotted path with null value',
+    true, '{"a":{"b":null}}'::bson ? 'a.b';
+
+INSERT INTO results_table(name, expected, got)
+SELECT '? on missing field',
+    false, '{"a":{"b":null}}'::bson ? 'a.c';
+
+CREATE TEMPORARY TABLE stats_table (
+    id BIGSERIAL,
+    data BSON
+);
+
+INSERT INTO stats_table(data)
+SELECT CASE WHEN i <= 25
+    THEN ('{"a":' || i % 4 || ', "b":"x"}')::bson
+    ELSE ('{"a":' || i % 4 || '}')::bson
+END
+FROM generate_series(1, 100) AS i;
+
+ANALYZE stats_table;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_path_stats paths',
+    'a,b', string_agg(bson_get_text(s, 'path'), ',' ORDER BY bson_get_text(s, 'path'))
+FROM bson_path_stats('stats_table', 'data') AS s;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_path_stats fraction of documents with path',
+    0.25::float8::text, bson_get_double(s, 'frac')::text
+FROM bson_path_stats('stats_table', 'data') AS s WHERE bson_get_text(s, 'path') = 'b';
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_path_stats distinct values',
+    4::text, bson_get_int(s, 'nd')::text
+FROM bson_path_stats('stats_table', 'data') AS s WHERE bson_get_text(s, 'path') = 'a';
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_path_stats most common values',
+    4::text, bson_array_size(s, 'mcv')::text
+FROM bson_path_stats('stats_table', 'data') AS s WHERE bson_get_text(s, 'path') = 'a';
+
+INSERT INTO results_table(name, expected, got)
+SELECT '? on analyzed table',
+    25::text, count(*)::text FROM stats_table WHERE data ? 'b';
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_exists on analyzed table',
+    25::text, count(*)::text FROM stats_table WHERE bson_exists(data, 'b');
+
+\qecho * Containment and GIN index
+
+INSERT INTO results_table(name, expected, got)
+SELECT '@> on nested object',
+    true, '{"a":{"b":1, "c":2}, "d":3}'::bson @> '{"a":{"b":1}}';
+
+INSERT INTO results_table(name, expected, got)
+SELECT '@> on different value',
+    false, '{"a":{"b":1, "c":2}, "d":3}'::bson @> '{"a":{"b":2}}';
+
+INSERT INTO results_table(name, expected, got)
+SELECT '@> with numbers of different types',
+    true, '{"a":1}'::bson @> '{"a":1.0}';
+
+INSERT INTO results_table(name, expected, got)
+SELECT '@> on array subset',
+    true, '{"tags":["a", "b", "c"]}'::bson @> '{"tags":["c", "a"]}';
+
+INSERT INTO results_table(name, expected, got)
+SELECT '@> on scalar in array',
+    true, '{"tags":["a", "b", "c"]}'::bson @> '{"tags":"b"}';
+
+INSERT INTO results_table(name, expected, got)
+SELECT '@> on object in array',
+    true, '{"items":[{"x":1, "y":2}, {"x":3}]}'::bson @> '{"items":{"x":3}}';
+
+INSERT INTO results_table(name, expected, got)
+SELECT '<@',
+    true, '{"a":1}'::bson <@ '{"a":1, "b":2}';
+
+INSERT INTO results_table(name, expected, got)
+SELECT '?| with one existing field',
+    true, '{"a":1, "b":2}'::bson ?| ARRAY['c', 'b'];
+
+INSERT INTO results_table(name, expected, got)
+SELECT '?& with one missing field',
+    false, '{"a":1, "b":2}'::bson ?& ARRAY['a', 'c'];
+
+CREATE TEMPORARY TABLE gin_table (
+    id BIGSERIAL,
+    data BSON
+);
+
+INSERT INTO gin_table(data)
+SELECT ('{"n":' || i || ', "kind":"k' || i % 10 || '", "tags":["t' || i % 3 || '", "t' || i % 5 || '"], "sub":{"arr":[' || i || ', 0]}'
+    || CASE WHEN i % 2 = 0 THEN ', "even":true' ELSE '' END || '}')::bson
+FROM generate_series(1, 1000) AS i;
+
+CREATE INDEX gin_table_idx ON gin_table USING gin (data);
+CREATE INDEX gin_table_path_idx ON gin_table USING gin (data bson_gin_path_ops);
+
+SET enable_seqscan = off;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'GIN @> on string',
+    100::text, count(*)::text FROM gin_table WHERE data @> '{"kind":"k3"}';
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'GIN @> on array elements',
+    133::text, count(*)::text FROM gin_table WHERE data @> '{"tags":["t1", "t2"]}';
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'GIN @> on nested array',
+    1::text, count(*)::text FROM gin_table WHERE data @> '{"sub":{"arr":42}}';
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'GIN @> on empty object',
+    1000::text, count(*)::text FROM gin_table WHERE data @> '{}';
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'GIN ?',
+    500::text, count(*)::text FROM gin_table WHERE data ? 'even';
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'GIN ? with array index',
+    1000::text, count(*)::text FROM gin_table WHERE data ? 'sub.arr.1';
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'GIN ?|',
+    500::text, count(*)::text FROM gin_table WHERE data ?| ARRAY['even', 'missing'];
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'GIN ?&',
+    0::text, count(*)::text FROM gin_table WHERE data ?& ARRAY['even', 'missing'];
+
+DROP INDEX gin_table_idx;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'GIN path_ops @>',
+    100::text, count(*)::text FROM gin_table WHERE data @> '{"kind":"k3"}';
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'GIN path_ops ?',
+    500::text, count(*)::text FROM gin_table WHERE data ? 'even';
+
+RESET enable_seqscan;
+
+\qecho * MongoDB queries
+
+CREATE TEMPORARY TABLE match_table (
+    id INTEGER,
+    data BSON
+);
+
+INSERT INTO match_table(id, data) VALUES
+(1, '{"name":"John", "age":32, "tags":["a", "b"], "address":{"city":"Paris"}}'),
+(2, '{"name":"Jane", "age":17, "tags":["b", "c"], "address":{"city":"London"}, "scores":[{"s":1}, {"s":9}]}'),
+(3, '{"name":"Spike", "species":"Dog", "age":null}'),
+(4, '{"name":"Mike", "age":45.5, "tags":[], "scores":[{"s":5}]}');
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_match equality', '1',
+    string_agg(id::text, ',' ORDER BY id) FROM match_table WHERE bson_match(data, '{"name":"John"}');
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_match dotted path', '2',
+    string_agg(id::text, ',' ORDER BY id) FROM match_table WHERE data @@ '{"address.city":"London"}';
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_match array element', '1,2',
+    string_agg(id::text, ',' ORDER BY id) FROM match_table WHERE data @@ '{"tags":"b"}';
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_match $gte and $lt', '1,4',
+    string_agg(id::text, ',' ORDER BY id) FROM match_table WHERE data @@ '{"age":{"$gte":18, "$lt":100}}';
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_match $ne', '2,3,4',
+    string_agg(id::text, ',' ORDER BY id) FROM match_table WHERE data @@ '{"name":{"$ne":"John"}}';
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_match $in and $nin', '2',
+    string_agg(id::text, ',' ORDER BY id) FROM match_table WHERE data @@ '{"tags":{"$in":["c", "x"], "$nin":["a"]}}';
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_match $exists', '3',
+    string_agg(id::text, ',' ORDER BY id) FROM match_table WHERE data @@ '{"species":{"$exists":true}}';
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_match null matches missing', '3',
+    string_agg(id::text, ',' ORDER BY id) FROM match_table WHERE data @@ '{"age":null}';
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_match $regex', '1,2',
+    string_agg(id::text, ',' ORDER BY id) FROM match_table WHERE data @@ '{"name":{"$regex":"^j", "$options":"i"}}';
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_match $not $regex', '3,4',
+    string_agg(id::text, ',' ORDER BY id) FROM match_table WHERE data @@ '{"name":{"$not":{"$regex":"^J"}}}';
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_match $elemMatch', '2',
+    string_agg(id::text, ',' ORDER BY id) FROM match_table WHERE data @@ '{"scores":{"$elemMatch":{"s":{"$gt":6}}}}';
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_match $size and $all', '1',
+    string_agg(id::text, ',' ORDER BY id) FROM match_table WHERE data @@ '{"tags":{"$size":2, "$all":["a", "b"]}}';
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_match path into array elements', '4',
+    string_agg(id::text, ',' ORDER BY id) FROM match_table WHERE data @@ '{"scores.s":5}';
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_match array element by position', '2',
+    string_agg(id::text, ',' ORDER BY id) FROM match_table WHERE data @@ '{"scores.1.s":9}';
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_match $or and $nor', '1,4',
+    string_agg(id::text, ',' ORDER BY id) FROM match_table
+    WHERE data @@ '{"$or":[{"age":{"$gt":40}}, {"name":"John"}], "$nor":[{"species":"Dog"}]}';
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_match $mod and $type', '1',
+    string_agg(id::text, ',' ORDER BY id) FROM match_table WHERE data @@ '{"age":{"$mod":[4, 0], "$type":16}}';
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_match $mod by -1 of minimal int64', 'true',
+    (row_to_bson(row((-9223372036854775807 - 1)::int8)) @@ '{"f1":{"$mod":[-1, 0]}}')::text;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_match $regex changing per row', '1,2:2:2:2',
+    string_agg((SELECT string_agg(id::text, ',' ORDER BY id) FROM match_table
+        WHERE data @@ ('{"name":{"$regex":"' || p || '"}}')::bson), ':' ORDER BY n)
+    FROM (VALUES (1, '^J'), (2, 'a'), (3, 'ne$'), (4, 'ne$')) AS q(n, p);
+
+\qecho * index keys
+
+CREATE TEMPORARY TABLE key_table (
+    id INTEGER,
+    data BSON
+);
+
+INSERT INTO key_table(id, data) VALUES
+(1, '{"a":"b", "b":1}'),
+(2, '{"a":10, "b":1}'),
+(3, '{"a":2.5, "b":1}'),
+(4, '{"b":1}'),
+(5, '{"a":null, "b":2}'),
+(6, '{"a":10, "b":"x"}'),
+(7, '{"a":10}'),
+(8, '{"a":"abc", "b":1}'),
+(9, '{"a":"ab", "b":1}');
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_index_key ascending: missing and null, numbers, strings', '4,5,3,2,6,7,9,8,1',
+    string_agg(id::text, ',' ORDER BY bson_index_key(data, '{"a":1}'), id) FROM key_table;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_index_key descending second field', '5,4,3,6,2,7,9,8,1',
+    string_agg(id::text, ',' ORDER BY bson_index_key(data, '{"a":1, "b":-1}'), id) FROM key_table;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_index_key descending first field', '1,8,9,2,6,7,3,4,5',
+    string_agg(id::text, ',' ORDER BY bson_index_key(data, '{"a":-1}'), id) FROM key_table;
+
+INSERT INTO results_table(name, expected, got)
+WITH single(data) AS (VALUES
+    ('{"a":1}'::bson), ('{"a":-3}'), ('{"a":2.5}'), ('{"a":""}'), ('{"a":"ab"}'), ('{"a":"b"}'),
+    ('{"a":{"x":1}}'), ('{"a":{"x":"1"}}'), ('{"a":{"y":0}}'), ('{"a":[1, 2]}'), ('{"a":[1]}'), ('{"a":[]}'),
+    ('{"a":true}'), ('{"a":false}'), ('{"a":null}'), ('{"a":{"$oid":"5224a2d2c1a9e8b3f6e0a1b2"}}'), ('{"a":{"$date":5}}'))
+SELECT 'bson_index_key of single fields orders as bson_compare', '0',
+    count(*)::text FROM single x, single y
+    WHERE sign(bson_compare(x.data, y.data)) <> sign(bsonkey_compare(bson_index_key(x.data, '{"a":1}'), bson_index_key(y.data, '{"a":1}')));
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_index_key with pattern changing per row', '3',
+    count(DISTINCT bson_index_key('{"a":1, "b":2}', p::bson))::text
+    FROM (VALUES ('{"a":1}'), ('{"b":1}'), ('{"a":1}'), ('{"a":-1}')) AS patterns(p);
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_index_key numbers of different types', 'true',
+    (bson_index_key('{"a":1}', '{"a":1}') = bson_index_key('{"a":1.0}', '{"a":1}'))::text;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bson_index_key nested path', 'true',
+    (bson_index_key('{"a":{"b":1}}', '{"a.b":1}') < bson_index_key('{"a":{"b":2}}', '{"a.b":1}'))::text;
+
+INSERT INTO results_table(name, expected, got) VALUES
+    ('bson_index_key bytes', '\x0cbff00000000000008000000000000000ee87ffff', bson_index_key('{"a":1, "b":"x"}', '{"a":1, "b":-1}')::bytea::text),
+    ('bsonkey text input and output', '\x0cbff00000000000008000000000000000', '\x0cbff00000000000008000000000000000'::bsonkey::text);
+
+CREATE INDEX key_table_idx ON key_table (bson_index_key(data, '{"a":1, "b":-1}'));
+
+SET enable_seqscan = off;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'bsonkey btree index range', '3,6,2,7',
+    string_agg(id::text, ',' ORDER BY bson_index_key(data, '{"a":1, "b":-1}')) FROM key_table
+    WHERE bson_index_key(data, '{"a":1, "b":-1}') > bson_index_key('{"a":2}', '{"a":1, "b":-1}')
+    AND bson_index_key(data, '{"a":1, "b":-1}') < bson_index_key('{"a":""}', '{"a":1, "b":-1}');
+
+RESET enable_seqscan;
+
 \qecho * hash index creation
 CREATE INDEX test_hash_idx ON data_table USING hash (bson_get_bson(data, '_id'));
 
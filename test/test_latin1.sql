@@ -0,0 +1,62 @@
+-- run in a LATIN1 database: BSON strings are UTF-8, text is converted from and to the database encoding
+SET client_encoding = 'UTF8';
+
+\qecho * loading extension
+CREATE EXTENSION pgbson;
+
+\qecho * creating tables
+CREATE TEMPORARY TABLE results_table (
+    name TEXT NOT NULL,
+    expected TEXT,
+    got TEXT
+);
+
+CREATE TEMPORARY TABLE latin1_row (
+    größe TEXT,
+    note VARCHAR
+);
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'latin1 database encoding', 'LATIN1', pg_encoding_to_char(encoding)
+    FROM pg_database WHERE datname = current_database();
+
+\qecho * text input and output
+INSERT INTO results_table(name, expected, got)
+VALUES
+('latin1 input stored as UTF-8', '\x1100000002610005000000c3a9c3a90000',
+    ('{"a":"éé"}'::bson::bytea)::text),
+('latin1 shell syntax input stored as UTF-8', '\x1000000002610004000000c3a9790000',
+    ('{a:''éy''}'::bson::bytea)::text),
+('latin1 output', '{ "größe" : "café" }', '{"größe":"café"}'::bson::text),
+('latin1 bsonx output', '{ "größe" : "café" }', '{"größe":"café"}'::bsonx::text);
+
+\qecho * field access
+INSERT INTO results_table(name, expected, got)
+VALUES
+('latin1 bson_get_text', 'café', bson_get_text('{"a":{"größe":"café"}}', 'a.größe')),
+('latin1 bson_get_int', '3', bson_get_int('{"a":{"größe":3}}', 'a.größe')::text),
+('latin1 bsonx_get_text', 'café', bsonx_get_text('{"größe":"café"}', 'größe')),
+('latin1 bson_get_text_array', '{café,thé}', bson_get_text_array('{"a":["café","thé"]}', 'a')::text),
+('latin1 exists', 'true', ('{"größe":1}'::bson ? 'größe')::text),
+('latin1 exists any', 'true', ('{"größe":1}'::bson ?| '{x,größe}')::text),
+('latin1 match', 'true', ('{"größe":"café"}'::bson @@ '{"größe":{"$regex":"^caf.$"}}')::text);
+
+\qecho * row conversion
+INSERT INTO latin1_row VALUES ('café', 'thé');
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'latin1 row_to_bson', '{ "größe" : "café", "note" : "thé" }', row_to_bson(r)::text FROM latin1_row r;
+
+INSERT INTO results_table(name, expected, got)
+SELECT 'latin1 bson_populate_record', '(café,thé)',
+    bson_populate_record(NULL::latin1_row, '{"größe":"café", "note":"thé"}')::text;
+
+\qecho * jsonb
+INSERT INTO results_table(name, expected, got)
+VALUES
+('latin1 bson::jsonb', '{"größe": "café"}', ('{"größe":"café"}'::bson::jsonb)::text),
+('latin1 jsonb::bson', '{ "größe" : "café" }', ('{"größe":"café"}'::jsonb::bson)::text);
+
+-- this must be at the end
+\qecho * test results, check for failures!
+SELECT *, expected = got AS passed FROM results_table;